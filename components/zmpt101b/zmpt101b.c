@@ -1,4 +1,3 @@
-#include <math.h>
 #include <string.h>
 #include "zmpt101b.h"
 #include "esp_log.h"
@@ -6,66 +5,146 @@
 #include "esp_timer.h"
 #include "esp_adc_cal.h"
 #include "driver/i2s.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "zmpt101b_decimator.h"
+#include "zmpt101b_calibration.h"
+#include "zmpt101b_integrity.h"
+#include "zmpt101b_warmstart.h"
+#include "zmpt101b_timestamp.h"
+#include "zmpt101b_gridlock.h"
+#include "zmpt101b_zerocross.h"
+#include "zmpt101b_measurement.h"
+#include "zmpt101b_despike.h"
+#ifdef ZMPT101B_GRID_LOCK
+#include "soc/soc_caps.h"
+#include "clk_ctrl_os.h"
+#endif
+#ifdef DEBUG_EXTRA_INFO
+#include "esp_cpu.h"
+#endif
 
 // Internal functions
-// Applies a median filter to the entire array in-place, including edge cases.
-// This function modifies the input array `data` directly and calculates the
-// minimum and maximum values within the filtered data. It handles edge cases
-// by adjusting the window size near the boundaries.
-bool median_filter_in_place(uint16_t *data, size_t length, size_t window_size, uint16_t *min_value, uint16_t *max_value)
-{
-    // Validate window size
-    if (window_size > length) {
-        ESP_LOGE(TAG_ZMPT101B, "%s Invalid window size\n", __FUNCTION__ );
-        return false;
-    }
-
-    // Ensure window size is odd for a proper median calculation
-    if (window_size % 2 == 0)
-        window_size++;
-
-    uint16_t *window = (uint16_t*)malloc(window_size * sizeof(uint16_t));
-    if (window == NULL) {
-        ESP_LOGE(TAG_ZMPT101B, "%s Failed to allocate memory for window\n", __FUNCTION__ );
-        return false;
-    }
-
-    *min_value = 0xFFFFu;
-    *max_value = !*min_value;
-    const size_t half_window = window_size / 2;
-    for (size_t i = 0; i < length; ++i) {
-        // Determine the actual window size for edge cases
-        const size_t start = (i < half_window) ? 0 : i - half_window;
-        const size_t end = (i + half_window >= length) ? length - 1 : i + half_window;
-        const size_t current_window_size = end - start + 1;
-
-        // Copy the current window
-        memcpy(window, data + start, current_window_size * sizeof(uint16_t));
-
-        // Sort the window using insertion sort
-        for (size_t j = 1; j < current_window_size; ++j) {
-            const uint16_t key = window[j];
-            size_t k = j;
-            while (k > 0 && window[k - 1] > key) {
-                window[k] = window[k - 1];
-                k--;
-            }
-            window[k] = key;
-        }
+// ADC characterisation per attenuation. Entries are filled on first use and kept,
+// so switching ranges never has to characterise the ADC again.
+#define ATTEN_COUNT ( ADC_ATTEN_DB_12 + 1 )
+static esp_adc_cal_characteristics_t atten_chars[ATTEN_COUNT];
+static bool atten_chars_valid[ATTEN_COUNT];
+_Static_assert(ATTEN_COUNT == ZMPT101B_WARM_ATTEN_COUNT, "warm-start cache must hold every attenuation");
 
-        // Set the median value directly back to the original data array
-        data[i] = window[current_window_size / 2];
-        // Detect peaks
-        if (data[i] > *max_value)
-            *max_value = data[i];
-        if (data[i] < *min_value)
-            *min_value = data[i];
-    }
-    free(window);
-    return true;
-}
+// Characterisation of the active attenuation
+static const esp_adc_cal_characteristics_t *adc_chars = NULL;
+
+// Attenuation currently configured for each channel
+static adc_atten_t channel_atten[ADC1_CHANNEL_MAX];
+
+// Diagnostics of the last window per channel
+static zmpt101b_stats_t channel_stats[ADC1_CHANNEL_MAX];
+
+#define CHANNEL_VALID(channel) ( (unsigned)(channel) < ADC1_CHANNEL_MAX )
 
-static esp_adc_cal_characteristics_t *adc_chars = NULL;
+// Sample integrity checker of the window being acquired
+static zmpt101b_integrity_t integrity;
+
+// Integrity checker of the continuous stream served by zmpt101b_read_samples()
+static zmpt101b_integrity_t stream_integrity;
+static bool stream_started = false;
+
+// I2S and ADC are powered down between zmpt101b_suspend() and zmpt101b_resume()
+static bool suspended = false;
+
+// Acquisition supervisor state
+static bool driver_installed = false;
+static QueueHandle_t i2s_event_queue = NULL;
+static uint32_t consecutive_failures = 0;
+// Set when a reinitialisation failed: the port stays down, and the read paths start it again
+// no earlier than restart_at_us
+static bool restart_pending = false;
+static int64_t restart_at_us = 0;
+static uint32_t restart_backoff_ms = 0;
+
+// Raw samples read since the DMA ring was last drained or started; that point is a DMA buffer boundary
+static int64_t dma_position = 0;
+
+// Timestamping of the continuous stream
+static zmpt101b_ts_t stream_ts;
+static zmpt101b_wallclock_t wallclock;
+static portMUX_TYPE wallclock_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t stream_origin = 0;       // raw position of the stream's first sample
+static uint64_t stream_samples = 0;     // samples delivered since the stream started
+static uint32_t stream_number = 0;
+static zmpt101b_block_time_t block_time;
+static bool block_time_valid = false;
+
+#ifdef ZMPT101B_GRID_LOCK
+// Grid-locked sample clock, driven by the crossings of the continuous stream
+static zmpt101b_gridlock_t gridlock;
+static zmpt101b_zc_t grid_zc;
+
+// Half-wave hysteresis of the crossing detector, in millivolts at the sensor
+#define GRID_ZC_HYSTERESIS_MV 20
+
+// The legacy driver clocks the ADC mode with 32 MCLK periods per sample and runs the APLL at the
+// first multiple of MCLK above the APLL minimum. Retunes keep that divider and move the APLL only.
+#define GRID_MCLK_PER_SAMPLE 32
+#define GRID_APLL_DIV ( SOC_APLL_MIN_HZ / (SAMPLING_FREQ * GRID_MCLK_PER_SAMPLE) + 1 )
+_Static_assert(GRID_APLL_DIV >= 2, "the driver divides the APLL by at least 2");
+
+#define I2S_USE_APLL 1
+#else
+#define I2S_USE_APLL 0
+#endif
+
+// Time the DMA ring of DMA_BUFFER_COUNT buffers of DMA_BUFFER_LEN samples takes to fill up.
+// Consecutive blocks further apart than this have lost samples.
+#define DMA_RING_TIME_US ( (uint32_t)( (uint64_t)DMA_BUFFER_COUNT * DMA_BUFFER_LEN * 1000000 / ZMPT101B_ADC_SAMPLE_RATE ) )
+
+#ifdef ZMPT101B_OVERSAMPLING
+static zmpt101b_decimator_t decimator;
+
+// One DMA buffer of raw samples, decimated into the measurement window or the stream
+static uint16_t raw_buffer[DMA_BUFFER_LEN];
+
+// Number of fractional bits the decimated samples carry on top of the 12-bit ADC code
+#define DECIM_FRAC_BITS ( ZMPT101B_DECIM_OUTPUT_BITS - 12 )
+
+// Raw samples per stream sample, and the raw sample stream sample 0 stands for: the CIC outputs
+// swallowed while the filters settle and the compensator's delay, less the CIC group delay
+#define STREAM_RAW_STEP ZMPT101B_DECIM_RATIO
+#define STREAM_RAW_DELAY ( (ZMPT101B_DECIM_ORDER + 2) * ZMPT101B_DECIM_RATIO - 1 - ZMPT101B_DECIM_ORDER * (ZMPT101B_DECIM_RATIO - 1) / 2 )
+#else
+#define STREAM_RAW_STEP 1
+#define STREAM_RAW_DELAY 0
+#endif
+
+// Spike rejection of the measurement windows; decimated samples carry fractional bits below the code
+static const zmpt101b_despike_config_t despike_config = {
+    .mode = ZMPT101B_DESPIKE_METHOD,
+    .median_window = ZMPT101B_DESPIKE_MEDIAN_WINDOW,
+#ifdef ZMPT101B_OVERSAMPLING
+    .threshold = ZMPT101B_DESPIKE_THRESHOLD << DECIM_FRAC_BITS,
+#else
+    .threshold = ZMPT101B_DESPIKE_THRESHOLD,
+#endif
+};
+
+// Converts a sample from the measurement buffer to millivolts.
+// Decimated samples are interpolated between the two neighbouring ADC codes so the extra
+// resolution isn't thrown away by the characterisation curve.
+static uint32_t sample_to_voltage(uint16_t sample)
+{
+#ifdef ZMPT101B_OVERSAMPLING
+    const uint32_t code = sample >> DECIM_FRAC_BITS;
+    const uint32_t frac = sample & ((1u << DECIM_FRAC_BITS) - 1);
+    const uint32_t v0 = esp_adc_cal_raw_to_voltage(code, adc_chars);
+    if (frac == 0)
+        return v0;
+    const uint32_t v1 = esp_adc_cal_raw_to_voltage(code + 1, adc_chars);
+    return v0 + (((v1 - v0) * frac + (1u << (DECIM_FRAC_BITS - 1))) >> DECIM_FRAC_BITS);
+#else
+    return esp_adc_cal_raw_to_voltage(sample, adc_chars);
+#endif
+}
 
 static void check_efuse()
 {
@@ -95,101 +174,545 @@ static void print_char_val_type(esp_adc_cal_value_t val_type)
     }
 }
 
-// public API implementation
-esp_err_t zmpt101b_init(adc_channel_t adc_channel)
+// Returns the characterisation for an attenuation, characterising the ADC on first use.
+// Characterisations from before a software reset are taken from the warm-start cache.
+static const esp_adc_cal_characteristics_t *get_atten_chars(adc_atten_t atten)
 {
-    esp_err_t esp_err = ESP_OK;
-    ESP_LOGI(TAG_ZMPT101B, "%s: Initializing ADC for channel %d", __FUNCTION__, adc_channel);
-    check_efuse();
+    if (!atten_chars_valid[atten]) {
+        if (!zmpt101b_warm_get_chars(atten, &atten_chars[atten])) {
+            esp_adc_cal_value_t val_type = esp_adc_cal_characterize(ADC_UNIT, atten, ADC_WIDTH_BIT, DEFAULT_VREF, &atten_chars[atten]);
+            print_char_val_type(val_type);
+            zmpt101b_warm_put_chars(atten, &atten_chars[atten]);
+        }
+        atten_chars_valid[atten] = true;
+    }
+    return &atten_chars[atten];
+}
 
-    //Characterize ADC
-    if (NULL==adc_chars){
-        adc_chars = calloc(1, sizeof(esp_adc_cal_characteristics_t));
+// Reads from the DMA ring and keeps track of the raw position
+static esp_err_t read_dma(void *dest, size_t size, size_t *bytes_read, TickType_t ticks_to_wait)
+{
+    // The legacy driver dereferences the port's state in i2s_read(), an uninstalled port panics
+    if (!driver_installed) {
+        *bytes_read = 0;
+        return ESP_ERR_INVALID_STATE;
+    }
+    const esp_err_t err = i2s_read(ADC_I2S_NUM, dest, size, bytes_read, ticks_to_wait);
+    dma_position += *bytes_read / sizeof(uint16_t);
+    return err;
+}
+
+// Drops the samples queued in the DMA ring. The driver hands out whole DMA buffers, so the
+// ring is left at a buffer boundary. The scratch buffer is static, like the stream buffers: the
+// acquisition is driven from one task at a time, and this runs on the callers' small stacks.
+static void drain_dma(void)
+{
+    static uint16_t scratch[DMA_BUFFER_LEN];
+    size_t bytes_read = 0;
+    do {
+        if (!driver_installed)
+            break;
+        bytes_read = 0;
+        if (i2s_read(ADC_I2S_NUM, scratch, sizeof(scratch), &bytes_read, 0) != ESP_OK)
+            break;
+    } while (bytes_read > 0);
+    dma_position = 0;
+}
+
+#ifdef ZMPT101B_GRID_LOCK
+// Sets the APLL for a sample rate in mHz and hands the rate it actually produced to the loop,
+// and to the timestamp tracker so timestamps stay continuous across the change
+static void grid_apply(uint32_t rate_mhz)
+{
+    zmpt101b_gridlock_status_t status;
+    zmpt101b_gridlock_get_status(&gridlock, &status);
+
+    const uint64_t apll_per_rate = (uint64_t)GRID_MCLK_PER_SAMPLE * GRID_APLL_DIV;
+    uint32_t real_hz = 0;
+    const esp_err_t err = periph_rtc_apll_freq_set((uint32_t)((rate_mhz * apll_per_rate + 500) / 1000), &real_hz);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG_ZMPT101B, "APLL retune to %lu mHz failed (%s)", (unsigned long)rate_mhz, esp_err_to_name(err));
+        zmpt101b_gridlock_applied(&gridlock, status.rate_mhz);
+        return;
     }
-    esp_adc_cal_value_t val_type = esp_adc_cal_characterize(ADC_UNIT, ADC_ATTEN_DB, ADC_WIDTH_BIT, DEFAULT_VREF, adc_chars);
-    print_char_val_type(val_type);
+    const uint32_t applied_mhz = (uint32_t)((real_hz * 1000ULL + apll_per_rate / 2) / apll_per_rate);
+    zmpt101b_ts_rescale(&stream_ts, esp_timer_get_time(), status.rate_mhz, applied_mhz);
+    zmpt101b_gridlock_applied(&gridlock, applied_mhz);
+}
 
-    // I2S config
+// Feeds a block of the stream to the loop. A gap breaks the cycle being measured.
+static void grid_track(const int16_t *samples_mv, size_t count, uint32_t flags)
+{
+    if (flags & ZMPT101B_QUALITY_GAP) {
+        zmpt101b_zc_init(&grid_zc, GRID_ZC_HYSTERESIS_MV);
+        zmpt101b_gridlock_restart(&gridlock);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (zmpt101b_zc_update(&grid_zc, samples_mv[i]) != ZMPT101B_ZC_RISING || grid_zc.rising_count < 2)
+            continue;
+        if (zmpt101b_gridlock_cycle(&gridlock, grid_zc.period_q16))
+            grid_apply(zmpt101b_gridlock_target_mhz(&gridlock));
+    }
+}
+#endif
+
+// Installs the I2S driver for the channel and starts the DMA. A failed step is logged by name
+// and undone, so the next attempt starts from scratch.
+static esp_err_t start_acquisition(adc_channel_t adc_channel)
+{
     i2s_config_t i2s_config =
     {
         .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN),
-        .sample_rate = SAMPLING_FREQ,
+        .sample_rate = ZMPT101B_ADC_SAMPLE_RATE,
         .bits_per_sample = I2S_BITS_PER_SAMPLE,
         .channel_format = I2S_CHANNEL_FMT_RIGHT_LEFT,
         .communication_format = I2S_COMM_FORMAT_STAND_MSB,
         .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-        .dma_buf_count = 8,
+        .dma_buf_count = DMA_BUFFER_COUNT,
         .dma_buf_len = DMA_BUFFER_LEN,
         .tx_desc_auto_clear = 1,
-        .use_apll = 0,
+        .use_apll = I2S_USE_APLL,
     };
 
+    esp_err_t err = i2s_driver_install(ADC_I2S_NUM, &i2s_config, ZMPT101B_I2S_EVENT_QUEUE_LEN, &i2s_event_queue);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "i2s_driver_install failed (%s)", esp_err_to_name(err));
+        return err;
+    }
+    driver_installed = true;
+    dma_position = 0;
+
+    const char *step = "i2s_set_clk";
+    err = i2s_set_clk(ADC_I2S_NUM, ZMPT101B_ADC_SAMPLE_RATE, I2S_BITS_PER_SAMPLE_16BIT, I2S_CHANNEL_MONO);
+    if (err == ESP_OK) {
+        step = "i2s_set_adc_mode";
+        err = i2s_set_adc_mode(ADC_UNIT, adc_channel);
+    }
+    if (err == ESP_OK) {
+        step = "i2s_adc_enable";
+        err = i2s_adc_enable(ADC_I2S_NUM);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "%s failed (%s)", step, esp_err_to_name(err));
+        i2s_driver_uninstall(ADC_I2S_NUM);
+        driver_installed = false;
+        i2s_event_queue = NULL;
+        return err;
+    }
+#ifdef ZMPT101B_GRID_LOCK
+    // The driver set the APLL for the nominal rate; carry on at the one the loop had reached
+    zmpt101b_gridlock_applied(&gridlock, SAMPLING_FREQ * 1000);
+    grid_apply(zmpt101b_gridlock_target_mhz(&gridlock));
+#endif
+    return ESP_OK;
+}
+
+static void stop_acquisition(void)
+{
+    if (!driver_installed)
+        return;
+    if (!suspended)
+        i2s_adc_disable(ADC_I2S_NUM);
+    i2s_driver_uninstall(ADC_I2S_NUM);
+    driver_installed = false;
+    i2s_event_queue = NULL;
+    suspended = false;
+    stream_started = false;
+}
+
+// Collects the events the I2S driver queued since the last call.
+// Returns the number of DMA overflows among them.
+static uint32_t poll_i2s_events(adc_channel_t adc_channel)
+{
+    zmpt101b_stats_t *stats = &channel_stats[adc_channel];
+    uint32_t overflows = 0;
+    i2s_event_t event;
+    while (i2s_event_queue != NULL && xQueueReceive(i2s_event_queue, &event, 0) == pdTRUE) {
+        if (event.type == I2S_EVENT_RX_Q_OVF) {
+            overflows++;
+        } else if (event.type == I2S_EVENT_DMA_ERROR) {
+            stats->dma_errors++;
+        }
+    }
+    stats->overflows += overflows;
+    return overflows;
+}
+
+// Empties the event queue without counting: while nobody reads, the DMA ring overflows by design.
+// Returns true if the ring overflowed, i.e. its oldest blocks aren't contiguous any more.
+static bool discard_i2s_events(void)
+{
+    bool overflowed = false;
+    i2s_event_t event;
+    while (i2s_event_queue != NULL && xQueueReceive(i2s_event_queue, &event, 0) == pdTRUE) {
+        if (event.type == I2S_EVENT_RX_Q_OVF)
+            overflowed = true;
+    }
+    return overflowed;
+}
+
+// Drops everything queued so sampling continues from contiguous, fresh blocks
+static void resync(adc_channel_t adc_channel)
+{
+    drain_dma();
+#ifdef ZMPT101B_OVERSAMPLING
+    zmpt101b_decimator_reset(&decimator);
+#endif
+    stream_started = false;
+    channel_stats[adc_channel].resyncs++;
+}
+
+// Installs the driver again with the channel's attenuation. A failure leaves the port down and
+// schedules the next attempt, doubling the backoff each time.
+static esp_err_t restart_acquisition(adc_channel_t adc_channel)
+{
+    esp_err_t err = adc1_config_channel_atten(adc_channel, channel_atten[adc_channel]);
+    if (err == ESP_OK)
+        err = start_acquisition(adc_channel);
+    if (err != ESP_OK) {
+        restart_backoff_ms = restart_backoff_ms == 0 ? ZMPT101B_RESTART_BACKOFF_MS : restart_backoff_ms * 2;
+        if (restart_backoff_ms > ZMPT101B_RESTART_BACKOFF_MAX_MS)
+            restart_backoff_ms = ZMPT101B_RESTART_BACKOFF_MAX_MS;
+        restart_at_us = esp_timer_get_time() + restart_backoff_ms * 1000LL;
+        restart_pending = true;
+        ESP_LOGE(TAG_ZMPT101B, "Failed to reinitialise I2S (%s), next attempt in %lu ms", esp_err_to_name(err),
+                 (unsigned long)restart_backoff_ms);
+        return err;
+    }
+    restart_pending = false;
+    restart_backoff_ms = 0;
+    stream_started = false;
+#ifdef ZMPT101B_OVERSAMPLING
+    zmpt101b_decimator_reset(&decimator);
+#endif
+    channel_stats[adc_channel].reinits++;
+    return ESP_OK;
+}
+
+// Called after a failed read: resynchronises, and reinitialises the peripheral in place once
+// failures repeat. The channel keeps its attenuation and calibration.
+static void recover(adc_channel_t adc_channel, esp_err_t cause)
+{
+    zmpt101b_stats_t *stats = &channel_stats[adc_channel];
+    stats->last_error = cause;
+    poll_i2s_events(adc_channel);
+
+    if (++consecutive_failures < ZMPT101B_REINIT_AFTER) {
+        ESP_LOGW(TAG_ZMPT101B, "Acquisition failed (%s), resynchronising", esp_err_to_name(cause));
+        resync(adc_channel);
+        return;
+    }
+
+    ESP_LOGW(TAG_ZMPT101B, "Acquisition failed %lu times (%s), reinitialising I2S", (unsigned long)consecutive_failures,
+             esp_err_to_name(cause));
+    consecutive_failures = 0;
+    stop_acquisition();
+    restart_acquisition(adc_channel);
+}
+
+// Called by the read paths before they touch the port. A port left down by a failed
+// reinitialisation is never read from; it is started again here once the backoff has passed.
+static esp_err_t ensure_acquisition(adc_channel_t adc_channel)
+{
+    if (driver_installed)
+        return ESP_OK;
+    if (!restart_pending || esp_timer_get_time() < restart_at_us)
+        return ESP_ERR_INVALID_STATE;
+    return restart_acquisition(adc_channel) == ESP_OK ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+#ifdef ZMPT101B_AUTO_RANGE
+// Upper end of the linear input range for each attenuation, in millivolts
+static const uint16_t atten_range_mv[ATTEN_COUNT] = { 950, 1250, 1750, 3100 };
+
+// Picks the attenuation for the next window from the clipping counts and the voltage span of this one.
+// Clipping always steps one range up. Otherwise the lowest attenuation that still holds the
+// window's peak with ZMPT101B_RANGE_HEADROOM_PCT headroom is chosen; ranges only step down
+// when that is strictly lower than the current one, which gives the hysteresis.
+static adc_atten_t select_attenuation(adc_atten_t current, uint32_t clipped, uint32_t voltage_max)
+{
+    if (clipped > ZMPT101B_RANGE_CLIP_LIMIT) {
+        return current < ADC_ATTEN_DB_12 ? current + 1 : current;
+    }
+    for (int atten = ADC_ATTEN_DB_0; atten < (int)current; ++atten) {
+        if (voltage_max * 100 <= (uint32_t)atten_range_mv[atten] * ZMPT101B_RANGE_HEADROOM_PCT)
+            return (adc_atten_t)atten;
+    }
+    return current;
+}
+
+// Reconfigures the channel attenuation while the I2S driver stays installed. Samples already queued in
+// the DMA ring were taken with the old range, so they are drained; the next window starts fresh.
+static esp_err_t switch_attenuation(adc_channel_t adc_channel, adc_atten_t atten)
+{
+    // A failure leaves sampling stopped; the next window fails and the supervisor reinitialises
+    // the peripheral with the previous attenuation
+    esp_err_t esp_err = i2s_adc_disable(ADC_I2S_NUM);
+    if (esp_err == ESP_OK)
+        esp_err = adc1_config_channel_atten(adc_channel, atten);
+    if (esp_err == ESP_OK)
+        esp_err = i2s_set_adc_mode(ADC_UNIT, adc_channel);
+    if (esp_err == ESP_OK)
+        esp_err = i2s_adc_enable(ADC_I2S_NUM);
+    if (esp_err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "Failed to switch attenuation (%s)", esp_err_to_name(esp_err));
+        return esp_err;
+    }
+    drain_dma();
+
+    channel_atten[adc_channel] = atten;
+    adc_chars = get_atten_chars(atten);
+    ESP_LOGI(TAG_ZMPT101B, "Channel %d switched to attenuation %d", adc_channel, atten);
+    return ESP_OK;
+}
+#endif
+
+// Times the stream from a read that just returned. Overflows mean the caller fell behind the
+// DMA ring; they are counted here, the integrity checker flags the gap in the block. The
+// samples read no longer count DMA time after either, so the timing starts over.
+static void observe_stream(adc_channel_t adc_channel, uint32_t flags, int64_t read_us)
+{
+    if (poll_i2s_events(adc_channel) > 0 || (flags & ZMPT101B_QUALITY_GAP))
+        zmpt101b_ts_restart(&stream_ts);
+    zmpt101b_ts_observe(&stream_ts, dma_position, read_us);
+}
+
+// Timestamps the block of `count` stream samples just delivered
+static void stamp_block(size_t count)
+{
+    // Sample k is complete at raw position k + 1
+    const int64_t position = stream_origin + (int64_t)stream_samples * STREAM_RAW_STEP + STREAM_RAW_DELAY + 1;
+    block_time.first_sample = stream_samples;
+    block_time.count = count;
+    block_time.stream = stream_number;
+    block_time.time_us = zmpt101b_ts_time_ns(&stream_ts, position) / 1000;
+    taskENTER_CRITICAL(&wallclock_lock);
+    block_time.wall_us = zmpt101b_wallclock_to_wall(&wallclock, block_time.time_us);
+    taskEXIT_CRITICAL(&wallclock_lock);
+    block_time.period_ps = zmpt101b_ts_period_ps(&stream_ts) * STREAM_RAW_STEP;
+    block_time.locked = zmpt101b_ts_locked(&stream_ts);
+    block_time_valid = true;
+    stream_samples += count;
+}
+
+// public API implementation
+esp_err_t zmpt101b_init(adc_channel_t adc_channel)
+{
+    ESP_LOGI(TAG_ZMPT101B, "%s: Initializing ADC for channel %d", __FUNCTION__, adc_channel);
+    if (!CHANNEL_VALID(adc_channel)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const int64_t init_start_time = esp_timer_get_time();
+
+    // The eFuse only needs probing when nothing was cached before a software reset
+    const bool warm = zmpt101b_warm_started();
+    if (!warm) {
+        check_efuse();
+    }
+
+    // Called again after a failure or to switch channels: start from an uninstalled driver
+    stop_acquisition();
+    consecutive_failures = 0;
+    restart_pending = false;
+    restart_backoff_ms = 0;
+
+    channel_atten[adc_channel] = ADC_ATTEN_DB;
+    memset(&channel_stats[adc_channel], 0, sizeof(zmpt101b_stats_t));
+
     // Configure ADC width
-    esp_err |= adc1_config_width(ADC_WIDTH_BIT);
+    esp_err_t esp_err = adc1_config_width(ADC_WIDTH_BIT);
+    if (esp_err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "adc1_config_width failed (%s)", esp_err_to_name(esp_err));
+        return esp_err;
+    }
 
     // Configure attenuation for the ADC channel
-    esp_err |= adc1_config_channel_atten(adc_channel, ADC_ATTEN_DB);
+    esp_err = adc1_config_channel_atten(adc_channel, ADC_ATTEN_DB);
+    if (esp_err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "adc1_config_channel_atten failed (%s)", esp_err_to_name(esp_err));
+        return esp_err;
+    }
 
-    esp_err |= i2s_driver_install(ADC_I2S_NUM, &i2s_config, 0, NULL);
-    esp_err |= i2s_set_clk(ADC_I2S_NUM, SAMPLING_FREQ, I2S_BITS_PER_SAMPLE_16BIT, I2S_CHANNEL_MONO);
-    esp_err |= i2s_set_adc_mode(ADC_UNIT, adc_channel);
-    esp_err |= i2s_adc_enable(ADC_I2S_NUM);
+    zmpt101b_ts_init(&stream_ts, ZMPT101B_ADC_SAMPLE_RATE, DMA_BUFFER_LEN);
+    block_time_valid = false;
+#ifdef ZMPT101B_GRID_LOCK
+    zmpt101b_gridlock_init(&gridlock, ZMPT101B_GRID_SAMPLES_PER_CYCLE, ZMPT101B_GRID_NOMINAL_FREQ);
+#endif
 
+    // DMA starts first, the first block fills while the rest is set up
+    esp_err = start_acquisition(adc_channel);
     if (esp_err != ESP_OK) {
         ESP_LOGE(TAG_ZMPT101B, "Failed to initialize ADC (%s)", esp_err_to_name(esp_err));
+        return esp_err;
     }
 
-    return esp_err;
+    //Characterize ADC
+    adc_chars = get_atten_chars(ADC_ATTEN_DB);
+
+#ifdef ZMPT101B_OVERSAMPLING
+    esp_err = zmpt101b_decimator_init(&decimator, ZMPT101B_DECIM_ORDER, ZMPT101B_DECIM_RATIO);
+    if (esp_err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "Failed to initialize the decimator (%s)", esp_err_to_name(esp_err));
+        stop_acquisition();
+        return esp_err;
+    }
+#endif
+
+    // Missing calibration storage isn't fatal, the channel just runs uncorrected
+    esp_err_t cal_err = zmpt101b_calibration_load(adc_channel);
+    if (cal_err != ESP_OK) {
+        ESP_LOGW(TAG_ZMPT101B, "Calibration for channel %d not loaded (%s)", adc_channel, esp_err_to_name(cal_err));
+    }
+
+    channel_stats[adc_channel].warm_start = warm;
+    channel_stats[adc_channel].init_us = (uint32_t)(esp_timer_get_time() - init_start_time);
+    return ESP_OK;
 }
 
-esp_err_t zmpt101b_read_voltage(adc_channel_t adc_channel, uint16_t *rmsVoltage)
+// Measurement window, ADC codes converted to millivolts in place
+static uint16_t window_buffer[I2S_READ_BUFFER_16B];
+
+// Samples one measurement window and measures it, before any calibration correction is applied.
+static esp_err_t measure_window(adc_channel_t adc_channel, zmpt101b_measurement_t *measurement)
 {
-    *rmsVoltage = 0.0;
-    ESP_LOGI(TAG_ZMPT101B, "%s: for channel %d", __FUNCTION__, adc_channel);
+    if (suspended) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ensure_acquisition(adc_channel);
+    if (err != ESP_OK) {
+        return err;
+    }
+    int64_t perf_start_time = esp_timer_get_time();
+
+    // Blocks left in a ring that overflowed since the last read are stale and may be torn
+    if (discard_i2s_events()) {
+        drain_dma();
+    }
+
+    uint16_t* i2s_read_buffer = window_buffer;
 
+    // Every block is validated and stripped of its channel tag as it arrives
+    zmpt101b_integrity_begin(&integrity, adc_channel, DMA_RING_TIME_US);
+
+#ifdef ZMPT101B_OVERSAMPLING
+    // Raw samples arrive ZMPT101B_DECIM_RATIO times faster than the measurement buffer is filled,
+    // so they are read one DMA buffer at a time and decimated straight into i2s_read_buffer.
+    // Start each window from a clean filter so stale history from the previous call doesn't leak in
+    zmpt101b_decimator_reset(&decimator);
 #ifdef DEBUG_EXTRA_INFO
-    int64_t perf_start_time = esp_timer_get_time();
+    uint32_t decim_cycles = 0;
+    size_t decim_raw_samples = 0;
 #endif
 
-    uint16_t* i2s_read_buffer = (uint16_t*) calloc(I2S_READ_BUFFER_16B , sizeof(uint16_t));
-    if (i2s_read_buffer == NULL) {
-        ESP_LOGE(TAG_ZMPT101B, "Failed to allocate memory for I2S buffer");
-        return ESP_ERR_NO_MEM;
+    size_t samples_decimated = 0;
+    while (samples_decimated < I2S_READ_BUFFER_16B) {
+        size_t bytes_read = 0;
+        esp_err_t ret = read_dma(raw_buffer, DMA_BUFFER_BYTES, &bytes_read, pdMS_TO_TICKS(ZMPT101B_READ_TIMEOUT_MS));
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG_ZMPT101B, "Failed to read data from I2S: %s", esp_err_to_name(ret));
+            channel_stats[adc_channel].read_errors++;
+            return ret;
+        }
+        zmpt101b_integrity_check_block(&integrity, raw_buffer, bytes_read / sizeof(uint16_t), esp_timer_get_time());
+#ifdef DEBUG_EXTRA_INFO
+        const uint32_t decim_start = esp_cpu_get_cycle_count();
+#endif
+        samples_decimated += zmpt101b_decimator_process(&decimator, raw_buffer, bytes_read / sizeof(uint16_t),
+                                                        i2s_read_buffer + samples_decimated, I2S_READ_BUFFER_16B - samples_decimated);
+#ifdef DEBUG_EXTRA_INFO
+        decim_cycles += esp_cpu_get_cycle_count() - decim_start;
+        decim_raw_samples += bytes_read / sizeof(uint16_t);
+#endif
     }
-
+#else
     size_t total_bytes_read = 0;
     do{
         size_t bytes_read = 0;
-        esp_err_t ret = i2s_read(ADC_I2S_NUM, (uint8_t*)i2s_read_buffer + total_bytes_read, I2S_READ_BUFFER_16B * 2 - total_bytes_read, &bytes_read, portMAX_DELAY);
+        esp_err_t ret = read_dma((uint8_t*)i2s_read_buffer + total_bytes_read, I2S_READ_BUFFER_16B * 2 - total_bytes_read, &bytes_read, pdMS_TO_TICKS(ZMPT101B_READ_TIMEOUT_MS));
         if (ret != ESP_OK) {
             ESP_LOGE(TAG_ZMPT101B, "Failed to read data from I2S: %s", esp_err_to_name(ret));
-            free(i2s_read_buffer);
-            return ESP_ERR_INVALID_SIZE;
+            channel_stats[adc_channel].read_errors++;
+            return ret;
         }
+        zmpt101b_integrity_check_block(&integrity, (uint16_t*)((uint8_t*)i2s_read_buffer + total_bytes_read), bytes_read / sizeof(uint16_t), esp_timer_get_time());
         total_bytes_read += bytes_read;
     }while((total_bytes_read / 2) < I2S_READ_BUFFER_16B);
+#endif
+    const int64_t window_end_time = esp_timer_get_time();
+
+    // The ring overflowed while the window was read, so it has lost samples
+    if (poll_i2s_events(adc_channel) > 0) {
+        ESP_LOGW(TAG_ZMPT101B, "DMA overflow during the window");
+        return ESP_ERR_INVALID_SIZE;
+    }
 
+    // Clipping is counted on the raw codes, before the spike rejection hides it
+    zmpt101b_stats_t *stats = &channel_stats[adc_channel];
+    stats->attenuation = channel_atten[adc_channel];
+    stats->quality = zmpt101b_integrity_end(&integrity);
+    stats->clipped_low = integrity.clipped_low;
+    stats->clipped_high = integrity.clipped_high;
+    stats->tag_mismatches = integrity.tag_mismatches;
+    stats->stuck_mask = integrity.stuck_mask;
+    stats->gaps += integrity.gaps;
+    stats->duplicates += integrity.duplicates;
+    if (stats->quality != 0) {
+        ESP_LOGW(TAG_ZMPT101B, "Channel %d window quality 0x%02lx", adc_channel, (unsigned long)stats->quality);
+    }
+
+    // Ripple and spikes are filtered out before the window is measured
     uint16_t min_value = 0;
     uint16_t max_value = 0;
-    // The median filter is necessary for filtering out voltage ripples.
-    median_filter_in_place(i2s_read_buffer, I2S_READ_BUFFER_16B, 10, &min_value, &max_value);
+    esp_err_t despike_err = zmpt101b_despike(&despike_config, i2s_read_buffer, I2S_READ_BUFFER_16B, &min_value, &max_value, &stats->spikes);
+    if (despike_err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "Invalid spike rejection settings");
+        return despike_err;
+    }
+    stats->spikes_total += stats->spikes.rejected;
 
-    // Calculate the RMS voltage based on the full amplitude of the signal.
-    // The amplitude difference (voltage_max - voltage_min) is divided by 2 to get the peak-to-peak amplitude.
-    // The result is then divided by √2 (approximately 1.4142135) to convert peak-to-peak amplitude to RMS value.
-    const uint16_t voltage_min = esp_adc_cal_raw_to_voltage(min_value, adc_chars);
-    const uint16_t voltage_max = esp_adc_cal_raw_to_voltage(max_value, adc_chars);
-    *rmsVoltage = round((( voltage_max - voltage_min ) / 2.0 ) / 1.4142135);
+    // The filtered window in millivolts, in place: they fit the 16 bits of the codes
+    int16_t *window_mv = (int16_t*)i2s_read_buffer;
+    int32_t window_sum = 0;
+    for (size_t i = 0; i < I2S_READ_BUFFER_16B; i++) {
+        window_mv[i] = (int16_t)sample_to_voltage(i2s_read_buffer[i]);
+        window_sum += window_mv[i];
+    }
+
+    // RMS over whole cycles, frequency, extremes, peak and DC in one pass; the mean of the window
+    // is a crossing level close enough to the DC bias, and unlike the midpoint of the extremes a
+    // spike the filter left doesn't move it
+    const uint16_t voltage_min = sample_to_voltage(min_value);
+    const uint16_t voltage_max = sample_to_voltage(max_value);
+#ifdef ZMPT101B_GRID_LOCK
+    // The window was sampled at the rate the loop applied last, not the nominal one. The block
+    // analysis takes whole Hz; the frequency is scaled by the fraction, which the loop knows to the mHz.
+    zmpt101b_gridlock_status_t grid_status;
+    zmpt101b_gridlock_get_status(&gridlock, &grid_status);
+    const uint32_t rate_mhz = grid_status.rate_mhz;
+#else
+    const uint32_t rate_mhz = SAMPLING_FREQ * 1000;
+#endif
+    *measurement = zmpt101b_measurement_compute(window_mv, I2S_READ_BUFFER_16B, rate_mhz / 1000,
+                                                window_sum / (int32_t)I2S_READ_BUFFER_16B);
+#ifdef ZMPT101B_GRID_LOCK
+    measurement->frequency_mhz = (uint32_t)((uint64_t)measurement->frequency_mhz * rate_mhz / (rate_mhz / 1000 * 1000));
+#endif
+    measurement->timestamp_us = window_end_time - (int64_t)I2S_READ_BUFFER_16B * 1000000000 / rate_mhz;
+    measurement->quality = stats->quality;
 
-#ifdef DEBUG_EXTRA_INFO
     int64_t perf_end_time = esp_timer_get_time();
     int64_t perf_elapsed_time = perf_end_time - perf_start_time;
+    stats->windows++;
+    stats->window_us = (uint32_t)perf_elapsed_time;
+
+#ifdef DEBUG_EXTRA_INFO
 
     // Print sensor voltage
     printf("SAMPLING_FREQ: %d\nSAMPLED: %d\n", SAMPLING_FREQ, I2S_READ_BUFFER_16B);
     for (size_t i = 0; i < I2S_READ_BUFFER_16B; i++) {
-        const double voltage = esp_adc_cal_raw_to_voltage(i2s_read_buffer[i], adc_chars) / 1000.0;
-        printf("%.2f ", voltage);
+        // Volts with two decimals from integer millivolts
+        const uint32_t voltage = (window_mv[i] + 5) / 10;
+        printf("%lu.%02lu ", (unsigned long)(voltage / 100), (unsigned long)(voltage % 100));
         if ((i + 1) % 32 == 0) {
             printf("\n");
         }
@@ -197,12 +720,304 @@ esp_err_t zmpt101b_read_voltage(adc_channel_t adc_channel, uint16_t *rmsVoltage)
     printf("\n");
     // Print summary
     printf("%s Performance time: %lld microseconds ( %lld milliseconds )\n", __FUNCTION__, perf_elapsed_time, perf_elapsed_time / 1000);
+#ifdef ZMPT101B_OVERSAMPLING
+    printf("decimator: %u raw samples, %lu cycles/sample\n", (unsigned)decim_raw_samples,
+           (unsigned long)(decim_raw_samples ? decim_cycles / decim_raw_samples : 0));
+#endif
     printf("sensor voltage delta == %.2fV\n", (voltage_max - voltage_min) / 1000.0 );
     printf("sensor voltage_max == %.2fV\n", voltage_max / 1000.0 );
     printf("sensor voltage_min == %.2fV\n", voltage_min / 1000.0 );
-    printf("sensor measuring voltage == %dV\n", *rmsVoltage );
+    printf("sensor uncorrected voltage == %.2fV, %lu mHz over %u half cycles, peak %.2fV, crest factor %u/1000\n",
+           measurement->rms_mv / 1000.0, (unsigned long)measurement->frequency_mhz, measurement->half_cycles,
+           measurement->peak_mv / 1000.0, measurement->crest_factor_milli);
+    printf("attenuation == %d, clipped low/high == %lu/%lu\n", stats->attenuation,
+           (unsigned long)stats->clipped_low, (unsigned long)stats->clipped_high);
+    printf("quality == 0x%02lx, tag mismatches == %lu, stuck bits == 0x%03x\n", (unsigned long)stats->quality,
+           (unsigned long)stats->tag_mismatches, stats->stuck_mask);
+    printf("spikes == %lu, largest %u, first at", (unsigned long)stats->spikes.rejected, stats->spikes.largest);
+    for (uint8_t i = 0; i < stats->spikes.logged; i++) {
+        printf(" %u", stats->spikes.index[i]);
+    }
+    printf("\n");
+#endif
+
+#ifdef ZMPT101B_AUTO_RANGE
+    // Range changes happen between windows; this window is reported with the range it was taken in
+    const adc_atten_t next_atten = select_attenuation(channel_atten[adc_channel], stats->clipped_low + stats->clipped_high, voltage_max);
+    if (next_atten != channel_atten[adc_channel]) {
+        if (switch_attenuation(adc_channel, next_atten) == ESP_OK)
+            stats->range_switches++;
+    }
 #endif
-    free(i2s_read_buffer);
 
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+// Measures a window under the supervisor: a window that failed to read or overflowed is measured
+// again after recovery, so sampling resumes within one window instead of surfacing the hiccup.
+static esp_err_t supervised_window(adc_channel_t adc_channel, zmpt101b_measurement_t *measurement)
+{
+    esp_err_t err = ESP_FAIL;
+    for (int attempt = 0; attempt < ZMPT101B_READ_ATTEMPTS; ++attempt) {
+        if (attempt > 0) {
+            channel_stats[adc_channel].retried_windows++;
+        }
+        err = measure_window(adc_channel, measurement);
+        if (err == ESP_OK) {
+            consecutive_failures = 0;
+            return ESP_OK;
+        }
+        // Nothing to recover from: out of memory, sampling suspended on purpose, or the port down
+        // until its restart backoff has passed
+        if (err == ESP_ERR_NO_MEM || err == ESP_ERR_INVALID_STATE) {
+            return err;
+        }
+        recover(adc_channel, err);
+    }
+    return err;
+}
+
+esp_err_t zmpt101b_read_measurement(adc_channel_t adc_channel, zmpt101b_measurement_t *measurement)
+{
+    ESP_LOGI(TAG_ZMPT101B, "%s: for channel %d", __FUNCTION__, adc_channel);
+    if (!CHANNEL_VALID(adc_channel) || measurement == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *measurement = (zmpt101b_measurement_t){ 0 };
+
+    zmpt101b_measurement_t m;
+    esp_err_t err = supervised_window(adc_channel, &m);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // The correction is a gain at the measured RMS, the instantaneous values scale with it
+    const int32_t corrected_mv = zmpt101b_calibration_apply(adc_channel, m.rms_mv);
+    if (m.rms_mv > 0 && corrected_mv != m.rms_mv) {
+        m.min_mv = (int32_t)((int64_t)m.min_mv * corrected_mv / m.rms_mv);
+        m.max_mv = (int32_t)((int64_t)m.max_mv * corrected_mv / m.rms_mv);
+        m.peak_mv = (int32_t)((int64_t)m.peak_mv * corrected_mv / m.rms_mv);
+    }
+    m.rms_mv = corrected_mv;
+    *measurement = m;
+
+#ifdef DEBUG_EXTRA_INFO
+    printf("sensor measuring voltage == %ld.%02ldV\n", (long)((m.rms_mv + 5) / 1000), (long)((m.rms_mv + 5) / 10 % 100));
+#endif
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_read_voltage(adc_channel_t adc_channel, uint16_t *rmsVoltage)
+{
+    *rmsVoltage = 0;
+    zmpt101b_measurement_t measurement;
+    esp_err_t err = zmpt101b_read_measurement(adc_channel, &measurement);
+    if (err != ESP_OK) {
+        return err;
+    }
+    const int32_t rms_v = (measurement.rms_mv + 500) / 1000;
+    *rmsVoltage = rms_v > UINT16_MAX ? UINT16_MAX : rms_v < 0 ? 0 : rms_v;
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_calibrate(adc_channel_t adc_channel, int32_t reference_mv)
+{
+    ESP_LOGI(TAG_ZMPT101B, "%s: channel %d against %ld mV", __FUNCTION__, adc_channel, (long)reference_mv);
+    if (!CHANNEL_VALID(adc_channel) || reference_mv <= 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Average several windows so a single noisy window doesn't end up in the calibration
+    int64_t sum_mv = 0;
+    for (int i = 0; i < ZMPT101B_CAL_WINDOWS; ++i) {
+        zmpt101b_measurement_t measurement;
+        esp_err_t err = supervised_window(adc_channel, &measurement);
+        if (err != ESP_OK) {
+            return err;
+        }
+        sum_mv += measurement.rms_mv;
+    }
+    const int32_t measured_mv = (int32_t)((sum_mv + ZMPT101B_CAL_WINDOWS / 2) / ZMPT101B_CAL_WINDOWS);
+    if (measured_mv <= 0) {
+        ESP_LOGE(TAG_ZMPT101B, "No signal on channel %d, calibration aborted", adc_channel);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    return zmpt101b_calibration_add_point(adc_channel, measured_mv, reference_mv);
+}
+
+esp_err_t zmpt101b_get_stats(adc_channel_t adc_channel, zmpt101b_stats_t *stats)
+{
+    if (!CHANNEL_VALID(adc_channel) || stats == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *stats = channel_stats[adc_channel];
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_read_samples(adc_channel_t adc_channel, int16_t *samples_mv, size_t max_samples, size_t *samples_read, uint32_t *quality)
+{
+    if (!CHANNEL_VALID(adc_channel) || samples_mv == NULL || samples_read == NULL || max_samples == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *samples_read = 0;
+    if (suspended) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    esp_err_t err = ensure_acquisition(adc_channel);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // The stream is one endless integrity window, so gaps between consecutive calls are detected too
+    if (!stream_started) {
+        zmpt101b_integrity_begin(&stream_integrity, adc_channel, DMA_RING_TIME_US);
+        discard_i2s_events();
+#ifdef ZMPT101B_OVERSAMPLING
+        zmpt101b_decimator_reset(&decimator);
+#endif
+        zmpt101b_ts_restart(&stream_ts);
+#ifdef ZMPT101B_GRID_LOCK
+        zmpt101b_zc_init(&grid_zc, GRID_ZC_HYSTERESIS_MV);
+        zmpt101b_gridlock_restart(&gridlock);
+#endif
+        stream_origin = dma_position;
+        stream_samples = 0;
+        stream_number++;
+        stream_started = true;
+    }
+
+    // ADC codes are converted to millivolts in place, both are 16 bits wide
+    uint16_t *codes = (uint16_t*)samples_mv;
+    uint32_t flags = 0;
+    size_t count = 0;
+
+#ifdef ZMPT101B_OVERSAMPLING
+    const size_t raw_len = max_samples * ZMPT101B_DECIM_RATIO < DMA_BUFFER_LEN ? max_samples * ZMPT101B_DECIM_RATIO : DMA_BUFFER_LEN;
+    while (count == 0) {
+        size_t bytes_read = 0;
+        esp_err_t ret = read_dma(raw_buffer, raw_len * sizeof(uint16_t), &bytes_read, pdMS_TO_TICKS(ZMPT101B_READ_TIMEOUT_MS));
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG_ZMPT101B, "Failed to read data from I2S: %s", esp_err_to_name(ret));
+            channel_stats[adc_channel].read_errors++;
+            recover(adc_channel, ret);
+            return ret;
+        }
+        const int64_t read_us = esp_timer_get_time();
+        const uint32_t block_flags = zmpt101b_integrity_check_block(&stream_integrity, raw_buffer, bytes_read / sizeof(uint16_t), read_us);
+        observe_stream(adc_channel, block_flags, read_us);
+        flags |= block_flags;
+        count = zmpt101b_decimator_process(&decimator, raw_buffer, bytes_read / sizeof(uint16_t), codes, max_samples);
+    }
+#else
+    size_t bytes_read = 0;
+    esp_err_t ret = read_dma(codes, max_samples * sizeof(uint16_t), &bytes_read, pdMS_TO_TICKS(ZMPT101B_READ_TIMEOUT_MS));
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "Failed to read data from I2S: %s", esp_err_to_name(ret));
+        channel_stats[adc_channel].read_errors++;
+        recover(adc_channel, ret);
+        return ret;
+    }
+    count = bytes_read / sizeof(uint16_t);
+    const int64_t read_us = esp_timer_get_time();
+    flags = zmpt101b_integrity_check_block(&stream_integrity, codes, count, read_us);
+    observe_stream(adc_channel, flags, read_us);
+#endif
+    consecutive_failures = 0;
+    stamp_block(count);
+
+    for (size_t i = 0; i < count; ++i) {
+        samples_mv[i] = (int16_t)sample_to_voltage(codes[i]);
+    }
+#ifdef ZMPT101B_GRID_LOCK
+    grid_track(samples_mv, count, flags);
+#endif
+
+    *samples_read = count;
+    if (quality != NULL) {
+        *quality = flags;
+    }
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_suspend(adc_channel_t adc_channel)
+{
+    if (!CHANNEL_VALID(adc_channel)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (suspended) {
+        return ESP_OK;
+    }
+    if (!driver_installed) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Releasing the ADC powers the SAR down, stopping I2S halts the DMA and lets the driver drop its PM lock
+    esp_err_t err = i2s_adc_disable(ADC_I2S_NUM);
+    if (err == ESP_OK) {
+        err = i2s_stop(ADC_I2S_NUM);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "Failed to suspend sampling (%s)", esp_err_to_name(err));
+        return err;
+    }
+    suspended = true;
+    // The stream restarts after the pause instead of reporting it as a DMA gap
+    stream_started = false;
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_resume(adc_channel_t adc_channel)
+{
+    if (!CHANNEL_VALID(adc_channel)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!suspended) {
+        return ESP_OK;
+    }
+
+    const int64_t start_us = esp_timer_get_time();
+    // Re-acquires the ADC for DMA and restarts I2S with the configured clock
+    esp_err_t err = i2s_adc_enable(ADC_I2S_NUM);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_ZMPT101B, "Failed to resume sampling (%s)", esp_err_to_name(err));
+        return err;
+    }
+    // Blocks left over from before the pause would look like fresh samples
+    drain_dma();
+    suspended = false;
+    channel_stats[adc_channel].resume_us = (uint32_t)(esp_timer_get_time() - start_us);
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_get_block_time(adc_channel_t adc_channel, zmpt101b_block_time_t *time)
+{
+    if (!CHANNEL_VALID(adc_channel) || time == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!block_time_valid) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *time = block_time;
+    return ESP_OK;
+}
+
+void zmpt101b_sync_wall_clock(int64_t wall_us)
+{
+    taskENTER_CRITICAL(&wallclock_lock);
+    zmpt101b_wallclock_sync(&wallclock, esp_timer_get_time(), wall_us);
+    taskEXIT_CRITICAL(&wallclock_lock);
+}
+
+esp_err_t zmpt101b_get_grid_lock(zmpt101b_gridlock_status_t *status)
+{
+    if (status == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#ifdef ZMPT101B_GRID_LOCK
+    zmpt101b_gridlock_get_status(&gridlock, status);
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
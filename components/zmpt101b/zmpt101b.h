@@ -10,6 +10,7 @@
  * - You will need to calibrate them yourself using the adjustment potentiometer on the board.
  * - A voltmeter is required for calibration; the more accurate the voltmeter, the better.
  * - An oscilloscope can also be used for more precise calibration and analysis.
+ * - After trimming, zmpt101b_calibrate() stores a per-channel gain/offset correction in NVS.
  *
  * Dependencies:
  * - ESP-IDF (Espressif IoT Development Framework)
@@ -31,10 +32,20 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "esp_idf_version.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/adc.h"
+#include "zmpt101b_integrity.h"
+#include "zmpt101b_timestamp.h"
+#include "zmpt101b_gridlock.h"
+#include "zmpt101b_measurement.h"
+#include "zmpt101b_despike.h"
 
+// esp_app_desc.h, esp_cpu_get_cycle_count() and the esp_app_format and esp_partition components
+#if ESP_IDF_VERSION < ESP_IDF_VERSION_VAL(5, 1, 0)
+#error "The ZMPT101B component needs ESP-IDF 5.1 or higher"
+#endif
 
 #define TAG_ZMPT101B "ZMPT101B_SENSOR"
 
@@ -58,18 +69,81 @@
 // without saturating the ADC and helps in achieving more accurate voltage measurements.
 #define ADC_ATTEN_DB  ADC_ATTEN_DB_12
 
+// Automatic attenuation selection.
+// When enabled, ADC_ATTEN_DB is only the starting range. After every window the component checks
+// how many samples were pinned at code 0 or 4095 and how much of the range the signal used, and
+// switches the channel attenuation before the next window. The I2S driver stays installed; only
+// samples queued with the old range are discarded. Characterisation of each attenuation is cached.
+// #define ZMPT101B_AUTO_RANGE
+
+// Number of clipped samples per window tolerated before switching to a higher attenuation.
+#define ZMPT101B_RANGE_CLIP_LIMIT 2
+
+// A lower attenuation is selected only if the window's peak voltage stays below this percentage of its range.
+#define ZMPT101B_RANGE_HEADROOM_PCT 80
+
 // ADC unit to be used for voltage measurements (ADC Unit 1)
 #define ADC_UNIT ADC_UNIT_1
 
 // Default reference voltage (Vref) for ADC calibration, in millivolts (mV)
 #define DEFAULT_VREF 1100  // in mV
 
+// Grid-locked sampling mode.
+// When enabled, the I2S clock runs from the APLL and a software PLL (see zmpt101b_gridlock.h)
+// retunes it so that every mains cycle holds exactly ZMPT101B_GRID_SAMPLES_PER_CYCLE samples.
+// Windows of whole cycles then need no window function: DFT/Goertzel bins land on the harmonics.
+// The loop is driven by the continuous stream of zmpt101b_read_samples(); the APLL must not be
+// used by another peripheral.
+// #define ZMPT101B_GRID_LOCK
+
+// Samples per mains cycle in grid-locked mode
+#define ZMPT101B_GRID_SAMPLES_PER_CYCLE 512
+
+// Nominal mains frequency in grid-locked mode, in Hz; the sample rate starts at the product of the two
+#define ZMPT101B_GRID_NOMINAL_FREQ 50
+
 // I2S Configuration
 // Sampling frequency for collecting voltage data from the ADC using I2S
+#ifdef ZMPT101B_GRID_LOCK
+#define SAMPLING_FREQ ( ZMPT101B_GRID_SAMPLES_PER_CYCLE * ZMPT101B_GRID_NOMINAL_FREQ )  // in Hz, nominal
+#else
 #define SAMPLING_FREQ 25000  // in Hz
+#endif
+
+// Oversampling-and-decimation mode.
+// When enabled, the ADC is sampled ZMPT101B_DECIM_RATIO times faster than SAMPLING_FREQ and
+// an integer CIC + compensation FIR decimator (see zmpt101b_decimator.h) brings the stream back
+// down to SAMPLING_FREQ. Each decimated sample is 16 bits wide instead of 12; averaging R noisy
+// samples buys roughly 0.5 * log2(R) extra effective bits on the ESP32's noisy ADC.
+// Keep SAMPLING_FREQ * ZMPT101B_DECIM_RATIO within what the I2S ADC can sustain (~150 kHz).
+// #define ZMPT101B_OVERSAMPLING
+
+// Decimation ratio, must be a power of two.
+#define ZMPT101B_DECIM_RATIO 4
+
+// CIC filter order. Higher orders reject more aliasing at the cost of passband droop,
+// which the compensation FIR flattens. ZMPT101B_DECIM_ORDER * log2(ZMPT101B_DECIM_RATIO) must not exceed 20.
+#define ZMPT101B_DECIM_ORDER 3
+
+#if defined(ZMPT101B_GRID_LOCK) && defined(ZMPT101B_OVERSAMPLING)
+#error "ZMPT101B_GRID_LOCK and ZMPT101B_OVERSAMPLING can't be combined"
+#endif
 
-// Maximum length of the DMA buffer for I2S data transfer
-#define DMA_BUFFER_LEN 1024  // in bytes
+#ifdef ZMPT101B_OVERSAMPLING
+#define ZMPT101B_ADC_SAMPLE_RATE ( SAMPLING_FREQ * ZMPT101B_DECIM_RATIO )
+#else
+#define ZMPT101B_ADC_SAMPLE_RATE SAMPLING_FREQ
+#endif
+
+// Length of each DMA buffer for I2S data transfer, in frames: the legacy driver's dma_buf_len
+// counts 16-bit samples in ADC mode, up to 1024
+#define DMA_BUFFER_LEN 1024  // in samples
+
+// Size of each DMA buffer in bytes, for i2s_read()
+#define DMA_BUFFER_BYTES ( DMA_BUFFER_LEN * sizeof(uint16_t) )
+
+// Number of DMA buffers in the I2S receive ring
+#define DMA_BUFFER_COUNT 8
 
 // I2S bit resolution for each sample (16-bit per sample)
 #define I2S_BITS_PER_SAMPLE I2S_BITS_PER_SAMPLE_16BIT
@@ -77,12 +151,70 @@
 // I2S peripheral number to be used for ADC data acquisition
 #define ADC_I2S_NUM I2S_NUM_0
 
-// Size of the internal buffer for I2S ADC readings. The DMA buffer is initially sized for 8-bit data,
-// but since we are using a 12-bit ADC, we need to repack the 1-byte DMA buffer into a 2-byte buffer.
-// Therefore, we divide the DMA buffer length by the size of a uint16_t to accommodate the 12-bit ADC data
-// and then multiply by 2 to allocate sufficient space for 1024 samples ( 40ms per 25kHz sampling ).
-// Note that this value depends on the ADC_WIDTH_BIT setting.
-#define I2S_READ_BUFFER_16B ( DMA_BUFFER_LEN / sizeof(uint16_t) ) * 2
+// Size of the measurement window in samples: one DMA buffer, 1024 samples ( ~41ms at 25kHz ).
+// The 12-bit ADC codes arrive in 16-bit words, one per sample.
+#define I2S_READ_BUFFER_16B ( DMA_BUFFER_LEN )
+
+// Spike rejection applied to every measurement window before it is measured (see zmpt101b_despike.h):
+// ZMPT101B_DESPIKE_MEDIAN is the reference, ZMPT101B_DESPIKE_MEDIAN3 and ZMPT101B_DESPIKE_SLEW run in O(N).
+#define ZMPT101B_DESPIKE_METHOD ZMPT101B_DESPIKE_MEDIAN
+
+// Window of ZMPT101B_DESPIKE_MEDIAN, in samples
+#define ZMPT101B_DESPIKE_MEDIAN_WINDOW 11
+
+// Smallest change of a sample counted as a rejected spike, in ADC codes (about 30 mV at 12 dB).
+// ZMPT101B_DESPIKE_SLEW never replaces a sample closer than this to its prediction.
+#define ZMPT101B_DESPIKE_THRESHOLD 40
+
+// Number of measurement windows averaged by zmpt101b_calibrate() for one calibration point
+#define ZMPT101B_CAL_WINDOWS 8
+
+// Acquisition supervisor
+// Longest wait for a DMA block before the acquisition is considered stalled, in milliseconds
+#define ZMPT101B_READ_TIMEOUT_MS 200
+
+// Depth of the I2S driver event queue watched for DMA overflows and errors
+#define ZMPT101B_I2S_EVENT_QUEUE_LEN 8
+
+// Failures in a row after which the I2S peripheral is reinitialised in place instead of resynchronised
+#define ZMPT101B_REINIT_AFTER 2
+
+// Wait before I2S is started again after a failed reinitialisation, in milliseconds. It doubles
+// after every failed attempt, up to ZMPT101B_RESTART_BACKOFF_MAX_MS.
+#define ZMPT101B_RESTART_BACKOFF_MS 100
+#define ZMPT101B_RESTART_BACKOFF_MAX_MS 5000
+
+// Windows zmpt101b_read_voltage() attempts before it gives up and returns the error
+#define ZMPT101B_READ_ATTEMPTS 3
+
+/*
+ * Diagnostics of the last measurement window of a channel.
+ */
+typedef struct {
+    adc_atten_t attenuation;    // attenuation (range) the window was sampled with
+    uint32_t clipped_low;       // samples pinned at ADC code 0
+    uint32_t clipped_high;      // samples pinned at the ADC full scale
+    uint32_t range_switches;    // attenuation changes since zmpt101b_init()
+    uint32_t quality;           // ZMPT101B_QUALITY_* bits of the window (see zmpt101b_integrity.h)
+    uint32_t tag_mismatches;    // words tagged with another channel
+    uint16_t stuck_mask;        // ADC data bits found stuck
+    zmpt101b_despike_stats_t spikes; // samples the spike rejection replaced in the window
+    uint32_t spikes_total;      // samples replaced since zmpt101b_init()
+    uint32_t gaps;              // DMA gaps since zmpt101b_init()
+    uint32_t duplicates;        // duplicated DMA blocks since zmpt101b_init()
+    uint32_t windows;           // measurement windows since zmpt101b_init()
+    uint32_t window_us;         // time the last window took to sample and process
+    uint32_t resume_us;         // time the last zmpt101b_resume() took
+    uint32_t init_us;           // time zmpt101b_init() took
+    uint32_t overflows;         // DMA overflows reported by the I2S driver since zmpt101b_init()
+    uint32_t dma_errors;        // DMA errors reported by the I2S driver since zmpt101b_init()
+    uint32_t read_errors;       // failed or timed-out I2S reads since zmpt101b_init()
+    uint32_t resyncs;           // DMA ring flushes to restart from contiguous samples
+    uint32_t reinits;           // in-place reinitialisations of the I2S peripheral
+    uint32_t retried_windows;   // windows measured again after a failure
+    esp_err_t last_error;       // cause of the last recovery, ESP_OK if none
+    bool     warm_start;        // zmpt101b_init() used the warm-start cache (see zmpt101b_warmstart.h)
+} zmpt101b_stats_t;
 
 /*
  * Public APIs
@@ -98,13 +230,137 @@
  */
 esp_err_t zmpt101b_init(adc_channel_t adc_channel);
 
+/**
+ * @brief Measures one window on the ZMPT101B sensor.
+ *
+ * The window is cleared of spikes (ZMPT101B_DESPIKE_METHOD), then its true RMS over whole cycles, frequency, extremes, DC offset and crest
+ * factor are taken in one pass (see zmpt101b_measurement.h), and the calibration correction is applied.
+ * A window that fails to read, times out or loses samples to a DMA overflow is measured again after the
+ * acquisition is resynchronised, or reinitialised in place once failures repeat (see zmpt101b_stats_t).
+ * If the reinitialisation fails, the port stays down and reads return ESP_ERR_INVALID_STATE; each read
+ * after the backoff (ZMPT101B_RESTART_BACKOFF_MS) tries to start it again.
+ * With ZMPT101B_GRID_LOCK the window is measured at the sample rate the loop applied, so the frequency
+ * is the mains frequency rather than nominal, see zmpt101b_get_grid_lock().
+ *
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @param measurement Receives the measurement; zeroed on error.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG, or the error of the last of ZMPT101B_READ_ATTEMPTS windows:
+ *                   an I2S read error, ESP_ERR_TIMEOUT if sampling stalled, ESP_ERR_INVALID_SIZE if the
+ *                   window overflowed, ESP_ERR_INVALID_STATE while sampling is suspended or the I2S port
+ *                   is down.
+ */
+esp_err_t zmpt101b_read_measurement(adc_channel_t adc_channel, zmpt101b_measurement_t *measurement);
+
 /**
  * @brief Reads the RMS voltage from the ZMPT101B sensor.
  *
- * This function reads the current RMS voltage from the ZMPT101B sensor connected to the specified ADC channel.
+ * The RMS of zmpt101b_read_measurement() rounded to whole volts.
  *
  * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
  * @param rmsVoltage Pointer to a variable where the measured RMS voltage value will be stored.
- * @return esp_err_t Error code indicating success (ESP_OK) or failure (appropriate ESP-IDF error code).
+ * @return esp_err_t As zmpt101b_read_measurement().
  */
 esp_err_t zmpt101b_read_voltage(adc_channel_t adc_channel, uint16_t *rmsVoltage);
+
+/**
+ * @brief Adds a calibration point for the channel using a known reference voltage.
+ *
+ * Apply a stable reference voltage to the sensor (measured with an accurate voltmeter) and call this
+ * function with its value. The uncorrected reading is averaged over ZMPT101B_CAL_WINDOWS windows and stored
+ * together with the reference in NVS, so the correction survives reboots. Calling it at several
+ * reference voltages builds a multi-point gain/offset correction (see zmpt101b_calibration.h).
+ * The application must call nvs_flash_init() before zmpt101b_init() for calibration to persist.
+ *
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @param reference_mv Reference RMS voltage in millivolts.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_STATE if no signal was detected, or a read/storage error.
+ */
+esp_err_t zmpt101b_calibrate(adc_channel_t adc_channel, int32_t reference_mv);
+
+/**
+ * @brief Returns diagnostics of the last measurement window of a channel.
+ *
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @param stats Pointer to a structure receiving the diagnostics.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_get_stats(adc_channel_t adc_channel, zmpt101b_stats_t *stats);
+
+/**
+ * @brief Reads the next block of the continuous sample stream.
+ *
+ * Intended for the streaming stages (aggregation, flicker, phasors, ...) that need every sample rather than
+ * an isolated window. Call it back to back from a dedicated task; samples are only contiguous as long as the
+ * caller keeps up with the DMA ring. Don't interleave it with zmpt101b_read_voltage() on the same sensor.
+ *
+ * Samples are ADC input voltages in millivolts, DC bias included. With the sensor trimmed, 1 mV there
+ * corresponds to 1 V of mains.
+ *
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @param samples_mv Buffer receiving the samples.
+ * @param max_samples Capacity of the buffer in samples.
+ * @param samples_read Number of samples written.
+ * @param quality Optional, receives the ZMPT101B_QUALITY_* bits of the block (tag mismatch, gap, duplicate).
+ *                zmpt101b_get_block_time() returns when the block was sampled.
+ * @return esp_err_t ESP_OK or an I2S read error (ESP_ERR_TIMEOUT if sampling stalled); the acquisition is
+ *                   already recovering when it returns, the next call may succeed. ESP_ERR_INVALID_STATE
+ *                   while sampling is suspended or the I2S port is down, as for zmpt101b_read_measurement().
+ */
+esp_err_t zmpt101b_read_samples(adc_channel_t adc_channel, int16_t *samples_mv, size_t max_samples, size_t *samples_read, uint32_t *quality);
+
+/**
+ * @brief Powers the ADC and the I2S DMA down, e.g. before light sleep between measurement windows.
+ *
+ * The driver stays installed and keeps its configuration. Reads fail with ESP_ERR_INVALID_STATE
+ * until zmpt101b_resume(). See zmpt101b_duty.h for a scheduler built on it.
+ *
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_STATE if the I2S port is down, or the error of the I2S driver.
+ */
+esp_err_t zmpt101b_suspend(adc_channel_t adc_channel);
+
+/**
+ * @brief Restarts sampling after zmpt101b_suspend(); stale DMA blocks are dropped.
+ *
+ * The time it took is reported as resume_us by zmpt101b_get_stats().
+ *
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @return esp_err_t ESP_OK or the error of the I2S driver.
+ */
+esp_err_t zmpt101b_resume(adc_channel_t adc_channel);
+
+/**
+ * @brief Returns when the last block returned by zmpt101b_read_samples() was sampled.
+ *
+ * Timestamps are interpolated along the I2S sample clock as measured against esp_timer, not taken
+ * when the read returned (see zmpt101b_timestamp.h). Sample i of the block was taken at
+ * time_us + i * period_ps / 1000000. With ZMPT101B_OVERSAMPLING the decimator's group delay is
+ * taken out. After the stream restarts, timestamps are only accurate once `locked` is set again.
+ *
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @param time Receives the block time.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG, or ESP_ERR_INVALID_STATE before the first block.
+ */
+esp_err_t zmpt101b_get_block_time(adc_channel_t adc_channel, zmpt101b_block_time_t *time);
+
+/**
+ * @brief Maps sample timestamps to wall-clock time.
+ *
+ * Call it from the SNTP time sync notification with the time just set. Syncs at least
+ * ZMPT101B_TS_WALL_MIN_SPAN_S apart also estimate the esp_timer drift between them.
+ *
+ * @param wall_us Current wall-clock time, microseconds since the Unix epoch.
+ */
+void zmpt101b_sync_wall_clock(int64_t wall_us);
+
+/**
+ * @brief Returns the state of the grid-locked sample clock.
+ *
+ * While locked, the sample rate is ZMPT101B_GRID_SAMPLES_PER_CYCLE times the mains frequency
+ * within ZMPT101B_GRIDLOCK_LOCK_PPM. The mains frequency itself is in frequency_mhz; a frequency
+ * derived from SAMPLING_FREQ and a cycle length reads nominal by design, use rate_mhz instead.
+ *
+ * @param status Receives the loop status.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG, or ESP_ERR_NOT_SUPPORTED without ZMPT101B_GRID_LOCK.
+ */
+esp_err_t zmpt101b_get_grid_lock(zmpt101b_gridlock_status_t *status);
@@ -0,0 +1,195 @@
+#include <string.h>
+#include "zmpt101b_aggregation.h"
+#include "zmpt101b_fixed.h"
+
+// Event condition of a single cycle
+enum {
+    EVENT_NONE = 0,
+    EVENT_DIP,
+    EVENT_SWELL,
+    EVENT_INTERRUPTION,
+};
+
+// Internal functions
+// RMS in mains millivolts of `count` AC samples given in ADC millivolts
+static uint32_t samples_rms_mv(uint64_t sum_sq, uint32_t count)
+{
+    return count ? zmpt101b_isqrt64(sum_sq * 1000000 / count) : 0;
+}
+
+static uint32_t level_rms_mv(const zmpt101b_agg_level_t *level)
+{
+    return level->count ? zmpt101b_isqrt64(level->sum_sq / level->count) : 0;
+}
+
+static void level_add(zmpt101b_agg_level_t *level, uint32_t rms_mv, bool flagged)
+{
+    level->sum_sq += (uint64_t)rms_mv * rms_mv;
+    level->count++;
+    level->flagged |= flagged;
+}
+
+static void emit(const zmpt101b_agg_t *agg, zmpt101b_agg_interval_t interval, uint32_t rms_mv, int64_t timestamp_us, uint32_t count, bool flagged)
+{
+    if (agg->cfg.callback == NULL)
+        return;
+    const zmpt101b_agg_value_t value = {
+        .interval = interval,
+        .rms_mv = rms_mv,
+        .timestamp_us = timestamp_us,
+        .count = count,
+        .flagged = flagged,
+    };
+    agg->cfg.callback(&value, agg->cfg.ctx);
+}
+
+static void emit_level(const zmpt101b_agg_t *agg, zmpt101b_agg_interval_t interval, const zmpt101b_agg_level_t *level, int64_t timestamp_us)
+{
+    if (level->count != 0)
+        emit(agg, interval, level_rms_mv(level), timestamp_us, level->count, level->flagged);
+}
+
+// First clock tick of a `period_us` grid strictly after `time_us`
+static int64_t next_tick(int64_t time_us, int64_t period_us)
+{
+    int64_t tick = (time_us / period_us) * period_us;
+    if (tick <= time_us)
+        tick += period_us;
+    return tick;
+}
+
+// Classifies a completed cycle and feeds it into the current 10/12-cycle window
+static void close_cycle(zmpt101b_agg_t *agg)
+{
+    if (agg->cycle_samples == 0)
+        return;
+
+    const uint32_t rms_mv = samples_rms_mv(agg->cycle_sum_sq, agg->cycle_samples);
+    uint8_t event = EVENT_NONE;
+    if (rms_mv < agg->interruption_mv)
+        event = EVENT_INTERRUPTION;
+    else if (rms_mv < agg->dip_mv)
+        event = EVENT_DIP;
+    else if (rms_mv > agg->swell_mv)
+        event = EVENT_SWELL;
+
+    if (event != EVENT_NONE) {
+        agg->window_flagged = true;
+        if (event != agg->event_state) {
+            agg->dips += (event == EVENT_DIP);
+            agg->swells += (event == EVENT_SWELL);
+            agg->interruptions += (event == EVENT_INTERRUPTION);
+        }
+    }
+    agg->event_state = event;
+
+    agg->window_sum_sq += agg->cycle_sum_sq;
+    agg->window_samples += agg->cycle_samples;
+    agg->window_cycle_count++;
+    agg->cycle_sum_sq = 0;
+    agg->cycle_samples = 0;
+}
+
+// Closes the 10-minute interval ending at `tick_us` and rolls it into the 2-hour aggregate
+static void close_10min(zmpt101b_agg_t *agg, int64_t tick_us)
+{
+    if (agg->min10_level.count != 0) {
+        emit_level(agg, ZMPT101B_AGG_10_MIN, &agg->min10_level, tick_us);
+
+        // After a clock jump the pending 2-hour interval is closed as it is
+        if (tick_us > agg->next_2hour_us) {
+            emit_level(agg, ZMPT101B_AGG_2_HOUR, &agg->hour2_level, agg->next_2hour_us);
+            memset(&agg->hour2_level, 0, sizeof(agg->hour2_level));
+            agg->next_2hour_us = next_tick(tick_us - 1, ZMPT101B_AGG_2_HOUR_US);
+        }
+        level_add(&agg->hour2_level, level_rms_mv(&agg->min10_level), agg->min10_level.flagged);
+        if (tick_us == agg->next_2hour_us) {
+            emit_level(agg, ZMPT101B_AGG_2_HOUR, &agg->hour2_level, tick_us);
+            memset(&agg->hour2_level, 0, sizeof(agg->hour2_level));
+            agg->next_2hour_us += ZMPT101B_AGG_2_HOUR_US;
+        }
+    }
+    memset(&agg->min10_level, 0, sizeof(agg->min10_level));
+}
+
+static void close_window(zmpt101b_agg_t *agg, int64_t end_us)
+{
+    const uint32_t rms_mv = samples_rms_mv(agg->window_sum_sq, agg->window_samples);
+    const bool flagged = agg->window_flagged;
+    emit(agg, ZMPT101B_AGG_CYCLES, rms_mv, end_us, agg->window_samples, flagged);
+
+    if (agg->next_10min_us == 0) {
+        agg->next_10min_us = next_tick(end_us, ZMPT101B_AGG_10_MIN_US);
+        agg->next_2hour_us = next_tick(end_us, ZMPT101B_AGG_2_HOUR_US);
+    } else if (end_us >= agg->next_10min_us) {
+        close_10min(agg, agg->next_10min_us);
+        // The 150/180-cycle aggregation is resynchronised at every 10-minute tick
+        memset(&agg->short_level, 0, sizeof(agg->short_level));
+        agg->next_10min_us = next_tick(end_us, ZMPT101B_AGG_10_MIN_US);
+    }
+
+    level_add(&agg->short_level, rms_mv, flagged);
+    level_add(&agg->min10_level, rms_mv, flagged);
+    if (agg->short_level.count == ZMPT101B_AGG_SHORT_WINDOWS) {
+        emit_level(agg, ZMPT101B_AGG_150_CYCLES, &agg->short_level, end_us);
+        memset(&agg->short_level, 0, sizeof(agg->short_level));
+    }
+
+    agg->window_sum_sq = 0;
+    agg->window_samples = 0;
+    agg->window_cycle_count = 0;
+    agg->window_flagged = false;
+}
+
+// public API implementation
+esp_err_t zmpt101b_agg_init(zmpt101b_agg_t *agg, const zmpt101b_agg_config_t *config)
+{
+    if (agg == NULL || config == NULL || config->sample_rate == 0 || (config->nominal_freq != 50 && config->nominal_freq != 60)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(agg, 0, sizeof(*agg));
+    agg->cfg = *config;
+    agg->window_cycles = config->nominal_freq == 50 ? 10 : 12;
+    agg->max_cycle_samples = config->sample_rate * 3 / (config->nominal_freq * 2);
+    agg->dip_mv = (uint32_t)((uint64_t)config->declared_mv * ZMPT101B_AGG_DIP_PCT / 100);
+    agg->swell_mv = (uint32_t)((uint64_t)config->declared_mv * ZMPT101B_AGG_SWELL_PCT / 100);
+    agg->interruption_mv = (uint32_t)((uint64_t)config->declared_mv * ZMPT101B_AGG_INTERRUPTION_PCT / 100);
+    zmpt101b_zc_init(&agg->zc, ZMPT101B_AGG_ZC_HYSTERESIS_MV);
+    return ESP_OK;
+}
+
+void zmpt101b_agg_process(zmpt101b_agg_t *agg, const int16_t *samples, size_t length, int64_t start_us)
+{
+    for (size_t i = 0; i < length; ++i) {
+        const zmpt101b_zc_event_t event = zmpt101b_zc_update(&agg->zc, samples[i]);
+
+        // Cycles are delimited by rising crossings. Without crossings (interruption) the cycle
+        // is closed after 1.5 nominal periods so the aggregation keeps running.
+        if (event == ZMPT101B_ZC_RISING) {
+            if (agg->synced) {
+                close_cycle(agg);
+            } else {
+                agg->synced = true;
+                agg->cycle_sum_sq = 0;
+                agg->cycle_samples = 0;
+            }
+        } else if (agg->cycle_samples >= agg->max_cycle_samples) {
+            close_cycle(agg);
+            agg->synced = true;
+        }
+
+        if (agg->window_cycle_count == agg->window_cycles) {
+            close_window(agg, start_us + (int64_t)i * 1000000 / agg->cfg.sample_rate);
+        }
+
+        const int32_t ac = agg->zc.ac;
+        agg->cycle_sum_sq += (uint64_t)((int64_t)ac * ac);
+        agg->cycle_samples++;
+    }
+}
+
+void zmpt101b_agg_flag(zmpt101b_agg_t *agg)
+{
+    agg->window_flagged = true;
+}
@@ -0,0 +1,135 @@
+/*
+ * ZMPT101B Measurement Aggregation
+ *
+ * IEC 61000-4-30 style aggregation hierarchy over the continuous sample stream:
+ * - 10-cycle (50 Hz) / 12-cycle (60 Hz) RMS, synchronised to the mains zero crossings,
+ * - 150/180-cycle (~3 s) aggregates of 15 consecutive 10/12-cycle values,
+ * - 10-minute aggregates aligned to the wall clock,
+ * - 2-hour aggregates of twelve 10-minute values, aligned to the wall clock.
+ *
+ * Every aggregate is the root of the mean of the squared underlying values and uses a constant
+ * amount of memory. Per-cycle RMS values are checked against the declared voltage: a dip, swell or
+ * interruption flags every aggregate whose interval contains it, as the standard's flagging concept
+ * requires. Other stages can flag the current interval with zmpt101b_agg_flag().
+ *
+ * Samples are ADC input millivolts (see zmpt101b_read_samples()). With the sensor trimmed, 1 mV there
+ * corresponds to 1 V of mains, so RMS values are reported in mains millivolts.
+ * Time is supplied by the caller with each block. Nothing depends on a real clock, so
+ * simulated streams can be fed as fast as they are generated.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "zmpt101b_zerocross.h"
+
+// Number of 10/12-cycle values in a 150/180-cycle aggregate
+#define ZMPT101B_AGG_SHORT_WINDOWS 15
+
+#define ZMPT101B_AGG_10_MIN_US  ( 600LL * 1000000 )
+#define ZMPT101B_AGG_2_HOUR_US  ( 7200LL * 1000000 )
+
+// Event thresholds in percent of the declared voltage
+#define ZMPT101B_AGG_DIP_PCT            90
+#define ZMPT101B_AGG_SWELL_PCT          110
+#define ZMPT101B_AGG_INTERRUPTION_PCT   5
+
+// Zero-crossing hysteresis in ADC millivolts
+#define ZMPT101B_AGG_ZC_HYSTERESIS_MV   20
+
+typedef enum {
+    ZMPT101B_AGG_CYCLES = 0,    // 10-cycle (50 Hz) or 12-cycle (60 Hz) value
+    ZMPT101B_AGG_150_CYCLES,    // 150-cycle (50 Hz) or 180-cycle (60 Hz) value
+    ZMPT101B_AGG_10_MIN,
+    ZMPT101B_AGG_2_HOUR,
+} zmpt101b_agg_interval_t;
+
+typedef struct {
+    zmpt101b_agg_interval_t interval;
+    uint32_t rms_mv;            // RMS voltage in mains millivolts
+    int64_t  timestamp_us;      // end of the interval
+    uint32_t count;             // number of underlying values (samples for the 10/12-cycle value)
+    bool     flagged;           // interval contains a dip, swell, interruption or external flag
+} zmpt101b_agg_value_t;
+
+typedef void (*zmpt101b_agg_callback_t)(const zmpt101b_agg_value_t *value, void *ctx);
+
+typedef struct {
+    uint32_t sample_rate;       // Hz
+    uint16_t nominal_freq;      // 50 or 60 Hz
+    uint32_t declared_mv;       // declared supply voltage in mains millivolts
+    zmpt101b_agg_callback_t callback;
+    void *ctx;
+} zmpt101b_agg_config_t;
+
+// Running sums of one aggregation level
+typedef struct {
+    uint64_t sum_sq;            // sum of squared values, mV^2
+    uint32_t count;
+    bool     flagged;
+} zmpt101b_agg_level_t;
+
+typedef struct {
+    zmpt101b_agg_config_t cfg;
+    zmpt101b_zc_t zc;
+    uint8_t  window_cycles;     // 10 or 12
+    uint32_t max_cycle_samples; // cycle length forced when no crossing shows up (interruption)
+    uint32_t dip_mv;
+    uint32_t swell_mv;
+    uint32_t interruption_mv;
+
+    // Current cycle and 10/12-cycle window, sums of squared AC samples
+    uint64_t cycle_sum_sq;
+    uint32_t cycle_samples;
+    uint64_t window_sum_sq;
+    uint32_t window_samples;
+    uint8_t  window_cycle_count;
+    bool     window_flagged;
+    bool     synced;            // first rising crossing seen
+
+    zmpt101b_agg_level_t short_level;   // 150/180 cycles
+    zmpt101b_agg_level_t min10_level;   // 10 minutes
+    zmpt101b_agg_level_t hour2_level;   // 2 hours
+    int64_t  next_10min_us;
+    int64_t  next_2hour_us;
+
+    // Event state and counters
+    uint8_t  event_state;       // event condition of the last cycle
+    uint32_t dips;
+    uint32_t swells;
+    uint32_t interruptions;
+} zmpt101b_agg_t;
+
+/**
+ * @brief Initializes an aggregation engine.
+ *
+ * @param agg Engine state.
+ * @param config Configuration, copied into the state.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_agg_init(zmpt101b_agg_t *agg, const zmpt101b_agg_config_t *config);
+
+/**
+ * @brief Feeds a block of consecutive samples.
+ *
+ * @param agg Engine state.
+ * @param samples Samples in ADC millivolts, DC bias included.
+ * @param length Number of samples.
+ * @param start_us Wall-clock time of the first sample in microseconds (e.g. UTC since the epoch).
+ */
+void zmpt101b_agg_process(zmpt101b_agg_t *agg, const int16_t *samples, size_t length, int64_t start_us);
+
+/**
+ * @brief Flags the intervals currently being aggregated, e.g. after a sample integrity problem.
+ *
+ * @param agg Engine state.
+ */
+void zmpt101b_agg_flag(zmpt101b_agg_t *agg);
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <string.h>
+#include "zmpt101b_calibration.h"
+#include "zmpt101b_storage.h"
+#include "zmpt101b_warmstart.h"
+#include "esp_log.h"
+
+#define TAG_CALIBRATION "ZMPT101B_CAL"
+
+// Bumped whenever zmpt101b_cal_data_t changes layout; stale records are ignored
+#define CAL_DATA_VERSION 1
+
+// One piecewise-linear segment of the correction: corrected = measured * gain + offset,
+// used for readings at or above `threshold_mv` (the first segment has no lower bound).
+typedef struct {
+    int32_t threshold_mv;
+    int32_t gain_q16;
+    int32_t offset_mv;
+} cal_segment_t;
+
+typedef struct {
+    uint8_t segment_count;
+    cal_segment_t segments[ZMPT101B_CAL_MAX_POINTS];
+} cal_table_t;
+
+static zmpt101b_cal_data_t cal_data[ZMPT101B_CAL_CHANNELS];
+static cal_table_t cal_tables[ZMPT101B_CAL_CHANNELS];
+
+// Internal functions
+static void cal_storage_key(uint8_t channel, char *key, size_t size)
+{
+    snprintf(key, size, "cal_ch%u", channel);
+}
+
+static void reset_data(zmpt101b_cal_data_t *data)
+{
+    memset(data, 0, sizeof(*data));
+    data->version = CAL_DATA_VERSION;
+}
+
+// Expands the calibration points of a channel into the correction table used by
+// zmpt101b_calibration_apply(). All divisions happen here, never per measurement.
+static void build_table(uint8_t channel)
+{
+    const zmpt101b_cal_data_t *data = &cal_data[channel];
+    cal_table_t *table = &cal_tables[channel];
+    const zmpt101b_cal_point_t *p = data->points;
+
+    memset(table, 0, sizeof(*table));
+    table->segment_count = 1;
+    table->segments[0].gain_q16 = 1 << 16;
+
+    if (data->point_count == 1) {
+        table->segments[0].gain_q16 = (int32_t)((((int64_t)p[0].reference_mv << 16) + p[0].measured_mv / 2) / p[0].measured_mv);
+        return;
+    }
+
+    uint8_t count = 0;
+    for (uint8_t i = 0; i + 1 < data->point_count; ++i) {
+        const int32_t dm = p[i + 1].measured_mv - p[i].measured_mv;
+        if (dm <= 0)
+            continue;
+        cal_segment_t *seg = &table->segments[count];
+        seg->gain_q16 = (int32_t)((((int64_t)(p[i + 1].reference_mv - p[i].reference_mv) << 16) + dm / 2) / dm);
+        seg->offset_mv = p[i].reference_mv - (int32_t)(((int64_t)p[i].measured_mv * seg->gain_q16 + 32768) >> 16);
+        seg->threshold_mv = count == 0 ? INT32_MIN : p[i].measured_mv;
+        count++;
+    }
+    if (count > 0)
+        table->segment_count = count;
+}
+
+static esp_err_t save_channel(uint8_t channel)
+{
+    char key[16];
+    cal_storage_key(channel, key, sizeof(key));
+    esp_err_t err = zmpt101b_storage_save(key, &cal_data[channel], sizeof(zmpt101b_cal_data_t));
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_CALIBRATION, "Failed to store calibration for channel %u (%s)", channel, esp_err_to_name(err));
+        return err;
+    }
+    zmpt101b_warm_put_cal(channel, &cal_data[channel]);
+    return ESP_OK;
+}
+
+// public API implementation
+esp_err_t zmpt101b_calibration_load(uint8_t channel)
+{
+    if (channel >= ZMPT101B_CAL_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+
+    // After a software reset the record is still in RTC memory, NVS isn't touched
+    zmpt101b_cal_data_t *data = &cal_data[channel];
+    if (zmpt101b_warm_get_cal(channel, data) && data->version == CAL_DATA_VERSION &&
+        data->point_count <= ZMPT101B_CAL_MAX_POINTS) {
+        build_table(channel);
+        return ESP_OK;
+    }
+
+    char key[16];
+    cal_storage_key(channel, key, sizeof(key));
+    esp_err_t err = zmpt101b_storage_load(key, data, sizeof(*data));
+
+    if (err == ESP_OK && (data->version != CAL_DATA_VERSION || data->point_count > ZMPT101B_CAL_MAX_POINTS)) {
+        ESP_LOGW(TAG_CALIBRATION, "Ignoring incompatible calibration record for channel %u", channel);
+        err = ESP_ERR_NOT_FOUND;
+    }
+    if (err != ESP_OK) {
+        reset_data(data);
+    }
+    build_table(channel);
+
+    if (err == ESP_ERR_NOT_FOUND || err == ESP_ERR_INVALID_SIZE) {
+        ESP_LOGI(TAG_CALIBRATION, "Channel %u is not calibrated", channel);
+        zmpt101b_warm_put_cal(channel, data);
+        return ESP_OK;
+    }
+    if (err == ESP_OK) {
+        ESP_LOGI(TAG_CALIBRATION, "Channel %u: %u calibration point(s) loaded", channel, data->point_count);
+        zmpt101b_warm_put_cal(channel, data);
+    }
+    return err;
+}
+
+esp_err_t zmpt101b_calibration_add_point(uint8_t channel, int32_t measured_mv, int32_t reference_mv)
+{
+    if (channel >= ZMPT101B_CAL_CHANNELS || measured_mv <= 0 || reference_mv <= 0)
+        return ESP_ERR_INVALID_ARG;
+
+    zmpt101b_cal_data_t *data = &cal_data[channel];
+    if (data->version != CAL_DATA_VERSION)
+        reset_data(data);
+
+    // Pick the slot: an existing point at the same reference, a free slot,
+    // or the point with the nearest reference when the table is full.
+    int slot = -1;
+    int32_t nearest_distance = INT32_MAX;
+    for (uint8_t i = 0; i < data->point_count; ++i) {
+        int32_t distance = data->points[i].reference_mv - reference_mv;
+        if (distance < 0)
+            distance = -distance;
+        if ((int64_t)distance * 100 <= (int64_t)reference_mv * ZMPT101B_CAL_SAME_POINT_PCT || (data->point_count == ZMPT101B_CAL_MAX_POINTS && distance < nearest_distance)) {
+            slot = i;
+            nearest_distance = distance;
+        }
+    }
+    if (slot < 0)
+        slot = data->point_count++;
+
+    data->points[slot].measured_mv = measured_mv;
+    data->points[slot].reference_mv = reference_mv;
+
+    // Keep the points ordered by the measured value (insertion sort, at most a handful of points)
+    for (uint8_t i = 1; i < data->point_count; ++i) {
+        const zmpt101b_cal_point_t key = data->points[i];
+        uint8_t j = i;
+        while (j > 0 && data->points[j - 1].measured_mv > key.measured_mv) {
+            data->points[j] = data->points[j - 1];
+            j--;
+        }
+        data->points[j] = key;
+    }
+
+    build_table(channel);
+    ESP_LOGI(TAG_CALIBRATION, "Channel %u: point %ld mV -> %ld mV, %u point(s) total", channel,
+             (long)measured_mv, (long)reference_mv, data->point_count);
+    return save_channel(channel);
+}
+
+esp_err_t zmpt101b_calibration_set_phase(uint8_t channel, int32_t phase_mdeg)
+{
+    if (channel >= ZMPT101B_CAL_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+
+    if (cal_data[channel].version != CAL_DATA_VERSION)
+        reset_data(&cal_data[channel]);
+    cal_data[channel].phase_mdeg = phase_mdeg;
+    return save_channel(channel);
+}
+
+esp_err_t zmpt101b_calibration_clear(uint8_t channel)
+{
+    if (channel >= ZMPT101B_CAL_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+
+    reset_data(&cal_data[channel]);
+    build_table(channel);
+
+    char key[16];
+    cal_storage_key(channel, key, sizeof(key));
+    esp_err_t err = zmpt101b_storage_erase(key);
+    if (err == ESP_OK || err == ESP_ERR_NOT_FOUND)
+        zmpt101b_warm_put_cal(channel, &cal_data[channel]);
+    return err;
+}
+
+esp_err_t zmpt101b_calibration_get(uint8_t channel, zmpt101b_cal_data_t *data)
+{
+    if (channel >= ZMPT101B_CAL_CHANNELS || data == NULL)
+        return ESP_ERR_INVALID_ARG;
+
+    *data = cal_data[channel];
+    return ESP_OK;
+}
+
+int32_t zmpt101b_calibration_apply(uint8_t channel, int32_t measured_mv)
+{
+    if (channel >= ZMPT101B_CAL_CHANNELS)
+        return measured_mv;
+
+    const cal_table_t *table = &cal_tables[channel];
+    if (table->segment_count == 0)
+        return measured_mv;     // never loaded
+
+    uint8_t i = table->segment_count - 1;
+    while (i > 0 && measured_mv < table->segments[i].threshold_mv)
+        i--;
+
+    const cal_segment_t *seg = &table->segments[i];
+    const int64_t corrected = (((int64_t)measured_mv * seg->gain_q16 + 32768) >> 16) + seg->offset_mv;
+    return corrected < 0 ? 0 : (int32_t)corrected;
+}
+
+int32_t zmpt101b_calibration_phase(uint8_t channel)
+{
+    return channel < ZMPT101B_CAL_CHANNELS ? cal_data[channel].phase_mdeg : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * ZMPT101B Calibration
+ *
+ * Per-channel multi-point gain/offset correction of the measured RMS voltage.
+ * Calibration points pair an uncorrected reading with the value of a known reference
+ * voltage. They are persisted through zmpt101b_storage (NVS on the device) and expanded
+ * into a table of piecewise-linear segments, so applying the correction in the
+ * measurement path costs one comparison per segment and a single multiply.
+ *
+ * - No points: readings pass through unchanged (potentiometer-only trimming).
+ * - One point: pure gain correction through zero.
+ * - Two or more points: piecewise-linear gain/offset between the points,
+ *   the outer segments are extrapolated.
+ *
+ * A phase correction is stored alongside for stages that work with phase angles.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Number of calibration points kept per channel
+#define ZMPT101B_CAL_MAX_POINTS 4
+
+// Number of channels with their own calibration (ADC1 channels 0..7)
+#define ZMPT101B_CAL_CHANNELS 8
+
+// Two references closer than this (in percent) are treated as the same calibration point,
+// so re-running a calibration at the same voltage replaces the old point.
+#define ZMPT101B_CAL_SAME_POINT_PCT 5
+
+typedef struct {
+    int32_t measured_mv;    // uncorrected reading
+    int32_t reference_mv;   // reference voltage applied while the reading was taken
+} zmpt101b_cal_point_t;
+
+// Persisted calibration record of one channel
+typedef struct {
+    uint16_t version;
+    uint8_t  point_count;
+    uint8_t  reserved;
+    int32_t  phase_mdeg;    // phase correction in millidegrees, added to measured angles
+    zmpt101b_cal_point_t points[ZMPT101B_CAL_MAX_POINTS];   // sorted by measured_mv
+} zmpt101b_cal_data_t;
+
+/**
+ * @brief Loads the calibration of a channel from storage and rebuilds its correction table.
+ *
+ * A channel without stored calibration falls back to the identity correction.
+ *
+ * @param channel ADC channel.
+ * @return esp_err_t ESP_OK (also when nothing was stored) or a storage error.
+ */
+esp_err_t zmpt101b_calibration_load(uint8_t channel);
+
+/**
+ * @brief Adds a calibration point and persists the result.
+ *
+ * A point whose reference is within ZMPT101B_CAL_SAME_POINT_PCT of an existing one replaces it.
+ * When all slots are used, the point with the nearest reference is replaced.
+ *
+ * @param channel ADC channel.
+ * @param measured_mv Uncorrected reading taken with the reference applied.
+ * @param reference_mv Known reference voltage.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG for non-positive values, or a storage error.
+ */
+esp_err_t zmpt101b_calibration_add_point(uint8_t channel, int32_t measured_mv, int32_t reference_mv);
+
+/**
+ * @brief Sets and persists the phase correction of a channel.
+ *
+ * @param channel ADC channel.
+ * @param phase_mdeg Phase correction in millidegrees.
+ * @return esp_err_t ESP_OK or a storage error.
+ */
+esp_err_t zmpt101b_calibration_set_phase(uint8_t channel, int32_t phase_mdeg);
+
+/**
+ * @brief Drops all calibration of a channel, in RAM and in storage.
+ *
+ * @param channel ADC channel.
+ * @return esp_err_t ESP_OK or a storage error.
+ */
+esp_err_t zmpt101b_calibration_clear(uint8_t channel);
+
+/**
+ * @brief Returns a copy of the calibration record of a channel.
+ *
+ * @param channel ADC channel.
+ * @param data Destination.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_calibration_get(uint8_t channel, zmpt101b_cal_data_t *data);
+
+/**
+ * @brief Applies the correction table to an uncorrected reading.
+ *
+ * @param channel ADC channel.
+ * @param measured_mv Uncorrected reading.
+ * @return int32_t Corrected reading, never negative.
+ */
+int32_t zmpt101b_calibration_apply(uint8_t channel, int32_t measured_mv);
+
+/**
+ * @brief Returns the phase correction of a channel in millidegrees.
+ *
+ * @param channel ADC channel.
+ */
+int32_t zmpt101b_calibration_phase(uint8_t channel);
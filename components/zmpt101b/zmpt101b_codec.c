@@ -0,0 +1,253 @@
+#include <string.h>
+#include "zmpt101b_codec.h"
+
+#define HISTORY_MASK    ( ZMPT101B_CODEC_HISTORY - 1 )
+
+#define FLAG_PERIOD_MASK    0x03FF
+#define FLAG_PREDICTOR_SHIFT 12
+#define FLAG_SYNC           0x8000
+
+// Unary quotients from RICE_LIMIT on are escaped to a literal of ESCAPE_BITS
+#define RICE_LIMIT      16
+#define ESCAPE_BITS     20
+// Decay of the Rice parameter estimator as a power of two, in samples
+#define RICE_SHIFT      4
+
+enum {
+    PREDICT_PREVIOUS = 0,   // x[n-1]
+    PREDICT_CYCLE,          // x[n-P]
+    PREDICT_CYCLE_STEP,     // x[n-P] + x[n-1] - x[n-P-1]
+    PREDICT_COUNT,
+};
+
+typedef struct {
+    uint8_t *data;
+    size_t   size;
+    size_t   pos;
+    uint64_t acc;
+    uint32_t bits;
+    bool     overflow;
+} bit_writer_t;
+
+typedef struct {
+    const uint8_t *data;
+    size_t   size;
+    size_t   pos;
+    uint64_t acc;
+    uint32_t bits;
+    bool     underflow;
+} bit_reader_t;
+
+// Internal functions
+static void put_bits(bit_writer_t *bw, uint32_t value, uint32_t count)
+{
+    bw->acc = (bw->acc << count) | (value & ((1ULL << count) - 1));
+    bw->bits += count;
+    while (bw->bits >= 8) {
+        bw->bits -= 8;
+        if (bw->pos < bw->size)
+            bw->data[bw->pos++] = (uint8_t)(bw->acc >> bw->bits);
+        else
+            bw->overflow = true;
+    }
+}
+
+static void flush_bits(bit_writer_t *bw)
+{
+    if (bw->bits != 0)
+        put_bits(bw, 0, 8 - bw->bits);
+}
+
+static uint32_t get_bits(bit_reader_t *br, uint32_t count)
+{
+    while (br->bits < count) {
+        uint8_t byte = 0;
+        if (br->pos < br->size)
+            byte = br->data[br->pos++];
+        else
+            br->underflow = true;
+        br->acc = (br->acc << 8) | byte;
+        br->bits += 8;
+    }
+    br->bits -= count;
+    return (uint32_t)(br->acc >> br->bits) & (uint32_t)((1ULL << count) - 1);
+}
+
+static uint32_t zigzag(int32_t value)
+{
+    return value < 0 ? ((uint32_t)-value << 1) - 1 : (uint32_t)value << 1;
+}
+
+static int32_t unzigzag(uint32_t value)
+{
+    return (value & 1) ? -(int32_t)(value >> 1) - 1 : (int32_t)(value >> 1);
+}
+
+static uint32_t rice_parameter(uint32_t acc)
+{
+    const uint32_t mean = acc >> RICE_SHIFT;
+    return mean != 0 ? 31 - __builtin_clz(mean) : 0;
+}
+
+// Sample `back` positions before index `i` of the current block, reaching into the history.
+// `position` counts the samples since the sync point; anything before it reads as zero.
+static int32_t sample_at(const zmpt101b_codec_t *codec, uint32_t position, const int16_t *block, size_t i, uint32_t back)
+{
+    if (i >= back)
+        return block[i - back];
+    if (position + i < back)
+        return 0;
+    return codec->history[(position + i - back) & HISTORY_MASK];
+}
+
+static int32_t predict(const zmpt101b_codec_t *codec, uint32_t position, const int16_t *block, size_t i, uint32_t predictor, uint32_t period)
+{
+    switch (predictor) {
+    case PREDICT_CYCLE:
+        return sample_at(codec, position, block, i, period);
+    case PREDICT_CYCLE_STEP:
+        return sample_at(codec, position, block, i, period) + sample_at(codec, position, block, i, 1)
+             - sample_at(codec, position, block, i, period + 1);
+    default:
+        return sample_at(codec, position, block, i, 1);
+    }
+}
+
+static void append_history(zmpt101b_codec_t *codec, uint32_t position, const int16_t *block, size_t length)
+{
+    const size_t skip = length > ZMPT101B_CODEC_HISTORY ? length - ZMPT101B_CODEC_HISTORY : 0;
+    for (size_t i = skip; i < length; ++i)
+        codec->history[(position + i) & HISTORY_MASK] = block[i];
+    codec->position = position + (uint32_t)length;
+}
+
+// public API implementation
+void zmpt101b_codec_init(zmpt101b_codec_t *codec, uint16_t period)
+{
+    memset(codec, 0, sizeof(*codec));
+    codec->period = (period >= 1 && period <= ZMPT101B_CODEC_MAX_PERIOD) ? period : 1;
+    codec->sync_pending = true;
+}
+
+bool zmpt101b_codec_set_period(zmpt101b_codec_t *codec, uint16_t period)
+{
+    if (period < 1 || period > ZMPT101B_CODEC_MAX_PERIOD)
+        return false;
+    codec->period = period;
+    return true;
+}
+
+void zmpt101b_codec_sync(zmpt101b_codec_t *codec)
+{
+    codec->sync_pending = true;
+}
+
+size_t zmpt101b_codec_encode(zmpt101b_codec_t *codec, const int16_t *samples, size_t length, uint8_t *out, size_t out_size)
+{
+    if (length == 0 || length > 0xFFFF || out_size < ZMPT101B_CODEC_HEADER_SIZE)
+        return 0;
+
+    // The state is only committed once the block is complete, a failed call leaves it untouched
+    const bool sync = codec->sync_pending;
+    const uint32_t position = sync ? 0 : codec->position;
+    const uint32_t period = codec->period;
+    uint32_t rice_acc = sync ? 0 : codec->rice_acc;
+
+    // Pick the predictor with the smallest absolute residual sum over the block
+    uint64_t cost[PREDICT_COUNT] = { 0 };
+    for (size_t i = 0; i < length; ++i) {
+        for (uint32_t p = 0; p < PREDICT_COUNT; ++p) {
+            const int32_t residual = samples[i] - predict(codec, position, samples, i, p, period);
+            cost[p] += (uint32_t)(residual < 0 ? -residual : residual);
+        }
+    }
+    uint32_t predictor = PREDICT_PREVIOUS;
+    for (uint32_t p = 1; p < PREDICT_COUNT; ++p) {
+        if (cost[p] < cost[predictor])
+            predictor = p;
+    }
+
+    bit_writer_t bw = { .data = out + ZMPT101B_CODEC_HEADER_SIZE, .size = out_size - ZMPT101B_CODEC_HEADER_SIZE };
+    for (size_t i = 0; i < length && !bw.overflow; ++i) {
+        const uint32_t value = zigzag(samples[i] - predict(codec, position, samples, i, predictor, period));
+        const uint32_t k = rice_parameter(rice_acc);
+        const uint32_t quotient = value >> k;
+        if (quotient < RICE_LIMIT) {
+            put_bits(&bw, ((1U << quotient) - 1) << 1, quotient + 1);
+            put_bits(&bw, value, k);
+        } else {
+            put_bits(&bw, (1U << RICE_LIMIT) - 1, RICE_LIMIT);
+            put_bits(&bw, value, ESCAPE_BITS);
+        }
+        rice_acc += value - (rice_acc >> RICE_SHIFT);
+    }
+    flush_bits(&bw);
+    if (bw.overflow || bw.pos > 0xFFFF)
+        return 0;
+
+    const uint16_t flags = (uint16_t)(period | (predictor << FLAG_PREDICTOR_SHIFT) | (sync ? FLAG_SYNC : 0));
+    out[0] = (uint8_t)length;
+    out[1] = (uint8_t)(length >> 8);
+    out[2] = (uint8_t)bw.pos;
+    out[3] = (uint8_t)(bw.pos >> 8);
+    out[4] = (uint8_t)flags;
+    out[5] = (uint8_t)(flags >> 8);
+
+    append_history(codec, position, samples, length);
+    codec->rice_acc = rice_acc;
+    codec->sync_pending = false;
+    return ZMPT101B_CODEC_HEADER_SIZE + bw.pos;
+}
+
+size_t zmpt101b_codec_decode(zmpt101b_codec_t *codec, const uint8_t *in, size_t in_len, int16_t *samples, size_t max_samples, size_t *consumed)
+{
+    *consumed = 0;
+    if (in_len < ZMPT101B_CODEC_HEADER_SIZE)
+        return 0;
+
+    const size_t length = in[0] | (in[1] << 8);
+    const size_t payload = in[2] | (in[3] << 8);
+    const uint16_t flags = (uint16_t)(in[4] | (in[5] << 8));
+    const uint32_t period = flags & FLAG_PERIOD_MASK;
+    const uint32_t predictor = (flags >> FLAG_PREDICTOR_SHIFT) & 3;
+    if (in_len < ZMPT101B_CODEC_HEADER_SIZE + payload || length == 0 || period == 0
+        || period > ZMPT101B_CODEC_MAX_PERIOD || predictor >= PREDICT_COUNT) {
+        return 0;
+    }
+
+    if (flags & FLAG_SYNC) {
+        codec->position = 0;
+        codec->rice_acc = 0;
+        codec->synced = true;
+    }
+    if (!codec->synced) {
+        *consumed = ZMPT101B_CODEC_HEADER_SIZE + payload;
+        return 0;
+    }
+    if (length > max_samples)
+        return 0;
+
+    bit_reader_t br = { .data = in + ZMPT101B_CODEC_HEADER_SIZE, .size = payload };
+    for (size_t i = 0; i < length; ++i) {
+        const uint32_t k = rice_parameter(codec->rice_acc);
+        uint32_t quotient = 0;
+        while (quotient < RICE_LIMIT && get_bits(&br, 1))
+            quotient++;
+        uint32_t value;
+        if (quotient < RICE_LIMIT)
+            value = (quotient << k) | get_bits(&br, k);
+        else
+            value = get_bits(&br, ESCAPE_BITS);
+        if (br.underflow) {
+            codec->synced = false;
+            return 0;
+        }
+        samples[i] = (int16_t)(predict(codec, codec->position, samples, i, predictor, period) + unzigzag(value));
+        codec->rice_acc += value - (codec->rice_acc >> RICE_SHIFT);
+    }
+
+    append_history(codec, codec->position, samples, length);
+    codec->period = (uint16_t)period;
+    *consumed = ZMPT101B_CODEC_HEADER_SIZE + payload;
+    return length;
+}
@@ -0,0 +1,101 @@
+/*
+ * ZMPT101B Waveform Codec
+ *
+ * Streaming lossless compressor for captures of the quasi-periodic mains waveform.
+ * Every block (typically one DMA buffer) is coded on its own call with bounded memory:
+ * - prediction: the block uses whichever predictor fits it best - the previous sample,
+ *   the same sample one mains period back, or the previous period corrected by the last step,
+ * - residuals are zigzag mapped and Rice coded, the Rice parameter tracking the running mean
+ *   of the residuals; outliers are escaped to a fixed-width literal.
+ *
+ * Block layout (little-endian): u16 sample count, u16 payload bytes, u16 flags, payload.
+ * The flags hold the period (bits 0-9), the predictor (bits 12-13) and a sync bit (bit 15)
+ * marking blocks coded from a cleared history, where a decoder can start.
+ * The period may change between blocks (e.g. from the zero-crossing detector); it travels
+ * in the block header, so the decoder needs no side information.
+ *
+ * Plain C without ESP-IDF dependencies so host tools (tools/zmpt101b_codec.py) can build
+ * the same file as the decoder.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Samples of history kept for the cycle predictors; the period must be shorter
+#define ZMPT101B_CODEC_HISTORY 1024
+#define ZMPT101B_CODEC_MAX_PERIOD ( ZMPT101B_CODEC_HISTORY - 2 )
+
+#define ZMPT101B_CODEC_HEADER_SIZE 6
+
+// Worst-case size of a coded block of `n` samples
+#define ZMPT101B_CODEC_BOUND(n) ( ZMPT101B_CODEC_HEADER_SIZE + 5 * (n) )
+
+typedef struct {
+    int16_t  history[ZMPT101B_CODEC_HISTORY];  // last samples, indexed by position
+    uint32_t position;          // samples coded since the last sync point
+    uint32_t rice_acc;          // running mean of the mapped residuals, x16
+    uint16_t period;            // samples per mains period used by the next block
+    bool     sync_pending;      // encoder: the next block is a sync point
+    bool     synced;            // decoder: a sync block has been seen
+} zmpt101b_codec_t;
+
+/**
+ * @brief Initializes an encoder or decoder state.
+ *
+ * @param codec Codec state (about 2 KB).
+ * @param period Samples per mains period, e.g. sample rate / 50. Ignored by the decoder.
+ */
+void zmpt101b_codec_init(zmpt101b_codec_t *codec, uint16_t period);
+
+/**
+ * @brief Changes the period used from the next block on.
+ *
+ * @param codec Encoder state.
+ * @param period Samples per mains period, 1 ... ZMPT101B_CODEC_MAX_PERIOD.
+ * @return bool false if the period is out of range and was not applied.
+ */
+bool zmpt101b_codec_set_period(zmpt101b_codec_t *codec, uint16_t period);
+
+/**
+ * @brief Makes the next block a sync point a decoder can start from.
+ *
+ * @param codec Encoder state.
+ */
+void zmpt101b_codec_sync(zmpt101b_codec_t *codec);
+
+/**
+ * @brief Encodes one block.
+ *
+ * @param codec Encoder state.
+ * @param samples Samples to encode.
+ * @param length Number of samples, 1 ... 65535.
+ * @param out Output buffer; ZMPT101B_CODEC_BOUND(length) bytes always suffice.
+ * @param out_size Size of the output buffer.
+ * @return size_t Bytes written, 0 if the arguments are invalid or the output buffer is too small.
+ *         On failure the state is unchanged.
+ */
+size_t zmpt101b_codec_encode(zmpt101b_codec_t *codec, const int16_t *samples, size_t length, uint8_t *out, size_t out_size);
+
+/**
+ * @brief Decodes one block.
+ *
+ * Blocks ahead of the first sync block can't be decoded and are skipped.
+ *
+ * @param codec Decoder state.
+ * @param in Coded data starting at a block header.
+ * @param in_len Bytes available.
+ * @param samples Output buffer.
+ * @param max_samples Size of the output buffer in samples.
+ * @param consumed Bytes of the block, also set for skipped blocks; 0 when the data is malformed or truncated
+ *        or the output buffer is too small.
+ * @return size_t Samples decoded.
+ */
+size_t zmpt101b_codec_decode(zmpt101b_codec_t *codec, const uint8_t *in, size_t in_len, int16_t *samples, size_t max_samples, size_t *consumed);
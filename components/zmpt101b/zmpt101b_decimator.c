@@ -0,0 +1,102 @@
+#include <string.h>
+#include "zmpt101b_decimator.h"
+#include "zmpt101b_fixed.h"
+
+// Width of the raw ADC sample carried in the lower bits of each I2S word.
+#define RAW_SAMPLE_BITS 12
+#define RAW_SAMPLE_MASK 0x0FFFu
+
+// Internal functions
+// Side tap of the 3-tap compensator [-a, 1+2a, -a]. Near DC its response is 1 + 4*pi^2*a*f^2,
+// while a CIC of order N droops by roughly N*pi^2*f^2/6, so a = N/24 flattens the passband.
+static int32_t compensation_coeff(uint8_t order)
+{
+    return (int32_t)((order * 32768u + 12u) / 24u);
+}
+
+esp_err_t zmpt101b_decimator_init(zmpt101b_decimator_t *dec, uint8_t order, uint16_t ratio)
+{
+    if (dec == NULL || order == 0 || order > ZMPT101B_CIC_MAX_ORDER || ratio < 2 || (ratio & (ratio - 1)) != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t ratio_log2 = 0;
+    while ((1u << ratio_log2) < ratio)
+        ratio_log2++;
+
+    // Bit growth of the CIC is order * log2(ratio); the result must still fit the 32-bit registers.
+    const unsigned growth = order * ratio_log2;
+    if (RAW_SAMPLE_BITS + growth > 32 || RAW_SAMPLE_BITS + growth < ZMPT101B_DECIM_OUTPUT_BITS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(dec, 0, sizeof(*dec));
+    dec->order = order;
+    dec->ratio_log2 = ratio_log2;
+    dec->out_shift = RAW_SAMPLE_BITS + growth - ZMPT101B_DECIM_OUTPUT_BITS;
+    dec->comp_coeff = compensation_coeff(order);
+    return ESP_OK;
+}
+
+void zmpt101b_decimator_reset(zmpt101b_decimator_t *dec)
+{
+    memset(dec->integrator, 0, sizeof(dec->integrator));
+    memset(dec->comb, 0, sizeof(dec->comb));
+    memset(dec->fir_hist, 0, sizeof(dec->fir_hist));
+    dec->phase = 0;
+    dec->primed = 0;
+}
+
+size_t zmpt101b_decimator_process(zmpt101b_decimator_t *dec, const uint16_t *in, size_t in_len, uint16_t *out, size_t out_len)
+{
+    const uint8_t order = dec->order;
+    const uint16_t ratio_mask = (1u << dec->ratio_log2) - 1;
+    const int32_t a = dec->comp_coeff;
+    const int32_t out_max = (1 << ZMPT101B_DECIM_OUTPUT_BITS) - 1;
+    size_t produced = 0;
+
+    for (size_t i = 0; i < in_len && produced < out_len; ++i) {
+        // Integrator section runs at the input rate. Unsigned arithmetic keeps the
+        // wraparound well defined; the comb section undoes it exactly.
+        uint32_t acc = in[i] & RAW_SAMPLE_MASK;
+        for (uint8_t s = 0; s < order; ++s) {
+            dec->integrator[s] += acc;
+            acc = dec->integrator[s];
+        }
+
+        dec->phase = (dec->phase + 1) & ratio_mask;
+        if (dec->phase != 0)
+            continue;
+
+        // Comb section runs at the output rate
+        for (uint8_t s = 0; s < order; ++s) {
+            const uint32_t delayed = dec->comb[s];
+            dec->comb[s] = acc;
+            acc -= delayed;
+        }
+        const int32_t cic = (int32_t)(acc >> dec->out_shift);
+
+        // The first `order` comb outputs are start-up transients and the compensator needs
+        // two samples of history, so nothing is emitted until both have settled.
+        if (dec->primed < order + 2) {
+            dec->fir_hist[1] = dec->fir_hist[0];
+            dec->fir_hist[0] = cic;
+            dec->primed++;
+            continue;
+        }
+
+        // Droop compensation [-a, 1+2a, -a], delays the stream by one output sample
+        const int32_t x1 = dec->fir_hist[0];
+        const int32_t x2 = dec->fir_hist[1];
+        int32_t y = x1 + zmpt101b_q15_scale(2 * x1 - cic - x2, a);
+        dec->fir_hist[1] = x1;
+        dec->fir_hist[0] = cic;
+
+        if (y < 0)
+            y = 0;
+        else if (y > out_max)
+            y = out_max;
+        out[produced++] = (uint16_t)y;
+    }
+    return produced;
+}
@@ -0,0 +1,71 @@
+/*
+ * ZMPT101B Oversampling Decimator
+ *
+ * Integer CIC decimator followed by a short droop-compensation FIR.
+ * The ADC is sampled ZMPT101B_DECIM_RATIO times faster than SAMPLING_FREQ and the
+ * decimator folds each group of raw 12-bit samples into one 16-bit sample,
+ * trading sample rate for effective resolution.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Highest supported CIC order. The accumulator is 32 bits wide, so the register growth
+// order * log2(ratio) on top of the 12-bit input must not exceed 20 bits.
+#define ZMPT101B_CIC_MAX_ORDER 5
+
+// Resolution of the decimated output stream in bits.
+#define ZMPT101B_DECIM_OUTPUT_BITS 16
+
+typedef struct {
+    uint8_t  order;          // CIC order (number of integrator/comb pairs)
+    uint8_t  ratio_log2;     // log2 of the decimation ratio
+    uint8_t  out_shift;      // right shift from CIC gain to ZMPT101B_DECIM_OUTPUT_BITS
+    uint16_t phase;          // raw samples consumed since the last output
+    int32_t  comp_coeff;     // droop compensation side tap, Q15
+    uint32_t integrator[ZMPT101B_CIC_MAX_ORDER];   // wraps modulo 2^32 by design
+    uint32_t comb[ZMPT101B_CIC_MAX_ORDER];         // delayed values for the comb stages
+    int32_t  fir_hist[2];    // last two CIC outputs for the compensation FIR
+    uint8_t  primed;         // CIC outputs discarded while the filters settle
+} zmpt101b_decimator_t;
+
+/**
+ * @brief Initializes a decimator instance.
+ *
+ * @param dec Decimator state to initialize.
+ * @param order CIC order, 1..ZMPT101B_CIC_MAX_ORDER.
+ * @param ratio Decimation ratio, must be a power of two.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG if the configuration would overflow the accumulator.
+ */
+esp_err_t zmpt101b_decimator_init(zmpt101b_decimator_t *dec, uint8_t order, uint16_t ratio);
+
+/**
+ * @brief Clears the filter history without changing the configuration.
+ *
+ * @param dec Decimator state.
+ */
+void zmpt101b_decimator_reset(zmpt101b_decimator_t *dec);
+
+/**
+ * @brief Decimates a block of raw I2S ADC words.
+ *
+ * The upper 4 channel bits of each word are masked off. The decimator keeps its phase
+ * across calls, so blocks don't need to be a multiple of the ratio. After init or reset the
+ * first order + 2 decimated samples are swallowed while the comb and FIR stages settle.
+ *
+ * @param dec Decimator state.
+ * @param in Raw 16-bit words read from I2S.
+ * @param in_len Number of words in `in`.
+ * @param out Output buffer for ZMPT101B_DECIM_OUTPUT_BITS-wide samples.
+ * @param out_len Capacity of `out` in samples.
+ * @return size_t Number of samples written to `out`. Input past a full output buffer is dropped.
+ */
+size_t zmpt101b_decimator_process(zmpt101b_decimator_t *dec, const uint16_t *in, size_t in_len, uint16_t *out, size_t out_len);
@@ -0,0 +1,149 @@
+#include <string.h>
+#include "zmpt101b_despike.h"
+
+// Internal functions
+// Counts a sample moved from `before` to `after` if the move exceeds the threshold
+static void report(zmpt101b_despike_stats_t *stats, uint16_t threshold, size_t index, int32_t before, int32_t after)
+{
+    const int32_t moved = after > before ? after - before : before - after;
+    if (moved <= threshold)
+        return;
+    stats->rejected++;
+    if (moved > stats->largest)
+        stats->largest = (uint16_t)moved;
+    if (stats->logged < ZMPT101B_DESPIKE_LOG)
+        stats->index[stats->logged++] = (uint16_t)index;
+}
+
+// Running median; each window sees the samples before it already filtered, as it always has
+static void median(uint16_t *data, size_t length, size_t window_size, uint16_t threshold, zmpt101b_despike_stats_t *stats)
+{
+    uint16_t window[ZMPT101B_DESPIKE_MAX_WINDOW];
+    const size_t half_window = window_size / 2;
+    for (size_t i = 0; i < length; ++i) {
+        // Determine the actual window size for edge cases
+        const size_t start = (i < half_window) ? 0 : i - half_window;
+        const size_t end = (i + half_window >= length) ? length - 1 : i + half_window;
+        const size_t current_window_size = end - start + 1;
+
+        // Copy the current window
+        memcpy(window, data + start, current_window_size * sizeof(uint16_t));
+
+        // Sort the window using insertion sort
+        for (size_t j = 1; j < current_window_size; ++j) {
+            const uint16_t key = window[j];
+            size_t k = j;
+            while (k > 0 && window[k - 1] > key) {
+                window[k] = window[k - 1];
+                k--;
+            }
+            window[k] = key;
+        }
+
+        // Set the median value directly back to the original data array; the shortened windows
+        // at the edges shift samples on a slope, which isn't a spike
+        if (current_window_size == window_size)
+            report(stats, threshold, i, data[i], window[current_window_size / 2]);
+        data[i] = window[current_window_size / 2];
+    }
+}
+
+static uint16_t median3(uint16_t a, uint16_t b, uint16_t c)
+{
+    if (a > b) {
+        const uint16_t t = a;
+        a = b;
+        b = t;
+    }
+    // a <= b: the median is b unless c is below it
+    return c >= b ? b : c >= a ? c : a;
+}
+
+static void median_of_three(uint16_t *data, size_t length, uint16_t threshold, zmpt101b_despike_stats_t *stats)
+{
+    uint16_t previous = data[0];    // unfiltered
+    for (size_t i = 1; i + 1 < length; ++i) {
+        const uint16_t current = data[i];
+        data[i] = median3(previous, current, data[i + 1]);
+        report(stats, threshold, i, current, data[i]);
+        previous = current;
+    }
+}
+
+static void slew(uint16_t *data, size_t length, uint16_t threshold, zmpt101b_despike_stats_t *stats)
+{
+    int32_t y1 = data[0];
+    int32_t slope_q4 = 0;           // running mean of the change per sample, 1/16 sample units
+    uint32_t deviation_q4 = 0;      // running mean of the prediction error, 1/16 sample units
+    uint32_t run = 0;
+    for (size_t i = 1; i < length; ++i) {
+        const int32_t x = data[i];
+        // Last filtered sample moved on by the averaged slope; the slope of two noisy samples
+        // alone would throw a burst far off on a steep edge
+        const int32_t prediction = y1 + ((slope_q4 + 8) >> 4);
+        const uint32_t error = (uint32_t)(x > prediction ? x - prediction : prediction - x);
+        uint32_t limit = (ZMPT101B_DESPIKE_SLEW_K * deviation_q4) >> 4;
+        if (limit < threshold)
+            limit = threshold;
+
+        int32_t y = x;
+        if (error > limit && run < ZMPT101B_DESPIKE_SLEW_MAX_RUN) {
+            y = prediction < 0 ? 0 : prediction > UINT16_MAX ? UINT16_MAX : prediction;
+            run++;
+            report(stats, threshold, i, x, y);
+        } else {
+            // Too long for a spike: the excursion is a real step, follow the signal from here
+            if (error > limit)
+                slope_q4 = 0;
+            else
+                slope_q4 += (((x - y1) * 16) - slope_q4) >> ZMPT101B_DESPIKE_SLEW_SLOPE_SHIFT;
+            run = 0;
+        }
+        // Errors count up to the limit only, so a spike doesn't raise its own threshold
+        deviation_q4 += (int32_t)(((error < limit ? error : limit) << 4) - deviation_q4) >> ZMPT101B_DESPIKE_SLEW_SHIFT;
+        data[i] = (uint16_t)y;
+        y1 = y;
+    }
+}
+
+// public API implementation
+esp_err_t zmpt101b_despike(const zmpt101b_despike_config_t *config, uint16_t *data, size_t len,
+                           uint16_t *min_value, uint16_t *max_value, zmpt101b_despike_stats_t *stats)
+{
+    if (len == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(stats, 0, sizeof(*stats));
+    switch (config->mode) {
+    case ZMPT101B_DESPIKE_MEDIAN: {
+        // Ensure window size is odd for a proper median calculation
+        const size_t window_size = config->median_window | 1;
+        if (window_size > len || window_size > ZMPT101B_DESPIKE_MAX_WINDOW) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        median(data, len, window_size, config->threshold, stats);
+        break;
+    }
+    case ZMPT101B_DESPIKE_MEDIAN3:
+        median_of_three(data, len, config->threshold, stats);
+        break;
+    case ZMPT101B_DESPIKE_SLEW:
+        slew(data, len, config->threshold, stats);
+        break;
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Detect peaks
+    uint16_t lowest = data[0];
+    uint16_t highest = data[0];
+    for (size_t i = 1; i < len; ++i) {
+        if (data[i] > highest)
+            highest = data[i];
+        if (data[i] < lowest)
+            lowest = data[i];
+    }
+    *min_value = lowest;
+    *max_value = highest;
+    return ESP_OK;
+}
@@ -0,0 +1,83 @@
+/*
+ * ZMPT101B Spike Rejection
+ *
+ * Filters that take impulses and ripple out of a measurement window before it is measured,
+ * in place, and return the window's extremes after filtering:
+ * - ZMPT101B_DESPIKE_MEDIAN: the running median over `median_window` samples the component
+ *   has always used. It removes bursts of up to half the window, at O(N * W^2).
+ * - ZMPT101B_DESPIKE_MEDIAN3: median of three, O(N). It removes single-sample spikes only.
+ * - ZMPT101B_DESPIKE_SLEW: a slew-rate test, O(N). Every sample is predicted from the one before
+ *   it and the running mean slope. A sample further from the prediction than
+ *   ZMPT101B_DESPIKE_SLEW_K times the running mean deviation (a MAD-like noise estimate), and at
+ *   least `threshold`, is replaced by the prediction. Bursts of up to
+ *   ZMPT101B_DESPIKE_SLEW_MAX_RUN samples are removed; a longer excursion is a real step and the
+ *   filter follows it.
+ * Every method reports the samples it moved by more than `threshold`, with the positions of
+ * the first ones; the median leaves out the shortened windows at the edges. Being recursive,
+ * the median also drags the samples before a spike on a steep slope along with it, by up to a
+ * few times the slope per sample. Nothing is allocated and there are no hardware dependencies;
+ * tools/zmpt101b_despike_bench.py compares quality and speed of the three on the host.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Longest median window
+#define ZMPT101B_DESPIKE_MAX_WINDOW 31
+
+// Spike threshold of ZMPT101B_DESPIKE_SLEW in running mean deviations of the prediction error
+#define ZMPT101B_DESPIKE_SLEW_K 8
+
+// Time constant of the running mean deviation, as a power of two in samples
+#define ZMPT101B_DESPIKE_SLEW_SHIFT 5
+
+// Time constant of the slope ZMPT101B_DESPIKE_SLEW predicts with, as a power of two in samples
+#define ZMPT101B_DESPIKE_SLEW_SLOPE_SHIFT 3
+
+// Longest burst ZMPT101B_DESPIKE_SLEW replaces, in samples
+#define ZMPT101B_DESPIKE_SLEW_MAX_RUN 3
+
+// Positions of rejected samples kept per window
+#define ZMPT101B_DESPIKE_LOG 4
+
+typedef enum {
+    ZMPT101B_DESPIKE_MEDIAN = 0,
+    ZMPT101B_DESPIKE_MEDIAN3,
+    ZMPT101B_DESPIKE_SLEW,
+} zmpt101b_despike_mode_t;
+
+typedef struct {
+    zmpt101b_despike_mode_t mode;
+    uint8_t  median_window;     // ZMPT101B_DESPIKE_MEDIAN only, made odd, up to ZMPT101B_DESPIKE_MAX_WINDOW
+    uint16_t threshold;         // smallest change reported as a rejected spike, sample units
+} zmpt101b_despike_config_t;
+
+typedef struct {
+    uint32_t rejected;          // samples moved by more than the threshold
+    uint16_t largest;           // largest of those moves, sample units
+    uint8_t  logged;            // valid entries of index
+    uint16_t index[ZMPT101B_DESPIKE_LOG];  // positions of the first rejected samples in the window
+} zmpt101b_despike_stats_t;
+
+/**
+ * @brief Filters a window in place and returns its extremes after filtering.
+ *
+ * @param config Method and thresholds.
+ * @param data Samples, e.g. ADC codes.
+ * @param len Number of samples.
+ * @param min_value Receives the smallest filtered sample.
+ * @param max_value Receives the largest filtered sample.
+ * @param stats Receives what was rejected.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_ARG for an empty window, an unknown method or a
+ *         median window longer than the data or ZMPT101B_DESPIKE_MAX_WINDOW.
+ */
+esp_err_t zmpt101b_despike(const zmpt101b_despike_config_t *config, uint16_t *data, size_t len,
+                           uint16_t *min_value, uint16_t *max_value, zmpt101b_despike_stats_t *stats);
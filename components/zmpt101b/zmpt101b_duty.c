@@ -0,0 +1,266 @@
+#include <string.h>
+#include "zmpt101b_duty.h"
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "zmpt101b_zerocross.h"
+#endif
+
+// Internal functions
+static uint32_t elapsed_us(int64_t from_us, int64_t to_us)
+{
+    return to_us > from_us ? (uint32_t)(to_us - from_us) : 0;
+}
+
+// Period of the whole number of cycles between the crossings of two windows. The cycle count is
+// only unambiguous while the current estimate predicts the crossing within a quarter cycle.
+static bool refine_period(zmpt101b_duty_t *duty, int64_t start_us)
+{
+    const int64_t span_ns = (start_us - duty->crossing_us) * 1000;
+    const int64_t cycles = (span_ns + duty->period_ns / 2) / duty->period_ns;
+    if (cycles <= 0)
+        return false;
+    int64_t residual_ns = span_ns - cycles * duty->period_ns;
+    if (residual_ns < 0)
+        residual_ns = -residual_ns;
+    if (residual_ns * 4 >= duty->period_ns)
+        return false;
+    duty->period_ns = (uint32_t)(span_ns / cycles);
+    return true;
+}
+
+// public API implementation
+esp_err_t zmpt101b_duty_init(zmpt101b_duty_t *duty, const zmpt101b_duty_config_t *config, int64_t now_us)
+{
+    if (duty == NULL || config == NULL || config->interval_us == 0 ||
+        (config->nominal_freq != 50 && config->nominal_freq != 60)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(duty, 0, sizeof(*duty));
+    duty->cfg = *config;
+    if (duty->cfg.active_uw == 0)
+        duty->cfg.active_uw = ZMPT101B_DUTY_ACTIVE_UW;
+    if (duty->cfg.sleep_uw == 0)
+        duty->cfg.sleep_uw = ZMPT101B_DUTY_SLEEP_UW;
+    duty->slot_us = now_us;
+    return ESP_OK;
+}
+
+void zmpt101b_duty_plan(zmpt101b_duty_t *duty, int64_t now_us, zmpt101b_duty_plan_t *plan)
+{
+    // Slots that already began while the previous window ran are given up; a slot that is merely
+    // closer than the resume time is still taken, slightly late
+    while (duty->slot_us < now_us && duty->stats.windows > 0) {
+        duty->slot_us += duty->cfg.interval_us;
+        duty->stats.missed_slots++;
+    }
+
+    int64_t target_us = duty->slot_us;
+    int64_t ready_us = duty->slot_us;
+    plan->predicted = false;
+    if (duty->crossing_us != 0 && duty->period_ns != 0) {
+        // The phase uncertainty grows with the time since the reference crossing
+        const int64_t span_us = duty->slot_us - duty->crossing_us;
+        const int64_t margin_us = span_us * ZMPT101B_DUTY_FREQ_TOLERANCE_PPM / 1000000 + ZMPT101B_DUTY_GUARD_US;
+        if (margin_us * 2000 < duty->period_ns) {
+            // First crossing at or after the slot
+            const int64_t cycles = (span_us * 1000 + duty->period_ns - 1) / duty->period_ns;
+            target_us = duty->crossing_us + cycles * duty->period_ns / 1000;
+            ready_us = target_us - margin_us;
+            plan->predicted = true;
+        }
+    }
+
+    int64_t wake_us = ready_us - duty->resume_allow_us;
+    if (wake_us < now_us)
+        wake_us = now_us;
+    const uint32_t sleep_us = elapsed_us(now_us, wake_us);
+
+    plan->wake_us = wake_us;
+    plan->target_us = target_us;
+    plan->earliest_us = ready_us;
+    plan->sleep_us = sleep_us >= duty->cfg.min_sleep_us ? sleep_us : 0;
+    plan->measure_period = !duty->period_locked;
+    duty->target_us = plan->predicted ? target_us : 0;
+    duty->ready_by_us = ready_us;
+}
+
+void zmpt101b_duty_window_done(zmpt101b_duty_t *duty, const zmpt101b_duty_result_t *result)
+{
+    zmpt101b_duty_stats_t *stats = &duty->stats;
+
+    // Fast attack, slow decay: one slow resume widens the allowance at once
+    const uint32_t resume_us = elapsed_us(result->wake_us, result->ready_us);
+    if (resume_us > duty->resume_allow_us)
+        duty->resume_allow_us = resume_us;
+    else
+        duty->resume_allow_us -= (duty->resume_allow_us - resume_us) / 64;
+    stats->resume_us = resume_us;
+    if (resume_us > stats->resume_max_us)
+        stats->resume_max_us = resume_us;
+    if (result->ready_us > duty->ready_by_us)
+        stats->late_resumes++;
+
+    if (result->start_us != 0) {
+        stats->align_wait_us = elapsed_us(result->ready_us, result->start_us);
+        if (stats->align_wait_us > stats->align_wait_max_us)
+            stats->align_wait_max_us = stats->align_wait_us;
+        // A window measuring the period starts one cycle after the predicted crossing
+        const int64_t expected_us = duty->target_us + result->period_ns / 1000;
+        stats->prediction_error_us = duty->target_us != 0 ? (int32_t)(result->start_us - expected_us) : 0;
+
+        // Within ±10 % of nominal, anything else is noise mistaken for a cycle
+        const uint32_t nominal_ns = 1000000000u / duty->cfg.nominal_freq;
+        if (!duty->period_locked && result->period_ns > nominal_ns - nominal_ns / 10 &&
+            result->period_ns < nominal_ns + nominal_ns / 10) {
+            duty->period_ns = result->period_ns;
+        }
+        if (duty->crossing_us != 0 && duty->period_ns != 0)
+            duty->period_locked = refine_period(duty, result->start_us);
+        duty->crossing_us = result->start_us;
+    } else {
+        // The prediction keeps running from the last crossing seen
+        stats->unaligned++;
+        stats->align_wait_us = 0;
+        stats->prediction_error_us = 0;
+    }
+
+    // Energy model: light sleep at sleep_uw, everything else since the previous window at active_uw
+    const uint32_t cycle_us = duty->last_end_us != 0 ? elapsed_us(duty->last_end_us, result->end_us)
+                                                     : elapsed_us(result->wake_us, result->end_us);
+    const uint32_t sleep_us = result->sleep_us < cycle_us ? result->sleep_us : cycle_us;
+    const uint32_t active_us = cycle_us - sleep_us;
+    stats->active_us += active_us;
+    stats->sleep_us += sleep_us;
+    stats->energy_uj = (uint32_t)(((uint64_t)active_us * duty->cfg.active_uw +
+                                   (uint64_t)sleep_us * duty->cfg.sleep_uw) / 1000000);
+    stats->windows++;
+    stats->energy_avg_uj = (uint32_t)((stats->active_us * duty->cfg.active_uw +
+                                       stats->sleep_us * duty->cfg.sleep_uw) / 1000000 / stats->windows);
+
+    duty->last_end_us = result->end_us;
+    duty->slot_us += duty->cfg.interval_us;
+}
+
+void zmpt101b_duty_get_stats(const zmpt101b_duty_t *duty, zmpt101b_duty_stats_t *stats)
+{
+    *stats = duty->stats;
+}
+
+#ifdef ESP_PLATFORM
+// Time of a sample position (Q16) counted from when sampling resumed
+static int64_t sample_time_us(int64_t ready_us, uint64_t position_q16)
+{
+    return ready_us + (int64_t)((position_q16 * 1000000 / SAMPLING_FREQ) >> 16);
+}
+
+// Reads the stream until the rising crossing that starts the window, one cycle more if the plan
+// asks for the period. The DC bias is learned over one cycle on the first call.
+static esp_err_t wait_rising_crossing(zmpt101b_duty_t *duty, adc_channel_t adc_channel, const zmpt101b_duty_plan_t *plan,
+                                      zmpt101b_duty_result_t *result)
+{
+    int16_t chunk[ZMPT101B_DUTY_ALIGN_CHUNK];
+    const uint32_t cycle_samples = SAMPLING_FREQ / duty->cfg.nominal_freq;
+    uint32_t consumed = 0;
+    size_t count = 0;
+    esp_err_t err = ESP_OK;
+
+    if (!duty->dc_valid) {
+        int64_t sum = 0;
+        while (consumed < cycle_samples) {
+            err = zmpt101b_read_samples(adc_channel, chunk, ZMPT101B_DUTY_ALIGN_CHUNK, &count, NULL);
+            if (err != ESP_OK)
+                return err;
+            for (size_t i = 0; i < count; ++i)
+                sum += chunk[i];
+            consumed += count;
+        }
+        duty->dc_q8 = (int32_t)(sum * 256 / consumed);
+        duty->dc_valid = true;
+    }
+
+    // Detector positions count from here
+    const uint32_t offset = consumed;
+    zmpt101b_zc_t zc;
+    zmpt101b_zc_init(&zc, ZMPT101B_DUTY_ZC_HYSTERESIS_MV);
+    zc.dc_q8 = duty->dc_q8;
+    zc.primed = true;
+
+    // Gives up after three cycles, e.g. during an interruption
+    const uint32_t rising_needed = plan->measure_period ? 2 : 1;
+    const uint32_t limit = consumed + (3 + rising_needed) * cycle_samples;
+    uint32_t rising_taken = 0;
+    bool first = true;
+    while (rising_taken < rising_needed && consumed < limit) {
+        err = zmpt101b_read_samples(adc_channel, chunk, ZMPT101B_DUTY_ALIGN_CHUNK, &count, NULL);
+        if (err != ESP_OK)
+            return err;
+        for (size_t i = 0; i < count && rising_taken < rising_needed; ++i) {
+            const zmpt101b_zc_event_t event = zmpt101b_zc_update(&zc, chunk[i]);
+            // The half-wave the window resumes in is taken as it is, so it can't fake a crossing
+            if (first) {
+                zc.positive = zc.ac > 0;
+                first = false;
+            }
+            // Resuming early for an unpredictable slot mustn't start the window before it
+            if (event == ZMPT101B_ZC_RISING &&
+                (rising_taken > 0 || sample_time_us(result->ready_us, ((uint64_t)offset << 16) + zc.rising_q16) >= plan->earliest_us))
+                rising_taken++;
+        }
+        consumed += count;
+    }
+    duty->dc_q8 = zc.dc_q8;
+
+    if (rising_taken == rising_needed) {
+        result->start_us = sample_time_us(result->ready_us, ((uint64_t)offset << 16) + zc.rising_q16);
+        if (plan->measure_period)
+            result->period_ns = (uint32_t)(((uint64_t)zc.period_q16 * 1000000000 / SAMPLING_FREQ) >> 16);
+    }
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_duty_measure(zmpt101b_duty_t *duty, adc_channel_t adc_channel, uint16_t *rmsVoltage)
+{
+    zmpt101b_duty_plan_t plan;
+    zmpt101b_duty_result_t result = { 0 };
+    zmpt101b_duty_plan(duty, esp_timer_get_time(), &plan);
+
+    if (plan.sleep_us > 0) {
+        const int64_t sleep_start_us = esp_timer_get_time();
+        esp_sleep_enable_timer_wakeup(plan.sleep_us);
+        const esp_err_t err = esp_light_sleep_start();
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG_ZMPT101B, "Light sleep rejected (%s), waiting awake", esp_err_to_name(err));
+        } else {
+            result.sleep_us = elapsed_us(sleep_start_us, esp_timer_get_time());
+        }
+    }
+    // Short waits, early wake-ups and rejected sleeps: ticks while they're long, then spin
+    int64_t now_us = esp_timer_get_time();
+    while (now_us < plan.wake_us) {
+        if (plan.wake_us - now_us > 2000 * portTICK_PERIOD_MS)
+            vTaskDelay(1);
+        now_us = esp_timer_get_time();
+    }
+
+    result.wake_us = now_us;
+    esp_err_t err = zmpt101b_resume(adc_channel);
+    if (err != ESP_OK)
+        return err;
+    result.ready_us = esp_timer_get_time();
+
+    err = wait_rising_crossing(duty, adc_channel, &plan, &result);
+    if (err == ESP_OK)
+        err = zmpt101b_read_voltage(adc_channel, rmsVoltage);
+    const esp_err_t suspend_err = zmpt101b_suspend(adc_channel);
+    if (err == ESP_OK)
+        err = suspend_err;
+    result.end_us = esp_timer_get_time();
+
+    zmpt101b_duty_window_done(duty, &result);
+    return err;
+}
+#endif
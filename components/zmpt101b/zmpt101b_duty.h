@@ -0,0 +1,162 @@
+/*
+ * ZMPT101B Duty-Cycled Measurement
+ *
+ * Low-power mode for battery-backed monitors: between measurement windows the ADC and I2S DMA
+ * are powered down (zmpt101b_suspend()) and the CPU sits in light sleep until a timer wakes it
+ * for the next window.
+ * - Windows start on a rising zero crossing of the mains. The scheduler predicts that crossing
+ *   from the crossing seen in the previous window and the mains period, which it refines from
+ *   the whole number of cycles between consecutive windows. The wake-up is placed so sampling
+ *   is running a safety margin before the predicted crossing; the margin grows with the sleep
+ *   length (ZMPT101B_DUTY_FREQ_TOLERANCE_PPM). When the margin would exceed half a cycle the
+ *   prediction is worthless and the window simply starts on the first crossing after its slot.
+ * - Crossing times are derived from the sample count since sampling resumed, not from when the
+ *   samples were read: reads return whole DMA blocks, long after the samples were taken.
+ * - The time zmpt101b_resume() takes is measured on every wake-up and allowed for, tracking
+ *   the slowest recent resume.
+ * - Energy per measurement is estimated from the awake and sleep times with a configurable
+ *   power model; it's an estimate, not a measurement.
+ * The scheduler (zmpt101b_duty_plan(), zmpt101b_duty_window_done()) has no hardware
+ * dependencies, tools/zmpt101b_duty_sim.py runs it against a simulated mains on the host.
+ * zmpt101b_duty_measure() drives the hardware on the device. Light sleep stops every task,
+ * so network servers etc. only run while the window is measured.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#ifdef ESP_PLATFORM
+#include "zmpt101b.h"
+#endif
+
+// Mains frequency change assumed possible while sleeping, in ppm (1000 ppm = 0.05 Hz at 50 Hz)
+#define ZMPT101B_DUTY_FREQ_TOLERANCE_PPM 1000
+
+// Margin for wake-up jitter and crossing timestamp resolution, in microseconds
+#define ZMPT101B_DUTY_GUARD_US 500
+
+// Samples read per step while waiting for the rising zero crossing that starts a window
+#define ZMPT101B_DUTY_ALIGN_CHUNK 8
+
+// Hysteresis of the zero-crossing detector that finds the window start, in millivolts
+#define ZMPT101B_DUTY_ZC_HYSTERESIS_MV 20
+
+// Default power model: ESP32 awake with radio off (~30 mA) and in light sleep (~0.8 mA), at 3.3 V
+#define ZMPT101B_DUTY_ACTIVE_UW 100000
+#define ZMPT101B_DUTY_SLEEP_UW 2600
+
+typedef struct {
+    uint32_t interval_us;       // nominal time between window starts
+    uint16_t nominal_freq;      // 50 or 60 Hz
+    uint32_t min_sleep_us;      // shorter waits are spent awake
+    uint32_t active_uw;         // power while awake, for the energy estimate
+    uint32_t sleep_uw;          // power in light sleep, for the energy estimate
+} zmpt101b_duty_config_t;
+
+typedef struct {
+    int64_t  wake_us;           // when sampling must be resumed
+    int64_t  target_us;         // predicted rising crossing the window starts on (the slot if unpredictable)
+    int64_t  earliest_us;       // crossings before this belong to the previous cycle and are skipped
+    uint32_t sleep_us;          // light sleep from now until wake_us, 0 to stay awake
+    bool     predicted;         // target_us is a predicted crossing
+    bool     measure_period;    // the period isn't locked: the window starts one cycle later to measure it
+} zmpt101b_duty_plan_t;
+
+typedef struct {
+    uint32_t sleep_us;          // time spent in light sleep before the window
+    int64_t  wake_us;           // woke up and started resuming
+    int64_t  ready_us;          // sampling running again
+    int64_t  start_us;          // rising crossing the window started on, 0 if none was found
+    int64_t  end_us;            // window done and sampling suspended
+    uint32_t period_ns;         // mains period measured in the window, 0 if not measured
+} zmpt101b_duty_result_t;
+
+typedef struct {
+    uint32_t windows;
+    uint32_t missed_slots;      // slots given up because the previous window overran them
+    uint32_t unaligned;         // windows without a rising crossing (no mains)
+    uint32_t late_resumes;      // resumes that overran the allowance; the planned crossing may have been missed
+    uint32_t resume_us;         // time the last resume took
+    uint32_t resume_max_us;
+    uint32_t align_wait_us;     // time the last window waited for its crossing after resuming
+    uint32_t align_wait_max_us;
+    int32_t  prediction_error_us; // actual minus predicted crossing of the last window
+    uint32_t energy_uj;         // energy of the last cycle (sleep before it and the window)
+    uint32_t energy_avg_uj;     // mean energy per measurement
+    uint64_t active_us;         // total time awake
+    uint64_t sleep_us;          // total time in light sleep
+} zmpt101b_duty_stats_t;
+
+typedef struct {
+    zmpt101b_duty_config_t cfg;
+    int64_t  slot_us;           // nominal start of the planned window
+    int64_t  target_us;         // crossing predicted for the planned window, 0 if none
+    int64_t  ready_by_us;       // when the planned window needs sampling running
+    int64_t  crossing_us;       // rising crossing the last window started on, 0 until known
+    uint32_t period_ns;         // mains period, 0 until measured
+    bool     period_locked;     // period refined across windows; otherwise windows measure it
+    uint32_t resume_allow_us;   // resume time allowed for
+    int64_t  last_end_us;       // end of the previous window, 0 before the first
+    int32_t  dc_q8;             // sensor DC bias kept across windows for the crossing detector, mV << 8
+    bool     dc_valid;
+    zmpt101b_duty_stats_t stats;
+} zmpt101b_duty_t;
+
+/**
+ * @brief Initializes the scheduler. The first window is due at now_us.
+ *
+ * @param duty Scheduler state.
+ * @param config Configuration; zero power figures select the ZMPT101B_DUTY_*_UW defaults.
+ * @param now_us Current time.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_duty_init(zmpt101b_duty_t *duty, const zmpt101b_duty_config_t *config, int64_t now_us);
+
+/**
+ * @brief Plans the next window: when to wake up and which crossing to start on.
+ *
+ * Slots that can no longer be reached in time are skipped and counted.
+ *
+ * @param duty Scheduler state.
+ * @param now_us Current time.
+ * @param plan Receives the plan.
+ */
+void zmpt101b_duty_plan(zmpt101b_duty_t *duty, int64_t now_us, zmpt101b_duty_plan_t *plan);
+
+/**
+ * @brief Reports how the planned window went; updates the prediction, resume allowance and statistics.
+ *
+ * @param duty Scheduler state.
+ * @param result Timestamps of the window.
+ */
+void zmpt101b_duty_window_done(zmpt101b_duty_t *duty, const zmpt101b_duty_result_t *result);
+
+#ifdef ESP_PLATFORM
+/**
+ * @brief Sleeps until the next window, measures it cycle-aligned and powers sampling down again.
+ *
+ * The sensor must have been initialized; it is left suspended. Wake-up sources other than the
+ * timer (e.g. GPIO) end the sleep early, the window is then still taken on time.
+ *
+ * @param duty Scheduler state.
+ * @param adc_channel ADC channel where the ZMPT101B sensor is connected.
+ * @param rmsVoltage Receives the RMS voltage as zmpt101b_read_voltage() does.
+ * @return esp_err_t ESP_OK or the error of the driver.
+ */
+esp_err_t zmpt101b_duty_measure(zmpt101b_duty_t *duty, adc_channel_t adc_channel, uint16_t *rmsVoltage);
+#endif
+
+/**
+ * @brief Returns the scheduler statistics.
+ *
+ * @param duty Scheduler state.
+ * @param stats Statistics.
+ */
+void zmpt101b_duty_get_stats(const zmpt101b_duty_t *duty, zmpt101b_duty_stats_t *stats);
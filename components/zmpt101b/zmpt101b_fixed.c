@@ -0,0 +1,55 @@
+#include "zmpt101b_fixed.h"
+
+// public API implementation
+uint32_t zmpt101b_isqrt64(uint64_t value)
+{
+    // Digit by digit, two bits of the radicand per bit of the root
+    uint64_t result = 0;
+    uint64_t bit = 1ULL << 62;
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)result;
+}
+
+uint16_t zmpt101b_isqrt32(uint32_t value)
+{
+    uint32_t result = 0;
+    uint32_t bit = 1u << 30;
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0) {
+        if (value >= result + bit) {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        } else {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint16_t)result;
+}
+
+uint32_t zmpt101b_fx_ac_rms_q8(int64_t sum, uint64_t sum_squares, uint32_t count)
+{
+    if (count == 0)
+        return 0;
+    // n * sum(x^2) >= sum(x)^2, so the difference is n^2 times the variance and never negative
+    const uint64_t magnitude = sum < 0 ? (uint64_t)-sum : (uint64_t)sum;
+    const uint64_t variance_n2 = (uint64_t)count * sum_squares - magnitude * magnitude;
+
+    // Scaled by 2^(2 * FRAC_BITS) before the root where it fits, by less for huge sums
+    unsigned shift = 2 * ZMPT101B_FX_RMS_FRAC_BITS;
+    while (shift > 0 && variance_n2 > (UINT64_MAX >> shift))
+        shift -= 2;
+    const uint64_t root = (uint64_t)zmpt101b_isqrt64(variance_n2 << shift) << (ZMPT101B_FX_RMS_FRAC_BITS - shift / 2);
+    return (uint32_t)((root + count / 2) / count);
+}
@@ -0,0 +1,115 @@
+/*
+ * ZMPT101B Fixed-Point Arithmetic
+ *
+ * The numeric layer of the per-sample and per-block paths. The ESP32 emulates double precision
+ * in software, so the measurement chain stays in integers and converts to float or double only
+ * where a value leaves the component:
+ * - Q15 samples and coefficients (int16_t scaled by 2^15) with rounding, saturating multiplies,
+ * - Q31 values with 64-bit products and saturating adds,
+ * - integer square roots and the RMS of a block from its integer sums, with the DC removed
+ *   exactly and the result in 1/256 of the sample unit,
+ * - the peak-to-peak to RMS conversion of zmpt101b_read_voltage().
+ * Everything rounds to nearest unless noted. No hardware dependencies;
+ * tools/zmpt101b_fixed_bench.py checks every function against a float and double reference on
+ * the host, with error bounds, and compares their speed.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef int16_t zmpt101b_q15_t;
+typedef int32_t zmpt101b_q31_t;
+
+// Largest Q15 value, 1 - 2^-15
+#define ZMPT101B_Q15_ONE 32767
+
+// Q15 and Q31 constants from a literal in [-1, 1), for compile-time use only
+#define ZMPT101B_Q15(x) ((zmpt101b_q15_t)((x) * 32768.0 + ((x) < 0 ? -0.5 : 0.5)))
+#define ZMPT101B_Q31(x) ((zmpt101b_q31_t)((x) * 2147483648.0 + ((x) < 0 ? -0.5 : 0.5)))
+
+// 1000 / (2 * sqrt(2)) in Q16: half the peak-to-peak amplitude over sqrt(2), in mains millivolts
+// per sensor millivolt
+#define ZMPT101B_FX_P2P_TO_RMS_Q16 23170475
+
+// Sub-unit bits of zmpt101b_fx_ac_rms_q8()
+#define ZMPT101B_FX_RMS_FRAC_BITS 8
+
+static inline zmpt101b_q15_t zmpt101b_q15_sat(int32_t x)
+{
+    return x > INT16_MAX ? INT16_MAX : x < INT16_MIN ? INT16_MIN : (zmpt101b_q15_t)x;
+}
+
+static inline zmpt101b_q31_t zmpt101b_q31_sat(int64_t x)
+{
+    return x > INT32_MAX ? INT32_MAX : x < INT32_MIN ? INT32_MIN : (zmpt101b_q31_t)x;
+}
+
+// a * b, both Q15; -1 * -1 saturates
+static inline zmpt101b_q15_t zmpt101b_q15_mul(zmpt101b_q15_t a, zmpt101b_q15_t b)
+{
+    return zmpt101b_q15_sat(((int32_t)a * b + (1 << 14)) >> 15);
+}
+
+// x * coeff for an integer x of up to 32 bits and a Q15 coefficient, without saturation
+static inline int32_t zmpt101b_q15_scale(int32_t x, int32_t coeff_q15)
+{
+    return (int32_t)(((int64_t)x * coeff_q15 + (1 << 14)) >> 15);
+}
+
+// a * b, both Q31; -1 * -1 saturates
+static inline zmpt101b_q31_t zmpt101b_q31_mul(zmpt101b_q31_t a, zmpt101b_q31_t b)
+{
+    return zmpt101b_q31_sat(((int64_t)a * b + (1LL << 30)) >> 31);
+}
+
+static inline zmpt101b_q31_t zmpt101b_q31_add_sat(zmpt101b_q31_t a, zmpt101b_q31_t b)
+{
+    return zmpt101b_q31_sat((int64_t)a + b);
+}
+
+// Multiply-accumulate of Q15 samples into a Q30 sum; 64 bits hold 2^33 full-scale products
+static inline int64_t zmpt101b_q15_mac(int64_t acc, zmpt101b_q15_t a, zmpt101b_q15_t b)
+{
+    return acc + (int32_t)a * b;
+}
+
+// RMS in mains millivolts of a sine with the given peak-to-peak amplitude in sensor millivolts
+static inline int32_t zmpt101b_fx_p2p_to_rms_mv(int32_t peak_to_peak_mv)
+{
+    return (int32_t)(((int64_t)peak_to_peak_mv * ZMPT101B_FX_P2P_TO_RMS_Q16 + 32768) >> 16);
+}
+
+/**
+ * @brief Integer square root, rounded down.
+ *
+ * @param value Radicand.
+ * @return uint32_t floor(sqrt(value)).
+ */
+uint32_t zmpt101b_isqrt64(uint64_t value);
+
+/**
+ * @brief Integer square root of a 32-bit value, rounded down.
+ *
+ * @param value Radicand.
+ * @return uint16_t floor(sqrt(value)).
+ */
+uint16_t zmpt101b_isqrt32(uint32_t value);
+
+/**
+ * @brief RMS of a block without its mean, from the sums of the samples and of their squares.
+ *
+ * count * sum_squares - sum^2 is evaluated exactly, so a large DC bias costs no precision. It must
+ * fit 64 bits: count * sum_squares < 2^63, e.g. 2^16 samples of 16 bits.
+ *
+ * @param sum Sum of the samples.
+ * @param sum_squares Sum of their squares.
+ * @param count Number of samples.
+ * @return uint32_t RMS in 1/256 of the sample unit, 0 for an empty block.
+ */
+uint32_t zmpt101b_fx_ac_rms_q8(int64_t sum, uint64_t sum_squares, uint32_t count);
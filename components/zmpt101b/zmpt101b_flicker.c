@@ -0,0 +1,293 @@
+#include <string.h>
+#include <math.h>
+#include "zmpt101b_flicker.h"
+
+#define COEF_SHIFT      30
+#define SIGNAL_SHIFT    24
+
+// Time constant of the DC bias tracker as a power of two, in input samples
+#define DC_SHIFT        13
+// Time constant of the normaliser as a power of two, in processing samples (~1 min),
+// and the faster one used while the filters settle (~2 s, slow enough that its 100 Hz ripple leaves
+// no step in the mean when the slow one takes over)
+#define MEAN_SHIFT      16
+#define MEAN_SETTLE_SHIFT 11
+
+// The normalised signal is limited to 4x the mean square (twice the voltage) to keep the filters in range
+#define RELATIVE_MAX    ( 4ULL << SIGNAL_SHIFT )
+
+// Pinst is saturated at 4096 so the smoothing filter can't overflow
+#define PINST_MAX_Q16   ( 1U << 28 )
+
+// Lamp-eye-brain weighting filter parameters (IEC 61000-4-15, 230 V and 120 V lamps)
+typedef struct {
+    double k, lambda_hz, f1, f2, f3, f4;
+    double cutoff_hz;       // Butterworth low-pass cut-off
+    double reference;       // 8.8 Hz sinusoidal dV/V giving Pinst = 1
+} lamp_t;
+
+static const lamp_t lamp_230v = { 1.74802, 4.05981, 9.15494, 2.27979, 1.22535, 21.9, 35.0, 0.0025 };
+static const lamp_t lamp_120v = { 1.6357, 4.167375, 9.077169, 2.939902, 1.394468, 17.31512, 42.0, 0.00321 };
+
+// Internal functions
+// Bilinear transform of H(s) = (b0 s^2 + b1 s + b2) / (a0 s^2 + a1 s + a2)
+static void biquad_design(zmpt101b_flicker_biquad_t *bq, double b0, double b1, double b2, double a0, double a1, double a2, double fs)
+{
+    const double k = 2.0 * fs;
+    const double k2 = k * k;
+    const double norm = a0 * k2 + a1 * k + a2;
+    const double scale = (double)(1LL << COEF_SHIFT) / norm;
+
+    memset(bq, 0, sizeof(*bq));
+    bq->b0 = llround((b0 * k2 + b1 * k + b2) * scale);
+    bq->b1 = llround(2.0 * (b2 - b0 * k2) * scale);
+    bq->b2 = llround((b0 * k2 - b1 * k + b2) * scale);
+    bq->a1 = llround(2.0 * (a2 - a0 * k2) * scale);
+    bq->a2 = llround((a0 * k2 - a1 * k + a2) * scale);
+}
+
+// Magnitude of the quantised section at `freq` Hz
+static double biquad_gain(const zmpt101b_flicker_biquad_t *bq, double freq, double fs)
+{
+    const double w = 2.0 * M_PI * freq / fs;
+    const double c1 = cos(w), s1 = sin(w), c2 = cos(2.0 * w), s2 = sin(2.0 * w);
+    const double one = (double)(1LL << COEF_SHIFT);
+    const double nr = bq->b0 + bq->b1 * c1 + bq->b2 * c2;
+    const double ni = -(bq->b1 * s1 + bq->b2 * s2);
+    const double dr = one + bq->a1 * c1 + bq->a2 * c2;
+    const double di = -(bq->a1 * s1 + bq->a2 * s2);
+    return sqrt((nr * nr + ni * ni) / (dr * dr + di * di));
+}
+
+static int64_t biquad_run(zmpt101b_flicker_biquad_t *bq, int64_t x)
+{
+    const int64_t acc = bq->b0 * x + bq->b1 * bq->x1 + bq->b2 * bq->x2
+                      - bq->a1 * bq->y1 - bq->a2 * bq->y2 + bq->err;
+    const int64_t y = acc >> COEF_SHIFT;
+    bq->err = acc - y * (1LL << COEF_SHIFT);
+    bq->x2 = bq->x1;
+    bq->x1 = x;
+    bq->y2 = bq->y1;
+    bq->y1 = y;
+    return y;
+}
+
+// First clock tick of a `period_us` grid strictly after `time_us`
+static int64_t next_tick(int64_t time_us, int64_t period_us)
+{
+    int64_t tick = (time_us / period_us) * period_us;
+    if (tick <= time_us)
+        tick += period_us;
+    return tick;
+}
+
+// Histogram class of a Pinst value: class 0 holds values below one LSB, then 16 classes per octave
+static uint32_t pinst_class(uint32_t pinst_q16)
+{
+    if (pinst_q16 == 0)
+        return 0;
+    const uint32_t octave = 31 - __builtin_clz(pinst_q16);
+    const uint32_t step = (uint32_t)((((uint64_t)pinst_q16) << 4) >> octave) & 15;
+    return 1 + octave * 16 + step;
+}
+
+// Lower bound of a class in Q16; the upper bound is the lower bound of the next class
+static double class_lower_q16(uint32_t cls)
+{
+    if (cls == 0)
+        return 0.0;
+    const uint32_t octave = (cls - 1) / 16;
+    const uint32_t step = (cls - 1) % 16;
+    return ldexp(16 + step, (int)octave - 4);
+}
+
+// Pinst level exceeded during `percent` of the interval, interpolated inside its class
+static double percentile(const zmpt101b_flicker_t *fm, double percent)
+{
+    const double target = fm->histogram_count * percent / 100.0;
+    double above = 0.0;
+    for (int cls = ZMPT101B_FLICKER_CLASSES - 1; cls >= 0; --cls) {
+        const uint32_t count = fm->histogram[cls];
+        if (count == 0)
+            continue;
+        if (above + count >= target) {
+            const double lower = class_lower_q16(cls);
+            const double upper = class_lower_q16(cls + 1);
+            const double frac = (target - above) / count;
+            return (upper - frac * (upper - lower)) / 65536.0;
+        }
+        above += count;
+    }
+    return 0.0;
+}
+
+static double pst_from_histogram(const zmpt101b_flicker_t *fm)
+{
+    const double p0_1 = percentile(fm, 0.1);
+    const double p1s = (percentile(fm, 0.7) + percentile(fm, 1.0) + percentile(fm, 1.5)) / 3.0;
+    const double p3s = (percentile(fm, 2.2) + percentile(fm, 3.0) + percentile(fm, 4.0)) / 3.0;
+    const double p10s = (percentile(fm, 6.0) + percentile(fm, 8.0) + percentile(fm, 10.0)
+                       + percentile(fm, 13.0) + percentile(fm, 17.0)) / 5.0;
+    const double p50s = (percentile(fm, 30.0) + percentile(fm, 50.0) + percentile(fm, 80.0)) / 3.0;
+    return sqrt(0.0314 * p0_1 + 0.0525 * p1s + 0.0657 * p3s + 0.28 * p10s + 0.08 * p50s);
+}
+
+// Closes the 10-minute interval ending at `tick_us` and rolls it into the 2-hour interval
+static void close_10min(zmpt101b_flicker_t *fm, int64_t tick_us)
+{
+    if (fm->histogram_count != 0) {
+        zmpt101b_flicker_value_t value = {
+            .pst = (float)pst_from_histogram(fm),
+            .partial = !fm->interval_full,
+            .timestamp_us = tick_us,
+        };
+
+        // After a clock jump the pending 2-hour interval is dropped
+        if (tick_us > fm->next_2hour_us) {
+            fm->pst_cube_sum = 0.0f;
+            fm->pst_count = 0;
+            fm->plt_full = false;
+            fm->next_2hour_us = next_tick(tick_us - 1, ZMPT101B_FLICKER_2_HOUR_US);
+        }
+        fm->pst_cube_sum += value.pst * value.pst * value.pst;
+        fm->pst_count++;
+        fm->plt_full &= !value.partial;
+        if (tick_us == fm->next_2hour_us) {
+            value.plt = cbrtf(fm->pst_cube_sum / fm->pst_count);
+            value.plt_valid = true;
+            value.plt_partial = !fm->plt_full || fm->pst_count < 12;
+            fm->pst_cube_sum = 0.0f;
+            fm->pst_count = 0;
+            fm->plt_full = true;
+            fm->next_2hour_us += ZMPT101B_FLICKER_2_HOUR_US;
+        }
+
+        if (fm->cfg.callback != NULL)
+            fm->cfg.callback(&value, fm->cfg.ctx);
+    }
+    memset(fm->histogram, 0, sizeof(fm->histogram));
+    fm->histogram_count = 0;
+    fm->interval_full = fm->settle_samples == 0;
+}
+
+// Runs blocks 1-5 on one box-car sum of squared samples
+static void process_square(zmpt101b_flicker_t *fm, uint64_t square_sum, int64_t time_us)
+{
+    // Block 1/2: normalisation of the demodulated signal to its slow mean, Q24
+    const int64_t square_q8 = (int64_t)(square_sum << 8);
+    if (fm->mean_q8 == 0)
+        fm->mean_q8 = square_q8;
+    fm->mean_q8 += (square_q8 - fm->mean_q8) >> (fm->settle_samples != 0 ? MEAN_SETTLE_SHIFT : MEAN_SHIFT);
+    const int64_t mean_q8 = fm->mean_q8 > 0 ? fm->mean_q8 : 1;
+    uint64_t ratio = (square_sum << 32) / (uint64_t)mean_q8;
+    if (ratio > RELATIVE_MAX)
+        ratio = RELATIVE_MAX;
+    const int64_t relative = (int64_t)ratio;
+
+    // Block 3: 0.05 Hz high-pass as the difference to a first-order low-pass kept at Q36
+    if (fm->hp_lp_q36 == 0)
+        fm->hp_lp_q36 = relative * 4096;
+    fm->hp_lp_q36 += ((relative * 4096 - fm->hp_lp_q36) * fm->hp_alpha_q32) >> 32;
+    int64_t y = relative - ((fm->hp_lp_q36 + 2048) >> 12);
+    for (size_t i = 0; i < sizeof(fm->stages) / sizeof(fm->stages[0]); ++i)
+        y = biquad_run(&fm->stages[i], y);
+
+    // Block 4: squaring and 300 ms smoothing
+    const int64_t scaled = (y * fm->gain_q16) >> 16;
+    uint32_t pinst_q16 = PINST_MAX_Q16;
+    if (scaled > -(1LL << 30) && scaled < (1LL << 30))
+        pinst_q16 = (uint32_t)(((uint64_t)(scaled * scaled)) >> 32);
+    fm->smooth_q32 += ((((int64_t)pinst_q16) << 16) - fm->smooth_q32) * fm->smooth_alpha_q20 >> 20;
+    fm->pinst_q16 = (uint32_t)(fm->smooth_q32 >> 16);
+
+    // Block 5: classification over clock-aligned intervals
+    if (fm->next_10min_us == 0) {
+        fm->next_10min_us = next_tick(time_us, ZMPT101B_FLICKER_10_MIN_US);
+        fm->next_2hour_us = next_tick(time_us, ZMPT101B_FLICKER_2_HOUR_US);
+    } else if (time_us >= fm->next_10min_us) {
+        close_10min(fm, fm->next_10min_us);
+        fm->next_10min_us = next_tick(time_us, ZMPT101B_FLICKER_10_MIN_US);
+    }
+
+    if (fm->settle_samples != 0) {
+        fm->settle_samples--;
+        return;
+    }
+    fm->histogram[pinst_class(fm->pinst_q16)]++;
+    fm->histogram_count++;
+}
+
+// public API implementation
+esp_err_t zmpt101b_flicker_init(zmpt101b_flicker_t *fm, const zmpt101b_flicker_config_t *config)
+{
+    if (fm == NULL || config == NULL || config->sample_rate < ZMPT101B_FLICKER_RATE
+        || config->sample_rate % ZMPT101B_FLICKER_RATE != 0
+        || config->sample_rate / ZMPT101B_FLICKER_RATE > 0xFFFF
+        || (config->nominal_freq != 50 && config->nominal_freq != 60)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(fm, 0, sizeof(*fm));
+    fm->cfg = *config;
+    fm->decimation = (uint16_t)(config->sample_rate / ZMPT101B_FLICKER_RATE);
+    fm->settle_samples = (uint32_t)((uint64_t)ZMPT101B_FLICKER_SETTLE_MS * ZMPT101B_FLICKER_RATE / 1000);
+    fm->plt_full = true;
+
+    const lamp_t *lamp = config->nominal_freq == 50 ? &lamp_230v : &lamp_120v;
+    const double fs = ZMPT101B_FLICKER_RATE;
+
+    fm->hp_alpha_q32 = llround((1.0 - exp(-2.0 * M_PI * 0.05 / fs)) * 4294967296.0);
+    fm->smooth_alpha_q20 = llround((1.0 - exp(-1.0 / (0.3 * fs))) * 1048576.0);
+
+    // 6th order Butterworth low-pass as three sections, cut-off pre-warped
+    const double wc = 2.0 * fs * tan(M_PI * lamp->cutoff_hz / fs);
+    for (int i = 0; i < 3; ++i) {
+        const double q = 1.0 / (2.0 * cos(M_PI * (2 * i + 1) / 12.0));
+        biquad_design(&fm->stages[i], 0.0, 0.0, wc * wc, 1.0, wc / q, wc * wc, fs);
+    }
+
+    // Weighting filter: k w1 s / (s^2 + 2 lambda s + w1^2) * (1 + s/w2) / ((1 + s/w3) (1 + s/w4))
+    const double w1 = 2.0 * M_PI * lamp->f1;
+    const double w2 = 2.0 * M_PI * lamp->f2;
+    const double w3 = 2.0 * M_PI * lamp->f3;
+    const double w4 = 2.0 * M_PI * lamp->f4;
+    biquad_design(&fm->stages[3], 0.0, lamp->k * w1, 0.0, 1.0, 2.0 * 2.0 * M_PI * lamp->lambda_hz, w1 * w1, fs);
+    biquad_design(&fm->stages[4], 0.0, 1.0 / w2, 1.0, 1.0 / (w3 * w4), 1.0 / w3 + 1.0 / w4, 1.0, fs);
+
+    // Scaling: the reference modulation must peak at Pinst = 1. The squared 8.8 Hz fluctuation has a
+    // mean of (dV/V)^2 / 2 and a 17.6 Hz ripple the 300 ms smoothing leaves partly in.
+    double chain = 1.0;
+    for (size_t i = 0; i < sizeof(fm->stages) / sizeof(fm->stages[0]); ++i)
+        chain *= biquad_gain(&fm->stages[i], 8.8, fs);
+    const double alpha = fm->smooth_alpha_q20 / 1048576.0;
+    const double w = 2.0 * M_PI * 17.6 / fs;
+    const double ripple = alpha / sqrt(1.0 - 2.0 * (1.0 - alpha) * cos(w) + (1.0 - alpha) * (1.0 - alpha));
+    const double fluctuation = lamp->reference * chain;
+    fm->gain_q16 = llround(sqrt(2.0 / (fluctuation * fluctuation * (1.0 + ripple))) * 65536.0);
+    return ESP_OK;
+}
+
+void zmpt101b_flicker_process(zmpt101b_flicker_t *fm, const int16_t *samples, size_t length, int64_t start_us)
+{
+    for (size_t i = 0; i < length; ++i) {
+        const int32_t sample = samples[i];
+        if (!fm->primed) {
+            fm->dc_q8 = sample * 256;
+            fm->primed = true;
+        }
+        fm->dc_q8 += (sample * 256 - fm->dc_q8 + (1 << (DC_SHIFT - 1))) >> DC_SHIFT;
+
+        const int32_t ac = sample - (fm->dc_q8 >> 8);
+        fm->square_sum += (uint64_t)((int64_t)ac * ac);
+        if (++fm->square_count == fm->decimation) {
+            process_square(fm, fm->square_sum, start_us + (int64_t)i * 1000000 / fm->cfg.sample_rate);
+            fm->square_sum = 0;
+            fm->square_count = 0;
+        }
+    }
+}
+
+float zmpt101b_flicker_pinst(const zmpt101b_flicker_t *fm)
+{
+    return fm->pinst_q16 / 65536.0f;
+}
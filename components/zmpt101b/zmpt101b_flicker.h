@@ -0,0 +1,127 @@
+/*
+ * ZMPT101B Flickermeter
+ *
+ * IEC 61000-4-15 flickermeter running on the continuous sample stream (zmpt101b_read_samples()):
+ * - Block 1/2: DC removal, squaring demodulator, normalisation to the mean squared voltage,
+ * - Block 3:   0.05 Hz high-pass, 6th order Butterworth low-pass (35 Hz at 50 Hz, 42 Hz at 60 Hz)
+ *              and the lamp-eye-brain weighting filter (230 V lamp at 50 Hz, 120 V lamp at 60 Hz),
+ * - Block 4:   squaring and 300 ms smoothing, giving the instantaneous flicker sensation Pinst,
+ * - Block 5:   statistical classifier over clock-aligned 10-minute intervals giving Pst,
+ *              and Plt from the Pst values of each clock-aligned 2-hour interval.
+ *
+ * The squared signal is box-car decimated to a 1 kHz processing rate right after demodulation.
+ * The filter chain runs in fixed point (Q24 signal, Q30 coefficients, 64-bit accumulators with
+ * fraction saving); coefficients are derived with the bilinear transform once at init.
+ * The classifier is a 512-class logarithmic histogram (16 classes per octave), so memory doesn't
+ * grow with the interval length. Only the Pst/Plt evaluation every 10 minutes uses floating point.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Processing rate of the filter chain after demodulation. The input sample rate must be a multiple of it.
+#define ZMPT101B_FLICKER_RATE 1000
+
+// Number of classes of the Pinst histogram
+#define ZMPT101B_FLICKER_CLASSES 512
+
+// Time the filters need to settle after start; Pinst isn't classified before
+#define ZMPT101B_FLICKER_SETTLE_MS 20000
+
+#define ZMPT101B_FLICKER_10_MIN_US  ( 600LL * 1000000 )
+#define ZMPT101B_FLICKER_2_HOUR_US  ( 7200LL * 1000000 )
+
+typedef struct {
+    float    pst;           // short-term severity of the 10-minute interval
+    float    plt;           // long-term severity, valid when plt_valid is set
+    bool     plt_valid;     // this value also closes a 2-hour interval
+    bool     partial;       // the 10-minute interval was not observed for its full length
+    bool     plt_partial;   // Plt is based on fewer than 12 complete Pst values
+    int64_t  timestamp_us;  // end of the interval
+} zmpt101b_flicker_value_t;
+
+typedef void (*zmpt101b_flicker_callback_t)(const zmpt101b_flicker_value_t *value, void *ctx);
+
+typedef struct {
+    uint32_t sample_rate;   // Hz, multiple of ZMPT101B_FLICKER_RATE
+    uint16_t nominal_freq;  // 50 (230 V lamp) or 60 (120 V lamp)
+    zmpt101b_flicker_callback_t callback;
+    void *ctx;
+} zmpt101b_flicker_config_t;
+
+// Fixed-point biquad, Direct Form I with fraction saving
+typedef struct {
+    int64_t b0, b1, b2, a1, a2;     // Q30
+    int64_t x1, x2, y1, y2;         // Q24
+    int64_t err;                    // truncated fraction carried to the next sample
+} zmpt101b_flicker_biquad_t;
+
+typedef struct {
+    zmpt101b_flicker_config_t cfg;
+    uint16_t decimation;            // input samples per processing sample
+
+    // Block 1/2
+    int32_t  dc_q8;                 // DC bias of the input
+    bool     primed;
+    uint64_t square_sum;            // box-car sum of squared AC samples
+    uint16_t square_count;
+    int64_t  mean_q8;               // slow mean of the box-car sums, normaliser
+
+    // Block 3
+    int64_t  hp_lp_q36;             // low-pass state of the 0.05 Hz high-pass
+    int64_t  hp_alpha_q32;
+    zmpt101b_flicker_biquad_t stages[5];   // 3 Butterworth sections + 2 weighting sections
+    int64_t  gain_q16;              // sensation scaling, sqrt of the Pinst gain
+
+    // Block 4
+    int64_t  smooth_q32;            // 300 ms low-pass state
+    int64_t  smooth_alpha_q20;
+    uint32_t pinst_q16;             // instantaneous flicker sensation, Q16
+
+    // Block 5
+    uint32_t histogram[ZMPT101B_FLICKER_CLASSES];
+    uint32_t histogram_count;
+    uint32_t settle_samples;        // processing samples left before classification starts
+    bool     interval_full;         // classification ran since the start of the current interval
+    int64_t  next_10min_us;
+    int64_t  next_2hour_us;
+    float    pst_cube_sum;          // sum of Pst^3 of the current 2-hour interval
+    uint8_t  pst_count;
+    bool     plt_full;              // every Pst of the current 2-hour interval is complete
+} zmpt101b_flicker_t;
+
+/**
+ * @brief Initializes a flickermeter.
+ *
+ * @param fm Flickermeter state (about 2.5 KB).
+ * @param config Configuration, copied into the state.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_flicker_init(zmpt101b_flicker_t *fm, const zmpt101b_flicker_config_t *config);
+
+/**
+ * @brief Feeds a block of consecutive samples.
+ *
+ * @param fm Flickermeter state.
+ * @param samples Samples in ADC millivolts, DC bias included.
+ * @param length Number of samples.
+ * @param start_us Wall-clock time of the first sample in microseconds.
+ */
+void zmpt101b_flicker_process(zmpt101b_flicker_t *fm, const int16_t *samples, size_t length, int64_t start_us);
+
+/**
+ * @brief Returns the current instantaneous flicker sensation.
+ *
+ * @param fm Flickermeter state.
+ * @return float Pinst, 1.0 being the perceptibility threshold.
+ */
+float zmpt101b_flicker_pinst(const zmpt101b_flicker_t *fm);
@@ -0,0 +1,155 @@
+#include <string.h>
+#include "zmpt101b_gridlock.h"
+
+// Internal functions
+static uint32_t clamp_rate(uint64_t rate_mhz, uint64_t low_mhz, uint64_t high_mhz)
+{
+    if (rate_mhz < low_mhz)
+        return (uint32_t)low_mhz;
+    if (rate_mhz > high_mhz)
+        return (uint32_t)high_mhz;
+    return (uint32_t)rate_mhz;
+}
+
+// Mean cycle length over the update, Q16: least-squares slope through the crossing positions,
+// which weighs every crossing instead of just the first and the last
+static int64_t fit_period_q16(const zmpt101b_gridlock_t *gl)
+{
+    const int64_t points = (int64_t)gl->cycles + 1;
+    const int64_t sum_k = points * (points - 1) / 2;
+    const int64_t sum_kk = points * (points - 1) * (2 * points - 1) / 6;
+    const int64_t denominator = points * sum_kk - sum_k * sum_k;
+    const int64_t numerator = points * gl->sum_kx_q16 - sum_k * gl->sum_x_q16;
+    return (numerator + denominator / 2) / denominator;
+}
+
+static void update(zmpt101b_gridlock_t *gl)
+{
+    zmpt101b_gridlock_status_t *status = &gl->status;
+    const int64_t target_q16 = (int64_t)gl->samples_per_cycle << 16;
+    const int64_t period_q16 = fit_period_q16(gl);
+    const int64_t slip_q16 = (int64_t)gl->cycle_sum_q16 - target_q16 * gl->cycles;
+    const uint32_t rate_mhz = status->rate_mhz;
+
+    status->error_ppb = (int32_t)((period_q16 - target_q16) * 1000000000 / target_q16);
+    status->frequency_mhz = (uint32_t)(((uint64_t)rate_mhz << 16) / (uint64_t)period_q16);
+    status->updates++;
+
+    // Slip only accumulates once the loop is close; while it pulls in, it would just wind up
+    const int64_t error_ppb = status->error_ppb < 0 ? -(int64_t)status->error_ppb : status->error_ppb;
+    if (error_ppb <= (int64_t)ZMPT101B_GRIDLOCK_LOCK_PPM * 10000) {
+        const int64_t limit_q16 = (int64_t)gl->samples_per_cycle << 15;
+        gl->phase_q16 += slip_q16;
+        if (gl->phase_q16 > limit_q16)
+            gl->phase_q16 = limit_q16;
+        else if (gl->phase_q16 < -limit_q16)
+            gl->phase_q16 = -limit_q16;
+    } else {
+        gl->phase_q16 = 0;
+    }
+    status->phase_msamples = (int32_t)(gl->phase_q16 * 1000 / 65536);
+
+    if (error_ppb <= (int64_t)ZMPT101B_GRIDLOCK_LOCK_PPM * 1000) {
+        if (gl->good_updates < ZMPT101B_GRIDLOCK_LOCK_UPDATES)
+            gl->good_updates++;
+        status->locked = gl->good_updates >= ZMPT101B_GRIDLOCK_LOCK_UPDATES;
+    } else {
+        if (status->locked)
+            status->unlocks++;
+        status->locked = false;
+        gl->good_updates = 0;
+    }
+
+    // N times the measured mains frequency. The measurement is half an update old and the new rate
+    // holds for a whole update, so a drifting frequency is extrapolated by its trend
+    const int64_t measured_mhz = (int64_t)rate_mhz * target_q16 / period_q16;
+    if (gl->measured_mhz != 0 && error_ppb <= (int64_t)ZMPT101B_GRIDLOCK_LOCK_PPM * 10000)
+        gl->trend_mhz += (measured_mhz - gl->measured_mhz - gl->trend_mhz) / 2;
+    else
+        gl->trend_mhz = 0;
+    gl->measured_mhz = measured_mhz;
+
+    // Less a share of the slip, spread over the next update
+    int64_t target_mhz = measured_mhz + gl->trend_mhz;
+    target_mhz -= target_mhz * (gl->phase_q16 / (1 << ZMPT101B_GRIDLOCK_PHASE_SHIFT)) / (target_q16 * gl->cycles);
+
+    const uint64_t step_mhz = (uint64_t)rate_mhz * ZMPT101B_GRIDLOCK_MAX_STEP_PPM / 1000000;
+    const uint64_t range_mhz = (uint64_t)gl->nominal_mhz * ZMPT101B_GRIDLOCK_RANGE_PPM / 1000000;
+    uint32_t target = clamp_rate(target_mhz > 0 ? (uint64_t)target_mhz : 0, rate_mhz - step_mhz, rate_mhz + step_mhz);
+    gl->target_mhz = clamp_rate(target, gl->nominal_mhz - range_mhz, gl->nominal_mhz + range_mhz);
+
+    gl->cycle_sum_q16 = 0;
+    gl->sum_x_q16 = 0;
+    gl->sum_kx_q16 = 0;
+    gl->cycles = 0;
+}
+
+// public API implementation
+esp_err_t zmpt101b_gridlock_init(zmpt101b_gridlock_t *gl, uint16_t samples_per_cycle, uint16_t nominal_freq)
+{
+    if (gl == NULL || samples_per_cycle == 0 || nominal_freq == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(gl, 0, sizeof(*gl));
+    gl->samples_per_cycle = samples_per_cycle;
+    gl->nominal_mhz = (uint32_t)samples_per_cycle * nominal_freq * 1000;
+    gl->target_mhz = gl->nominal_mhz;
+    gl->status.rate_mhz = gl->nominal_mhz;
+    return ESP_OK;
+}
+
+bool zmpt101b_gridlock_cycle(zmpt101b_gridlock_t *gl, uint32_t period_q16)
+{
+    const uint32_t target_q16 = (uint32_t)gl->samples_per_cycle << 16;
+    const uint32_t deviation_q16 = period_q16 > target_q16 ? period_q16 - target_q16 : target_q16 - period_q16;
+    if ((uint64_t)deviation_q16 * 100 > (uint64_t)target_q16 * ZMPT101B_GRIDLOCK_REJECT_PCT) {
+        gl->status.rejected++;
+        return false;
+    }
+
+    gl->cycle_sum_q16 += period_q16;
+    gl->cycles++;
+    gl->sum_x_q16 += (int64_t)gl->cycle_sum_q16;
+    gl->sum_kx_q16 += (int64_t)gl->cycle_sum_q16 * gl->cycles;
+    if (gl->cycles < ZMPT101B_GRIDLOCK_UPDATE_CYCLES)
+        return false;
+
+    update(gl);
+    const uint32_t rate_mhz = gl->status.rate_mhz;
+    const uint32_t change_mhz = gl->target_mhz > rate_mhz ? gl->target_mhz - rate_mhz : rate_mhz - gl->target_mhz;
+    if ((uint64_t)change_mhz * 1000000 < (uint64_t)rate_mhz * ZMPT101B_GRIDLOCK_MIN_STEP_PPM)
+        return false;
+    gl->status.retunes++;
+    return true;
+}
+
+void zmpt101b_gridlock_restart(zmpt101b_gridlock_t *gl)
+{
+    gl->cycle_sum_q16 = 0;
+    gl->sum_x_q16 = 0;
+    gl->sum_kx_q16 = 0;
+    gl->cycles = 0;
+    gl->phase_q16 = 0;
+    gl->measured_mhz = 0;
+    gl->trend_mhz = 0;
+}
+
+uint32_t zmpt101b_gridlock_target_mhz(const zmpt101b_gridlock_t *gl)
+{
+    return gl->target_mhz;
+}
+
+void zmpt101b_gridlock_applied(zmpt101b_gridlock_t *gl, uint32_t rate_mhz)
+{
+    gl->status.rate_mhz = rate_mhz;
+    // Cycles collected so far were sampled at the old rate
+    gl->cycle_sum_q16 = 0;
+    gl->sum_x_q16 = 0;
+    gl->sum_kx_q16 = 0;
+    gl->cycles = 0;
+}
+
+void zmpt101b_gridlock_get_status(const zmpt101b_gridlock_t *gl, zmpt101b_gridlock_status_t *status)
+{
+    *status = gl->status;
+}
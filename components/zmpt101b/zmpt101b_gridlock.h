@@ -0,0 +1,139 @@
+/*
+ * ZMPT101B Grid-Locked Sample Clock
+ *
+ * Software PLL that keeps the sample rate at an exact multiple of the mains frequency, so a window
+ * of whole cycles holds an exact number of samples. DFT and Goertzel bins then land on the
+ * harmonics without a window function.
+ * - The input is the length of each mains cycle in samples, measured by the zero-crossing
+ *   detector on the sampled signal. The loop drives it towards ZMPT101B_GRID_SAMPLES_PER_CYCLE.
+ * - Every ZMPT101B_GRIDLOCK_UPDATE_CYCLES cycles a least-squares fit through the crossings gives
+ *   the mean cycle length, which is the mains frequency in units of the current rate. The rate
+ *   is retuned to N times that frequency, extrapolated by its trend over the last updates so a
+ *   drifting grid doesn't leave the loop behind. The sample slip accumulated against N cycles is
+ *   fed back as well, so the long-term average is exactly N even though the hardware sets the
+ *   rate in steps.
+ * - Each retune is limited to ZMPT101B_GRIDLOCK_MAX_STEP_PPM, and the rate stays within
+ *   ZMPT101B_GRIDLOCK_RANGE_PPM of nominal. Cycles much longer or shorter than N are noise or
+ *   missed crossings, and are ignored.
+ * - The loop reports lock once ZMPT101B_GRIDLOCK_LOCK_UPDATES updates in a row were within
+ *   ZMPT101B_GRIDLOCK_LOCK_PPM. It also reports the tracking error of the last update and the
+ *   accumulated phase slip.
+ * While locked, a frequency derived from SAMPLING_FREQ and a cycle length always reads nominal.
+ * The mains frequency is the rate divided by the cycle length, reported in the status.
+ * No hardware dependencies; tools/zmpt101b_gridlock_sim.py runs the loop against frequency ramps
+ * on the host. zmpt101b.c drives the APLL with it when ZMPT101B_GRID_LOCK is enabled.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Cycles averaged per update (25 cycles = 0.5 s at 50 Hz)
+#define ZMPT101B_GRIDLOCK_UPDATE_CYCLES 25
+
+// Share of the accumulated sample slip removed per update, as a power of two (1/4)
+#define ZMPT101B_GRIDLOCK_PHASE_SHIFT 2
+
+// Largest rate change per update, in ppm
+#define ZMPT101B_GRIDLOCK_MAX_STEP_PPM 2000
+
+// Capture range around the nominal rate, in ppm (±10 % = 45..55 Hz at 50 Hz)
+#define ZMPT101B_GRIDLOCK_RANGE_PPM 100000
+
+// Cycles deviating from the target length by more than this are discarded, in percent
+#define ZMPT101B_GRIDLOCK_REJECT_PCT 20
+
+// Lock threshold on the cycle length error of an update, in ppm
+#define ZMPT101B_GRIDLOCK_LOCK_PPM 100
+
+// Updates in a row within the threshold before lock is reported
+#define ZMPT101B_GRIDLOCK_LOCK_UPDATES 3
+
+// Retunes smaller than this are not worth a hardware write, in ppm
+#define ZMPT101B_GRIDLOCK_MIN_STEP_PPM 1
+
+typedef struct {
+    bool     locked;
+    int32_t  error_ppb;         // cycle length against the target over the last update
+    int32_t  phase_msamples;    // accumulated sample slip against the target, in 1/1000 sample
+    uint32_t frequency_mhz;     // mains frequency over the last update, 0 until measured
+    uint32_t rate_mhz;          // sample rate in effect
+    uint32_t updates;
+    uint32_t retunes;           // rate changes requested
+    uint32_t unlocks;           // lock losses
+    uint32_t rejected;          // cycles discarded as implausible
+} zmpt101b_gridlock_status_t;
+
+typedef struct {
+    uint16_t samples_per_cycle; // target N
+    uint32_t nominal_mhz;       // N times the nominal mains frequency
+    uint32_t target_mhz;        // rate the loop asks for
+    int64_t  measured_mhz;      // N times the mains frequency at the last update, 0 before it
+    int64_t  trend_mhz;         // smoothed change of measured_mhz per update
+    uint64_t cycle_sum_q16;     // samples over the cycles collected for the next update, Q16
+    int64_t  sum_x_q16;         // sum of the crossing positions since the update began, Q16
+    int64_t  sum_kx_q16;        // the same weighted by crossing number, for the fit
+    uint16_t cycles;
+    int64_t  phase_q16;         // accumulated sample slip, Q16
+    uint8_t  good_updates;      // updates in a row within the lock threshold
+    zmpt101b_gridlock_status_t status;
+} zmpt101b_gridlock_t;
+
+/**
+ * @brief Initializes the loop at the nominal rate.
+ *
+ * @param gl Loop state.
+ * @param samples_per_cycle Target samples per mains cycle.
+ * @param nominal_freq Nominal mains frequency in Hz.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_gridlock_init(zmpt101b_gridlock_t *gl, uint16_t samples_per_cycle, uint16_t nominal_freq);
+
+/**
+ * @brief Feeds the length of one mains cycle sampled at the rate in effect.
+ *
+ * @param gl Loop state.
+ * @param period_q16 Cycle length in samples, Q16 (zmpt101b_zc_t.period_q16).
+ * @return true If the loop wants a new rate: set it, then report it with zmpt101b_gridlock_applied().
+ */
+bool zmpt101b_gridlock_cycle(zmpt101b_gridlock_t *gl, uint32_t period_q16);
+
+/**
+ * @brief Drops the cycles collected for the next update after a break in the sample stream.
+ *
+ * The rate and the lock status are kept; the slip and the trend start over.
+ *
+ * @param gl Loop state.
+ */
+void zmpt101b_gridlock_restart(zmpt101b_gridlock_t *gl);
+
+/**
+ * @brief Returns the rate the loop asks for.
+ *
+ * @param gl Loop state.
+ * @return uint32_t Sample rate in mHz.
+ */
+uint32_t zmpt101b_gridlock_target_mhz(const zmpt101b_gridlock_t *gl);
+
+/**
+ * @brief Reports the rate the hardware actually set, after rounding to its resolution.
+ *
+ * @param gl Loop state.
+ * @param rate_mhz Sample rate now in effect, in mHz.
+ */
+void zmpt101b_gridlock_applied(zmpt101b_gridlock_t *gl, uint32_t rate_mhz);
+
+/**
+ * @brief Returns the lock status and tracking error.
+ *
+ * @param gl Loop state.
+ * @param status Status.
+ */
+void zmpt101b_gridlock_get_status(const zmpt101b_gridlock_t *gl, zmpt101b_gridlock_status_t *status);
@@ -0,0 +1,130 @@
+#include <string.h>
+#include "zmpt101b_integrity.h"
+
+#define CODE_MASK      0x0FFFu
+#define CODE_MAX       0x0FFFu
+#define PAIR_CODE_MASK 0x0FFF0FFFu
+#define PAIR_TAG_MASK  0xF000F000u
+
+// Internal functions
+static inline uint32_t rotl32(uint32_t value, unsigned shift)
+{
+    return (value << shift) | (value >> (32 - shift));
+}
+
+static inline void account_code(zmpt101b_integrity_t *st, uint16_t code)
+{
+    st->clipped_low += (code == 0);
+    st->clipped_high += (code == CODE_MAX);
+    if (code < st->min_code)
+        st->min_code = code;
+    if (code > st->max_code)
+        st->max_code = code;
+}
+
+void zmpt101b_integrity_begin(zmpt101b_integrity_t *st, uint8_t channel, uint32_t max_interval_us)
+{
+    memset(st, 0, sizeof(*st));
+    st->expected_tag = channel & 0x0F;
+    st->max_interval_us = max_interval_us;
+    st->min_code = CODE_MAX;
+    st->and_bits = 0xFFFFFFFFu;
+}
+
+uint32_t zmpt101b_integrity_check_block(zmpt101b_integrity_t *st, uint16_t *words, size_t length, int64_t arrival_us)
+{
+    uint32_t flags = 0;
+    if (length == 0)
+        return flags;
+
+    // Blocks further apart than the DMA ring can buffer mean the driver had to drop data
+    if (st->has_prev && st->max_interval_us != 0 && arrival_us - st->prev_arrival_us > (int64_t)st->max_interval_us) {
+        flags |= ZMPT101B_QUALITY_GAP;
+        st->gaps++;
+    }
+
+    const uint32_t expected_pair = ((uint32_t)st->expected_tag << 12) | ((uint32_t)st->expected_tag << 28);
+    uint32_t or_bits = 0;
+    uint32_t and_bits = 0xFFFFFFFFu;
+    uint32_t checksum = 0;
+    uint32_t mismatches = 0;
+
+    // Two samples per iteration: tag check, tag stripping, bit statistics and checksum all
+    // operate on both 16-bit lanes of a 32-bit word at once.
+    size_t i = 0;
+    for (; i + 1 < length; i += 2) {
+        uint32_t pair;
+        memcpy(&pair, &words[i], sizeof(pair));
+
+        const uint32_t tags = (pair & PAIR_TAG_MASK) ^ expected_pair;
+        mismatches += ((tags & 0x0000F000u) != 0) + ((tags & 0xF0000000u) != 0);
+
+        pair &= PAIR_CODE_MASK;
+        or_bits |= pair;
+        and_bits &= pair;
+        checksum = rotl32(checksum, 5) ^ pair;
+        memcpy(&words[i], &pair, sizeof(pair));
+
+        account_code(st, (uint16_t)(pair & CODE_MASK));
+        account_code(st, (uint16_t)(pair >> 16));
+    }
+    if (i < length) {
+        const uint16_t word = words[i];
+        mismatches += ((word >> 12) != st->expected_tag);
+        const uint16_t code = word & CODE_MASK;
+        or_bits |= code;
+        and_bits &= code | 0xFFFF0000u;
+        checksum = rotl32(checksum, 5) ^ code;
+        words[i] = code;
+        account_code(st, code);
+    }
+
+    if (mismatches != 0) {
+        flags |= ZMPT101B_QUALITY_TAG_MISMATCH;
+        st->tag_mismatches += mismatches;
+    }
+
+    // Identical content in two consecutive blocks is a re-delivered DMA buffer. A flat stream
+    // repeats legitimately, which is reported as constant instead.
+    checksum ^= (uint32_t)length;
+    const bool block_constant = ((or_bits | (or_bits >> 16)) & CODE_MASK) == ((and_bits & (and_bits >> 16)) & CODE_MASK);
+    if (st->has_prev && checksum == st->prev_checksum && !block_constant) {
+        flags |= ZMPT101B_QUALITY_DUPLICATE;
+        st->duplicates++;
+    }
+
+    st->or_bits |= or_bits;
+    st->and_bits &= and_bits;
+    st->prev_checksum = checksum;
+    st->prev_arrival_us = arrival_us;
+    st->has_prev = true;
+    st->samples += length;
+    st->quality |= flags;
+    return flags;
+}
+
+uint32_t zmpt101b_integrity_end(zmpt101b_integrity_t *st)
+{
+    if (st->samples == 0)
+        return st->quality;
+
+    const uint16_t span = st->max_code - st->min_code;
+    if (span <= ZMPT101B_INTEGRITY_CONSTANT_SPAN) {
+        st->quality |= ZMPT101B_QUALITY_CONSTANT;
+    } else {
+        // A signal spanning `span` codes must toggle every bit worth less than a quarter of it.
+        // Any such bit that stayed 0 or 1 through the whole window is stuck.
+        const uint16_t or_bits = (uint16_t)(st->or_bits | (st->or_bits >> 16));
+        const uint16_t and_bits = (uint16_t)(st->and_bits & (st->and_bits >> 16));
+        uint16_t must_toggle = 0;
+        for (uint16_t weight = 1; weight <= span / 4; weight <<= 1)
+            must_toggle |= weight;
+        st->stuck_mask = ~(or_bits ^ and_bits) & must_toggle;
+        if (st->stuck_mask != 0)
+            st->quality |= ZMPT101B_QUALITY_STUCK_BITS;
+    }
+
+    if (st->clipped_low + st->clipped_high != 0)
+        st->quality |= ZMPT101B_QUALITY_CLIPPED;
+    return st->quality;
+}
@@ -0,0 +1,93 @@
+/*
+ * ZMPT101B Sample Integrity Checks
+ *
+ * Validates the raw I2S ADC stream before it reaches the measurement stage.
+ * With the built-in ADC each 16-bit I2S word carries the channel ID in its upper 4 bits
+ * and the conversion result in the lower 12. The checker strips the tags in place and
+ * flags what it finds in the window quality bits:
+ * - words tagged with another channel,
+ * - data bits that never toggled although the signal swing says they must have,
+ * - a flat (constant) stream, e.g. a disconnected sensor output,
+ * - DMA gaps, i.e. blocks arriving later than the DMA ring could have buffered,
+ * - a block delivered twice,
+ * - samples pinned at either end of the ADC range.
+ *
+ * Blocks are processed two words at a time through 32-bit operations, so the cost per sample is
+ * a handful of ALU instructions. The module has no hardware dependencies and can run on host.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Quality bits reported per measurement window
+#define ZMPT101B_QUALITY_TAG_MISMATCH  (1u << 0)   // words carried a different channel ID
+#define ZMPT101B_QUALITY_STUCK_BITS    (1u << 1)   // data bits stuck at 0 or 1
+#define ZMPT101B_QUALITY_CONSTANT      (1u << 2)   // no signal, the stream is flat
+#define ZMPT101B_QUALITY_GAP           (1u << 3)   // samples were lost between DMA blocks
+#define ZMPT101B_QUALITY_DUPLICATE     (1u << 4)   // a DMA block was delivered twice
+#define ZMPT101B_QUALITY_CLIPPED       (1u << 5)   // samples pinned at ADC code 0 or full scale
+
+// A window whose peak-to-peak span is at most this many ADC codes is reported as constant.
+#define ZMPT101B_INTEGRITY_CONSTANT_SPAN 8
+
+typedef struct {
+    // Configuration, set by zmpt101b_integrity_begin()
+    uint8_t  expected_tag;      // channel ID expected in the upper 4 bits
+    uint32_t max_interval_us;   // longest block-to-block interval the DMA ring can absorb
+
+    // Window results
+    uint32_t quality;           // ZMPT101B_QUALITY_* bits
+    uint32_t samples;
+    uint32_t tag_mismatches;
+    uint32_t clipped_low;
+    uint32_t clipped_high;
+    uint32_t gaps;
+    uint32_t duplicates;
+    uint16_t stuck_mask;        // data bits found stuck
+    uint16_t min_code;
+    uint16_t max_code;
+
+    // Running state
+    uint32_t or_bits;           // both 16-bit lanes, folded at the end of the window
+    uint32_t and_bits;
+    uint32_t prev_checksum;
+    int64_t  prev_arrival_us;
+    bool     has_prev;
+} zmpt101b_integrity_t;
+
+/**
+ * @brief Starts a new measurement window.
+ *
+ * @param st Checker state.
+ * @param channel Channel ID expected in the tag bits.
+ * @param max_interval_us Longest interval between two consecutive blocks without losing samples,
+ *                        i.e. the time the DMA ring takes to fill up. 0 disables gap detection.
+ */
+void zmpt101b_integrity_begin(zmpt101b_integrity_t *st, uint8_t channel, uint32_t max_interval_us);
+
+/**
+ * @brief Validates one DMA block and strips the channel tags in place.
+ *
+ * @param st Checker state.
+ * @param words Raw I2S words; on return they hold plain 12-bit ADC codes.
+ * @param length Number of words.
+ * @param arrival_us Time the block was handed over by the driver (esp_timer clock).
+ * @return uint32_t Quality bits found in this block.
+ */
+uint32_t zmpt101b_integrity_check_block(zmpt101b_integrity_t *st, uint16_t *words, size_t length, int64_t arrival_us);
+
+/**
+ * @brief Completes the window-level checks (stuck bits, constant stream).
+ *
+ * @param st Checker state.
+ * @return uint32_t Quality bits of the whole window, also kept in st->quality.
+ */
+uint32_t zmpt101b_integrity_end(zmpt101b_integrity_t *st);
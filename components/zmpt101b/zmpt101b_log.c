@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "zmpt101b_log.h"
+
+#ifndef ZMPT101B_STORAGE_FILE
+#include "esp_partition.h"
+#endif
+
+#define LOG_MAGIC       0x474F4C5A  // "ZLOG"
+#define LOG_VERSION     1
+
+// Slot 0 of every sector holds the sector header
+#define SLOTS_PER_SECTOR    ( ZMPT101B_LOG_SECTOR_SIZE / ZMPT101B_LOG_RECORD_SIZE )
+#define RECORDS_PER_SECTOR  ( SLOTS_PER_SECTOR - 1 )
+
+// Records read from flash at once
+#define READ_CHUNK      8
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t generation;
+    uint8_t  reserved[16];
+    uint32_t crc;
+} sector_header_t;
+
+typedef struct {
+    int64_t  timestamp_us;
+    uint32_t sequence;
+    uint16_t type;
+    uint16_t flags;
+    int32_t  values[3];
+    uint32_t crc;
+} flash_record_t;
+
+_Static_assert(sizeof(sector_header_t) == ZMPT101B_LOG_RECORD_SIZE, "sector header must fill one slot");
+_Static_assert(sizeof(flash_record_t) == ZMPT101B_LOG_RECORD_SIZE, "record must fill one slot");
+
+// Internal functions
+static uint32_t crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static bool is_blank(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < length; ++i) {
+        if (bytes[i] != 0xFF)
+            return false;
+    }
+    return true;
+}
+
+#ifndef ZMPT101B_STORAGE_FILE
+
+static esp_err_t partition_open(zmpt101b_log_t *log, const char *label, size_t *size)
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == NULL)
+        return ESP_ERR_NOT_FOUND;
+    log->partition = partition;
+    *size = partition->size;
+    return ESP_OK;
+}
+
+static void partition_close(zmpt101b_log_t *log)
+{
+    log->partition = NULL;
+}
+
+static esp_err_t partition_read(const zmpt101b_log_t *log, size_t offset, void *data, size_t length)
+{
+    return esp_partition_read(log->partition, offset, data, length);
+}
+
+static esp_err_t partition_write(const zmpt101b_log_t *log, size_t offset, const void *data, size_t length)
+{
+    return esp_partition_write(log->partition, offset, data, length);
+}
+
+static esp_err_t partition_erase(const zmpt101b_log_t *log, size_t offset, size_t length)
+{
+    return esp_partition_erase_range(log->partition, offset, length);
+}
+
+#else // ZMPT101B_STORAGE_FILE
+
+static esp_err_t partition_open(zmpt101b_log_t *log, const char *label, size_t *size)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s.part", zmpt101b_storage_get_dir(), label);
+
+    FILE *file = fopen(path, "r+b");
+    if (file == NULL) {
+        // A new stand-in starts out erased, like a freshly flashed partition
+        file = fopen(path, "w+b");
+        if (file == NULL)
+            return ESP_ERR_NOT_FOUND;
+        for (size_t i = 0; i < ZMPT101B_LOG_FILE_SIZE; ++i)
+            fputc(0xFF, file);
+        fflush(file);
+    }
+    fseek(file, 0, SEEK_END);
+    *size = (size_t)ftell(file);
+    log->partition = file;
+    return ESP_OK;
+}
+
+static void partition_close(zmpt101b_log_t *log)
+{
+    if (log->partition != NULL)
+        fclose((FILE *)log->partition);
+    log->partition = NULL;
+}
+
+static esp_err_t partition_read(const zmpt101b_log_t *log, size_t offset, void *data, size_t length)
+{
+    FILE *file = (FILE *)log->partition;
+    if (fseek(file, (long)offset, SEEK_SET) != 0 || fread(data, 1, length, file) != length)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+// NOR flash semantics: programming can only clear bits
+static esp_err_t partition_write(const zmpt101b_log_t *log, size_t offset, const void *data, size_t length)
+{
+    FILE *file = (FILE *)log->partition;
+    uint8_t current[ZMPT101B_LOG_RECORD_SIZE];
+    const uint8_t *bytes = data;
+    for (size_t done = 0; done < length; done += sizeof(current)) {
+        const size_t chunk = length - done < sizeof(current) ? length - done : sizeof(current);
+        esp_err_t err = partition_read(log, offset + done, current, chunk);
+        if (err != ESP_OK)
+            return err;
+        for (size_t i = 0; i < chunk; ++i)
+            current[i] &= bytes[done + i];
+        if (fseek(file, (long)(offset + done), SEEK_SET) != 0 || fwrite(current, 1, chunk, file) != chunk)
+            return ESP_FAIL;
+    }
+    return fflush(file) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t partition_erase(const zmpt101b_log_t *log, size_t offset, size_t length)
+{
+    FILE *file = (FILE *)log->partition;
+    if (fseek(file, (long)offset, SEEK_SET) != 0)
+        return ESP_FAIL;
+    for (size_t i = 0; i < length; ++i)
+        fputc(0xFF, file);
+    return fflush(file) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+#endif // ZMPT101B_STORAGE_FILE
+
+static size_t slot_offset(uint32_t sector, uint32_t slot)
+{
+    return (size_t)sector * ZMPT101B_LOG_SECTOR_SIZE + (size_t)slot * ZMPT101B_LOG_RECORD_SIZE;
+}
+
+static void reset_sector(zmpt101b_log_sector_t *sector, uint32_t generation)
+{
+    sector->min_us = INT64_MAX;
+    sector->max_us = INT64_MIN;
+    sector->generation = generation;
+    sector->records = 0;
+}
+
+static bool record_valid(const flash_record_t *record)
+{
+    return record->crc == crc32(record, offsetof(flash_record_t, crc));
+}
+
+// Erases a sector and starts it with the given generation
+static esp_err_t start_sector(zmpt101b_log_t *log, uint32_t sector, uint32_t generation)
+{
+    reset_sector(&log->sectors[sector], 0);
+    esp_err_t err = partition_erase(log, slot_offset(sector, 0), ZMPT101B_LOG_SECTOR_SIZE);
+    if (err != ESP_OK)
+        return err;
+
+    sector_header_t header = {
+        .magic = LOG_MAGIC,
+        .version = LOG_VERSION,
+        .record_size = ZMPT101B_LOG_RECORD_SIZE,
+        .generation = generation,
+    };
+    memset(header.reserved, 0xFF, sizeof(header.reserved));
+    header.crc = crc32(&header, offsetof(sector_header_t, crc));
+    err = partition_write(log, slot_offset(sector, 0), &header, sizeof(header));
+    if (err != ESP_OK)
+        return err;
+
+    reset_sector(&log->sectors[sector], generation);
+    log->head = sector;
+    log->generation = generation;
+    return ESP_OK;
+}
+
+// Rebuilds the index entry of a sector with a valid header; the used slots end at the first blank one
+static esp_err_t scan_sector(zmpt101b_log_t *log, uint32_t sector)
+{
+    zmpt101b_log_sector_t *entry = &log->sectors[sector];
+    flash_record_t records[READ_CHUNK];
+    for (uint32_t slot = 1; slot < SLOTS_PER_SECTOR; slot += READ_CHUNK) {
+        const uint32_t count = SLOTS_PER_SECTOR - slot < READ_CHUNK ? SLOTS_PER_SECTOR - slot : READ_CHUNK;
+        esp_err_t err = partition_read(log, slot_offset(sector, slot), records, count * sizeof(records[0]));
+        if (err != ESP_OK)
+            return err;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (is_blank(&records[i], sizeof(records[i])))
+                return ESP_OK;
+            entry->records++;
+            if (!record_valid(&records[i])) {
+                log->corrupt++;
+                continue;
+            }
+            if (records[i].timestamp_us < entry->min_us)
+                entry->min_us = records[i].timestamp_us;
+            if (records[i].timestamp_us > entry->max_us)
+                entry->max_us = records[i].timestamp_us;
+            if (records[i].sequence >= log->sequence)
+                log->sequence = records[i].sequence + 1;
+        }
+    }
+    return ESP_OK;
+}
+
+// public API implementation
+esp_err_t zmpt101b_log_open(zmpt101b_log_t *log, const char *label)
+{
+    memset(log, 0, sizeof(*log));
+    size_t size = 0;
+    esp_err_t err = partition_open(log, label, &size);
+    if (err != ESP_OK)
+        return err;
+
+    log->sector_count = (uint32_t)(size / ZMPT101B_LOG_SECTOR_SIZE);
+    if (log->sector_count > ZMPT101B_LOG_MAX_SECTORS)
+        log->sector_count = ZMPT101B_LOG_MAX_SECTORS;
+    if (log->sector_count < 2) {
+        partition_close(log);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    bool found = false;
+    for (uint32_t sector = 0; sector < log->sector_count; ++sector) {
+        reset_sector(&log->sectors[sector], 0);
+        sector_header_t header;
+        err = partition_read(log, slot_offset(sector, 0), &header, sizeof(header));
+        if (err != ESP_OK)
+            break;
+        // Sectors without a valid header (blank, foreign or torn by a power loss) count as free
+        if (header.magic != LOG_MAGIC || header.version != LOG_VERSION
+            || header.record_size != ZMPT101B_LOG_RECORD_SIZE || header.generation == 0
+            || header.crc != crc32(&header, offsetof(sector_header_t, crc))) {
+            continue;
+        }
+        log->sectors[sector].generation = header.generation;
+        err = scan_sector(log, sector);
+        if (err != ESP_OK)
+            break;
+        if (!found || header.generation > log->generation) {
+            log->head = sector;
+            log->generation = header.generation;
+            found = true;
+        }
+    }
+    if (err == ESP_OK && !found)
+        err = start_sector(log, 0, 1);
+    if (err != ESP_OK)
+        partition_close(log);
+    return err;
+}
+
+void zmpt101b_log_close(zmpt101b_log_t *log)
+{
+    partition_close(log);
+}
+
+esp_err_t zmpt101b_log_append(zmpt101b_log_t *log, const zmpt101b_log_record_t *record)
+{
+    if (log->partition == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    if (log->sectors[log->head].records >= RECORDS_PER_SECTOR) {
+        // Ring rotation: the oldest sector is the one after the head
+        esp_err_t err = start_sector(log, (log->head + 1) % log->sector_count, log->generation + 1);
+        if (err != ESP_OK)
+            return err;
+    }
+
+    flash_record_t entry = {
+        .timestamp_us = record->timestamp_us,
+        .sequence = log->sequence,
+        .type = record->type,
+        .flags = record->flags,
+    };
+    memcpy(entry.values, record->values, sizeof(entry.values));
+    entry.crc = crc32(&entry, offsetof(flash_record_t, crc));
+
+    // The slot is consumed even if the write fails, it may hold a partial record now
+    zmpt101b_log_sector_t *sector = &log->sectors[log->head];
+    const uint32_t slot = 1 + sector->records++;
+    log->sequence++;
+    esp_err_t err = partition_write(log, slot_offset(log->head, slot), &entry, sizeof(entry));
+    if (err != ESP_OK)
+        return err;
+
+    if (entry.timestamp_us < sector->min_us)
+        sector->min_us = entry.timestamp_us;
+    if (entry.timestamp_us > sector->max_us)
+        sector->max_us = entry.timestamp_us;
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_log_query(zmpt101b_log_t *log, int64_t from_us, int64_t to_us, zmpt101b_log_callback_t callback, void *ctx)
+{
+    if (log->partition == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    flash_record_t records[READ_CHUNK];
+    // Sectors are filled in ring order, so the one after the head is the oldest
+    for (uint32_t n = 1; n <= log->sector_count; ++n) {
+        const uint32_t sector = (log->head + n) % log->sector_count;
+        const zmpt101b_log_sector_t *entry = &log->sectors[sector];
+        if (entry->generation == 0 || entry->records == 0 || entry->max_us < from_us || entry->min_us >= to_us)
+            continue;
+
+        for (uint32_t slot = 1; slot <= entry->records; slot += READ_CHUNK) {
+            const uint32_t count = entry->records + 1 - slot < READ_CHUNK ? entry->records + 1 - slot : READ_CHUNK;
+            esp_err_t err = partition_read(log, slot_offset(sector, slot), records, count * sizeof(records[0]));
+            if (err != ESP_OK)
+                return err;
+            for (uint32_t i = 0; i < count; ++i) {
+                if (!record_valid(&records[i]) || records[i].timestamp_us < from_us || records[i].timestamp_us >= to_us)
+                    continue;
+                zmpt101b_log_record_t record = {
+                    .timestamp_us = records[i].timestamp_us,
+                    .type = records[i].type,
+                    .flags = records[i].flags,
+                };
+                memcpy(record.values, records[i].values, sizeof(record.values));
+                if (!callback(&record, records[i].sequence, ctx))
+                    return ESP_OK;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_log_clear(zmpt101b_log_t *log)
+{
+    if (log->partition == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    for (uint32_t sector = 0; sector < log->sector_count; ++sector) {
+        reset_sector(&log->sectors[sector], 0);
+        esp_err_t err = partition_erase(log, slot_offset(sector, 0), ZMPT101B_LOG_SECTOR_SIZE);
+        if (err != ESP_OK)
+            return err;
+    }
+    log->sequence = 0;
+    log->corrupt = 0;
+    return start_sector(log, 0, 1);
+}
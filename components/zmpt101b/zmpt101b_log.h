@@ -0,0 +1,132 @@
+/*
+ * ZMPT101B Measurement Log
+ *
+ * Append-only time-series log of measurements, aggregates and events in a dedicated flash
+ * data partition (label ZMPT101B_LOG_PARTITION_LABEL, see partitions.csv).
+ * - The partition is a ring of 4 KB sectors. Each sector starts with a header carrying its
+ *   generation number and holds fixed-size 32-byte records. When the ring is full the oldest
+ *   sector is erased and reused, so every sector is erased equally often.
+ * - Every record carries a CRC32 and is written with a single flash write into erased space.
+ *   After a power loss at most the record being written fails its CRC; it is skipped when the
+ *   log is opened and appending continues behind it.
+ * - An index in RAM keeps the time span of each sector, built when the log is opened, so a
+ *   time-range query only reads the sectors overlapping the range.
+ *
+ * Host builds (ZMPT101B_STORAGE_FILE, see zmpt101b_storage.h) use a file named
+ * "<label>.part" in the storage directory as a partition stand-in, with NOR flash semantics
+ * (erase to 0xFF, writes can only clear bits).
+ * The log isn't thread-safe; use it from one task or guard it.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "zmpt101b_storage.h"
+
+// Label of the log partition
+#define ZMPT101B_LOG_PARTITION_LABEL "zmpt_log"
+
+#define ZMPT101B_LOG_SECTOR_SIZE 4096
+#define ZMPT101B_LOG_RECORD_SIZE 32
+
+// Sectors used at most; a larger partition is only used up to this size
+#define ZMPT101B_LOG_MAX_SECTORS 64
+
+#ifdef ZMPT101B_STORAGE_FILE
+// Size of the partition stand-in file
+#define ZMPT101B_LOG_FILE_SIZE ( 16 * ZMPT101B_LOG_SECTOR_SIZE )
+#endif
+
+typedef enum {
+    ZMPT101B_LOG_VOLTAGE = 1,   // values[0]: voltage in V
+    ZMPT101B_LOG_AGGREGATE,     // values[0]: interval, values[1]: RMS in mains mV, values[2]: count
+    ZMPT101B_LOG_EVENT,         // values[0]: event kind, values[1]: magnitude, values[2]: duration in ms
+    ZMPT101B_LOG_FLICKER,       // values[0]: Pst x1000, values[1]: Plt x1000 or -1
+} zmpt101b_log_type_t;
+
+typedef struct {
+    int64_t  timestamp_us;
+    uint16_t type;              // zmpt101b_log_type_t
+    uint16_t flags;             // type specific, e.g. the aggregation flag
+    int32_t  values[3];
+} zmpt101b_log_record_t;
+
+// Time span and state of one sector
+typedef struct {
+    int64_t  min_us;
+    int64_t  max_us;
+    uint32_t generation;        // 0: sector is free
+    uint16_t records;           // slots used, including corrupt ones
+} zmpt101b_log_sector_t;
+
+typedef struct {
+    const void *partition;      // esp_partition_t, or FILE in the host stand-in
+    uint32_t sector_count;
+    uint32_t head;              // sector being written
+    uint32_t generation;        // generation of the head sector
+    uint32_t sequence;          // sequence number of the next record
+    uint32_t corrupt;           // records that failed their CRC when the log was opened
+    zmpt101b_log_sector_t sectors[ZMPT101B_LOG_MAX_SECTORS];
+} zmpt101b_log_t;
+
+/**
+ * @brief Callback receiving query results.
+ *
+ * @param record Matching record.
+ * @param sequence Record sequence number, increasing in append order.
+ * @param ctx User context.
+ * @return bool false stops the query.
+ */
+typedef bool (*zmpt101b_log_callback_t)(const zmpt101b_log_record_t *record, uint32_t sequence, void *ctx);
+
+/**
+ * @brief Opens the log, recovering its state from flash. A blank or foreign partition is formatted.
+ *
+ * @param log Log state (about 1.6 KB).
+ * @param label Partition label, usually ZMPT101B_LOG_PARTITION_LABEL.
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if there's no such partition, or a flash error.
+ */
+esp_err_t zmpt101b_log_open(zmpt101b_log_t *log, const char *label);
+
+/**
+ * @brief Closes the log.
+ *
+ * @param log Log state.
+ */
+void zmpt101b_log_close(zmpt101b_log_t *log);
+
+/**
+ * @brief Appends a record, erasing the oldest sector when the ring is full.
+ *
+ * @param log Log state.
+ * @param record Record to append.
+ * @return esp_err_t ESP_OK or a flash error.
+ */
+esp_err_t zmpt101b_log_append(zmpt101b_log_t *log, const zmpt101b_log_record_t *record);
+
+/**
+ * @brief Reads the records with from_us <= timestamp < to_us, oldest first.
+ *
+ * @param log Log state.
+ * @param from_us Start of the range.
+ * @param to_us End of the range, exclusive.
+ * @param callback Called for every matching record.
+ * @param ctx User context.
+ * @return esp_err_t ESP_OK or a flash error.
+ */
+esp_err_t zmpt101b_log_query(zmpt101b_log_t *log, int64_t from_us, int64_t to_us, zmpt101b_log_callback_t callback, void *ctx);
+
+/**
+ * @brief Erases the whole log.
+ *
+ * @param log Log state.
+ * @return esp_err_t ESP_OK or a flash error.
+ */
+esp_err_t zmpt101b_log_clear(zmpt101b_log_t *log);
@@ -0,0 +1,161 @@
+#include <stdbool.h>
+#include "zmpt101b_measurement.h"
+#include "zmpt101b_fixed.h"
+
+// Running sums and position at a crossing through the level
+typedef struct {
+    int64_t  sum;
+    uint64_t sum_squares;
+    size_t   index;             // first sample past the crossing
+    uint64_t position_q16;      // interpolated between that sample and the one before, Q16
+} crossing_t;
+
+// Internal functions
+static int32_t divide_rounded(int64_t value, uint32_t divisor)
+{
+    return (int32_t)((value + (value < 0 ? -(int64_t)divisor : (int64_t)divisor) / 2) / divisor);
+}
+
+// Mains millivolts of a sample against the DC offset sum / count, exact up to the final division
+static int32_t ac_mains_mv(int32_t sample, int64_t sum, uint32_t count)
+{
+    return divide_rounded(((int64_t)sample * count - sum) * ZMPT101B_MEAS_MAINS_PER_SENSOR, count);
+}
+
+// Trimmed mean of the half cycle peaks against the DC offset, sorted in place; there are few
+static int32_t trimmed_peak_mv(int32_t *peaks, uint32_t n, int64_t dc_sum, uint32_t count)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        const int32_t peak = ac_mains_mv(peaks[i], dc_sum, count);
+        peaks[i] = peak < 0 ? -peak : peak;
+    }
+    for (uint32_t i = 1; i < n; i++) {
+        const int32_t key = peaks[i];
+        uint32_t k = i;
+        while (k > 0 && peaks[k - 1] > key) {
+            peaks[k] = peaks[k - 1];
+            k--;
+        }
+        peaks[k] = key;
+    }
+    uint32_t trim = n / ZMPT101B_MEAS_PEAK_TRIM;
+    if (trim == 0 && n >= 3)
+        trim = 1;
+    int64_t sum = 0;
+    for (uint32_t i = trim; i < n - trim; i++)
+        sum += peaks[i];
+    return divide_rounded(sum, n - 2 * trim);
+}
+
+// public API implementation
+zmpt101b_measurement_t zmpt101b_measurement_compute(const int16_t *samples, size_t len, uint32_t sample_rate,
+                                                    int32_t level)
+{
+    zmpt101b_measurement_t m = { .sample_count = (uint32_t)len };
+    if (len == 0)
+        return m;
+
+    int64_t sum = 0;
+    uint64_t sum_squares = 0;
+    int32_t lowest = samples[0];
+    int32_t highest = samples[0];
+    // Extremes of the half cycle in progress, and of the ones completed since the first crossing
+    int32_t half_lowest = samples[0];
+    int32_t half_highest = samples[0];
+    int32_t peaks[ZMPT101B_MEAS_MAX_HALF_CYCLES];
+    uint32_t peak_count = 0;
+    // The first crossing and the last two, so the span can end on whole cycles
+    crossing_t first = { 0 }, previous = { 0 }, last = { 0 };
+    uint32_t crossings = 0;
+    int side = 0;       // -1 below level - hysteresis since the last crossing, 1 above level + hysteresis
+
+    for (size_t i = 0; i < len; i++) {
+        const int32_t x = samples[i];
+        // The previous sample is on the old side, or this one would have crossed already
+        const bool crossed = (side < 0 && x >= level) || (side > 0 && x < level);
+        const bool rising = side < 0;
+        if (x < level - ZMPT101B_MEAS_ZC_HYSTERESIS_MV)
+            side = -1;
+        else if (x > level + ZMPT101B_MEAS_ZC_HYSTERESIS_MV)
+            side = 1;
+        else if (crossed)
+            side = 0;
+        if (crossed) {
+            const int32_t prev = samples[i - 1];
+            previous = last;
+            last.sum = sum;
+            last.sum_squares = sum_squares;
+            last.index = i;
+            last.position_q16 = ((uint64_t)(i - 1) << 16) + (uint64_t)((int64_t)(level - prev) * 65536 / (x - prev));
+            if (crossings++ == 0)
+                first = last;
+            else if (peak_count < ZMPT101B_MEAS_MAX_HALF_CYCLES)
+                peaks[peak_count++] = rising ? half_lowest : half_highest;
+            half_lowest = x;
+            half_highest = x;
+        }
+        sum += x;
+        sum_squares += (uint64_t)(x * x);
+        if (x < lowest)
+            lowest = x;
+        if (x > highest)
+            highest = x;
+        if (x < half_lowest)
+            half_lowest = x;
+        if (x > half_highest)
+            half_highest = x;
+    }
+
+    uint32_t count = (uint32_t)len;
+    int64_t dc_sum = sum;       // count times the DC offset
+    uint32_t rms_q8;
+    if (crossings >= 2) {
+        // Whole cycles where the window holds one, a half cycle otherwise
+        uint32_t half_cycles = crossings - 1;
+        if (half_cycles % 2 != 0 && half_cycles > 1) {
+            last = previous;
+            half_cycles--;
+        }
+        m.half_cycles = (uint16_t)half_cycles;
+        const uint64_t span_q16 = last.position_q16 - first.position_q16;
+        m.frequency_mhz = (uint32_t)((((uint64_t)sample_rate * 500 * half_cycles) << 16) / span_q16);
+        count = (uint32_t)(last.index - first.index);
+        sum = last.sum - first.sum;
+        sum_squares = last.sum_squares - first.sum_squares;
+        if (half_cycles > 1) {
+            dc_sum = sum;
+            rms_q8 = zmpt101b_fx_ac_rms_q8(sum, sum_squares, count);
+        } else {
+            // The mean of a half cycle isn't the DC offset, the level is the best estimate there is
+            dc_sum = (int64_t)level * count;
+            const int64_t squares = (int64_t)sum_squares - 2 * (int64_t)level * sum + (int64_t)level * dc_sum;
+            rms_q8 = zmpt101b_isqrt64(((uint64_t)squares << (2 * ZMPT101B_FX_RMS_FRAC_BITS)) / count);
+        }
+        // The span starts and ends right after a crossing, where the signal is close to its mean,
+        // so the samples it has too many or too few add next to nothing to the sum of squares:
+        // the mean square is that sum over the measured duration, not over the span
+        if (count < (1u << 15)) {
+            const uint32_t factor_q16 = zmpt101b_isqrt64(((uint64_t)count << 48) / span_q16);
+            rms_q8 = (uint32_t)(((uint64_t)rms_q8 * factor_q16 + 32768) >> 16);
+        }
+    } else {
+        rms_q8 = zmpt101b_fx_ac_rms_q8(sum, sum_squares, count);
+    }
+
+    m.rms_mv = (int32_t)(((uint64_t)rms_q8 * ZMPT101B_MEAS_MAINS_PER_SENSOR + (1u << (ZMPT101B_FX_RMS_FRAC_BITS - 1)))
+                         >> ZMPT101B_FX_RMS_FRAC_BITS);
+    m.dc_offset_mv = divide_rounded(dc_sum, count);
+    m.min_mv = ac_mains_mv(lowest, dc_sum, count);
+    m.max_mv = ac_mains_mv(highest, dc_sum, count);
+    // Every half cycle between the first and the last crossing counts, also one the span left out
+    // to end on whole cycles: the more there are, the more spikes the trimming takes
+    if (peak_count > 0)
+        m.peak_mv = trimmed_peak_mv(peaks, peak_count, dc_sum, count);
+    else
+        m.peak_mv = m.max_mv > -m.min_mv ? m.max_mv : -m.min_mv;
+    if (m.rms_mv > 0) {
+        const int64_t crest = ((int64_t)m.peak_mv * 1000 + m.rms_mv / 2) / m.rms_mv;
+        m.crest_factor_milli = crest > UINT16_MAX ? UINT16_MAX : (uint16_t)crest;
+    }
+    return m;
+}
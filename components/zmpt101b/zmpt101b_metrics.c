@@ -0,0 +1,441 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "zmpt101b_metrics.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#else
+#include <time.h>
+#endif
+
+// Start of a metric family: HELP and TYPE lines and the sample name, the value follows
+#define FAMILY(name, type, help) \
+    "# HELP zmpt101b_" name " " help "\n# TYPE zmpt101b_" name " " type "\nzmpt101b_" name " "
+
+typedef struct {
+    char *p;
+    char *end;
+    bool overflow;
+} writer_t;
+
+// Internal functions
+static int64_t now_us(void)
+{
+#ifdef ESP_PLATFORM
+    return esp_timer_get_time();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+static void append(writer_t *w, const char *text, size_t length)
+{
+    if (w->overflow || (size_t)(w->end - w->p) < length) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->p, text, length);
+    w->p += length;
+}
+
+#define APPEND_LITERAL(w, literal) append((w), (literal), sizeof(literal) - 1)
+
+// Appends value / 10^decimals as a decimal number and ends the line
+static void append_fixed(writer_t *w, uint64_t value, int decimals)
+{
+    char digits[24];
+    char *p = digits + sizeof(digits);
+    *--p = '\n';
+    for (int i = 0; i < decimals; ++i) {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    }
+    if (decimals > 0)
+        *--p = '.';
+    do {
+        *--p = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    append(w, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+static void append_u64(writer_t *w, uint64_t value)
+{
+    append_fixed(w, value, 0);
+}
+
+static void render(writer_t *w, const zmpt101b_snapshot_data_t *data, const zmpt101b_metrics_stats_t *stats, uint32_t scrapes)
+{
+    APPEND_LITERAL(w, FAMILY("voltage_rms_volts", "gauge", "RMS mains voltage of the last measurement."));
+    append_fixed(w, data->rms_mv, 3);
+    APPEND_LITERAL(w, FAMILY("voltage_rms_min_volts", "gauge", "Lowest RMS voltage since the last min/max reset."));
+    append_fixed(w, data->rms_min_mv, 3);
+    APPEND_LITERAL(w, FAMILY("voltage_rms_max_volts", "gauge", "Highest RMS voltage since the last min/max reset."));
+    append_fixed(w, data->rms_max_mv, 3);
+    APPEND_LITERAL(w, FAMILY("frequency_hertz", "gauge", "Mains frequency, 0 while unknown."));
+    append_fixed(w, data->frequency_mhz, 3);
+    APPEND_LITERAL(w, FAMILY("thd_ratio", "gauge", "Total harmonic distortion, NaN without harmonic analysis."));
+    if (data->thd_centi_pct == ZMPT101B_SNAPSHOT_THD_UNKNOWN)
+        APPEND_LITERAL(w, "NaN\n");
+    else
+        append_fixed(w, data->thd_centi_pct, 4);
+    APPEND_LITERAL(w, FAMILY("adc_attenuation", "gauge", "ADC attenuation setting of the last measurement."));
+    append_u64(w, data->attenuation);
+    // A counter has no unknown value, so without event detection the families are left out
+    if (data->dips != ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN) {
+        APPEND_LITERAL(w, FAMILY("dips_total", "counter", "Voltage dips detected."));
+        append_u64(w, data->dips);
+    }
+    if (data->swells != ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN) {
+        APPEND_LITERAL(w, FAMILY("swells_total", "counter", "Voltage swells detected."));
+        append_u64(w, data->swells);
+    }
+    if (data->interruptions != ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN) {
+        APPEND_LITERAL(w, FAMILY("interruptions_total", "counter", "Voltage interruptions detected."));
+        append_u64(w, data->interruptions);
+    }
+    APPEND_LITERAL(w, FAMILY("quality_flags", "gauge", "ZMPT101B_QUALITY_* bits of the last measurement."));
+    append_u64(w, data->quality);
+    APPEND_LITERAL(w, FAMILY("clipped_samples", "gauge", "Samples clipped at the ADC range in the last measurement."));
+    append_u64(w, data->clipped);
+    APPEND_LITERAL(w, FAMILY("dma_gaps_total", "counter", "Gaps detected in the DMA sample stream."));
+    append_u64(w, data->gaps);
+    APPEND_LITERAL(w, FAMILY("dma_duplicates_total", "counter", "Duplicated DMA blocks detected."));
+    append_u64(w, data->duplicates);
+    APPEND_LITERAL(w, FAMILY("range_switches_total", "counter", "ADC attenuation changes."));
+    append_u64(w, data->range_switches);
+    APPEND_LITERAL(w, FAMILY("measurements_total", "counter", "Measurements published."));
+    append_u64(w, data->updates);
+    APPEND_LITERAL(w, FAMILY("measurement_timestamp_seconds", "gauge", "Time of the last measurement."));
+    append_fixed(w, data->timestamp_us > 0 ? (uint64_t)data->timestamp_us : 0, 6);
+    APPEND_LITERAL(w, FAMILY("window_seconds", "gauge", "Time the last measurement took to sample and process."));
+    append_fixed(w, data->window_us, 6);
+    APPEND_LITERAL(w, FAMILY("metrics_render_seconds", "gauge", "Time the previous exposition text took to render."));
+    append_fixed(w, stats->render_us, 6);
+    APPEND_LITERAL(w, FAMILY("metrics_renders_total", "counter", "Exposition texts rendered."));
+    append_u64(w, stats->renders);
+    APPEND_LITERAL(w, FAMILY("metrics_renders_skipped_total", "counter", "Renders skipped while both texts were being served."));
+    append_u64(w, stats->renders_skipped);
+    APPEND_LITERAL(w, FAMILY("metrics_scrapes_total", "counter", "Scrapes served."));
+    append_u64(w, scrapes);
+}
+
+static void close_client(zmpt101b_metrics_t *metrics, zmpt101b_metrics_client_t *client)
+{
+    if (client->buffer >= 0)
+        zmpt101b_metrics_release(metrics, client->buffer);
+    client->buffer = -1;
+    if (client->sock >= 0)
+        close(client->sock);
+    client->sock = -1;
+    client->request_length = 0;
+    client->header_length = 0;
+    client->body_length = 0;
+    client->sent = 0;
+}
+
+static bool response_pending(const zmpt101b_metrics_client_t *client)
+{
+    return client->sent < client->header_length + client->body_length;
+}
+
+static void accept_client(zmpt101b_metrics_t *metrics)
+{
+    const int sock = accept(metrics->listen_sock, NULL, NULL);
+    if (sock < 0)
+        return;
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    const int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    // A free slot, else the connection idle the longest
+    const uint32_t scrapes = atomic_load(&metrics->scrapes);
+    zmpt101b_metrics_client_t *slot = &metrics->clients[0];
+    for (int i = 0; i < ZMPT101B_METRICS_MAX_CLIENTS; ++i) {
+        zmpt101b_metrics_client_t *client = &metrics->clients[i];
+        if (client->sock < 0) {
+            slot = client;
+            break;
+        }
+        if (scrapes - client->last_scrape > scrapes - slot->last_scrape)
+            slot = client;
+    }
+    close_client(metrics, slot);
+    slot->sock = sock;
+    slot->last_scrape = scrapes;
+}
+
+// Starts the response to the request at the start of the buffer; returns false until a whole request head is buffered
+static bool start_response(zmpt101b_metrics_t *metrics, zmpt101b_metrics_client_t *client)
+{
+    client->request[client->request_length] = '\0';
+    const char *head_end = strstr(client->request, "\r\n\r\n");
+    if (head_end == NULL)
+        return false;
+    const size_t head_length = (size_t)(head_end - client->request) + 4;
+    // Header searches stop at the end of this request, pipelined ones follow it
+    client->request[head_length - 2] = '\0';
+
+    const char *line_end = strstr(client->request, "\r\n");
+    const bool get = strncmp(client->request, "GET ", 4) == 0;
+    const bool found = get && (strncmp(client->request + 4, "/metrics ", 9) == 0 || strncmp(client->request + 4, "/metrics?", 9) == 0);
+    client->close_after = (line_end - client->request >= 8 && strncmp(line_end - 8, "HTTP/1.0", 8) == 0) ||
+                          strstr(client->request, "\r\nConnection: close") != NULL ||
+                          strstr(client->request, "\r\nconnection: close") != NULL;
+
+    client->sent = 0;
+    if (found) {
+        client->buffer = zmpt101b_metrics_acquire(metrics, &client->body, &client->body_length);
+        const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: " ZMPT101B_METRICS_CONTENT_TYPE "\r\nContent-Length: ";
+        writer_t w = { client->header, client->header + sizeof(client->header), false };
+        APPEND_LITERAL(&w, header);
+        append_fixed(&w, client->body_length, 0);
+        w.p[-1] = '\r';     // the number ended with '\n'
+        APPEND_LITERAL(&w, "\n\r\n");
+        client->header_length = (size_t)(w.p - client->header);
+    } else {
+        const char header_404[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+        const char header_405[] = "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET\r\nContent-Length: 0\r\n\r\n";
+        const char *header = get ? header_404 : header_405;
+        client->header_length = strlen(header);
+        memcpy(client->header, header, client->header_length);
+        client->body = NULL;
+        client->body_length = 0;
+    }
+
+    client->request_length -= head_length;
+    memmove(client->request, client->request + head_length, client->request_length);
+    return true;
+}
+
+// Sends as much of the pending response as the socket takes; returns false if the connection was closed
+static bool send_response(zmpt101b_metrics_t *metrics, zmpt101b_metrics_client_t *client)
+{
+    while (response_pending(client)) {
+        const bool in_header = client->sent < client->header_length;
+        const char *data = in_header ? client->header + client->sent : client->body + (client->sent - client->header_length);
+        const size_t length = in_header ? client->header_length - client->sent : client->body_length - (client->sent - client->header_length);
+        const ssize_t sent = send(client->sock, data, length, 0);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true;
+            close_client(metrics, client);
+            return false;
+        }
+        client->sent += (size_t)sent;
+    }
+
+    if (client->buffer >= 0) {
+        zmpt101b_metrics_release(metrics, client->buffer);
+        client->buffer = -1;
+        client->last_scrape = atomic_load(&metrics->scrapes);
+    }
+    client->header_length = 0;
+    client->body_length = 0;
+    client->sent = 0;
+    if (client->close_after) {
+        close_client(metrics, client);
+        return false;
+    }
+    return true;
+}
+
+static void serve_client(zmpt101b_metrics_t *metrics, zmpt101b_metrics_client_t *client)
+{
+    const ssize_t received = recv(client->sock, client->request + client->request_length, sizeof(client->request) - 1 - client->request_length, 0);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_client(metrics, client);
+        return;
+    }
+    if (received > 0)
+        client->request_length += (size_t)received;
+
+    // Pipelined requests are answered one after the other
+    while (!response_pending(client) && start_response(metrics, client)) {
+        if (!send_response(metrics, client))
+            return;
+    }
+    if (!response_pending(client) && client->request_length == sizeof(client->request) - 1)
+        close_client(metrics, client);  // request head too long
+}
+
+// public API implementation
+void zmpt101b_metrics_init(zmpt101b_metrics_t *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    for (int i = 0; i < 2; ++i)
+        atomic_init(&metrics->buffers[i].readers, 0);
+    atomic_init(&metrics->published, 0);
+    atomic_init(&metrics->scrapes, 0);
+    metrics->listen_sock = -1;
+    for (int i = 0; i < ZMPT101B_METRICS_MAX_CLIENTS; ++i) {
+        metrics->clients[i].sock = -1;
+        metrics->clients[i].buffer = -1;
+    }
+}
+
+esp_err_t zmpt101b_metrics_update(zmpt101b_metrics_t *metrics, const zmpt101b_snapshot_data_t *data)
+{
+    const unsigned index = atomic_load(&metrics->published) ^ 1;
+    zmpt101b_metrics_buffer_t *buffer = &metrics->buffers[index];
+    // A scrape that took the buffer before the last publication may still be sending it
+    if (atomic_load(&buffer->readers) != 0) {
+        metrics->stats.renders_skipped++;
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    const int64_t start_us = now_us();
+    writer_t w = { buffer->text, buffer->text + sizeof(buffer->text), false };
+    render(&w, data, &metrics->stats, atomic_load(&metrics->scrapes));
+    if (w.overflow) {
+        metrics->stats.overflows++;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    buffer->length = (size_t)(w.p - buffer->text);
+    atomic_store(&metrics->published, index);
+    metrics->stats.renders++;
+    metrics->stats.render_us = (uint32_t)(now_us() - start_us);
+    return ESP_OK;
+}
+
+int zmpt101b_metrics_acquire(zmpt101b_metrics_t *metrics, const char **text, size_t *length)
+{
+    for (;;) {
+        const unsigned index = atomic_load(&metrics->published);
+        atomic_fetch_add(&metrics->buffers[index].readers, 1);
+        // Still published after the reader was counted, so the writer leaves it alone
+        if (atomic_load(&metrics->published) == index) {
+            *text = metrics->buffers[index].text;
+            *length = metrics->buffers[index].length;
+            return (int)index;
+        }
+        atomic_fetch_sub(&metrics->buffers[index].readers, 1);
+    }
+}
+
+void zmpt101b_metrics_release(zmpt101b_metrics_t *metrics, int handle)
+{
+    atomic_fetch_add(&metrics->scrapes, 1);
+    atomic_fetch_sub(&metrics->buffers[handle].readers, 1);
+}
+
+void zmpt101b_metrics_get_stats(zmpt101b_metrics_t *metrics, zmpt101b_metrics_stats_t *stats)
+{
+    *stats = metrics->stats;
+    stats->scrapes = atomic_load(&metrics->scrapes);
+}
+
+esp_err_t zmpt101b_metrics_http_start(zmpt101b_metrics_t *metrics, uint16_t port)
+{
+    const struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    metrics->listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (metrics->listen_sock < 0)
+        return ESP_FAIL;
+    const int reuse = 1;
+    setsockopt(metrics->listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(metrics->listen_sock, (const struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(metrics->listen_sock, ZMPT101B_METRICS_MAX_CLIENTS) != 0) {
+        close(metrics->listen_sock);
+        metrics->listen_sock = -1;
+        return ESP_FAIL;
+    }
+    fcntl(metrics->listen_sock, F_SETFL, fcntl(metrics->listen_sock, F_GETFL, 0) | O_NONBLOCK);
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_metrics_http_service(zmpt101b_metrics_t *metrics, uint32_t timeout_ms)
+{
+    if (metrics->listen_sock < 0)
+        return ESP_ERR_INVALID_STATE;
+
+    fd_set readable;
+    fd_set writable;
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    FD_SET(metrics->listen_sock, &readable);
+    int max_sock = metrics->listen_sock;
+    for (int i = 0; i < ZMPT101B_METRICS_MAX_CLIENTS; ++i) {
+        const zmpt101b_metrics_client_t *client = &metrics->clients[i];
+        if (client->sock < 0)
+            continue;
+        // A connection with a response in progress is only read again once the response is out
+        if (response_pending(client))
+            FD_SET(client->sock, &writable);
+        else
+            FD_SET(client->sock, &readable);
+        if (client->sock > max_sock)
+            max_sock = client->sock;
+    }
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    if (select(max_sock + 1, &readable, &writable, NULL, &timeout) <= 0)
+        return ESP_OK;
+
+    for (int i = 0; i < ZMPT101B_METRICS_MAX_CLIENTS; ++i) {
+        zmpt101b_metrics_client_t *client = &metrics->clients[i];
+        if (client->sock < 0)
+            continue;
+        if (FD_ISSET(client->sock, &writable)) {
+            if (!send_response(metrics, client))
+                continue;
+            // Requests buffered while the response was going out
+            while (!response_pending(client) && start_response(metrics, client)) {
+                if (!send_response(metrics, client))
+                    break;
+            }
+        } else if (FD_ISSET(client->sock, &readable)) {
+            serve_client(metrics, client);
+        }
+    }
+    if (FD_ISSET(metrics->listen_sock, &readable))
+        accept_client(metrics);
+    return ESP_OK;
+}
+
+void zmpt101b_metrics_http_stop(zmpt101b_metrics_t *metrics)
+{
+    for (int i = 0; i < ZMPT101B_METRICS_MAX_CLIENTS; ++i)
+        close_client(metrics, &metrics->clients[i]);
+    if (metrics->listen_sock >= 0)
+        close(metrics->listen_sock);
+    metrics->listen_sock = -1;
+}
+
+#ifdef ESP_PLATFORM
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    zmpt101b_metrics_t *metrics = req->user_ctx;
+    const char *text;
+    size_t length;
+    const int handle = zmpt101b_metrics_acquire(metrics, &text, &length);
+    httpd_resp_set_type(req, ZMPT101B_METRICS_CONTENT_TYPE);
+    const esp_err_t err = httpd_resp_send(req, text, (ssize_t)length);
+    zmpt101b_metrics_release(metrics, handle);
+    return err;
+}
+
+esp_err_t zmpt101b_metrics_register_handler(zmpt101b_metrics_t *metrics, httpd_handle_t server)
+{
+    const httpd_uri_t uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = metrics_handler,
+        .user_ctx = metrics,
+    };
+    return httpd_register_uri_handler(server, &uri);
+}
+#endif
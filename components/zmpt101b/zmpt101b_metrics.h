@@ -0,0 +1,164 @@
+/*
+ * ZMPT101B Metrics Endpoint
+ *
+ * Prometheus text exposition (format 0.0.4) of the measurement snapshot and the component's
+ * own counters, served at GET /metrics.
+ * - zmpt101b_metrics_update() renders the text once per measurement window into the buffer
+ *   nobody is serving; the metric names, HELP and TYPE lines are string literals, only the
+ *   values are formatted. The buffer is then published.
+ * - A scrape sends the published buffer as it is, without formatting or copying, and holds it
+ *   until the response is out. An update that would overwrite a buffer still being sent is
+ *   skipped and counted instead of waiting for the scrape.
+ * The text is served either by the built-in minimal HTTP/1.1 server (BSD sockets, works on the
+ * host too, see tools/zmpt101b_metrics_scrape.py) or by a handler registered on an
+ * esp_http_server instance the application already runs.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "esp_err.h"
+#include "zmpt101b_snapshot.h"
+#ifdef ESP_PLATFORM
+#include "esp_http_server.h"
+#endif
+
+// Size of each of the two text buffers
+#define ZMPT101B_METRICS_BUFFER_SIZE 4096
+
+// Concurrent connections of the built-in server; a new one replaces the least recently active
+#define ZMPT101B_METRICS_MAX_CLIENTS 4
+
+// Longest request head (request line and headers) the built-in server accepts
+#define ZMPT101B_METRICS_REQUEST_SIZE 512
+
+#define ZMPT101B_METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+typedef struct {
+    uint32_t renders;           // texts rendered and published
+    uint32_t renders_skipped;   // updates skipped because the spare buffer was still being served
+    uint32_t render_us;         // time the last render took
+    uint32_t overflows;         // renders that didn't fit ZMPT101B_METRICS_BUFFER_SIZE
+    uint32_t scrapes;           // responses served
+} zmpt101b_metrics_stats_t;
+
+typedef struct {
+    char     text[ZMPT101B_METRICS_BUFFER_SIZE];
+    size_t   length;
+    atomic_uint readers;        // scrapes sending from this buffer
+} zmpt101b_metrics_buffer_t;
+
+typedef struct {
+    int      sock;
+    size_t   request_length;
+    char     request[ZMPT101B_METRICS_REQUEST_SIZE];
+    int      buffer;            // buffer held by the response in progress, -1 if none
+    const char *body;
+    size_t   body_length;
+    char     header[160];
+    size_t   header_length;
+    size_t   sent;              // bytes of header and body sent
+    bool     close_after;       // HTTP/1.0 or "Connection: close"
+    uint32_t last_scrape;       // scrape counter at the last response, picks the connection to replace
+} zmpt101b_metrics_client_t;
+
+typedef struct {
+    zmpt101b_metrics_buffer_t buffers[2];
+    atomic_uint published;      // index of the buffer scrapes send
+    atomic_uint scrapes;
+    zmpt101b_metrics_stats_t stats;
+
+    int      listen_sock;
+    zmpt101b_metrics_client_t clients[ZMPT101B_METRICS_MAX_CLIENTS];
+} zmpt101b_metrics_t;
+
+/**
+ * @brief Initializes the endpoint with an empty text.
+ *
+ * @param metrics Endpoint state (about 10 KB, keep it static).
+ */
+void zmpt101b_metrics_init(zmpt101b_metrics_t *metrics);
+
+/**
+ * @brief Renders and publishes the text for new measurements. Call it once per measurement window.
+ *
+ * Single writer; never blocks on scrapes.
+ *
+ * @param metrics Endpoint state.
+ * @param data Measurements, e.g. the data published to the snapshot.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_STATE if skipped because both buffers are being served,
+ *                   or ESP_ERR_INVALID_SIZE if the text didn't fit (the previous text stays published).
+ */
+esp_err_t zmpt101b_metrics_update(zmpt101b_metrics_t *metrics, const zmpt101b_snapshot_data_t *data);
+
+/**
+ * @brief Takes the published text for sending. It stays unchanged until released.
+ *
+ * @param metrics Endpoint state.
+ * @param text Receives the text.
+ * @param length Receives the text length.
+ * @return int Buffer handle for zmpt101b_metrics_release().
+ */
+int zmpt101b_metrics_acquire(zmpt101b_metrics_t *metrics, const char **text, size_t *length);
+
+/**
+ * @brief Releases a text taken with zmpt101b_metrics_acquire() and counts the scrape.
+ *
+ * @param metrics Endpoint state.
+ * @param handle Buffer handle.
+ */
+void zmpt101b_metrics_release(zmpt101b_metrics_t *metrics, int handle);
+
+/**
+ * @brief Returns the endpoint counters.
+ *
+ * @param metrics Endpoint state.
+ * @param stats Counters.
+ */
+void zmpt101b_metrics_get_stats(zmpt101b_metrics_t *metrics, zmpt101b_metrics_stats_t *stats);
+
+/**
+ * @brief Opens the listening socket of the built-in HTTP server.
+ *
+ * @param metrics Endpoint state.
+ * @param port TCP port, e.g. 9100.
+ * @return esp_err_t ESP_OK or ESP_FAIL if the socket can't be opened.
+ */
+esp_err_t zmpt101b_metrics_http_start(zmpt101b_metrics_t *metrics, uint16_t port);
+
+/**
+ * @brief Waits up to timeout_ms for HTTP traffic and serves it without blocking.
+ *
+ * Call it in a loop from the serving task. Anything but GET /metrics is answered with 404.
+ *
+ * @param metrics Endpoint state.
+ * @param timeout_ms Longest wait for traffic.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_STATE if the server isn't started.
+ */
+esp_err_t zmpt101b_metrics_http_service(zmpt101b_metrics_t *metrics, uint32_t timeout_ms);
+
+/**
+ * @brief Closes the listening socket and all connections.
+ *
+ * @param metrics Endpoint state.
+ */
+void zmpt101b_metrics_http_stop(zmpt101b_metrics_t *metrics);
+
+#ifdef ESP_PLATFORM
+/**
+ * @brief Registers GET /metrics on a running esp_http_server instead of the built-in server.
+ *
+ * @param metrics Endpoint state.
+ * @param server Server handle from httpd_start().
+ * @return esp_err_t Result of httpd_register_uri_handler().
+ */
+esp_err_t zmpt101b_metrics_register_handler(zmpt101b_metrics_t *metrics, httpd_handle_t server);
+#endif
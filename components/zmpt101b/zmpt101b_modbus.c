@@ -0,0 +1,373 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "zmpt101b_modbus.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "driver/uart.h"
+#endif
+
+#define FC_READ_HOLDING     0x03
+#define FC_READ_INPUT       0x04
+#define FC_WRITE_SINGLE     0x06
+#define FC_WRITE_MULTIPLE   0x10
+
+#define EX_ILLEGAL_FUNCTION 0x01
+#define EX_ILLEGAL_ADDRESS  0x02
+#define EX_ILLEGAL_VALUE    0x03
+#define EX_TARGET_FAILED    0x0B
+
+#define MAX_READ_REGISTERS  125
+#define MBAP_SIZE           7
+#define RTU_MIN_SIZE        4
+
+// Internal functions
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)(value >> 8);
+    p[1] = (uint8_t)value;
+}
+
+static void put_u32_registers(uint16_t *regs, uint32_t value)
+{
+    regs[0] = (uint16_t)(value >> 16);
+    regs[1] = (uint16_t)value;
+}
+
+// Lays the snapshot out as the register map
+static void fill_map(const zmpt101b_snapshot_data_t *data, uint16_t *regs)
+{
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_RMS, data->rms_mv);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_RMS_MIN, data->rms_min_mv);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_RMS_MAX, data->rms_max_mv);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_FREQUENCY, data->frequency_mhz);
+    regs[ZMPT101B_MODBUS_REG_THD] = data->thd_centi_pct;
+    regs[ZMPT101B_MODBUS_REG_ATTENUATION] = data->attenuation;
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_DIPS, data->dips);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_SWELLS, data->swells);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_INTERRUPTIONS, data->interruptions);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_QUALITY, data->quality);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_CLIPPED, data->clipped);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_GAPS, data->gaps);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_DUPLICATES, data->duplicates);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_RANGE_SWITCHES, data->range_switches);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_UPDATES, data->updates);
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_TIMESTAMP, (uint32_t)((uint64_t)data->timestamp_us >> 32));
+    put_u32_registers(regs + ZMPT101B_MODBUS_REG_TIMESTAMP + 2, (uint32_t)data->timestamp_us);
+}
+
+static size_t exception(zmpt101b_modbus_t *mb, uint8_t function, uint8_t code, uint8_t *out)
+{
+    mb->stats.exceptions++;
+    out[0] = function | 0x80;
+    out[1] = code;
+    return 2;
+}
+
+static size_t read_registers(zmpt101b_modbus_t *mb, const uint8_t *pdu, size_t length, uint8_t *out)
+{
+    const uint8_t function = pdu[0];
+    if (length != 5)
+        return exception(mb, function, EX_ILLEGAL_VALUE, out);
+    const uint16_t start = get_u16(pdu + 1);
+    const uint16_t count = get_u16(pdu + 3);
+    if (count == 0 || count > MAX_READ_REGISTERS)
+        return exception(mb, function, EX_ILLEGAL_VALUE, out);
+
+    out[0] = function;
+    out[1] = (uint8_t)(count * 2);
+    if (function == FC_READ_HOLDING && start == ZMPT101B_MODBUS_REG_CONTROL && count == 1) {
+        put_u16(out + 2, 0);
+        return 4;
+    }
+    if ((uint32_t)start + count > ZMPT101B_MODBUS_REG_COUNT)
+        return exception(mb, function, EX_ILLEGAL_ADDRESS, out);
+
+    zmpt101b_snapshot_data_t data;
+    mb->stats.snapshot_retries += zmpt101b_snapshot_read(mb->snapshot, &data) - 1;
+    uint16_t regs[ZMPT101B_MODBUS_REG_COUNT];
+    fill_map(&data, regs);
+    for (uint16_t i = 0; i < count; ++i)
+        put_u16(out + 2 + 2 * i, regs[start + i]);
+    return 2 + 2 * (size_t)count;
+}
+
+static bool write_control(zmpt101b_modbus_t *mb, uint16_t value)
+{
+    if (value == ZMPT101B_MODBUS_CONTROL_RESET_MINMAX)
+        zmpt101b_snapshot_reset_minmax(mb->snapshot);
+    else if (value != 0)
+        return false;
+    return true;
+}
+
+// Answers a PDU; out has room for the largest response PDU
+static size_t process_pdu(zmpt101b_modbus_t *mb, const uint8_t *pdu, size_t length, uint8_t *out)
+{
+    mb->stats.requests++;
+    const uint8_t function = pdu[0];
+    switch (function) {
+    case FC_READ_HOLDING:
+    case FC_READ_INPUT:
+        return read_registers(mb, pdu, length, out);
+
+    case FC_WRITE_SINGLE:
+        if (length != 5)
+            return exception(mb, function, EX_ILLEGAL_VALUE, out);
+        if (get_u16(pdu + 1) != ZMPT101B_MODBUS_REG_CONTROL)
+            return exception(mb, function, EX_ILLEGAL_ADDRESS, out);
+        if (!write_control(mb, get_u16(pdu + 3)))
+            return exception(mb, function, EX_ILLEGAL_VALUE, out);
+        memcpy(out, pdu, 5);
+        return 5;
+
+    case FC_WRITE_MULTIPLE:
+        if (length < 6 || length != 6 + (size_t)pdu[5] || pdu[5] != 2 * get_u16(pdu + 3))
+            return exception(mb, function, EX_ILLEGAL_VALUE, out);
+        if (get_u16(pdu + 1) != ZMPT101B_MODBUS_REG_CONTROL || get_u16(pdu + 3) != 1)
+            return exception(mb, function, EX_ILLEGAL_ADDRESS, out);
+        if (!write_control(mb, get_u16(pdu + 6)))
+            return exception(mb, function, EX_ILLEGAL_VALUE, out);
+        memcpy(out, pdu, 5);
+        return 5;
+
+    default:
+        return exception(mb, function, EX_ILLEGAL_FUNCTION, out);
+    }
+}
+
+static void close_client(zmpt101b_modbus_client_t *client)
+{
+    if (client->sock >= 0)
+        close(client->sock);
+    client->sock = -1;
+    client->length = 0;
+}
+
+static void accept_client(zmpt101b_modbus_t *mb)
+{
+    const int sock = accept(mb->listen_sock, NULL, NULL);
+    if (sock < 0)
+        return;
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+    const int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    // A free slot, else the connection idle the longest (e.g. half-open after a SCADA restart)
+    zmpt101b_modbus_client_t *slot = &mb->clients[0];
+    for (int i = 0; i < ZMPT101B_MODBUS_MAX_CLIENTS; ++i) {
+        zmpt101b_modbus_client_t *client = &mb->clients[i];
+        if (client->sock < 0) {
+            slot = client;
+            break;
+        }
+        if (mb->stats.requests - client->last_request > mb->stats.requests - slot->last_request)
+            slot = client;
+    }
+    close_client(slot);
+    slot->sock = sock;
+    slot->last_request = mb->stats.requests;
+    mb->stats.connections++;
+}
+
+// Reads from a connection and answers the complete ADUs, pipelined requests included
+static void serve_client(zmpt101b_modbus_t *mb, zmpt101b_modbus_client_t *client)
+{
+    const ssize_t received = recv(client->sock, client->buffer + client->length, sizeof(client->buffer) - client->length, 0);
+    if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close_client(client);
+        return;
+    }
+    if (received < 0)
+        return;
+    client->length += (size_t)received;
+
+    while (client->length >= MBAP_SIZE) {
+        const size_t adu_length = 6 + (size_t)get_u16(client->buffer + 4);
+        if (adu_length > sizeof(client->buffer) || adu_length <= MBAP_SIZE || get_u16(client->buffer + 2) != 0) {
+            // The stream can't be resynchronized
+            mb->stats.ignored++;
+            close_client(client);
+            return;
+        }
+        if (client->length < adu_length)
+            break;
+
+        uint8_t response[ZMPT101B_MODBUS_ADU_SIZE];
+        const size_t response_length = zmpt101b_modbus_tcp_process(mb, client->buffer, adu_length, response);
+        client->last_request = mb->stats.requests;
+        if (send(client->sock, response, response_length, 0) != (ssize_t)response_length) {
+            close_client(client);
+            return;
+        }
+        client->length -= adu_length;
+        memmove(client->buffer, client->buffer + adu_length, client->length);
+    }
+}
+
+// public API implementation
+esp_err_t zmpt101b_modbus_init(zmpt101b_modbus_t *mb, zmpt101b_snapshot_t *snapshot, uint8_t unit_id)
+{
+    if (mb == NULL || snapshot == NULL || unit_id == 0 || unit_id > 247) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(mb, 0, sizeof(*mb));
+    mb->snapshot = snapshot;
+    mb->unit_id = unit_id;
+    mb->listen_sock = -1;
+    for (int i = 0; i < ZMPT101B_MODBUS_MAX_CLIENTS; ++i)
+        mb->clients[i].sock = -1;
+    return ESP_OK;
+}
+
+size_t zmpt101b_modbus_rtu_process(zmpt101b_modbus_t *mb, const uint8_t *frame, size_t length, uint8_t *response)
+{
+    if (length < RTU_MIN_SIZE || length > ZMPT101B_MODBUS_ADU_SIZE ||
+        zmpt101b_modbus_crc16(frame, length - 2) != (frame[length - 2] | (frame[length - 1] << 8)) ||
+        (frame[0] != mb->unit_id && frame[0] != 0)) {
+        mb->stats.ignored++;
+        return 0;
+    }
+
+    const size_t pdu_length = process_pdu(mb, frame + 1, length - 3, response + 1);
+    // Broadcasts are executed but never answered
+    if (frame[0] == 0)
+        return 0;
+    response[0] = mb->unit_id;
+    const uint16_t crc = zmpt101b_modbus_crc16(response, 1 + pdu_length);
+    response[1 + pdu_length] = (uint8_t)crc;
+    response[2 + pdu_length] = (uint8_t)(crc >> 8);
+    return 3 + pdu_length;
+}
+
+size_t zmpt101b_modbus_tcp_process(zmpt101b_modbus_t *mb, const uint8_t *adu, size_t length, uint8_t *response)
+{
+    if (length <= MBAP_SIZE || length > ZMPT101B_MODBUS_ADU_SIZE || get_u16(adu + 2) != 0 || get_u16(adu + 4) != length - 6) {
+        mb->stats.ignored++;
+        return 0;
+    }
+
+    size_t pdu_length;
+    const uint8_t unit = adu[6];
+    if (unit == mb->unit_id || unit == 0 || unit == 0xFF) {
+        pdu_length = process_pdu(mb, adu + MBAP_SIZE, length - MBAP_SIZE, response + MBAP_SIZE);
+    } else {
+        mb->stats.requests++;
+        pdu_length = exception(mb, adu[MBAP_SIZE], EX_TARGET_FAILED, response + MBAP_SIZE);
+    }
+    memcpy(response, adu, 4);   // transaction and protocol identifiers
+    put_u16(response + 4, (uint16_t)(pdu_length + 1));
+    response[6] = unit;
+    return MBAP_SIZE + pdu_length;
+}
+
+esp_err_t zmpt101b_modbus_tcp_start(zmpt101b_modbus_t *mb, uint16_t port)
+{
+    const struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    mb->listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (mb->listen_sock < 0)
+        return ESP_FAIL;
+    const int reuse = 1;
+    setsockopt(mb->listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (bind(mb->listen_sock, (const struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(mb->listen_sock, ZMPT101B_MODBUS_MAX_CLIENTS) != 0) {
+        close(mb->listen_sock);
+        mb->listen_sock = -1;
+        return ESP_FAIL;
+    }
+    fcntl(mb->listen_sock, F_SETFL, fcntl(mb->listen_sock, F_GETFL, 0) | O_NONBLOCK);
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_modbus_tcp_service(zmpt101b_modbus_t *mb, uint32_t timeout_ms)
+{
+    if (mb->listen_sock < 0)
+        return ESP_ERR_INVALID_STATE;
+
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(mb->listen_sock, &readable);
+    int max_sock = mb->listen_sock;
+    for (int i = 0; i < ZMPT101B_MODBUS_MAX_CLIENTS; ++i) {
+        if (mb->clients[i].sock >= 0) {
+            FD_SET(mb->clients[i].sock, &readable);
+            if (mb->clients[i].sock > max_sock)
+                max_sock = mb->clients[i].sock;
+        }
+    }
+    struct timeval timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+    if (select(max_sock + 1, &readable, NULL, NULL, &timeout) <= 0)
+        return ESP_OK;
+
+    for (int i = 0; i < ZMPT101B_MODBUS_MAX_CLIENTS; ++i) {
+        if (mb->clients[i].sock >= 0 && FD_ISSET(mb->clients[i].sock, &readable))
+            serve_client(mb, &mb->clients[i]);
+    }
+    if (FD_ISSET(mb->listen_sock, &readable))
+        accept_client(mb);
+    return ESP_OK;
+}
+
+void zmpt101b_modbus_tcp_stop(zmpt101b_modbus_t *mb)
+{
+    for (int i = 0; i < ZMPT101B_MODBUS_MAX_CLIENTS; ++i)
+        close_client(&mb->clients[i]);
+    if (mb->listen_sock >= 0)
+        close(mb->listen_sock);
+    mb->listen_sock = -1;
+}
+
+#ifdef ESP_PLATFORM
+esp_err_t zmpt101b_modbus_rtu_service(zmpt101b_modbus_t *mb, int uart_num, uint32_t timeout_ms)
+{
+    uint8_t frame[ZMPT101B_MODBUS_ADU_SIZE];
+    int length = uart_read_bytes(uart_num, frame, 1, pdMS_TO_TICKS(timeout_ms));
+    if (length < 0)
+        return ESP_FAIL;
+    if (length == 0)
+        return ESP_ERR_TIMEOUT;
+
+    // The frame ends with the first idle tick
+    while (length < (int)sizeof(frame)) {
+        const int received = uart_read_bytes(uart_num, frame + length, sizeof(frame) - length, 1);
+        if (received <= 0)
+            break;
+        length += received;
+    }
+
+    uint8_t response[ZMPT101B_MODBUS_ADU_SIZE];
+    const size_t response_length = zmpt101b_modbus_rtu_process(mb, frame, (size_t)length, response);
+    if (response_length > 0 && uart_write_bytes(uart_num, response, response_length) < 0)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+#endif
+
+uint16_t zmpt101b_modbus_crc16(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
@@ -0,0 +1,177 @@
+/*
+ * ZMPT101B Modbus Server
+ *
+ * Serves the measurement snapshot (zmpt101b_snapshot.h) to SCADA systems over Modbus TCP
+ * (BSD sockets, lwIP on the device) and Modbus RTU (frames from any serial transport, UART
+ * helper on the device). Every request copies the snapshot once, so a multi-register read is
+ * consistent, and polling never blocks or slows down the acquisition task.
+ *
+ * Register map, input registers (function 0x04), mirrored read-only as holding registers
+ * (function 0x03). 32-bit values span two registers, high word first:
+ *   0  RMS voltage, mains mV          (u32)   16  quality bits              (u32)
+ *   2  RMS minimum since reset, mV    (u32)   18  clipped samples           (u32)
+ *   4  RMS maximum since reset, mV    (u32)   20  DMA gaps                  (u32)
+ *   6  frequency, mHz                 (u32)   22  duplicated DMA blocks     (u32)
+ *   8  THD, 0.01 %, 0xFFFF unknown    (u16)   24  range switches            (u32)
+ *   9  ADC attenuation                (u16)   26  snapshot updates          (u32)
+ *  10  dips, 0xFFFFFFFF unknown       (u32)   28  timestamp, us             (u64)
+ *  12  swells, 0xFFFFFFFF unknown     (u32)
+ *  14  interruptions, as above        (u32)
+ * Holding register 256 is the control register (functions 0x06 and 0x10): writing
+ * ZMPT101B_MODBUS_CONTROL_RESET_MINMAX restarts the RMS min/max. It reads back as 0.
+ *
+ * The server state is used from one serving task.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "zmpt101b_snapshot.h"
+
+// Modbus TCP port
+#define ZMPT101B_MODBUS_PORT 502
+
+// Concurrent Modbus TCP connections; a new one replaces the least recently active
+#define ZMPT101B_MODBUS_MAX_CLIENTS 4
+
+// Largest Modbus ADU (TCP: 7 byte MBAP header + 253 byte PDU; RTU: 256 bytes)
+#define ZMPT101B_MODBUS_ADU_SIZE 260
+
+// Register map, see the table above
+typedef enum {
+    ZMPT101B_MODBUS_REG_RMS = 0,
+    ZMPT101B_MODBUS_REG_RMS_MIN = 2,
+    ZMPT101B_MODBUS_REG_RMS_MAX = 4,
+    ZMPT101B_MODBUS_REG_FREQUENCY = 6,
+    ZMPT101B_MODBUS_REG_THD = 8,
+    ZMPT101B_MODBUS_REG_ATTENUATION = 9,
+    ZMPT101B_MODBUS_REG_DIPS = 10,
+    ZMPT101B_MODBUS_REG_SWELLS = 12,
+    ZMPT101B_MODBUS_REG_INTERRUPTIONS = 14,
+    ZMPT101B_MODBUS_REG_QUALITY = 16,
+    ZMPT101B_MODBUS_REG_CLIPPED = 18,
+    ZMPT101B_MODBUS_REG_GAPS = 20,
+    ZMPT101B_MODBUS_REG_DUPLICATES = 22,
+    ZMPT101B_MODBUS_REG_RANGE_SWITCHES = 24,
+    ZMPT101B_MODBUS_REG_UPDATES = 26,
+    ZMPT101B_MODBUS_REG_TIMESTAMP = 28,
+    ZMPT101B_MODBUS_REG_COUNT = 32,
+    ZMPT101B_MODBUS_REG_CONTROL = 256,
+} zmpt101b_modbus_register_t;
+
+#define ZMPT101B_MODBUS_CONTROL_RESET_MINMAX 1
+
+typedef struct {
+    uint32_t requests;          // requests answered, exceptions included
+    uint32_t exceptions;        // exception responses
+    uint32_t ignored;           // RTU frames with a bad CRC or another address, malformed TCP streams
+    uint32_t connections;       // TCP connections accepted
+    uint32_t snapshot_retries;  // snapshot copies repeated because they raced with the writer
+} zmpt101b_modbus_stats_t;
+
+typedef struct {
+    int      sock;
+    size_t   length;            // bytes buffered
+    uint32_t last_request;      // stats.requests at the last request, picks the connection to replace
+    uint8_t  buffer[ZMPT101B_MODBUS_ADU_SIZE];
+} zmpt101b_modbus_client_t;
+
+typedef struct {
+    zmpt101b_snapshot_t *snapshot;
+    uint8_t  unit_id;           // RTU address; TCP also accepts 0 and 0xFF
+    int      listen_sock;
+    zmpt101b_modbus_client_t clients[ZMPT101B_MODBUS_MAX_CLIENTS];
+    zmpt101b_modbus_stats_t stats;
+} zmpt101b_modbus_t;
+
+/**
+ * @brief Initializes the server state.
+ *
+ * @param mb Server state.
+ * @param snapshot Snapshot served, published by the acquisition task.
+ * @param unit_id Modbus unit (slave) address, 1..247.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_modbus_init(zmpt101b_modbus_t *mb, zmpt101b_snapshot_t *snapshot, uint8_t unit_id);
+
+/**
+ * @brief Answers one Modbus RTU frame (address, PDU, CRC).
+ *
+ * @param mb Server state.
+ * @param frame Received frame.
+ * @param length Frame length.
+ * @param response Buffer for the response, ZMPT101B_MODBUS_ADU_SIZE bytes.
+ * @return size_t Response length, 0 if nothing must be sent (bad CRC, other address, broadcast).
+ */
+size_t zmpt101b_modbus_rtu_process(zmpt101b_modbus_t *mb, const uint8_t *frame, size_t length, uint8_t *response);
+
+/**
+ * @brief Answers one complete Modbus TCP ADU (MBAP header and PDU).
+ *
+ * @param mb Server state.
+ * @param adu Received ADU.
+ * @param length ADU length.
+ * @param response Buffer for the response, ZMPT101B_MODBUS_ADU_SIZE bytes.
+ * @return size_t Response length, 0 if the ADU is malformed.
+ */
+size_t zmpt101b_modbus_tcp_process(zmpt101b_modbus_t *mb, const uint8_t *adu, size_t length, uint8_t *response);
+
+/**
+ * @brief Opens the Modbus TCP listening socket.
+ *
+ * @param mb Server state.
+ * @param port TCP port, usually ZMPT101B_MODBUS_PORT.
+ * @return esp_err_t ESP_OK or ESP_FAIL if the socket can't be opened.
+ */
+esp_err_t zmpt101b_modbus_tcp_start(zmpt101b_modbus_t *mb, uint16_t port);
+
+/**
+ * @brief Waits up to timeout_ms for Modbus TCP traffic and answers every complete request.
+ *
+ * Call it in a loop from the serving task.
+ *
+ * @param mb Server state.
+ * @param timeout_ms Longest wait for traffic.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_STATE if the server isn't started.
+ */
+esp_err_t zmpt101b_modbus_tcp_service(zmpt101b_modbus_t *mb, uint32_t timeout_ms);
+
+/**
+ * @brief Closes the listening socket and all connections.
+ *
+ * @param mb Server state.
+ */
+void zmpt101b_modbus_tcp_stop(zmpt101b_modbus_t *mb);
+
+#ifdef ESP_PLATFORM
+/**
+ * @brief Waits up to timeout_ms for a Modbus RTU frame on a UART and answers it.
+ *
+ * The UART driver must be installed and configured by the application (half-duplex RS-485
+ * mode for a transceiver with direction control). A frame ends when the line stays idle
+ * for one RTOS tick.
+ *
+ * @param mb Server state.
+ * @param uart_num UART port.
+ * @param timeout_ms Longest wait for the first byte of a frame.
+ * @return esp_err_t ESP_OK, ESP_ERR_TIMEOUT if nothing arrived, or a UART error.
+ */
+esp_err_t zmpt101b_modbus_rtu_service(zmpt101b_modbus_t *mb, int uart_num, uint32_t timeout_ms);
+#endif
+
+/**
+ * @brief Modbus CRC-16 (polynomial 0xA001, initial value 0xFFFF), sent low byte first.
+ *
+ * @param data Data.
+ * @param length Data length.
+ * @return uint16_t CRC.
+ */
+uint16_t zmpt101b_modbus_crc16(const uint8_t *data, size_t length);
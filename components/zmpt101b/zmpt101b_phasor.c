@@ -0,0 +1,236 @@
+#include <string.h>
+#include <math.h>
+#include "zmpt101b_phasor.h"
+#include "zmpt101b_fixed.h"
+
+#define TWO_PI 6.28318530718f
+
+#define FREQUENCY_HISTORY ( ZMPT101B_PHASOR_ROCOF_CYCLES * ZMPT101B_PHASOR_MAX_REPORTS + 1 )
+
+// Internal functions
+static float wrap_angle(float angle)
+{
+    while (angle > (float)M_PI)
+        angle -= TWO_PI;
+    while (angle <= -(float)M_PI)
+        angle += TWO_PI;
+    return angle;
+}
+
+// One sample into the sliding DFT. The sample leaving the window had the same window position,
+// so its term used the same twiddle: the difference is added once and the sums stay exact.
+// Returns true if a phasor is due with this sample.
+static inline bool push(zmpt101b_phasor_estimator_t *pe, int16_t sample)
+{
+    const uint16_t index = pe->index;
+    const int32_t difference = (int32_t)sample - pe->history[index];
+    pe->history[index] = sample;
+    pe->sum_re += (int64_t)difference * pe->twiddle[index][0];
+    pe->sum_im -= (int64_t)difference * pe->twiddle[index][1];
+    pe->samples++;
+    if (pe->fill < pe->window)
+        pe->fill++;
+    if (++pe->index == pe->window)
+        pe->index = 0;
+    if (index != pe->next_report)
+        return false;
+    const uint8_t reports = pe->config.reports_per_cycle;
+    pe->report = (pe->report + 1) % reports;
+    pe->next_report = (uint16_t)((pe->report + 1) * pe->window / reports - 1);
+    // Not before the window is full
+    return pe->fill == pe->window;
+}
+
+// Normalised sum of e^(j * omega * k) for k = 0..N-1, as magnitude and the phase of its centre
+static void geometric(float omega, uint16_t n, float *re, float *im)
+{
+    const float half = omega / 2;
+    const float gain = fabsf(sinf(half)) < 1e-7f ? 1.0f : sinf(half * n) / (n * sinf(half));
+    *re = gain * cosf(half * (n - 1));
+    *im = gain * sinf(half * (n - 1));
+}
+
+// A cosine at omega with phasor P gives the bin Y = a P + b conj(P): a is the fundamental seen
+// off the bin, b its negative-frequency image. Solves for P.
+static void solve(float omega, uint16_t n, float y_re, float y_im, float *p_re, float *p_im)
+{
+    const float bin = TWO_PI / n;
+    float a_re, a_im, b_re, b_im;
+    geometric(-(omega - bin), n, &a_re, &a_im);
+    geometric(omega + bin, n, &b_re, &b_im);
+    const float determinant = a_re * a_re + a_im * a_im - b_re * b_re - b_im * b_im;
+    // (conj(a) Y - b conj(Y)) / determinant
+    *p_re = (a_re * y_re + a_im * y_im - b_re * y_re - b_im * y_im) / determinant;
+    *p_im = (a_re * y_im - a_im * y_re - b_im * y_re + b_re * y_im) / determinant;
+}
+
+// Frequency from the phase advance between the last two phasors, both solved with the same
+// frequency so a change of the estimate doesn't show up as phase advance. A phasor at the bin
+// frequency advances by the bin times the hop; what it moved beyond that is the offset from the
+// bin. Refined once with its own result.
+static bool estimate_omega(zmpt101b_phasor_estimator_t *pe, float y_re, float y_im, uint32_t hop)
+{
+    const uint16_t n = pe->window;
+    const float bin = TWO_PI / n;
+    const float nominal = TWO_PI * pe->config.nominal_freq / (float)pe->config.sample_rate;
+    float omega = pe->omega;
+    for (int pass = 0; pass < 2; pass++) {
+        float last_re, last_im, p_re, p_im;
+        solve(omega, n, pe->last_re, pe->last_im, &last_re, &last_im);
+        solve(omega, n, y_re, y_im, &p_re, &p_im);
+        const float advance = atan2f(p_im, p_re) - atan2f(last_im, last_re) - bin * (float)(hop % n);
+        omega = bin + wrap_angle(advance) / (float)hop;
+        if (fabsf(omega - nominal) * 100 > nominal * ZMPT101B_PHASOR_RANGE_PCT)
+            return false;
+    }
+    pe->omega = omega;
+    return true;
+}
+
+// Phasor of the window ending with the last sample, and frequency and ROCOF from the ones before it
+static void finish(zmpt101b_phasor_estimator_t *pe)
+{
+    const uint16_t n = pe->window;
+    const float bin = TWO_PI / n;
+    const float sample_rate = (float)pe->config.sample_rate;
+    const uint64_t sample = pe->samples - 1;
+
+    // The bin rotated to the window position of the last sample: Y
+    const float scale = 2.0f / ((float)n * ZMPT101B_Q15_ONE);
+    const float s_re = (float)pe->sum_re * scale;
+    const float s_im = (float)pe->sum_im * scale;
+    const float rotation = bin * (float)((pe->index + n - 1) % n);
+    const float y_re = s_re * cosf(rotation) - s_im * sinf(rotation);
+    const float y_im = s_re * sinf(rotation) + s_im * cosf(rotation);
+
+    zmpt101b_phasor_t *phasor = &pe->last;
+    phasor->frequency_valid = pe->last_valid && estimate_omega(pe, y_re, y_im, (uint32_t)(sample - phasor->sample));
+    pe->last_re = y_re;
+    pe->last_im = y_im;
+    pe->last_valid = true;
+
+    float p_re, p_im;
+    solve(pe->omega, n, y_re, y_im, &p_re, &p_im);
+    phasor->sample = sample;
+    phasor->magnitude = sqrtf(p_re * p_re + p_im * p_im) * (float)M_SQRT1_2;
+    phasor->frequency = pe->omega * sample_rate / TWO_PI;
+
+    // Channels sampled later in the frame are rotated back to the frame's reference instant
+    phasor->angle = wrap_angle(atan2f(p_im, p_re) - pe->omega * sample_rate * (float)pe->config.skew_ns * 1e-9f);
+
+    phasor->rocof = 0;
+    phasor->rocof_valid = false;
+    if (!phasor->frequency_valid) {
+        pe->frequencies = 0;
+        return;
+    }
+    const uint8_t span = ZMPT101B_PHASOR_ROCOF_CYCLES * pe->config.reports_per_cycle;
+    pe->frequency_head = (pe->frequency_head + 1) % FREQUENCY_HISTORY;
+    pe->frequency_history[pe->frequency_head] = phasor->frequency;
+    pe->frequency_sample[pe->frequency_head] = sample;
+    if (pe->frequencies <= span)
+        pe->frequencies++;
+    if (pe->frequencies > span) {
+        const uint8_t oldest = (pe->frequency_head + FREQUENCY_HISTORY - span) % FREQUENCY_HISTORY;
+        const float span_s = (float)(sample - pe->frequency_sample[oldest]) / sample_rate;
+        phasor->rocof = (phasor->frequency - pe->frequency_history[oldest]) / span_s;
+        phasor->rocof_valid = true;
+    }
+}
+
+// public API implementation
+esp_err_t zmpt101b_phasor_init(zmpt101b_phasor_estimator_t *pe, const zmpt101b_phasor_config_t *config)
+{
+    if (pe == NULL || config == NULL || config->sample_rate == 0 || config->nominal_freq == 0 ||
+        config->reports_per_cycle > ZMPT101B_PHASOR_MAX_REPORTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint32_t window = (config->sample_rate + config->nominal_freq / 2) / config->nominal_freq;
+    if (window < 8 || window > ZMPT101B_PHASOR_MAX_N) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(pe, 0, sizeof(*pe));
+    pe->config = *config;
+    if (pe->config.reports_per_cycle == 0)
+        pe->config.reports_per_cycle = 1;
+    pe->window = (uint16_t)window;
+    pe->next_report = (uint16_t)(window / pe->config.reports_per_cycle - 1);
+    for (uint32_t i = 0; i < window; i++) {
+        const double angle = 2.0 * M_PI * i / window;
+        pe->twiddle[i][0] = (zmpt101b_q15_t)lround(ZMPT101B_Q15_ONE * cos(angle));
+        pe->twiddle[i][1] = (zmpt101b_q15_t)lround(ZMPT101B_Q15_ONE * sin(angle));
+    }
+    pe->omega = TWO_PI * config->nominal_freq / config->sample_rate;
+    return ESP_OK;
+}
+
+void zmpt101b_phasor_reset(zmpt101b_phasor_estimator_t *pe)
+{
+    memset(pe->history, 0, sizeof(pe->history));
+    pe->sum_re = 0;
+    pe->sum_im = 0;
+    pe->index = 0;
+    pe->fill = 0;
+    pe->report = 0;
+    pe->next_report = (uint16_t)(pe->window / pe->config.reports_per_cycle - 1);
+    pe->last_valid = false;
+    pe->frequencies = 0;
+}
+
+size_t zmpt101b_phasor_process(zmpt101b_phasor_estimator_t *pe, const int16_t *in, size_t len,
+                               zmpt101b_phasor_t *out, size_t out_len)
+{
+    size_t completed = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!push(pe, in[i]))
+            continue;
+        finish(pe);
+        if (out != NULL && completed < out_len)
+            out[completed] = pe->last;
+        completed++;
+    }
+    return completed;
+}
+
+size_t zmpt101b_phasor_process_interleaved(zmpt101b_phasor_estimator_t *pe, size_t channels, const int16_t *in,
+                                           size_t len, zmpt101b_phasor_t *out, size_t out_len)
+{
+    if (channels == 0)
+        return 0;
+    size_t completed = 0;
+    for (size_t frame = 0; frame + channels <= len; frame += channels) {
+        bool done = false;
+        for (size_t c = 0; c < channels; c++) {
+            if (push(&pe[c], in[frame + c])) {
+                finish(&pe[c]);
+                done = true;
+            }
+        }
+        if (!done)
+            continue;
+        if (out != NULL && (completed + 1) * channels <= out_len) {
+            for (size_t c = 0; c < channels; c++)
+                out[completed * channels + c] = pe[c].last;
+        }
+        completed++;
+    }
+    return completed;
+}
+
+esp_err_t zmpt101b_phasor_get(const zmpt101b_phasor_estimator_t *pe, zmpt101b_phasor_t *phasor)
+{
+    if (pe->samples < pe->window) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *phasor = pe->last;
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_phasor_angle_between(const zmpt101b_phasor_t *a, const zmpt101b_phasor_t *b, float *angle)
+{
+    if (a->sample != b->sample) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *angle = wrap_angle(a->angle - b->angle);
+    return ESP_OK;
+}
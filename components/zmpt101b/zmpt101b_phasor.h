@@ -0,0 +1,164 @@
+/*
+ * ZMPT101B Phasor Estimator
+ *
+ * Synchrophasor-style estimate of the fundamental: magnitude, phase angle, frequency and ROCOF,
+ * once or twice per mains cycle, from the streaming samples (zmpt101b_read_samples()).
+ * - A one-cycle recursive sliding DFT of the fundamental bin over the last N samples, N the
+ *   nominal cycle length rounded to whole samples. Each sample adds its own term and removes the
+ *   term of the sample leaving the window, with the same twiddle, so the update is O(1) and the
+ *   sums are exact integers that never drift (Q15 twiddles, 64-bit accumulators).
+ * - Once per window, or every half window for protection (zmpt101b_protection.h), the sums are
+ *   rotated to the last sample and become a phasor in floating point. Off the bin
+ *   frequency a one-cycle window leaks the negative-frequency image of the fundamental into the
+ *   bin; both terms are known functions of the frequency, so the phasor is solved from the bin
+ *   with the last frequency estimate and the ripple goes away.
+ * - The frequency is the phase advance from one phasor to the next, both solved with the same
+ *   estimate, so it is the mean over the span of both windows and lags the phasor by one window
+ *   (half a window when reporting every half cycle). ROCOF is the frequency change over
+ *   ZMPT101B_PHASOR_ROCOF_CYCLES cycles.
+ * - At the bin frequency harmonics don't reach the bin. Off it they leak in proportion to the
+ *   offset, about 1 % of a harmonic per 0.5 Hz at 50 Hz; for distorted signals far off nominal,
+ *   feed the stream from zmpt101b_resample.h instead (the frequency then reads nominal).
+ * - The phasor refers to the last sample of the window, cosine reference. Several estimators fed
+ *   from the same multi-channel DMA stream produce their phasors for the same frame, so their
+ *   angles compare directly; the time each channel is sampled after the first one in a scan is
+ *   compensated with zmpt101b_phasor_config_t.skew_ns.
+ * An estimator holds the window and the twiddles, about 6 KB at ZMPT101B_PHASOR_MAX_N. No memory
+ * is allocated and no hardware is used; tools/zmpt101b_phasor_sim.py checks the accuracy against
+ * analytic signals and measures the cost per sample on the host.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Longest window, in samples per channel (25 kHz at 50 Hz is 500)
+#define ZMPT101B_PHASOR_MAX_N 1024
+
+// Cycles between the frequencies ROCOF is taken from (5 cycles = 100 ms at 50 Hz)
+#define ZMPT101B_PHASOR_ROCOF_CYCLES 5
+
+// Most phasors per window
+#define ZMPT101B_PHASOR_MAX_REPORTS 2
+
+// Frequencies further than this from nominal are out of range and not used for the image
+// correction, in percent
+#define ZMPT101B_PHASOR_RANGE_PCT 20
+
+typedef struct {
+    uint64_t sample;            // index of the sample the phasor refers to, the last of the window
+    float    magnitude;         // RMS of the fundamental, input units
+    float    angle;             // phase angle in radians, (-pi, pi]
+    float    frequency;         // Hz, nominal until frequency_valid
+    float    rocof;             // Hz/s, 0 until rocof_valid
+    bool     frequency_valid;   // two phasors in a row without a break
+    bool     rocof_valid;       // valid frequencies in a row over ZMPT101B_PHASOR_ROCOF_CYCLES cycles
+} zmpt101b_phasor_t;
+
+typedef struct {
+    uint32_t sample_rate;       // per channel, Hz
+    uint16_t nominal_freq;      // Hz
+    uint32_t skew_ns;           // time this channel is sampled after the reference channel of its frame
+    uint8_t  reports_per_cycle; // phasors per window: 1 (0 counts as 1), or 2 for one every half cycle
+} zmpt101b_phasor_config_t;
+
+typedef struct {
+    zmpt101b_phasor_config_t config;
+    uint16_t window;            // samples per window, N
+    uint16_t index;             // window position of the next sample
+    uint16_t next_report;       // window position of the last sample of the next phasor
+    uint16_t fill;              // samples in the window since init or reset, up to N
+    uint8_t  report;            // phasors so far in this window
+    int64_t  sum_re;            // sliding DFT, Q15
+    int64_t  sum_im;
+    int16_t  history[ZMPT101B_PHASOR_MAX_N];
+    int16_t  twiddle[ZMPT101B_PHASOR_MAX_N][2]; // cos and sin of the bin, Q15
+    uint64_t samples;           // samples consumed
+    float    omega;             // frequency estimate, radians per sample
+    float    last_re;           // bin of the last window, for the frequency
+    float    last_im;
+    bool     last_valid;
+    uint8_t  frequencies;       // valid frequencies in the ROCOF history
+    uint8_t  frequency_head;
+    float    frequency_history[ZMPT101B_PHASOR_ROCOF_CYCLES * ZMPT101B_PHASOR_MAX_REPORTS + 1];
+    uint64_t frequency_sample[ZMPT101B_PHASOR_ROCOF_CYCLES * ZMPT101B_PHASOR_MAX_REPORTS + 1];
+    zmpt101b_phasor_t last;
+} zmpt101b_phasor_estimator_t;
+
+/**
+ * @brief Initializes an estimator.
+ *
+ * @param pe Estimator state.
+ * @param config Sample rate, nominal frequency, sampling skew and report rate of the channel.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_ARG if the window doesn't fit ZMPT101B_PHASOR_MAX_N.
+ */
+esp_err_t zmpt101b_phasor_init(zmpt101b_phasor_estimator_t *pe, const zmpt101b_phasor_config_t *config);
+
+/**
+ * @brief Starts over after a break in the input, e.g. a block flagged ZMPT101B_QUALITY_GAP.
+ *
+ * The window fills again before the next phasor, a cycle after the reset. The frequency estimate
+ * is kept for the image correction; frequency and ROCOF become valid again after two phasors and
+ * ZMPT101B_PHASOR_ROCOF_CYCLES cycles more.
+ *
+ * @param pe Estimator state.
+ */
+void zmpt101b_phasor_reset(zmpt101b_phasor_estimator_t *pe);
+
+/**
+ * @brief Feeds a block of samples of one channel.
+ *
+ * @param pe Estimator state.
+ * @param in Samples, e.g. millivolts from zmpt101b_read_samples().
+ * @param len Number of samples.
+ * @param out Phasors completed in this block, oldest first; may be NULL.
+ * @param out_len Capacity of `out`. Phasors past it are only kept as the last one.
+ * @return size_t Number of phasors completed in this block.
+ */
+size_t zmpt101b_phasor_process(zmpt101b_phasor_estimator_t *pe, const int16_t *in, size_t len,
+                               zmpt101b_phasor_t *out, size_t out_len);
+
+/**
+ * @brief Feeds a block of interleaved frames, one sample per channel and frame.
+ *
+ * All estimators must share sample rate and nominal frequency and start together, so their
+ * phasors complete on the same frame and refer to it.
+ *
+ * @param pe Estimators, one per channel in frame order.
+ * @param channels Number of channels.
+ * @param in Interleaved samples; a trailing partial frame is ignored.
+ * @param len Number of samples.
+ * @param out Phasors completed in this block, `channels` per phasor in channel order; may be NULL.
+ * @param out_len Capacity of `out`, in phasors.
+ * @return size_t Number of phasors per channel completed in this block.
+ */
+size_t zmpt101b_phasor_process_interleaved(zmpt101b_phasor_estimator_t *pe, size_t channels, const int16_t *in,
+                                           size_t len, zmpt101b_phasor_t *out, size_t out_len);
+
+/**
+ * @brief Returns the last phasor.
+ *
+ * @param pe Estimator state.
+ * @param phasor Last phasor.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_STATE before the first window is complete.
+ */
+esp_err_t zmpt101b_phasor_get(const zmpt101b_phasor_estimator_t *pe, zmpt101b_phasor_t *phasor);
+
+/**
+ * @brief Returns the angle from one phasor to another of the same frame, e.g. phase-to-phase.
+ *
+ * @param a Leading phasor, e.g. L1.
+ * @param b Phasor of another channel for the same sample, e.g. L2.
+ * @param angle Angle of `a` minus the angle of `b` in radians, (-pi, pi]; +2pi/3 for L1 to L2
+ *              in positive sequence.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_ARG if the phasors refer to different samples.
+ */
+esp_err_t zmpt101b_phasor_angle_between(const zmpt101b_phasor_t *a, const zmpt101b_phasor_t *b, float *angle);
@@ -0,0 +1,242 @@
+#include <string.h>
+#include <math.h>
+#include "zmpt101b_protection.h"
+#ifdef ESP_PLATFORM
+#include "driver/gpio.h"
+#include "esp_cpu.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+#else
+#include <time.h>
+#endif
+
+// Internal functions
+#ifdef ESP_PLATFORM
+static int64_t now_us(void)
+{
+    return esp_timer_get_time();
+}
+
+// CPU cycles, for the evaluation time
+static uint32_t now_ticks(void)
+{
+    return (uint32_t)esp_cpu_get_cycle_count();
+}
+
+static uint32_t ticks_to_ns(uint32_t ticks)
+{
+    return (uint32_t)((uint64_t)ticks * 1000 / esp_rom_get_cpu_ticks_per_us());
+}
+
+static void drive_output(const zmpt101b_protection_config_t *config, bool trip)
+{
+    if (config->trip_gpio >= 0)
+        gpio_set_level((gpio_num_t)config->trip_gpio, trip ? config->trip_level : !config->trip_level);
+}
+#else
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t now_ticks(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec);
+}
+
+static uint32_t ticks_to_ns(uint32_t ticks)
+{
+    return ticks;
+}
+
+static void drive_output(const zmpt101b_protection_config_t *config, bool trip)
+{
+    (void)config;
+    (void)trip;
+}
+#endif
+
+// Value of the element's quantity and how far it is past the threshold in the tripping direction;
+// false while the element is blocked
+static bool excess(const zmpt101b_protection_element_t *element, const zmpt101b_phasor_t *phasor, bool blocked,
+                   float *value, float *beyond)
+{
+    switch (element->quantity) {
+    case ZMPT101B_PROTECTION_UNDER_FREQUENCY:
+        *value = phasor->frequency;
+        *beyond = element->threshold - phasor->frequency;
+        return !blocked && phasor->frequency_valid;
+    case ZMPT101B_PROTECTION_OVER_FREQUENCY:
+        *value = phasor->frequency;
+        *beyond = phasor->frequency - element->threshold;
+        return !blocked && phasor->frequency_valid;
+    case ZMPT101B_PROTECTION_ROCOF:
+        *value = phasor->rocof;
+        *beyond = fabsf(phasor->rocof) - element->threshold;
+        return !blocked && phasor->rocof_valid;
+    case ZMPT101B_PROTECTION_UNDER_VOLTAGE:
+        *value = phasor->magnitude;
+        *beyond = element->threshold - phasor->magnitude;
+        return true;
+    case ZMPT101B_PROTECTION_OVER_VOLTAGE:
+        *value = phasor->magnitude;
+        *beyond = phasor->magnitude - element->threshold;
+        return true;
+    }
+    return false;
+}
+
+// One evaluation of all elements on the phasor that just completed
+static void evaluate(zmpt101b_protection_t *pr, const zmpt101b_phasor_t *phasor, int64_t sample_time_us)
+{
+    const uint32_t start = now_ticks();
+    const zmpt101b_protection_config_t *config = &pr->config;
+    const bool blocked = phasor->magnitude < config->block_voltage;
+    zmpt101b_protection_stats_t *stats = &pr->stats;
+
+    stats->evaluations++;
+    if (blocked)
+        stats->blocked++;
+    for (uint8_t e = 0; e < config->element_count; e++) {
+        const zmpt101b_protection_element_t *element = &config->elements[e];
+        const uint8_t bit = 1 << e;
+        float value, beyond;
+        // Picks up past the threshold, drops out only once back by the hysteresis
+        const float dropout = (pr->picked & bit) ? -element->hysteresis : 0;
+        if (!excess(element, phasor, blocked, &value, &beyond) || beyond <= dropout) {
+            pr->picked &= ~bit;
+            continue;
+        }
+        if (!(pr->picked & bit)) {
+            pr->picked |= bit;
+            pr->pickup_sample[e] = phasor->sample;
+        }
+        if (pr->tripped || phasor->sample - pr->pickup_sample[e] < pr->delay_samples[e])
+            continue;
+
+        // Outputs first, the record after
+        drive_output(config, true);
+        const int64_t output_us = now_us();
+        pr->tripped = true;
+        stats->trips++;
+        zmpt101b_protection_trip_t *trip = &pr->trip;
+        trip->sample = phasor->sample;
+        trip->pickup_sample = pr->pickup_sample[e];
+        trip->element = e;
+        trip->quantity = element->quantity;
+        trip->value = value;
+        trip->phasor = *phasor;
+        trip->sample_time_us = sample_time_us;
+        trip->output_us = output_us;
+        if (config->on_trip != NULL)
+            config->on_trip(trip, config->arg);
+    }
+
+    stats->eval_ns_last = ticks_to_ns(now_ticks() - start);
+    if (stats->eval_ns_last > stats->eval_ns_max)
+        stats->eval_ns_max = stats->eval_ns_last;
+    if (sample_time_us == 0)
+        return;
+    const int64_t latency_us = now_us() - sample_time_us;
+    stats->latency_us_last = latency_us > 0 ? (uint32_t)latency_us : 0;
+    if (stats->latency_us_last > stats->latency_us_max)
+        stats->latency_us_max = stats->latency_us_last;
+    if (config->deadline_us != 0 && stats->latency_us_last > config->deadline_us)
+        stats->deadline_misses++;
+}
+
+// public API implementation
+esp_err_t zmpt101b_protection_init(zmpt101b_protection_t *pr, const zmpt101b_protection_config_t *config)
+{
+    if (pr == NULL || config == NULL || config->element_count > ZMPT101B_PROTECTION_MAX_ELEMENTS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(pr, 0, sizeof(*pr));
+    pr->config = *config;
+    const zmpt101b_phasor_config_t phasor_config = {
+        .sample_rate = config->sample_rate,
+        .nominal_freq = config->nominal_freq,
+        .reports_per_cycle = 2,
+    };
+    esp_err_t ret = zmpt101b_phasor_init(&pr->phasor, &phasor_config);
+    if (ret != ESP_OK)
+        return ret;
+    for (uint8_t e = 0; e < config->element_count; e++)
+        pr->delay_samples[e] = (uint32_t)((uint64_t)config->elements[e].delay_ms * config->sample_rate / 1000);
+
+#ifdef ESP_PLATFORM
+    if (config->trip_gpio >= 0) {
+        const gpio_config_t io_conf = {
+            .pin_bit_mask = 1ULL << config->trip_gpio,
+            .mode = GPIO_MODE_OUTPUT,
+            .pull_up_en = GPIO_PULLUP_DISABLE,
+            .pull_down_en = GPIO_PULLDOWN_DISABLE,
+            .intr_type = GPIO_INTR_DISABLE,
+        };
+        ret = gpio_config(&io_conf);
+        if (ret != ESP_OK)
+            return ret;
+    }
+#endif
+    drive_output(config, false);
+    return ESP_OK;
+}
+
+void zmpt101b_protection_reset(zmpt101b_protection_t *pr)
+{
+    zmpt101b_phasor_reset(&pr->phasor);
+    pr->picked = 0;
+}
+
+size_t zmpt101b_protection_process(zmpt101b_protection_t *pr, const int16_t *in, size_t len,
+                                   const zmpt101b_block_time_t *time)
+{
+    zmpt101b_phasor_estimator_t *pe = &pr->phasor;
+    const uint64_t first = pe->samples;
+    size_t evaluations = 0;
+    size_t position = 0;
+    while (position < len) {
+        // Up to the next phasor, so it is evaluated before the rest of the block is processed
+        size_t chunk = pe->next_report >= pe->index ? (size_t)(pe->next_report - pe->index + 1)
+                                                    : (size_t)(pe->window - pe->index + pe->next_report + 1);
+        if (chunk > len - position)
+            chunk = len - position;
+        zmpt101b_phasor_t phasor;
+        const size_t completed = zmpt101b_phasor_process(pe, in + position, chunk, &phasor, 1);
+        position += chunk;
+        if (completed == 0)
+            continue;
+
+        int64_t sample_time_us = 0;
+        if (time != NULL)
+            sample_time_us = time->time_us + (int64_t)((phasor.sample - first) * time->period_ps / 1000000);
+        evaluate(pr, &phasor, sample_time_us);
+        evaluations++;
+    }
+    return evaluations;
+}
+
+esp_err_t zmpt101b_protection_get_trip(const zmpt101b_protection_t *pr, zmpt101b_protection_trip_t *trip)
+{
+    if (!pr->tripped) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    *trip = pr->trip;
+    return ESP_OK;
+}
+
+void zmpt101b_protection_rearm(zmpt101b_protection_t *pr)
+{
+    pr->tripped = false;
+    pr->picked = 0;
+    drive_output(&pr->config, false);
+}
+
+void zmpt101b_protection_get_stats(const zmpt101b_protection_t *pr, zmpt101b_protection_stats_t *stats)
+{
+    *stats = pr->stats;
+}
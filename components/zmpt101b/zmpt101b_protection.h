@@ -0,0 +1,176 @@
+/*
+ * ZMPT101B Protection
+ *
+ * Interface protection for generator sites (anti-islanding): trips on under/over frequency,
+ * ROCOF and under/over voltage within a bounded number of cycles, evaluated in the DSP task
+ * that reads the sample stream (zmpt101b_read_samples()).
+ * - The measurements are the phasors of zmpt101b_phasor.h, reported every half cycle: RMS of the
+ *   fundamental, frequency and ROCOF. Every phasor is one evaluation of all elements.
+ * - An element is a threshold on one quantity with a definite-time delay. Several elements on
+ *   the same quantity make a stepped trip curve, e.g. U< 85 % after 3 s and U<< 45 % after 0.16 s
+ *   as grid codes specify it. The delay counts samples of the stream, not task time, so the
+ *   decision is deterministic. An element drops out and starts over as soon as the quantity is
+ *   back past the threshold by its hysteresis for one evaluation, so measurement noise on a slow
+ *   excursion doesn't keep restarting the delay.
+ * - Frequency and ROCOF elements are blocked while the voltage is below block_voltage or the
+ *   estimate isn't valid, e.g. right after a gap; an undervoltage element covers a collapse.
+ * - The first element that times out trips: the GPIO is driven and the callback called, from
+ *   the task that feeds the samples, before the rest of the block is processed. The trip is
+ *   latched until zmpt101b_protection_rearm().
+ * - Latency from a step to the trip is the delay plus the detection time, which is bounded by
+ *   the window: voltage ZMPT101B_PROTECTION_VOLTAGE_HALF_CYCLES, frequency
+ *   ZMPT101B_PROTECTION_FREQUENCY_HALF_CYCLES and ROCOF ZMPT101B_PROTECTION_ROCOF_HALF_CYCLES.
+ *   On the device the samples of a DMA block are only seen when the block is read; with the
+ *   block time (zmpt101b_get_block_time()) every evaluation measures how long after its last
+ *   sample was taken the decision came out, and how long it took. The worst of both is kept and
+ *   decisions later than deadline_us are counted.
+ * One phasor estimator per channel, about 6 KB; nothing is allocated. The element logic has no
+ * hardware dependencies; tools/zmpt101b_protection_sim.py runs scripted frequency and voltage
+ * excursions on the host and checks every trip and its latency against the bounds.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "zmpt101b_phasor.h"
+#include "zmpt101b_timestamp.h"
+
+// Most elements per stage
+#define ZMPT101B_PROTECTION_MAX_ELEMENTS 8
+
+// Worst-case detection time of a step beyond the element's delay, in half cycles: a voltage step
+// is fully in the window after one cycle, the frequency lags it by half a cycle more and ROCOF
+// spans ZMPT101B_PHASOR_ROCOF_CYCLES cycles on top. One half cycle each is for the evaluation.
+#define ZMPT101B_PROTECTION_VOLTAGE_HALF_CYCLES 3
+#define ZMPT101B_PROTECTION_FREQUENCY_HALF_CYCLES 4
+#define ZMPT101B_PROTECTION_ROCOF_HALF_CYCLES (2 * ZMPT101B_PHASOR_ROCOF_CYCLES + 4)
+
+typedef enum {
+    ZMPT101B_PROTECTION_UNDER_FREQUENCY = 0,    // frequency below the threshold, Hz
+    ZMPT101B_PROTECTION_OVER_FREQUENCY,         // frequency above the threshold, Hz
+    ZMPT101B_PROTECTION_ROCOF,                  // absolute ROCOF above the threshold, Hz/s
+    ZMPT101B_PROTECTION_UNDER_VOLTAGE,          // RMS of the fundamental below the threshold, input units
+    ZMPT101B_PROTECTION_OVER_VOLTAGE,           // RMS of the fundamental above the threshold, input units
+} zmpt101b_protection_quantity_t;
+
+typedef struct {
+    zmpt101b_protection_quantity_t quantity;
+    float    threshold;
+    float    hysteresis;        // once picked up, drops out only this far back past the threshold, same units
+    uint32_t delay_ms;          // the condition must hold this long, 0 trips on the first evaluation
+} zmpt101b_protection_element_t;
+
+typedef struct {
+    uint64_t sample;            // last sample of the evaluation that tripped
+    uint64_t pickup_sample;     // last sample of the evaluation the element picked up on
+    uint8_t  element;           // index in zmpt101b_protection_config_t.elements
+    zmpt101b_protection_quantity_t quantity;
+    float    value;             // measured quantity at the trip
+    zmpt101b_phasor_t phasor;   // the evaluation that tripped
+    int64_t  sample_time_us;    // esp_timer time `sample` was taken, 0 without block time
+    int64_t  output_us;         // esp_timer time the output was driven
+} zmpt101b_protection_trip_t;
+
+typedef void (*zmpt101b_protection_cb_t)(const zmpt101b_protection_trip_t *trip, void *arg);
+
+typedef struct {
+    uint32_t sample_rate;       // per channel, Hz
+    uint16_t nominal_freq;      // Hz
+    zmpt101b_protection_element_t elements[ZMPT101B_PROTECTION_MAX_ELEMENTS];
+    uint8_t  element_count;
+    float    block_voltage;     // frequency and ROCOF elements are blocked below this RMS, input units
+    int32_t  trip_gpio;         // driven to trip_level on a trip, -1 for none
+    uint8_t  trip_level;
+    zmpt101b_protection_cb_t on_trip; // called on a trip, may be NULL
+    void    *arg;
+    uint32_t deadline_us;       // decisions later than this after their last sample are counted, 0 not to count
+} zmpt101b_protection_config_t;
+
+typedef struct {
+    uint32_t evaluations;       // half cycles evaluated
+    uint32_t blocked;           // evaluations with frequency and ROCOF elements blocked
+    uint32_t eval_ns_last;      // time one evaluation took, output included
+    uint32_t eval_ns_max;
+    uint32_t latency_us_last;   // from the last sample of an evaluation being taken to its decision
+    uint32_t latency_us_max;
+    uint32_t deadline_misses;   // decisions later than deadline_us
+    uint32_t trips;
+} zmpt101b_protection_stats_t;
+
+typedef struct {
+    zmpt101b_protection_config_t config;
+    zmpt101b_phasor_estimator_t phasor;
+    uint32_t delay_samples[ZMPT101B_PROTECTION_MAX_ELEMENTS];
+    uint64_t pickup_sample[ZMPT101B_PROTECTION_MAX_ELEMENTS];
+    uint8_t  picked;            // bit n set: element n is timing
+    bool     tripped;
+    zmpt101b_protection_trip_t trip;
+    zmpt101b_protection_stats_t stats;
+} zmpt101b_protection_t;
+
+/**
+ * @brief Initializes the stage and sets the trip GPIO, if any, to the inactive level.
+ *
+ * @param pr Stage state.
+ * @param config Sample rate, nominal frequency, elements and outputs.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG, or the error of the GPIO driver.
+ */
+esp_err_t zmpt101b_protection_init(zmpt101b_protection_t *pr, const zmpt101b_protection_config_t *config);
+
+/**
+ * @brief Starts the measurement over after a break in the input, e.g. a block flagged
+ *        ZMPT101B_QUALITY_GAP. Timing elements drop out; a trip stays latched. The elements
+ *        are evaluated again once the phasor window has refilled, a cycle later.
+ *
+ * @param pr Stage state.
+ */
+void zmpt101b_protection_reset(zmpt101b_protection_t *pr);
+
+/**
+ * @brief Feeds a block of samples and evaluates the elements every half cycle.
+ *
+ * Call it from the task that reads the stream, right after the read. A trip drives the outputs
+ * before the function returns.
+ *
+ * @param pr Stage state.
+ * @param in Samples, e.g. millivolts from zmpt101b_read_samples().
+ * @param len Number of samples.
+ * @param time When the block was sampled, from zmpt101b_get_block_time(); NULL leaves the
+ *             latency unmeasured.
+ * @return size_t Number of evaluations in this block.
+ */
+size_t zmpt101b_protection_process(zmpt101b_protection_t *pr, const int16_t *in, size_t len,
+                                   const zmpt101b_block_time_t *time);
+
+/**
+ * @brief Returns the latched trip.
+ *
+ * @param pr Stage state.
+ * @param trip Receives the trip.
+ * @return esp_err_t ESP_OK, or ESP_ERR_NOT_FOUND if the stage hasn't tripped.
+ */
+esp_err_t zmpt101b_protection_get_trip(const zmpt101b_protection_t *pr, zmpt101b_protection_trip_t *trip);
+
+/**
+ * @brief Releases a latched trip: the GPIO goes back to the inactive level and all elements
+ *        start timing from scratch.
+ *
+ * @param pr Stage state.
+ */
+void zmpt101b_protection_rearm(zmpt101b_protection_t *pr);
+
+/**
+ * @brief Returns the counters and the latency measurements.
+ *
+ * @param pr Stage state.
+ * @param stats Receives the statistics.
+ */
+void zmpt101b_protection_get_stats(const zmpt101b_protection_t *pr, zmpt101b_protection_stats_t *stats);
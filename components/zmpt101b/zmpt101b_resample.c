@@ -0,0 +1,114 @@
+#include <string.h>
+#include "zmpt101b_resample.h"
+
+#define ONE_Q32 ( (int64_t)1 << 32 )
+
+// Internal functions
+static void set_period(zmpt101b_resample_t *rs, uint32_t period_q16)
+{
+    rs->period_q16 = period_q16;
+    rs->step_q32 = (int64_t)(((uint64_t)period_q16 << 16) / rs->samples_per_cycle);
+    rs->stats.frequency_mhz = (uint32_t)((((uint64_t)rs->sample_rate * 1000) << 16) / period_q16);
+}
+
+static void measure_cycle(zmpt101b_resample_t *rs)
+{
+    const uint32_t period_q16 = rs->zc.period_q16;
+    if (period_q16 < rs->min_period_q16 || period_q16 > rs->max_period_q16) {
+        rs->stats.rejected++;
+        return;
+    }
+    if (rs->stats.cycles++ == 0) {
+        set_period(rs, period_q16);
+        return;
+    }
+    const int32_t change_q16 = (int32_t)(period_q16 - rs->period_q16) / (1 << ZMPT101B_RESAMPLE_PERIOD_SHIFT);
+    set_period(rs, (uint32_t)((int32_t)rs->period_q16 + change_q16));
+}
+
+// Catmull-Rom cubic between history[1] and history[2], Farrow form with coefficients doubled so
+// they stay integral
+static int16_t interpolate(const int32_t *x, int32_t mu)
+{
+    const int32_t c0 = 2 * x[1];
+    const int32_t c1 = x[2] - x[0];
+    const int32_t c2 = 2 * x[0] - 5 * x[1] + 4 * x[2] - x[3];
+    const int32_t c3 = x[3] - x[0] + 3 * (x[1] - x[2]);
+    int32_t y = (c3 * mu) >> ZMPT101B_RESAMPLE_MU_BITS;
+    y = ((y + c2) * mu) >> ZMPT101B_RESAMPLE_MU_BITS;
+    y = ((y + c1) * mu) >> ZMPT101B_RESAMPLE_MU_BITS;
+    y = (y + c0 + 1) >> 1;
+    return (int16_t)(y > INT16_MAX ? INT16_MAX : y < INT16_MIN ? INT16_MIN : y);
+}
+
+// public API implementation
+esp_err_t zmpt101b_resample_init(zmpt101b_resample_t *rs, uint16_t samples_per_cycle, uint32_t sample_rate,
+                                 uint16_t nominal_freq, int32_t hysteresis)
+{
+    if (rs == NULL || samples_per_cycle == 0 || nominal_freq == 0 || sample_rate < nominal_freq * 4u) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(rs, 0, sizeof(*rs));
+    rs->samples_per_cycle = samples_per_cycle;
+    rs->sample_rate = sample_rate;
+    rs->nominal_period_q16 = (uint32_t)(((uint64_t)sample_rate << 16) / nominal_freq);
+    rs->min_period_q16 = (uint32_t)((uint64_t)rs->nominal_period_q16 * (100 - ZMPT101B_RESAMPLE_RANGE_PCT) / 100);
+    rs->max_period_q16 = (uint32_t)((uint64_t)rs->nominal_period_q16 * (100 + ZMPT101B_RESAMPLE_RANGE_PCT) / 100);
+    set_period(rs, rs->nominal_period_q16);
+    zmpt101b_zc_init(&rs->zc, hysteresis);
+    return ESP_OK;
+}
+
+void zmpt101b_resample_reset(zmpt101b_resample_t *rs)
+{
+    zmpt101b_zc_init(&rs->zc, rs->zc.hysteresis);
+    rs->filled = 0;
+    rs->position_q32 = 0;
+}
+
+size_t zmpt101b_resample_process(zmpt101b_resample_t *rs, const int16_t *in, size_t in_len, int16_t *out, size_t out_len)
+{
+    int32_t *x = rs->history;
+    int64_t position_q32 = rs->position_q32;
+    size_t count = 0;
+
+    for (size_t i = 0; i < in_len; ++i) {
+        if (zmpt101b_zc_update(&rs->zc, in[i]) == ZMPT101B_ZC_RISING && rs->zc.rising_count >= 2)
+            measure_cycle(rs);
+
+        x[0] = x[1];
+        x[1] = x[2];
+        x[2] = x[3];
+        x[3] = in[i];
+        if (rs->filled < 4) {
+            if (++rs->filled < 4)
+                continue;
+        }
+
+        // Every output position between history[1] and history[2]
+        while (position_q32 < ONE_Q32) {
+            const int32_t mu = (int32_t)(position_q32 >> (32 - ZMPT101B_RESAMPLE_MU_BITS));
+            if (count < out_len)
+                out[count++] = interpolate(x, mu);
+            else
+                rs->stats.dropped++;
+            rs->stats.outputs++;
+            position_q32 += rs->step_q32;
+        }
+        position_q32 -= ONE_Q32;
+    }
+
+    rs->position_q32 = position_q32;
+    rs->stats.inputs += in_len;
+    return count;
+}
+
+size_t zmpt101b_resample_max_output(const zmpt101b_resample_t *rs, size_t in_len)
+{
+    return (size_t)((((uint64_t)in_len * rs->samples_per_cycle) << 16) / rs->min_period_q16) + 2;
+}
+
+void zmpt101b_resample_get_stats(const zmpt101b_resample_t *rs, zmpt101b_resample_stats_t *stats)
+{
+    *stats = rs->stats;
+}
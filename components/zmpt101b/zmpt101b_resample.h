@@ -0,0 +1,116 @@
+/*
+ * ZMPT101B Cycle-Synchronous Resampler
+ *
+ * Streaming fractional resampler that turns the fixed-rate sample stream into N samples per
+ * mains cycle, for synchronous DFT/Goertzel analysis where the sample clock can't be locked to
+ * the grid (see zmpt101b_gridlock.h for the APLL alternative).
+ * - The input cycle length is measured by a zero-crossing detector on the input itself, and
+ *   smoothed over a few cycles. Each output sample lies that length / N input samples after
+ *   the previous one.
+ * - Output samples are interpolated with a cubic (Catmull-Rom) Farrow structure over the four
+ *   input samples around them, in 32-bit integer arithmetic. The fractional position has
+ *   1/2048 sample resolution; the interpolation error stays well below 1 mV on mains
+ *   waveforms sampled at a few hundred samples per cycle.
+ * - Until a cycle length is measured, and for cycles outside ZMPT101B_RESAMPLE_RANGE_PCT of
+ *   nominal, the nominal frequency is assumed.
+ * Blocks can be any length and no memory is allocated. The output lags the input by one to two
+ * samples.
+ * No hardware dependencies; tools/zmpt101b_resample_sim.py checks the accuracy against analytic
+ * waveforms and measures the cost per sample on the host.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "zmpt101b_zerocross.h"
+
+// Measured cycles further than this from the nominal cycle length are ignored, in percent
+#define ZMPT101B_RESAMPLE_RANGE_PCT 20
+
+// Smoothing of the measured cycle length, as a power of two (1/4 of the difference per cycle)
+#define ZMPT101B_RESAMPLE_PERIOD_SHIFT 2
+
+// Resolution of the interpolation position, in bits. 11 keeps the Farrow stages within 32 bits.
+#define ZMPT101B_RESAMPLE_MU_BITS 11
+
+typedef struct {
+    uint64_t inputs;            // input samples consumed
+    uint64_t outputs;           // output samples produced
+    uint32_t cycles;            // input cycles measured
+    uint32_t rejected;          // cycles outside the capture range
+    uint32_t dropped;           // output samples that didn't fit the output buffer
+    uint32_t frequency_mhz;     // mains frequency the step is based on
+} zmpt101b_resample_stats_t;
+
+typedef struct {
+    uint16_t samples_per_cycle; // output samples per mains cycle, N
+    uint32_t sample_rate;       // input rate in Hz
+    uint32_t nominal_period_q16;
+    uint32_t min_period_q16;
+    uint32_t max_period_q16;
+    uint32_t period_q16;        // smoothed input samples per cycle, Q16
+    int64_t  step_q32;          // input samples per output sample, Q32
+    int64_t  position_q32;      // next output position past history[1], Q32
+    int32_t  history[4];        // last four input samples, oldest first
+    uint8_t  filled;            // input samples in the history, up to 4
+    zmpt101b_zc_t zc;
+    zmpt101b_resample_stats_t stats;
+} zmpt101b_resample_t;
+
+/**
+ * @brief Initializes a resampler at the nominal frequency.
+ *
+ * @param rs Resampler state.
+ * @param samples_per_cycle Output samples per mains cycle.
+ * @param sample_rate Input sample rate in Hz.
+ * @param nominal_freq Nominal mains frequency in Hz.
+ * @param hysteresis Zero-crossing hysteresis in input units, e.g. ZMPT101B_DUTY_ZC_HYSTERESIS_MV.
+ * @return esp_err_t ESP_OK or ESP_ERR_INVALID_ARG.
+ */
+esp_err_t zmpt101b_resample_init(zmpt101b_resample_t *rs, uint16_t samples_per_cycle, uint32_t sample_rate,
+                                 uint16_t nominal_freq, int32_t hysteresis);
+
+/**
+ * @brief Starts over after a break in the input, e.g. a block flagged ZMPT101B_QUALITY_GAP.
+ *
+ * The measured cycle length is kept.
+ *
+ * @param rs Resampler state.
+ */
+void zmpt101b_resample_reset(zmpt101b_resample_t *rs);
+
+/**
+ * @brief Resamples a block of input.
+ *
+ * @param rs Resampler state.
+ * @param in Input samples, e.g. millivolts from zmpt101b_read_samples().
+ * @param in_len Number of input samples.
+ * @param out Output buffer.
+ * @param out_len Capacity of `out`; zmpt101b_resample_max_output() is always enough.
+ * @return size_t Number of samples written to `out`. Output past a full buffer is dropped.
+ */
+size_t zmpt101b_resample_process(zmpt101b_resample_t *rs, const int16_t *in, size_t in_len, int16_t *out, size_t out_len);
+
+/**
+ * @brief Returns the most output samples a block of input can produce.
+ *
+ * @param rs Resampler state.
+ * @param in_len Number of input samples.
+ * @return size_t Output samples at the top of the capture range, rounded up.
+ */
+size_t zmpt101b_resample_max_output(const zmpt101b_resample_t *rs, size_t in_len);
+
+/**
+ * @brief Returns the resampler statistics.
+ *
+ * @param rs Resampler state.
+ * @param stats Statistics.
+ */
+void zmpt101b_resample_get_stats(const zmpt101b_resample_t *rs, zmpt101b_resample_stats_t *stats);
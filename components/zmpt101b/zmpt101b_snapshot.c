@@ -0,0 +1,66 @@
+#include <string.h>
+#include "zmpt101b_snapshot.h"
+
+// public API implementation
+void zmpt101b_snapshot_init(zmpt101b_snapshot_t *snapshot)
+{
+    memset(snapshot, 0, sizeof(*snapshot));
+    for (int i = 0; i < 2; ++i) {
+        atomic_init(&snapshot->buffers[i].sequence, 0);
+        snapshot->buffers[i].data.thd_centi_pct = ZMPT101B_SNAPSHOT_THD_UNKNOWN;
+        snapshot->buffers[i].data.dips = ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN;
+        snapshot->buffers[i].data.swells = ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN;
+        snapshot->buffers[i].data.interruptions = ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN;
+    }
+    atomic_init(&snapshot->published, 0);
+    atomic_init(&snapshot->reset_minmax, false);
+    snapshot->rms_min_mv = UINT32_MAX;
+}
+
+void zmpt101b_snapshot_publish(zmpt101b_snapshot_t *snapshot, const zmpt101b_snapshot_data_t *data)
+{
+    if (atomic_exchange_explicit(&snapshot->reset_minmax, false, memory_order_relaxed)) {
+        snapshot->rms_min_mv = UINT32_MAX;
+        snapshot->rms_max_mv = 0;
+    }
+    if (data->rms_mv < snapshot->rms_min_mv)
+        snapshot->rms_min_mv = data->rms_mv;
+    if (data->rms_mv > snapshot->rms_max_mv)
+        snapshot->rms_max_mv = data->rms_mv;
+    snapshot->updates++;
+
+    // Readers are directed to the other buffer, one still copying this one sees the odd sequence change
+    const unsigned index = atomic_load_explicit(&snapshot->published, memory_order_relaxed) ^ 1;
+    zmpt101b_snapshot_buffer_t *buffer = &snapshot->buffers[index];
+    const unsigned sequence = atomic_load_explicit(&buffer->sequence, memory_order_relaxed);
+    atomic_store_explicit(&buffer->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    buffer->data = *data;
+    buffer->data.rms_min_mv = snapshot->rms_min_mv;
+    buffer->data.rms_max_mv = snapshot->rms_max_mv;
+    buffer->data.updates = snapshot->updates;
+
+    atomic_store_explicit(&buffer->sequence, sequence + 2, memory_order_release);
+    atomic_store_explicit(&snapshot->published, index, memory_order_release);
+}
+
+uint32_t zmpt101b_snapshot_read(zmpt101b_snapshot_t *snapshot, zmpt101b_snapshot_data_t *data)
+{
+    for (uint32_t attempt = 1;; ++attempt) {
+        const unsigned index = atomic_load_explicit(&snapshot->published, memory_order_acquire);
+        zmpt101b_snapshot_buffer_t *buffer = &snapshot->buffers[index];
+        const unsigned before = atomic_load_explicit(&buffer->sequence, memory_order_acquire);
+        if (before & 1)
+            continue;
+        memcpy(data, &buffer->data, sizeof(*data));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&buffer->sequence, memory_order_relaxed) == before)
+            return attempt;
+    }
+}
+
+void zmpt101b_snapshot_reset_minmax(zmpt101b_snapshot_t *snapshot)
+{
+    atomic_store_explicit(&snapshot->reset_minmax, true, memory_order_relaxed);
+}
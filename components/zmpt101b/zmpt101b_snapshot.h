@@ -0,0 +1,96 @@
+/*
+ * ZMPT101B Measurement Snapshot
+ *
+ * Double-buffered snapshot of the latest measurements, published by the acquisition task and
+ * read by protocol servers (Modbus, HTTP, ...) without locks:
+ * - The writer fills the buffer readers aren't directed to, then flips the published index.
+ *   It never waits for a reader.
+ * - Each buffer carries a sequence counter, odd while it is written. A reader copies the
+ *   published buffer and retries only if the writer came around to that very buffer during
+ *   the copy, which takes two publications while one copy is in progress.
+ * One writer task, any number of readers.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// THD value when no harmonic analysis feeds the snapshot
+#define ZMPT101B_SNAPSHOT_THD_UNKNOWN 0xFFFF
+
+// Event counter value when no event detection (e.g. zmpt101b_aggregation.h) feeds the snapshot
+#define ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN 0xFFFFFFFF
+
+typedef struct {
+    int64_t  timestamp_us;      // time of the measurement
+    uint32_t rms_mv;            // RMS voltage in mains millivolts
+    uint32_t rms_min_mv;        // lowest RMS since the last reset, filled by zmpt101b_snapshot_publish()
+    uint32_t rms_max_mv;        // highest RMS since the last reset, filled by zmpt101b_snapshot_publish()
+    uint32_t frequency_mhz;     // 0 while unknown
+    uint16_t thd_centi_pct;     // THD in 0.01 %, ZMPT101B_SNAPSHOT_THD_UNKNOWN without harmonic analysis
+    uint16_t attenuation;       // ADC attenuation of the measurement
+    uint32_t dips;              // ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN without event detection, as the two below
+    uint32_t swells;
+    uint32_t interruptions;
+    uint32_t quality;           // ZMPT101B_QUALITY_* bits
+    uint32_t clipped;           // clipped samples
+    uint32_t gaps;              // DMA gaps
+    uint32_t duplicates;        // duplicated DMA blocks
+    uint32_t range_switches;
+    uint32_t updates;           // publications so far, filled by zmpt101b_snapshot_publish()
+    uint32_t window_us;         // time the measurement took to sample and process
+} zmpt101b_snapshot_data_t;
+
+typedef struct {
+    atomic_uint sequence;       // odd while the buffer is written
+    zmpt101b_snapshot_data_t data;
+} zmpt101b_snapshot_buffer_t;
+
+typedef struct {
+    zmpt101b_snapshot_buffer_t buffers[2];
+    atomic_uint published;      // index of the buffer readers copy
+    atomic_bool reset_minmax;   // reset request from a reader, applied by the next publication
+    uint32_t rms_min_mv;        // writer side
+    uint32_t rms_max_mv;
+    uint32_t updates;
+} zmpt101b_snapshot_t;
+
+/**
+ * @brief Initializes an empty snapshot (updates 0, THD and event counters unknown).
+ *
+ * @param snapshot Snapshot.
+ */
+void zmpt101b_snapshot_init(zmpt101b_snapshot_t *snapshot);
+
+/**
+ * @brief Publishes new measurements. Writer task only; never blocks.
+ *
+ * The RMS min/max and the update counter of data are maintained by the snapshot and ignored.
+ *
+ * @param snapshot Snapshot.
+ * @param data Measurements.
+ */
+void zmpt101b_snapshot_publish(zmpt101b_snapshot_t *snapshot, const zmpt101b_snapshot_data_t *data);
+
+/**
+ * @brief Copies the latest published measurements. Safe from any task, concurrently with the writer.
+ *
+ * @param snapshot Snapshot.
+ * @param data Receives a consistent copy.
+ * @return uint32_t Attempts the copy took, 1 unless it raced with the writer.
+ */
+uint32_t zmpt101b_snapshot_read(zmpt101b_snapshot_t *snapshot, zmpt101b_snapshot_data_t *data);
+
+/**
+ * @brief Requests the RMS min/max to restart from the next publication. Safe from any task.
+ *
+ * @param snapshot Snapshot.
+ */
+void zmpt101b_snapshot_reset_minmax(zmpt101b_snapshot_t *snapshot);
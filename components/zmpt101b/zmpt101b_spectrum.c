@@ -0,0 +1,310 @@
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include "zmpt101b_spectrum.h"
+#include "zmpt101b_fixed.h"
+
+// Bits the windowed samples are raised by before the FFT: 4095 mV at most, times 2^4, grows to
+// 2^26 over a 512-point complex FFT, and the split adds 2 bits, well within 32
+#define INPUT_SHIFT 4
+
+// Largest difference from the segment mean the headroom is made for, mV
+#define INPUT_LIMIT 4095
+
+// Internal functions
+static inline int32_t round_q15(int64_t x)
+{
+    return (int32_t)((x + (1 << 14)) >> 15);
+}
+
+// Mean-free, windowed and scaled segment into the FFT buffer, oldest sample first. Read as
+// complex numbers, even samples real and odd imaginary, it is what the half-size FFT takes.
+static void load_segment(zmpt101b_spectrum_t *sp)
+{
+    const uint32_t n = sp->config.fft_size;
+    const uint32_t mask = n - 1;
+    int32_t sum = 0;
+    for (uint32_t i = 0; i < n; i++)
+        sum += sp->history[i];
+    const int32_t mean = (sum + (int32_t)(n / 2)) >> sp->log2_size;
+    for (uint32_t i = 0; i < n; i++) {
+        int32_t x = sp->history[(sp->index + i) & mask] - mean;
+        x = x > INPUT_LIMIT ? INPUT_LIMIT : x < -INPUT_LIMIT ? -INPUT_LIMIT : x;
+        const int32_t w = sp->window[i <= n / 2 ? i : n - i];
+        sp->work[i] = (x * w + (1 << (14 - INPUT_SHIFT))) >> (15 - INPUT_SHIFT);
+    }
+}
+
+// In-place radix-2 decimation-in-time FFT of m = fft_size / 2 complex values; the twiddle
+// table is for fft_size, so the stage of `size` points steps it by fft_size / size
+static void fft(zmpt101b_spectrum_t *sp)
+{
+    int32_t *z = sp->work;
+    const uint32_t m = sp->config.fft_size / 2;
+    const uint32_t bits = sp->log2_size - 1u;
+    for (uint32_t i = 1; i < m; i++) {
+        uint32_t r = 0;
+        for (uint32_t b = 0; b < bits; b++)
+            r |= ((i >> b) & 1u) << (bits - 1 - b);
+        if (r > i) {
+            const int32_t re = z[2 * i], im = z[2 * i + 1];
+            z[2 * i] = z[2 * r];
+            z[2 * i + 1] = z[2 * r + 1];
+            z[2 * r] = re;
+            z[2 * r + 1] = im;
+        }
+    }
+    for (uint32_t size = 2; size <= m; size <<= 1) {
+        const uint32_t half = size / 2;
+        const uint32_t step = sp->config.fft_size / size;
+        for (uint32_t start = 0; start < m; start += size) {
+            int32_t *a = z + 2 * start;
+            int32_t *b = a + 2 * half;
+            // The first twiddle is 1, which Q15 can't hold exactly
+            int32_t t_re = b[0], t_im = b[1];
+            b[0] = a[0] - t_re;
+            b[1] = a[1] - t_im;
+            a[0] += t_re;
+            a[1] += t_im;
+            for (uint32_t j = 1; j < half; j++) {
+                const int32_t c = sp->twiddle[j * step][0];
+                const int32_t s = sp->twiddle[j * step][1];
+                // b * e^(-j theta)
+                t_re = round_q15((int64_t)b[2 * j] * c + (int64_t)b[2 * j + 1] * s);
+                t_im = round_q15((int64_t)b[2 * j + 1] * c - (int64_t)b[2 * j] * s);
+                b[2 * j] = a[2 * j] - t_re;
+                b[2 * j + 1] = a[2 * j + 1] - t_im;
+                a[2 * j] += t_re;
+                a[2 * j + 1] += t_im;
+            }
+        }
+    }
+}
+
+// Splits the half-size FFT Z into the real signal's bins and adds their power:
+// 2 X[k] = Z[k] + conj(Z[m - k]) - j e^(-j 2 pi k / n) (Z[k] - conj(Z[m - k]))
+static void accumulate_power(zmpt101b_spectrum_t *sp)
+{
+    const int32_t *z = sp->work;
+    const uint32_t m = sp->config.fft_size / 2;
+    for (uint32_t k = 0; k <= m; k++) {
+        const uint32_t i = k == m ? 0 : k;
+        const uint32_t r = k == 0 ? 0 : m - k;
+        const int64_t e_re = (int64_t)z[2 * i] + z[2 * r];
+        const int64_t e_im = (int64_t)z[2 * i + 1] - z[2 * r + 1];
+        // -j (Z[k] - conj(Z[m - k]))
+        const int64_t q_re = (int64_t)z[2 * i + 1] + z[2 * r + 1];
+        const int64_t q_im = (int64_t)z[2 * r] - z[2 * i];
+        int64_t x_re, x_im;
+        if (k == m) {
+            x_re = e_re - q_re;
+            x_im = e_im - q_im;
+        } else {
+            const int64_t c = sp->twiddle[k][0];
+            const int64_t s = sp->twiddle[k][1];
+            x_re = e_re + ((q_re * c + q_im * s + (1 << 14)) >> 15);
+            x_im = e_im + ((q_im * c - q_re * s + (1 << 14)) >> 15);
+        }
+        // |2 X|^2 / 4
+        sp->power[k] += (uint64_t)(x_re * x_re + x_im * x_im) >> 2;
+    }
+}
+
+// Bins of a tone around `centre`, clipped to the spectrum
+static void lobe(float centre, uint32_t m, uint32_t *first, uint32_t *last)
+{
+    const int32_t k = (int32_t)lroundf(centre);
+    *first = k > ZMPT101B_SPECTRUM_LOBE ? (uint32_t)(k - ZMPT101B_SPECTRUM_LOBE) : 0;
+    *last = (uint32_t)(k + ZMPT101B_SPECTRUM_LOBE) < m ? (uint32_t)(k + ZMPT101B_SPECTRUM_LOBE) : m;
+}
+
+// Power-weighted centre of the bins from first to last
+static float centroid(const float *psd, uint32_t first, uint32_t last)
+{
+    float sum = 0, moment = 0;
+    for (uint32_t k = first; k <= last; k++) {
+        sum += psd[k];
+        moment += psd[k] * k;
+    }
+    return sum > 0 ? moment / sum : (float)first;
+}
+
+// Whether a bin is DC, or within the main lobe of the fundamental or a harmonic at `fundamental` bins
+static bool excluded(uint32_t k, float fundamental)
+{
+    if (k < ZMPT101B_SPECTRUM_DC_BINS)
+        return true;
+    const float h = roundf(k / fundamental);
+    return h >= 1 && h <= ZMPT101B_SPECTRUM_HARMONICS &&
+           fabsf(k - h * fundamental) <= ZMPT101B_SPECTRUM_LOBE + 0.5f;
+}
+
+// The power sums as the published PSD, and its estimates
+static void publish(zmpt101b_spectrum_t *sp)
+{
+    const uint32_t m = sp->config.fft_size / 2;
+    const float bin_hz = (float)sp->config.sample_rate / sp->config.fft_size;
+    for (uint32_t k = 0; k <= m; k++) {
+        // One-sided: the negative frequencies fold onto every bin but DC and the Nyquist bin
+        sp->psd[k] = (float)sp->power[k] * sp->scale * (k == 0 || k == m ? 1.0f : 2.0f);
+        sp->power[k] = 0;
+    }
+    sp->segments = 0;
+
+    zmpt101b_spectrum_result_t *result = &sp->result;
+    result->sample = sp->samples - 1;
+    result->spectra++;
+    result->bin_hz = bin_hz;
+
+    // Fundamental: the strongest bin near nominal, its frequency from the main lobe
+    uint32_t low = 1, high = m;
+    if (sp->config.nominal_freq) {
+        low = (uint32_t)(0.8f * sp->config.nominal_freq / bin_hz);
+        high = (uint32_t)ceilf(1.2f * sp->config.nominal_freq / bin_hz);
+        low = low < 1 ? 1 : low;
+        high = high > m ? m : high;
+    }
+    uint32_t peak = low;
+    for (uint32_t k = low; k <= high; k++) {
+        if (sp->psd[k] > sp->psd[peak])
+            peak = k;
+    }
+    uint32_t first, last;
+    lobe((float)peak, m, &first, &last);
+    const float fundamental = centroid(sp->psd, first, last);
+    float signal = 0;
+    for (uint32_t k = first; k <= last; k++)
+        signal += sp->psd[k];
+    signal *= bin_hz;
+    result->signal_hz = fundamental * bin_hz;
+    result->signal_rms_mv = sqrtf(signal);
+
+    // Noise: the bins left, and the strongest of them
+    float noise = 0;
+    uint32_t noise_bins = 0;
+    uint32_t spur = 0;
+    for (uint32_t k = 0; k <= m; k++) {
+        if (excluded(k, fundamental))
+            continue;
+        noise += sp->psd[k];
+        noise_bins++;
+        if (spur == 0 || sp->psd[k] > sp->psd[spur])
+            spur = k;
+    }
+    result->noise_density = 0;
+    result->noise_rms_mv = 0;
+    result->snr_db = 0;
+    result->enob = 0;
+    result->spur_hz = 0;
+    result->spur_dbc = 0;
+    if (noise_bins == 0)
+        return;
+
+    // The largest spur, which the noise floor leaves out
+    lobe((float)spur, m, &first, &last);
+    float spur_power = 0, moment = 0;
+    uint32_t spur_bins = 0;
+    for (uint32_t k = first; k <= last; k++) {
+        if (excluded(k, fundamental))
+            continue;
+        spur_power += sp->psd[k];
+        moment += sp->psd[k] * k;
+        spur_bins++;
+    }
+    result->spur_hz = spur_power > 0 ? moment / spur_power * bin_hz : spur * bin_hz;
+    result->spur_dbc = signal > 0 && spur_power > 0 ? 10 * log10f(spur_power * bin_hz / signal) : 0;
+    result->noise_density = noise_bins > spur_bins ? (noise - spur_power) / (noise_bins - spur_bins) : noise / noise_bins;
+
+    // Every noise bin counts once, the spur included, and the floor stands in for the bins of
+    // DC, the fundamental and the harmonics
+    const float noise_power = (noise + result->noise_density * (m + 1 - noise_bins)) * bin_hz;
+    result->noise_rms_mv = sqrtf(noise_power);
+    result->snr_db = signal > 0 && noise_power > 0 ? 10 * log10f(signal / noise_power) : 0;
+    result->enob = (result->snr_db - 1.76f) / 6.02f;
+}
+
+// public API implementation
+esp_err_t zmpt101b_spectrum_init(zmpt101b_spectrum_t *sp, const zmpt101b_spectrum_config_t *config)
+{
+    if (sp == NULL || config == NULL || config->sample_rate == 0 || config->fft_size < 16 ||
+        config->fft_size > ZMPT101B_SPECTRUM_MAX_N || (config->fft_size & (config->fft_size - 1)) != 0 ||
+        config->averages == 0 || config->averages > ZMPT101B_SPECTRUM_MAX_AVERAGES) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // The segment mean takes a fundamental of less than two cycles apart
+    if (config->nominal_freq != 0 && (uint64_t)config->fft_size * config->nominal_freq < 2ull * config->sample_rate) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(sp, 0, sizeof(*sp));
+    sp->config = *config;
+    const uint32_t n = config->fft_size;
+    while ((1u << sp->log2_size) < n)
+        sp->log2_size++;
+    for (uint32_t k = 0; k < n / 2; k++) {
+        const double angle = 2.0 * M_PI * k / n;
+        sp->twiddle[k][0] = (zmpt101b_q15_t)lround(ZMPT101B_Q15_ONE * cos(angle));
+        sp->twiddle[k][1] = (zmpt101b_q15_t)lround(ZMPT101B_Q15_ONE * sin(angle));
+    }
+    // Periodic Hann window, symmetric about n / 2
+    double sum_squares = 0;
+    for (uint32_t i = 0; i <= n / 2; i++) {
+        const double w = 0.5 - 0.5 * cos(2.0 * M_PI * i / n);
+        sp->window[i] = (zmpt101b_q15_t)lround(ZMPT101B_Q15_ONE * w);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        const double w = sp->window[i <= n / 2 ? i : n - i] / 32768.0;
+        sum_squares += w * w;
+    }
+    // |X|^2 summed over the segments, in 2^INPUT_SHIFT of a mV, to mV^2/Hz per bin, one side
+    sp->scale = (float)(1.0 / ((double)(1u << (2 * INPUT_SHIFT)) * config->sample_rate * sum_squares * config->averages));
+    sp->due = (uint16_t)n;
+    return ESP_OK;
+}
+
+void zmpt101b_spectrum_reset(zmpt101b_spectrum_t *sp)
+{
+    memset(sp->power, 0, sizeof(sp->power));
+    sp->segments = 0;
+    sp->due = sp->config.fft_size;
+}
+
+size_t zmpt101b_spectrum_process(zmpt101b_spectrum_t *sp, const int16_t *in, size_t len)
+{
+    const uint32_t mask = sp->config.fft_size - 1u;
+    size_t published = 0;
+    for (size_t i = 0; i < len; i++) {
+        sp->history[sp->index] = in[i];
+        sp->index = (uint16_t)((sp->index + 1) & mask);
+        sp->samples++;
+        if (--sp->due != 0)
+            continue;
+        sp->due = sp->config.fft_size / 2;
+        load_segment(sp);
+        fft(sp);
+        accumulate_power(sp);
+        if (++sp->segments == sp->config.averages) {
+            publish(sp);
+            published++;
+        }
+    }
+    return published;
+}
+
+esp_err_t zmpt101b_spectrum_get(const zmpt101b_spectrum_t *sp, zmpt101b_spectrum_result_t *result)
+{
+    if (sp->result.spectra == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *result = sp->result;
+    return ESP_OK;
+}
+
+size_t zmpt101b_spectrum_get_psd(const zmpt101b_spectrum_t *sp, float *psd, size_t len)
+{
+    if (sp->result.spectra == 0)
+        return 0;
+    const size_t bins = sp->config.fft_size / 2 + 1u;
+    const size_t count = len < bins ? len : bins;
+    memcpy(psd, sp->psd, count * sizeof(float));
+    return count;
+}
@@ -0,0 +1,149 @@
+/*
+ * ZMPT101B Spectrum
+ *
+ * Welch power spectral density of the streaming samples (zmpt101b_read_samples()), for noise
+ * floor and interference diagnostics, e.g. switching-converter noise coupled into the ADC input:
+ * - Hann-windowed segments of `fft_size` samples overlapping by half, each with its mean removed,
+ *   go through a fixed-point FFT: a complex FFT of half the size on the even and odd samples,
+ *   split into the real spectrum, 32-bit data and Q15 twiddles. The input range of the ADC leaves
+ *   the transform enough headroom that it needs no scaling between stages.
+ * - The power of every bin is summed over `averages` segments in 64 bits; then the sums become
+ *   the published one-sided PSD in mV^2/Hz and start over. The spectrum is there on demand until
+ *   the next one replaces it.
+ * - With each spectrum: the fundamental, found near the nominal frequency, its power over the Hann
+ *   main lobe, and the noise, which is every bin that isn't DC, the fundamental or one of its
+ *   first ZMPT101B_SPECTRUM_HARMONICS harmonics. The strongest noise bin is reported as the
+ *   largest spur, against the fundamental. The noise floor is the mean density of the noise bins
+ *   without that spur; the noise RMS and the SNR take the noise bins, spur included, with the
+ *   floor in place of the bins left out. The harmonics belong to the grid, not to the converter,
+ *   and stay out of it. ENOB follows from the SNR of the signal as it is, not scaled to the ADC's
+ *   full range.
+ * A segment must hold two cycles of the fundamental, or removing its mean takes part of it: at
+ * 25 kHz that is 1024 samples for 50 and 60 Hz, with 24 Hz bins. With bins that wide the
+ * harmonics take the whole band below the last one counted, and the noise comes from above it.
+ * Without a nominal frequency the strongest tone anywhere is the signal, e.g. to look at noise
+ * and interference with the mains disconnected.
+ * Everything but the publication and its statistics is integer. An estimator holds the
+ * segment, the FFT buffers and the spectrum in fixed arrays, about 15 KB at
+ * ZMPT101B_SPECTRUM_MAX_N; nothing is allocated and no hardware is used.
+ * tools/zmpt101b_spectrum_bench.py checks the spectrum and the estimates against analytic noise
+ * and tones and a direct DFT, and measures the cost per sample on the host; EXAMPLE_SPECTRUM_N in
+ * the example measures it on the target.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Largest FFT, a power of two
+#define ZMPT101B_SPECTRUM_MAX_N 1024
+
+// Most segments averaged into one spectrum; more could overflow the 64-bit power sums
+#define ZMPT101B_SPECTRUM_MAX_AVERAGES 256
+
+// Harmonics of the fundamental left out of the noise, the fundamental included
+#define ZMPT101B_SPECTRUM_HARMONICS 50
+
+// Bins either side of a tone that its Hann main lobe covers
+#define ZMPT101B_SPECTRUM_LOBE 2
+
+// Bins from DC on left out of the noise: the remains of the segment mean and its window
+#define ZMPT101B_SPECTRUM_DC_BINS 3
+
+typedef struct {
+    uint32_t sample_rate;       // Hz
+    uint16_t fft_size;          // samples per segment, a power of two from 16 to ZMPT101B_SPECTRUM_MAX_N
+    uint16_t averages;          // segments per spectrum, 1 to ZMPT101B_SPECTRUM_MAX_AVERAGES
+    uint16_t nominal_freq;      // Hz; the fundamental is searched within 20 % of it, anywhere if 0
+} zmpt101b_spectrum_config_t;
+
+typedef struct {
+    uint64_t sample;            // stream index of the last sample of the spectrum
+    uint32_t spectra;           // spectra published since init
+    float    bin_hz;            // bin spacing
+    float    signal_hz;         // fundamental, interpolated between bins
+    float    signal_rms_mv;     // fundamental over its main lobe
+    float    noise_density;     // noise floor, mean PSD of the noise bins but the largest spur, mV^2/Hz
+    float    noise_rms_mv;      // noise over the whole band, spur included
+    float    snr_db;            // fundamental over the noise
+    float    enob;              // effective number of bits from the SNR, (SNR - 1.76) / 6.02
+    float    spur_hz;           // strongest noise bin, interpolated
+    float    spur_dbc;          // its power against the fundamental
+} zmpt101b_spectrum_result_t;
+
+typedef struct {
+    zmpt101b_spectrum_config_t config;
+    uint16_t log2_size;         // log2 of fft_size
+    uint16_t index;             // history position of the next sample, the oldest once full
+    uint16_t due;               // samples until the next segment
+    uint16_t segments;          // segments in the power sums
+    int16_t  history[ZMPT101B_SPECTRUM_MAX_N];
+    int32_t  work[ZMPT101B_SPECTRUM_MAX_N];             // half-size complex FFT, re and im interleaved
+    int16_t  twiddle[ZMPT101B_SPECTRUM_MAX_N / 2][2];   // cos and sin of 2 pi k / fft_size, Q15
+    int16_t  window[ZMPT101B_SPECTRUM_MAX_N / 2 + 1];   // first half of the Hann window and its centre, Q15
+    uint64_t power[ZMPT101B_SPECTRUM_MAX_N / 2 + 1];    // sums of |X|^2 over the segments
+    float    psd[ZMPT101B_SPECTRUM_MAX_N / 2 + 1];      // published one-sided PSD, mV^2/Hz
+    float    scale;             // power sum to PSD
+    uint64_t samples;           // samples consumed
+    zmpt101b_spectrum_result_t result;
+} zmpt101b_spectrum_t;
+
+/**
+ * @brief Initializes an estimator.
+ *
+ * @param sp Estimator state.
+ * @param config Sample rate, FFT size, averaging and nominal frequency of the channel.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_ARG for a size that isn't a power of two in range
+ *         or holds less than two cycles of the nominal frequency, or an averaging out of range.
+ */
+esp_err_t zmpt101b_spectrum_init(zmpt101b_spectrum_t *sp, const zmpt101b_spectrum_config_t *config);
+
+/**
+ * @brief Starts over after a break in the input, e.g. a block flagged ZMPT101B_QUALITY_GAP.
+ *
+ * The segments summed so far are dropped; the published spectrum stays until the next one.
+ *
+ * @param sp Estimator state.
+ */
+void zmpt101b_spectrum_reset(zmpt101b_spectrum_t *sp);
+
+/**
+ * @brief Feeds a block of samples of one channel.
+ *
+ * A segment is transformed every fft_size / 2 samples, in the call that completes it.
+ *
+ * @param sp Estimator state.
+ * @param in Samples, millivolts from zmpt101b_read_samples(); differences from the segment mean
+ *           beyond +-4095 mV are clamped.
+ * @param len Number of samples.
+ * @return size_t Number of spectra published in this block.
+ */
+size_t zmpt101b_spectrum_process(zmpt101b_spectrum_t *sp, const int16_t *in, size_t len);
+
+/**
+ * @brief Returns the estimates of the last spectrum.
+ *
+ * @param sp Estimator state.
+ * @param result Estimates.
+ * @return esp_err_t ESP_OK, or ESP_ERR_INVALID_STATE before the first spectrum.
+ */
+esp_err_t zmpt101b_spectrum_get(const zmpt101b_spectrum_t *sp, zmpt101b_spectrum_result_t *result);
+
+/**
+ * @brief Copies the last spectrum.
+ *
+ * Bin k is at k * bin_hz, from DC to half the sample rate.
+ *
+ * @param sp Estimator state.
+ * @param psd One-sided PSD in mV^2/Hz.
+ * @param len Capacity of `psd`; fft_size / 2 + 1 takes all bins.
+ * @return size_t Number of bins copied, 0 before the first spectrum.
+ */
+size_t zmpt101b_spectrum_get_psd(const zmpt101b_spectrum_t *sp, float *psd, size_t len);
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include "zmpt101b_storage.h"
+
+#ifndef ZMPT101B_STORAGE_FILE
+#include "nvs.h"
+
+esp_err_t zmpt101b_storage_load(const char *key, void *data, size_t length)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ZMPT101B_NVS_NAMESPACE, NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        return ESP_ERR_NOT_FOUND;
+    if (err != ESP_OK)
+        return err;
+
+    size_t stored_length = length;
+    err = nvs_get_blob(handle, key, data, &stored_length);
+    nvs_close(handle);
+
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        return ESP_ERR_NOT_FOUND;
+    if (err == ESP_ERR_NVS_INVALID_LENGTH || (err == ESP_OK && stored_length != length))
+        return ESP_ERR_INVALID_SIZE;
+    return err;
+}
+
+esp_err_t zmpt101b_storage_save(const char *key, const void *data, size_t length)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ZMPT101B_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_set_blob(handle, key, data, length);
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    nvs_close(handle);
+    return err;
+}
+
+esp_err_t zmpt101b_storage_erase(const char *key)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(ZMPT101B_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND)
+        return ESP_OK;
+    if (err != ESP_OK)
+        return err;
+
+    err = nvs_erase_key(handle, key);
+    if (err == ESP_OK)
+        err = nvs_commit(handle);
+    else if (err == ESP_ERR_NVS_NOT_FOUND)
+        err = ESP_OK;
+    nvs_close(handle);
+    return err;
+}
+
+#else // ZMPT101B_STORAGE_FILE
+
+static const char *storage_dir = ZMPT101B_STORAGE_DIR;
+
+void zmpt101b_storage_set_dir(const char *dir)
+{
+    storage_dir = dir;
+}
+
+const char *zmpt101b_storage_get_dir(void)
+{
+    return storage_dir;
+}
+
+// Builds "<dir>/<namespace>.<key>.bin", mirroring the NVS namespace/key split
+static void storage_path(const char *key, char *path, size_t size)
+{
+    snprintf(path, size, "%s/%s.%s.bin", storage_dir, ZMPT101B_NVS_NAMESPACE, key);
+}
+
+esp_err_t zmpt101b_storage_load(const char *key, void *data, size_t length)
+{
+    char path[256];
+    storage_path(key, path, sizeof(path));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return ESP_ERR_NOT_FOUND;
+
+    const size_t read = fread(data, 1, length, file);
+    const int trailing = fgetc(file);
+    fclose(file);
+    return (read == length && trailing == EOF) ? ESP_OK : ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t zmpt101b_storage_save(const char *key, const void *data, size_t length)
+{
+    char path[256];
+    char tmp_path[260];
+    storage_path(key, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    // Write to a temporary file and rename it over the old one, so an interrupted
+    // save leaves the previous value intact just like an NVS commit would.
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL)
+        return ESP_FAIL;
+    const size_t written = fwrite(data, 1, length, file);
+    if (fclose(file) != 0 || written != length) {
+        remove(tmp_path);
+        return ESP_FAIL;
+    }
+    return rename(tmp_path, path) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t zmpt101b_storage_erase(const char *key)
+{
+    char path[256];
+    storage_path(key, path, sizeof(path));
+    remove(path);
+    return ESP_OK;
+}
+
+#endif // ZMPT101B_STORAGE_FILE
@@ -0,0 +1,75 @@
+/*
+ * ZMPT101B Persistent Storage
+ *
+ * Small key/blob store used for calibration and other per-device data.
+ * On the device the blobs live in NVS under ZMPT101B_NVS_NAMESPACE; nvs_flash_init()
+ * must have been called by the application beforehand.
+ * Host builds (no ESP_PLATFORM) or builds with ZMPT101B_STORAGE_FILE defined use a
+ * file-backed stand-in instead, one file per key, so the callers can be exercised
+ * end-to-end without flash.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+
+// NVS namespace holding all ZMPT101B keys
+#define ZMPT101B_NVS_NAMESPACE "zmpt101b"
+
+#if !defined(ESP_PLATFORM) && !defined(ZMPT101B_STORAGE_FILE)
+#define ZMPT101B_STORAGE_FILE
+#endif
+
+#ifdef ZMPT101B_STORAGE_FILE
+// Default directory for the file-backed store
+#define ZMPT101B_STORAGE_DIR "."
+
+/**
+ * @brief Changes the directory used by the file-backed store.
+ *
+ * @param dir Directory path; the string must outlive all storage calls.
+ */
+void zmpt101b_storage_set_dir(const char *dir);
+
+/**
+ * @brief Returns the directory used by the file-backed store.
+ *
+ * @return const char* Directory path.
+ */
+const char *zmpt101b_storage_get_dir(void);
+#endif
+
+/**
+ * @brief Loads a blob.
+ *
+ * @param key Key name, at most 15 characters (NVS limit).
+ * @param data Destination buffer.
+ * @param length Expected blob size in bytes.
+ * @return esp_err_t ESP_OK, ESP_ERR_NOT_FOUND if the key was never written,
+ *         ESP_ERR_INVALID_SIZE if the stored blob has a different size.
+ */
+esp_err_t zmpt101b_storage_load(const char *key, void *data, size_t length);
+
+/**
+ * @brief Stores a blob, replacing any previous value.
+ *
+ * @param key Key name, at most 15 characters (NVS limit).
+ * @param data Blob contents.
+ * @param length Blob size in bytes.
+ * @return esp_err_t ESP_OK or the underlying NVS/file error.
+ */
+esp_err_t zmpt101b_storage_save(const char *key, const void *data, size_t length);
+
+/**
+ * @brief Removes a blob. Removing a missing key is not an error.
+ *
+ * @param key Key name.
+ * @return esp_err_t ESP_OK or the underlying NVS/file error.
+ */
+esp_err_t zmpt101b_storage_erase(const char *key);
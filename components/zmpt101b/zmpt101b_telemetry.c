@@ -0,0 +1,336 @@
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "zmpt101b_telemetry.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#else
+#include <stdlib.h>
+#include <pthread.h>
+#endif
+
+#define ITEM_HEADER_SIZE    4
+#define RECORD_BODY_SIZE    24
+#define WAVEFORM_BODY_SIZE  16
+
+// Internal functions
+#ifdef ESP_PLATFORM
+static void *lock_create(void)
+{
+    return xSemaphoreCreateMutex();
+}
+
+static void lock_destroy(void *lock)
+{
+    vSemaphoreDelete((SemaphoreHandle_t)lock);
+}
+
+static void lock_take(void *lock)
+{
+    xSemaphoreTake((SemaphoreHandle_t)lock, portMAX_DELAY);
+}
+
+static void lock_give(void *lock)
+{
+    xSemaphoreGive((SemaphoreHandle_t)lock);
+}
+#else
+static void *lock_create(void)
+{
+    pthread_mutex_t *mutex = malloc(sizeof(*mutex));
+    if (mutex != NULL)
+        pthread_mutex_init(mutex, NULL);
+    return mutex;
+}
+
+static void lock_destroy(void *lock)
+{
+    pthread_mutex_destroy(lock);
+    free(lock);
+}
+
+static void lock_take(void *lock)
+{
+    pthread_mutex_lock(lock);
+}
+
+static void lock_give(void *lock)
+{
+    pthread_mutex_unlock(lock);
+}
+#endif
+
+static void put_u16(uint8_t *p, uint16_t value)
+{
+    p[0] = (uint8_t)value;
+    p[1] = (uint8_t)(value >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t value)
+{
+    put_u16(p, (uint16_t)value);
+    put_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+static void put_u64(uint8_t *p, uint64_t value)
+{
+    put_u32(p, (uint32_t)value);
+    put_u32(p + 4, (uint32_t)(value >> 32));
+}
+
+static zmpt101b_telemetry_frame_t *frame_at(zmpt101b_telemetry_t *tm, uint32_t n)
+{
+    return &tm->frames[(tm->head + n) % ZMPT101B_TELEMETRY_FRAMES];
+}
+
+// Drops the oldest queued frame. A frame partly written to the TCP stream must be completed,
+// so in that case the frame after it goes instead.
+static void drop_oldest(zmpt101b_telemetry_t *tm)
+{
+    zmpt101b_telemetry_frame_t *victim = frame_at(tm, 0);
+    if (tm->send_offset != 0 && tm->queued > 1) {
+        victim = frame_at(tm, 1);
+        tm->stats.frames_dropped++;
+        tm->stats.items_dropped += victim->items;
+        memcpy(victim, frame_at(tm, 0), sizeof(*victim));
+    } else {
+        tm->stats.frames_dropped++;
+        tm->stats.items_dropped += victim->items;
+        tm->send_offset = 0;
+    }
+    tm->head = (tm->head + 1) % ZMPT101B_TELEMETRY_FRAMES;
+    tm->queued--;
+}
+
+// Completes the open frame: the header is written and the frame joins the send queue
+static void close_frame(zmpt101b_telemetry_t *tm)
+{
+    if (!tm->open)
+        return;
+    zmpt101b_telemetry_frame_t *frame = frame_at(tm, tm->queued);
+    put_u16(frame->data, ZMPT101B_TELEMETRY_MAGIC);
+    frame->data[2] = ZMPT101B_TELEMETRY_VERSION;
+    frame->data[3] = 0;
+    put_u32(frame->data + 4, tm->sequence++);
+    put_u16(frame->data + 12, frame->items);
+    put_u16(frame->data + 14, (uint16_t)(frame->length - ZMPT101B_TELEMETRY_HEADER_SIZE));
+    tm->queued++;
+    tm->open = false;
+}
+
+// Reserves room for an item in the open frame, starting a new frame (and dropping the oldest one) as needed
+static uint8_t *reserve_item(zmpt101b_telemetry_t *tm, uint8_t type, size_t body_size, int64_t now_us)
+{
+    const size_t size = ITEM_HEADER_SIZE + body_size;
+    if (size > ZMPT101B_TELEMETRY_FRAME_SIZE - ZMPT101B_TELEMETRY_HEADER_SIZE) {
+        tm->stats.items_rejected++;
+        return NULL;
+    }
+    if (tm->open && frame_at(tm, tm->queued)->length + size > ZMPT101B_TELEMETRY_FRAME_SIZE)
+        close_frame(tm);
+    if (!tm->open) {
+        if (tm->queued == ZMPT101B_TELEMETRY_FRAMES)
+            drop_oldest(tm);
+        zmpt101b_telemetry_frame_t *frame = frame_at(tm, tm->queued);
+        frame->length = ZMPT101B_TELEMETRY_HEADER_SIZE;
+        frame->items = 0;
+        frame->opened_us = now_us;
+        tm->open = true;
+    }
+
+    zmpt101b_telemetry_frame_t *frame = frame_at(tm, tm->queued);
+    uint8_t *item = frame->data + frame->length;
+    item[0] = type;
+    item[1] = 0;
+    put_u16(item + 2, (uint16_t)body_size);
+    frame->length += (uint16_t)size;
+    frame->items++;
+    return item + ITEM_HEADER_SIZE;
+}
+
+static void close_socket(zmpt101b_telemetry_t *tm)
+{
+    if (tm->sock >= 0)
+        close(tm->sock);
+    tm->sock = -1;
+    tm->connected = false;
+    // A frame cut off by the broken connection is sent again from its start
+    tm->send_offset = 0;
+}
+
+static esp_err_t open_socket(zmpt101b_telemetry_t *tm, int64_t now_us)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(tm->cfg.port),
+    };
+    if (inet_pton(AF_INET, tm->cfg.host, &addr.sin_addr) != 1)
+        return ESP_ERR_INVALID_ARG;
+
+    tm->last_connect_us = now_us;
+    tm->sock = socket(AF_INET, tm->cfg.transport == ZMPT101B_TELEMETRY_TCP ? SOCK_STREAM : SOCK_DGRAM, 0);
+    if (tm->sock < 0)
+        return ESP_FAIL;
+    fcntl(tm->sock, F_SETFL, fcntl(tm->sock, F_GETFL, 0) | O_NONBLOCK);
+
+    // UDP is connected too, so send() can be used for both transports
+    if (connect(tm->sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        tm->connected = true;
+    } else if (errno != EINPROGRESS) {
+        close_socket(tm);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Checks a pending non-blocking TCP connect
+static bool connection_ready(zmpt101b_telemetry_t *tm)
+{
+    if (tm->connected)
+        return true;
+    int error = 0;
+    socklen_t length = sizeof(error);
+    struct sockaddr_in peer;
+    socklen_t peer_length = sizeof(peer);
+    if (getsockopt(tm->sock, SOL_SOCKET, SO_ERROR, &error, &length) != 0 || error != 0) {
+        close_socket(tm);
+        return false;
+    }
+    if (getpeername(tm->sock, (struct sockaddr *)&peer, &peer_length) != 0)
+        return false;
+    tm->connected = true;
+    tm->stats.connects++;
+    return true;
+}
+
+// public API implementation
+esp_err_t zmpt101b_telemetry_init(zmpt101b_telemetry_t *tm, const zmpt101b_telemetry_config_t *config)
+{
+    if (tm == NULL || config == NULL || config->host == NULL || config->port == 0 || config->nominal_freq == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(tm, 0, sizeof(*tm));
+    tm->cfg = *config;
+    tm->sock = -1;
+    zmpt101b_codec_init(&tm->codec, 1);
+    tm->lock = lock_create();
+    if (tm->lock == NULL)
+        return ESP_ERR_NO_MEM;
+
+    esp_err_t err = open_socket(tm, 0);
+    if (err == ESP_OK && tm->connected && config->transport == ZMPT101B_TELEMETRY_TCP)
+        tm->stats.connects++;
+    if (err != ESP_OK) {
+        lock_destroy(tm->lock);
+        tm->lock = NULL;
+    }
+    return err;
+}
+
+void zmpt101b_telemetry_deinit(zmpt101b_telemetry_t *tm)
+{
+    close_socket(tm);
+    if (tm->lock != NULL)
+        lock_destroy(tm->lock);
+    tm->lock = NULL;
+}
+
+esp_err_t zmpt101b_telemetry_add_record(zmpt101b_telemetry_t *tm, const zmpt101b_log_record_t *record, int64_t now_us)
+{
+    lock_take(tm->lock);
+    uint8_t *body = reserve_item(tm, ZMPT101B_TELEMETRY_ITEM_RECORD, RECORD_BODY_SIZE, now_us);
+    if (body != NULL) {
+        put_u64(body, (uint64_t)record->timestamp_us);
+        put_u16(body + 8, record->type);
+        put_u16(body + 10, record->flags);
+        for (int i = 0; i < 3; ++i)
+            put_u32(body + 12 + 4 * i, (uint32_t)record->values[i]);
+    }
+    lock_give(tm->lock);
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_telemetry_add_waveform(zmpt101b_telemetry_t *tm, const int16_t *samples, size_t count, uint32_t sample_rate, int64_t timestamp_us, int64_t now_us)
+{
+    if (sample_rate == 0)
+        return ESP_ERR_INVALID_ARG;
+
+    lock_take(tm->lock);
+    // Every chunk is coded as a sync block so it decodes on its own, whatever was dropped around it
+    const uint32_t samples_per_cycle = (sample_rate + tm->cfg.nominal_freq / 2) / tm->cfg.nominal_freq;
+    const uint16_t period = samples_per_cycle < 1 ? 1
+                          : samples_per_cycle > ZMPT101B_CODEC_MAX_PERIOD ? ZMPT101B_CODEC_MAX_PERIOD : (uint16_t)samples_per_cycle;
+    zmpt101b_codec_set_period(&tm->codec, period);
+    for (size_t offset = 0; offset < count; offset += ZMPT101B_TELEMETRY_WAVEFORM_CHUNK) {
+        const size_t chunk = count - offset < ZMPT101B_TELEMETRY_WAVEFORM_CHUNK ? count - offset : ZMPT101B_TELEMETRY_WAVEFORM_CHUNK;
+        zmpt101b_codec_sync(&tm->codec);
+        const size_t coded = zmpt101b_codec_encode(&tm->codec, samples + offset, chunk, tm->scratch, sizeof(tm->scratch));
+        uint8_t *body = reserve_item(tm, ZMPT101B_TELEMETRY_ITEM_WAVEFORM, WAVEFORM_BODY_SIZE + coded, now_us);
+        if (body == NULL)
+            continue;
+        put_u64(body, (uint64_t)timestamp_us);
+        put_u32(body + 8, sample_rate);
+        put_u32(body + 12, (uint32_t)offset);
+        memcpy(body + WAVEFORM_BODY_SIZE, tm->scratch, coded);
+    }
+    lock_give(tm->lock);
+    return ESP_OK;
+}
+
+esp_err_t zmpt101b_telemetry_service(zmpt101b_telemetry_t *tm, int64_t now_us)
+{
+    esp_err_t err = ESP_OK;
+    lock_take(tm->lock);
+
+    if (tm->open && now_us - frame_at(tm, tm->queued)->opened_us >= (int64_t)tm->cfg.flush_interval_us)
+        close_frame(tm);
+
+    if (tm->sock < 0 && now_us - tm->last_connect_us >= ZMPT101B_TELEMETRY_RECONNECT_US) {
+        err = open_socket(tm, now_us);
+        if (err == ESP_OK && tm->connected && tm->cfg.transport == ZMPT101B_TELEMETRY_TCP)
+            tm->stats.connects++;
+    }
+
+    while (tm->queued > 0 && tm->sock >= 0 && connection_ready(tm)) {
+        zmpt101b_telemetry_frame_t *frame = frame_at(tm, 0);
+        // The drop counter is stamped when the frame goes out, so it covers every frame dropped ahead of it
+        if (tm->send_offset == 0)
+            put_u32(frame->data + 8, tm->stats.frames_dropped);
+        const ssize_t sent = send(tm->sock, frame->data + tm->send_offset, frame->length - tm->send_offset, 0);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOMEM || errno == ENOBUFS)
+                break;  // back-pressure, the frame stays queued
+            tm->stats.send_errors++;
+            err = ESP_FAIL;
+            if (tm->cfg.transport == ZMPT101B_TELEMETRY_TCP)
+                close_socket(tm);
+            // A UDP error (e.g. ICMP unreachable) is reported but the frame is retried
+            break;
+        }
+        tm->stats.bytes_sent += (uint64_t)sent;
+        tm->send_offset += (size_t)sent;
+        if (tm->send_offset < frame->length)
+            break;
+        tm->send_offset = 0;
+        tm->head = (tm->head + 1) % ZMPT101B_TELEMETRY_FRAMES;
+        tm->queued--;
+        tm->stats.frames_sent++;
+    }
+
+    lock_give(tm->lock);
+    return err;
+}
+
+void zmpt101b_telemetry_get_stats(zmpt101b_telemetry_t *tm, zmpt101b_telemetry_stats_t *stats)
+{
+    lock_take(tm->lock);
+    *stats = tm->stats;
+    lock_give(tm->lock);
+}
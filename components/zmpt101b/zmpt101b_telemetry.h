@@ -0,0 +1,167 @@
+/*
+ * ZMPT101B Telemetry Sink
+ *
+ * Optional network sink batching measurement records and waveform snapshots into compact binary
+ * frames sent over UDP or TCP (BSD sockets, lwIP on the device).
+ *
+ * Frame layout (little-endian):
+ *   header  u16 magic 0x5A54, u8 version, u8 reserved, u32 sequence,
+ *           u32 frames dropped by the sender before this one was sent, u16 item count, u16 payload bytes
+ *   items   u8 type, u8 reserved, u16 body bytes, body
+ *     ZMPT101B_TELEMETRY_ITEM_RECORD    i64 timestamp_us, u16 type, u16 flags, 3 x i32 values
+ *                                       (zmpt101b_log_record_t)
+ *     ZMPT101B_TELEMETRY_ITEM_WAVEFORM  i64 timestamp_us of the first sample, u32 sample rate,
+ *                                       u32 offset of the chunk within the snapshot, block coded
+ *                                       with zmpt101b_codec (always a sync block)
+ *
+ * Producers fill frames in a fixed ring; zmpt101b_telemetry_service() sends completed frames
+ * without blocking. A frame is completed when full or older than the flush interval.
+ * When the network can't keep up (send would block, TCP not connected) frames stay queued;
+ * once the ring is full the oldest queued frame is dropped and counted. A gap in the frame
+ * sequence numbers minus the growth of the drop counter is what got lost in transit.
+ * Producer and service calls may run in different tasks.
+ *
+ * Builds on the host as well, tools/zmpt101b_telemetry_rx.py drives it over localhost.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "zmpt101b_log.h"
+#include "zmpt101b_codec.h"
+
+// Frame size, chosen to fit a UDP datagram into one Ethernet/Wi-Fi MTU
+#define ZMPT101B_TELEMETRY_FRAME_SIZE 1400
+
+// Frames queued at most
+#define ZMPT101B_TELEMETRY_FRAMES 8
+
+// Samples per waveform item; longer snapshots are split
+#define ZMPT101B_TELEMETRY_WAVEFORM_CHUNK 250
+
+// Interval between TCP connection attempts
+#define ZMPT101B_TELEMETRY_RECONNECT_US 1000000
+
+#define ZMPT101B_TELEMETRY_MAGIC 0x5A54
+#define ZMPT101B_TELEMETRY_VERSION 1
+#define ZMPT101B_TELEMETRY_HEADER_SIZE 16
+
+typedef enum {
+    ZMPT101B_TELEMETRY_ITEM_RECORD = 1,
+    ZMPT101B_TELEMETRY_ITEM_WAVEFORM,
+} zmpt101b_telemetry_item_t;
+
+typedef enum {
+    ZMPT101B_TELEMETRY_UDP = 0,
+    ZMPT101B_TELEMETRY_TCP,
+} zmpt101b_telemetry_transport_t;
+
+typedef struct {
+    zmpt101b_telemetry_transport_t transport;
+    const char *host;           // IPv4 address of the collector
+    uint16_t port;
+    uint32_t flush_interval_us; // a frame is sent at the latest this long after its first item
+    uint16_t nominal_freq;      // Hz, the waveform codec predicts each sample from one period earlier
+} zmpt101b_telemetry_config_t;
+
+typedef struct {
+    uint32_t frames_sent;
+    uint32_t frames_dropped;    // dropped from the ring under congestion
+    uint32_t items_dropped;     // items in the dropped frames
+    uint32_t items_rejected;    // items that could never fit a frame
+    uint64_t bytes_sent;
+    uint32_t send_errors;
+    uint32_t connects;          // TCP connections established
+} zmpt101b_telemetry_stats_t;
+
+typedef struct {
+    uint8_t  data[ZMPT101B_TELEMETRY_FRAME_SIZE];
+    uint16_t length;            // bytes used including the header
+    uint16_t items;
+    int64_t  opened_us;         // time of the first item
+} zmpt101b_telemetry_frame_t;
+
+typedef struct {
+    zmpt101b_telemetry_config_t cfg;
+    void    *lock;
+    int      sock;
+    bool     connected;
+    int64_t  last_connect_us;
+
+    zmpt101b_telemetry_frame_t frames[ZMPT101B_TELEMETRY_FRAMES];
+    uint32_t head;              // oldest queued frame
+    uint32_t queued;            // completed frames waiting to be sent
+    bool     open;              // frames[(head + queued) % N] is being filled
+    size_t   send_offset;       // bytes of the head frame already sent (TCP)
+    uint32_t sequence;          // sequence number of the next frame
+
+    zmpt101b_codec_t codec;
+    uint8_t  scratch[ZMPT101B_CODEC_BOUND(ZMPT101B_TELEMETRY_WAVEFORM_CHUNK)];
+    zmpt101b_telemetry_stats_t stats;
+} zmpt101b_telemetry_t;
+
+/**
+ * @brief Initializes the sink and opens its socket. TCP connects from zmpt101b_telemetry_service().
+ *
+ * @param tm Sink state (about 15 KB, keep it static).
+ * @param config Configuration, copied into the state; the host string must stay valid.
+ * @return esp_err_t ESP_OK, ESP_ERR_INVALID_ARG, ESP_ERR_NO_MEM or ESP_FAIL if the socket can't be created.
+ */
+esp_err_t zmpt101b_telemetry_init(zmpt101b_telemetry_t *tm, const zmpt101b_telemetry_config_t *config);
+
+/**
+ * @brief Closes the socket and releases the sink.
+ *
+ * @param tm Sink state.
+ */
+void zmpt101b_telemetry_deinit(zmpt101b_telemetry_t *tm);
+
+/**
+ * @brief Queues a measurement record.
+ *
+ * @param tm Sink state.
+ * @param record Record, the same type the measurement log stores.
+ * @param now_us Current time, starts the flush interval of a new frame.
+ * @return esp_err_t ESP_OK; older data may have been dropped to make room.
+ */
+esp_err_t zmpt101b_telemetry_add_record(zmpt101b_telemetry_t *tm, const zmpt101b_log_record_t *record, int64_t now_us);
+
+/**
+ * @brief Queues a waveform snapshot, compressed and split into chunks of ZMPT101B_TELEMETRY_WAVEFORM_CHUNK samples.
+ *
+ * @param tm Sink state.
+ * @param samples Samples, e.g. from zmpt101b_read_samples().
+ * @param count Number of samples.
+ * @param sample_rate Sample rate in Hz; over the nominal frequency it sets the codec prediction period.
+ * @param timestamp_us Time of the first sample.
+ * @param now_us Current time.
+ * @return esp_err_t ESP_OK; older data may have been dropped to make room.
+ */
+esp_err_t zmpt101b_telemetry_add_waveform(zmpt101b_telemetry_t *tm, const int16_t *samples, size_t count, uint32_t sample_rate, int64_t timestamp_us, int64_t now_us);
+
+/**
+ * @brief Completes aged frames and sends queued frames as far as the socket accepts them without blocking.
+ *
+ * Call it periodically, e.g. from a network task.
+ *
+ * @param tm Sink state.
+ * @param now_us Current time.
+ * @return esp_err_t ESP_OK, or the error of a failed send; the frame is retried later.
+ */
+esp_err_t zmpt101b_telemetry_service(zmpt101b_telemetry_t *tm, int64_t now_us);
+
+/**
+ * @brief Returns the sink counters.
+ *
+ * @param tm Sink state.
+ * @param stats Counters.
+ */
+void zmpt101b_telemetry_get_stats(zmpt101b_telemetry_t *tm, zmpt101b_telemetry_stats_t *stats);
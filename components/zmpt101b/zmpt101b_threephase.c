@@ -0,0 +1,143 @@
+#include <string.h>
+#include <math.h>
+#include "zmpt101b_threephase.h"
+#include "zmpt101b_fixed.h"
+
+// cos and sin of 120 degrees: the operator a = e^(j 2pi/3)
+#define A_RE (-0.5f)
+#define A_IM 0.8660254038f
+
+// Internal functions
+static float rms(int64_t sum, int64_t sum_squares, uint32_t count)
+{
+    // Integer all the way, float only for the reported value
+    return (float)zmpt101b_fx_ac_rms_q8(sum, (uint64_t)sum_squares, count) / (1 << ZMPT101B_FX_RMS_FRAC_BITS);
+}
+
+static void accumulate(zmpt101b_threephase_t *tp, const int16_t *const in[3], size_t start, size_t len)
+{
+    for (size_t i = start; i < start + len; i++) {
+        const int32_t l1 = in[0][i];
+        const int32_t l2 = in[1][i];
+        const int32_t l3 = in[2][i];
+        const int32_t values[6] = { l1, l2, l3, l1 - l2, l2 - l3, l3 - l1 };
+        for (int k = 0; k < 6; k++) {
+            tp->sum[k] += values[k];
+            tp->sum_squares[k] += (int64_t)values[k] * values[k];
+        }
+    }
+    tp->count += len;
+}
+
+static void finish(zmpt101b_threephase_t *tp, const zmpt101b_phasor_t phasor[3])
+{
+    zmpt101b_threephase_value_t *value = &tp->last;
+    float re[3], im[3];
+
+    value->sample = phasor[0].sample;
+    value->missing = 0;
+    for (int c = 0; c < 3; c++) {
+        value->phasor[c] = phasor[c];
+        re[c] = phasor[c].magnitude * cosf(phasor[c].angle);
+        im[c] = phasor[c].magnitude * sinf(phasor[c].angle);
+        if (phasor[c].magnitude < ZMPT101B_THREEPHASE_PRESENT_MV)
+            value->missing |= 1 << c;
+        value->line_to_neutral_rms[c] = rms(tp->sum[c], tp->sum_squares[c], tp->count);
+        value->line_to_line_rms[c] = rms(tp->sum[c + 3], tp->sum_squares[c + 3], tp->count);
+    }
+    for (int c = 0; c < 3; c++) {
+        const int next = (c + 1) % 3;
+        value->line_to_line_fundamental[c] = hypotf(re[c] - re[next], im[c] - im[next]);
+    }
+
+    // V0 = (V1 + V2 + V3) / 3, Vpos = (V1 + a V2 + a^2 V3) / 3, Vneg = (V1 + a^2 V2 + a V3) / 3
+    const float zero_re = (re[0] + re[1] + re[2]) / 3;
+    const float zero_im = (im[0] + im[1] + im[2]) / 3;
+    const float pos_re = (re[0] + A_RE * (re[1] + re[2]) - A_IM * (im[1] - im[2])) / 3;
+    const float pos_im = (im[0] + A_RE * (im[1] + im[2]) + A_IM * (re[1] - re[2])) / 3;
+    const float neg_re = (re[0] + A_RE * (re[1] + re[2]) + A_IM * (im[1] - im[2])) / 3;
+    const float neg_im = (im[0] + A_RE * (im[1] + im[2]) - A_IM * (re[1] - re[2])) / 3;
+    value->zero = hypotf(zero_re, zero_im);
+    value->positive = hypotf(pos_re, pos_im);
+    value->negative = hypotf(neg_re, neg_im);
+    value->negative_unbalance_pct = value->positive > 0 ? value->negative / value->positive * 100 : 0;
+    value->zero_unbalance_pct = value->positive > 0 ? value->zero / value->positive * 100 : 0;
+
+    value->rotation = ZMPT101B_ROTATION_UNKNOWN;
+    if (value->missing == 0) {
+        if (value->positive >= ZMPT101B_THREEPHASE_ROTATION_RATIO * value->negative)
+            value->rotation = ZMPT101B_ROTATION_L1_L2_L3;
+        else if (value->negative >= ZMPT101B_THREEPHASE_ROTATION_RATIO * value->positive)
+            value->rotation = ZMPT101B_ROTATION_L1_L3_L2;
+    }
+
+    tp->count = 0;
+    memset(tp->sum, 0, sizeof(tp->sum));
+    memset(tp->sum_squares, 0, sizeof(tp->sum_squares));
+}
+
+// public API implementation
+esp_err_t zmpt101b_threephase_init(zmpt101b_threephase_t *tp, const zmpt101b_threephase_config_t *config)
+{
+    if (tp == NULL || config == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(tp, 0, sizeof(*tp));
+    for (int c = 0; c < 3; c++) {
+        const zmpt101b_phasor_config_t phasor_config = {
+            .sample_rate = config->sample_rate,
+            .nominal_freq = config->nominal_freq,
+            .skew_ns = config->skew_ns[c],
+        };
+        esp_err_t ret = zmpt101b_phasor_init(&tp->phasor[c], &phasor_config);
+        if (ret != ESP_OK)
+            return ret;
+    }
+    return ESP_OK;
+}
+
+void zmpt101b_threephase_reset(zmpt101b_threephase_t *tp)
+{
+    for (int c = 0; c < 3; c++)
+        zmpt101b_phasor_reset(&tp->phasor[c]);
+    tp->count = 0;
+    memset(tp->sum, 0, sizeof(tp->sum));
+    memset(tp->sum_squares, 0, sizeof(tp->sum_squares));
+}
+
+size_t zmpt101b_threephase_process(zmpt101b_threephase_t *tp, const int16_t *const in[3], size_t len,
+                                   zmpt101b_threephase_value_t *out, size_t out_len)
+{
+    size_t completed = 0;
+    size_t position = 0;
+    while (position < len) {
+        // Up to the end of the current window, so each chunk completes at most one
+        size_t chunk = tp->phasor[0].window - tp->phasor[0].index;
+        if (chunk > len - position)
+            chunk = len - position;
+        accumulate(tp, in, position, chunk);
+
+        zmpt101b_phasor_t phasor[3];
+        size_t windows = 0;
+        for (int c = 0; c < 3; c++)
+            windows = zmpt101b_phasor_process(&tp->phasor[c], in[c] + position, chunk, &phasor[c], 1);
+        position += chunk;
+        if (windows == 0)
+            continue;
+
+        finish(tp, phasor);
+        if (out != NULL && completed < out_len)
+            out[completed] = tp->last;
+        completed++;
+    }
+    return completed;
+}
+
+esp_err_t zmpt101b_threephase_get(const zmpt101b_threephase_t *tp, zmpt101b_threephase_value_t *value)
+{
+    if (zmpt101b_phasor_get(&tp->phasor[0], &value->phasor[0]) != ESP_OK) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    *value = tp->last;
+    return ESP_OK;
+}
@@ -0,0 +1,219 @@
+#include <string.h>
+#include "zmpt101b_timestamp.h"
+
+// Internal functions
+// Signed distance times a Q16 period, rounded towards zero
+static int64_t span_ns(int64_t samples, int64_t period_q16)
+{
+    return samples >= 0 ? (samples * period_q16) >> 16 : -((-samples * period_q16) >> 16);
+}
+
+static int64_t predict_ns(const zmpt101b_ts_t *ts, int64_t position)
+{
+    return ts->anchor_time_ns + span_ns(position - ts->anchor_position, ts->period_q16);
+}
+
+// Fits the period through the epoch bounds and lowers the line onto the lowest of them
+static void fit(zmpt101b_ts_t *ts)
+{
+    const zmpt101b_ts_point_t *bounds = ts->bounds;
+    const int n = ts->bound_count;
+    const zmpt101b_ts_point_t *origin = &bounds[0];
+
+    if (n >= 2) {
+        // Least squares on the residuals against the current period, which stay small
+        int64_t sum_x = 0;
+        int64_t sum_y = 0;
+        for (int i = 0; i < n; ++i) {
+            const int64_t dx = bounds[i].position - origin->position;
+            sum_x += dx;
+            sum_y += bounds[i].time_ns - origin->time_ns - span_ns(dx, ts->period_q16);
+        }
+        const int64_t mean_x = sum_x / n;
+        const int64_t mean_y = sum_y / n;
+        int64_t sxx = 0;
+        int64_t sxy = 0;
+        for (int i = 0; i < n; ++i) {
+            const int64_t dx = bounds[i].position - origin->position;
+            const int64_t x = dx - mean_x;
+            const int64_t y = bounds[i].time_ns - origin->time_ns - span_ns(dx, ts->period_q16) - mean_y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        if (sxx > 0) {
+            const int64_t correction_q16 = (sxy / sxx) * 65536 + (sxy % sxx) * 65536 / sxx;
+            const int64_t period_q16 = ts->period_q16 + correction_q16;
+            const int64_t deviation_q16 = period_q16 > ts->nominal_q16 ? period_q16 - ts->nominal_q16 : ts->nominal_q16 - period_q16;
+            if (deviation_q16 * 1000000 <= ts->nominal_q16 * ZMPT101B_TS_MAX_SKEW_PPM) {
+                ts->period_q16 = period_q16;
+                ts->period_valid = true;
+            } else {
+                ts->stats.rejected_fits++;
+            }
+        }
+    }
+
+    // Every bound is at or after the true time, so the line goes through the lowest one
+    int64_t lowest = INT64_MAX;
+    int64_t highest = INT64_MIN;
+    for (int i = 0; i < n; ++i) {
+        const int64_t residual = bounds[i].time_ns - origin->time_ns - span_ns(bounds[i].position - origin->position, ts->period_q16);
+        if (residual < lowest)
+            lowest = residual;
+        if (residual > highest)
+            highest = residual;
+    }
+    ts->anchor_position = origin->position;
+    ts->anchor_time_ns = origin->time_ns + lowest;
+    ts->stats.fit_spread_ns = (uint32_t)(highest - lowest);
+}
+
+static void close_epoch(zmpt101b_ts_t *ts)
+{
+    if (ts->bound_count == ZMPT101B_TS_EPOCHS) {
+        memmove(&ts->bounds[0], &ts->bounds[1], sizeof(ts->bounds[0]) * (ZMPT101B_TS_EPOCHS - 1));
+        ts->bound_count--;
+    }
+    ts->bounds[ts->bound_count++] = ts->epoch_best;
+    ts->epoch_seen = false;
+    ts->stats.epochs++;
+    fit(ts);
+}
+
+// public API implementation
+void zmpt101b_ts_init(zmpt101b_ts_t *ts, uint32_t sample_rate, uint32_t buffer_samples)
+{
+    memset(ts, 0, sizeof(*ts));
+    ts->buffer_samples = buffer_samples > 0 ? buffer_samples : 1;
+    ts->nominal_q16 = (int64_t)(((uint64_t)1000000000 << 16) / sample_rate);
+    ts->period_q16 = ts->nominal_q16;
+}
+
+void zmpt101b_ts_restart(zmpt101b_ts_t *ts)
+{
+    ts->anchored = false;
+    ts->epoch_seen = false;
+    ts->bound_count = 0;
+    ts->stats.restarts++;
+}
+
+void zmpt101b_ts_observe(zmpt101b_ts_t *ts, int64_t position, int64_t time_us)
+{
+    // The read waited at most for the end of the DMA buffer holding its last sample
+    const int64_t buffer = ts->buffer_samples;
+    const int64_t buffer_end = (position + buffer - 1) / buffer * buffer;
+    const int64_t time_ns = (time_us - ZMPT101B_TS_LATENCY_US) * 1000;
+    ts->stats.observations++;
+
+    if (!ts->anchored) {
+        ts->anchored = true;
+        ts->anchor_position = buffer_end;
+        ts->anchor_time_ns = time_ns;
+        ts->epoch_end = buffer_end + (int64_t)ZMPT101B_TS_EPOCH_BUFFERS * buffer;
+    }
+
+    // A buffer can't have been complete later than it was read
+    const int64_t early_ns = predict_ns(ts, buffer_end) - time_ns;
+    if (early_ns > 0) {
+        ts->anchor_time_ns -= early_ns;
+        ts->stats.pulls++;
+    }
+
+    if (!ts->epoch_seen || time_ns - predict_ns(ts, buffer_end) <
+                           ts->epoch_best.time_ns - predict_ns(ts, ts->epoch_best.position)) {
+        ts->epoch_best.position = buffer_end;
+        ts->epoch_best.time_ns = time_ns;
+        ts->epoch_seen = true;
+    }
+
+    if (buffer_end >= ts->epoch_end) {
+        close_epoch(ts);
+        // A reader that fell far behind may have skipped epochs
+        while (ts->epoch_end <= buffer_end)
+            ts->epoch_end += (int64_t)ZMPT101B_TS_EPOCH_BUFFERS * buffer;
+    }
+}
+
+void zmpt101b_ts_rescale(zmpt101b_ts_t *ts, int64_t time_us, uint32_t old_rate, uint32_t new_rate)
+{
+    if (old_rate == 0 || new_rate == 0 || old_rate == new_rate)
+        return;
+    const int64_t period_q16 = ts->period_q16 * old_rate / new_rate;
+    ts->nominal_q16 = ts->nominal_q16 * old_rate / new_rate;
+    if (!ts->anchored) {
+        ts->period_q16 = period_q16;
+        return;
+    }
+
+    // Raw position the old model puts at time_us; the new period applies from there on
+    const int64_t time_ns = (time_us - ZMPT101B_TS_LATENCY_US) * 1000;
+    const int64_t position = ts->anchor_position + (time_ns - ts->anchor_time_ns) * 65536 / ts->period_q16;
+    const int64_t position_ns = predict_ns(ts, position);
+
+    // Bounds keep their distance above the line, so a fit across the change sees a single period
+    for (int i = 0; i < ts->bound_count; ++i) {
+        zmpt101b_ts_point_t *bound = &ts->bounds[i];
+        const int64_t residual = bound->time_ns - predict_ns(ts, bound->position);
+        bound->time_ns = position_ns + span_ns(bound->position - position, period_q16) + residual;
+    }
+    if (ts->epoch_seen) {
+        const int64_t residual = ts->epoch_best.time_ns - predict_ns(ts, ts->epoch_best.position);
+        ts->epoch_best.time_ns = position_ns + span_ns(ts->epoch_best.position - position, period_q16) + residual;
+    }
+    ts->anchor_position = position;
+    ts->anchor_time_ns = position_ns;
+    ts->period_q16 = period_q16;
+}
+
+int64_t zmpt101b_ts_time_ns(const zmpt101b_ts_t *ts, int64_t position)
+{
+    return ts->anchored ? predict_ns(ts, position) : 0;
+}
+
+bool zmpt101b_ts_locked(const zmpt101b_ts_t *ts)
+{
+    return ts->period_valid && ts->bound_count > 0;
+}
+
+uint32_t zmpt101b_ts_period_ps(const zmpt101b_ts_t *ts)
+{
+    return (uint32_t)((ts->period_q16 * 1000 + 32768) >> 16);
+}
+
+void zmpt101b_ts_get_stats(const zmpt101b_ts_t *ts, zmpt101b_ts_stats_t *stats)
+{
+    *stats = ts->stats;
+}
+
+void zmpt101b_wallclock_sync(zmpt101b_wallclock_t *wc, int64_t mono_us, int64_t wall_us)
+{
+    if (wc->syncs > 0 && mono_us > wc->sync_mono_us) {
+        const int64_t span_us = mono_us - wc->sync_mono_us;
+        const int64_t error_us = wall_us - zmpt101b_wallclock_to_wall(wc, mono_us);
+        wc->last_error_us = (int32_t)(error_us > INT32_MAX ? INT32_MAX : error_us < INT32_MIN ? INT32_MIN : error_us);
+
+        // More than the largest plausible drift over the span: the clock was set
+        const int64_t step_us = span_us * ZMPT101B_TS_WALL_MAX_DRIFT_PPM / 1000000 + (int64_t)ZMPT101B_TS_WALL_STEP_MS * 1000;
+        if (error_us > step_us || error_us < -step_us) {
+            wc->steps++;
+        } else if (span_us >= (int64_t)ZMPT101B_TS_WALL_MIN_SPAN_S * 1000000) {
+            // Drift over the whole span, independent of the previous estimate; smoothed against sync jitter
+            const int64_t drift_ppb = (wall_us - wc->sync_wall_us - span_us) * 1000000000 / span_us;
+            if (drift_ppb <= (int64_t)ZMPT101B_TS_WALL_MAX_DRIFT_PPM * 1000 && drift_ppb >= -(int64_t)ZMPT101B_TS_WALL_MAX_DRIFT_PPM * 1000) {
+                wc->drift_ppb = wc->drift_valid ? (int32_t)(wc->drift_ppb + (drift_ppb - wc->drift_ppb) / 4) : (int32_t)drift_ppb;
+                wc->drift_valid = true;
+            }
+        }
+    }
+    wc->sync_mono_us = mono_us;
+    wc->sync_wall_us = wall_us;
+    wc->syncs++;
+}
+
+int64_t zmpt101b_wallclock_to_wall(const zmpt101b_wallclock_t *wc, int64_t mono_us)
+{
+    if (wc->syncs == 0)
+        return 0;
+    const int64_t elapsed_us = mono_us - wc->sync_mono_us;
+    return wc->sync_wall_us + elapsed_us + elapsed_us * wc->drift_ppb / 1000000000;
+}
@@ -0,0 +1,210 @@
+/*
+ * ZMPT101B Sample Timestamping
+ *
+ * Maps positions in the I2S DMA stream to esp_timer time and, optionally, to wall-clock time.
+ * - The only time reference on the device is when i2s_read() returns. That is never before the
+ *   DMA buffer holding the last sample read was complete, but it can be any time after it: the
+ *   read may have been served from a buffer queued long ago, or the task may have been preempted.
+ *   Every read is therefore an upper bound on when the end of its DMA buffer was sampled. Reads
+ *   that had to wait for their buffer come within interrupt and wake-up latency of it.
+ * - Per epoch of ZMPT101B_TS_EPOCH_BUFFERS DMA buffers the tightest bound is kept. The sample
+ *   period is fitted through the last ZMPT101B_TS_EPOCHS of them. This measures the I2S sample
+ *   clock against esp_timer and corrects for the skew between them. The line is then lowered
+ *   onto the lowest bound.
+ * - A read seen before the model says its buffer was complete pulls the model down at once.
+ * - Any sample position is interpolated from the model. Its error is the jitter of the tightest
+ *   bounds plus the constant wake-up latency, which ZMPT101B_TS_LATENCY_US compensates.
+ * - zmpt101b_wallclock_t maps esp_timer time to wall-clock time from SNTP synchronisations and
+ *   estimates the drift of esp_timer against it, so timestamps between syncs don't wander off.
+ *
+ * Positions count raw samples read from I2S since the DMA ring was last drained, which aligns
+ * them with the DMA buffers. After samples were lost (overflow) or the count was reset, the
+ * tracker must be restarted. It keeps the measured period across restarts.
+ * No hardware dependencies; tools/zmpt101b_timestamp_sim.py runs it against a simulated skewed
+ * clock on the host.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// DMA buffers per epoch; the tightest read of each epoch is kept for the fit
+#define ZMPT101B_TS_EPOCH_BUFFERS 16
+
+// Epochs the sample period is fitted over (16 x 8 buffers of 1024 samples = 5.2 s at 25 kHz)
+#define ZMPT101B_TS_EPOCHS 8
+
+// Fitted periods further than this from nominal are rejected as bogus, in ppm
+#define ZMPT101B_TS_MAX_SKEW_PPM 50000
+
+// Constant delay from a DMA buffer completing to i2s_read() returning (interrupt and task
+// wake-up), subtracted from every timestamp, in microseconds. Measure it against a reference
+// (e.g. a GPIO toggled at a known sample) to get below the residual bias.
+#define ZMPT101B_TS_LATENCY_US 0
+
+// Shortest interval between SNTP syncs used to estimate the esp_timer drift, in seconds
+#define ZMPT101B_TS_WALL_MIN_SPAN_S 60
+
+// Wall-clock corrections larger than this plus the largest plausible drift since the last sync are
+// clock steps (time set), not drift, in milliseconds
+#define ZMPT101B_TS_WALL_STEP_MS 100
+
+// Drift estimates beyond this are discarded, in ppm
+#define ZMPT101B_TS_WALL_MAX_DRIFT_PPM 500
+
+typedef struct {
+    int64_t  position;          // raw sample position of a DMA buffer end
+    int64_t  time_ns;           // earliest esp_timer time it was seen complete
+} zmpt101b_ts_point_t;
+
+typedef struct {
+    uint32_t observations;
+    uint32_t epochs;
+    uint32_t restarts;
+    uint32_t pulls;             // model pulled down by a read seen earlier than predicted
+    uint32_t rejected_fits;     // fits further than ZMPT101B_TS_MAX_SKEW_PPM from nominal
+    uint32_t fit_spread_ns;     // spread of the epoch bounds above the fitted line
+} zmpt101b_ts_stats_t;
+
+typedef struct {
+    uint32_t buffer_samples;    // raw samples per DMA buffer
+    int64_t  nominal_q16;       // nominal raw sample period, ns << 16
+    int64_t  period_q16;        // measured raw sample period against esp_timer, ns << 16
+    bool     period_valid;
+    // Model: time(position) = anchor_time_ns + (position - anchor_position) * period
+    bool     anchored;
+    int64_t  anchor_position;
+    int64_t  anchor_time_ns;
+    // Tightest read of the current epoch
+    int64_t  epoch_end;
+    bool     epoch_seen;
+    zmpt101b_ts_point_t epoch_best;
+    // Tightest reads of the last epochs, oldest first
+    zmpt101b_ts_point_t bounds[ZMPT101B_TS_EPOCHS];
+    uint8_t  bound_count;
+    zmpt101b_ts_stats_t stats;
+} zmpt101b_ts_t;
+
+/*
+ * Esp_timer to wall-clock mapping. A zero-initialised instance is valid and unsynchronised.
+ */
+typedef struct {
+    uint32_t syncs;
+    uint32_t steps;             // syncs that stepped the clock instead of correcting drift
+    int64_t  sync_mono_us;      // esp_timer time of the last sync
+    int64_t  sync_wall_us;      // wall-clock time of the last sync, microseconds since the Unix epoch
+    int32_t  drift_ppb;         // esp_timer rate error against the wall clock, positive if it runs slow
+    bool     drift_valid;
+    int32_t  last_error_us;     // wall-clock correction applied by the last sync
+} zmpt101b_wallclock_t;
+
+/*
+ * Time of a block returned by zmpt101b_read_samples().
+ */
+typedef struct {
+    uint64_t first_sample;      // index of the block's first sample in the stream
+    uint32_t count;             // samples in the block
+    uint32_t stream;            // incremented whenever the stream restarts and sample indices start over
+    int64_t  time_us;           // esp_timer time the first sample was taken
+    int64_t  wall_us;           // wall-clock time of the first sample, microseconds since the Unix epoch, 0 until synced
+    uint32_t period_ps;         // measured sample period in esp_timer picoseconds, for the samples after the first
+    bool     locked;            // the period and the offset are measured, the timestamps are accurate
+} zmpt101b_block_time_t;
+
+/**
+ * @brief Initializes a tracker.
+ *
+ * @param ts Tracker state.
+ * @param sample_rate Nominal raw sample rate in Hz.
+ * @param buffer_samples Raw samples per DMA buffer.
+ */
+void zmpt101b_ts_init(zmpt101b_ts_t *ts, uint32_t sample_rate, uint32_t buffer_samples);
+
+/**
+ * @brief Forgets the stream position after samples were lost or positions were reset; keeps the period.
+ *
+ * @param ts Tracker state.
+ */
+void zmpt101b_ts_restart(zmpt101b_ts_t *ts);
+
+/**
+ * @brief Feeds a completed read.
+ *
+ * @param ts Tracker state.
+ * @param position Raw sample position after the read.
+ * @param time_us esp_timer time the read returned.
+ */
+void zmpt101b_ts_observe(zmpt101b_ts_t *ts, int64_t position, int64_t time_us);
+
+/**
+ * @brief Returns the esp_timer time the raw samples before a position were complete.
+ *
+ * Raw sample n is complete at position n + 1.
+ *
+ * @param ts Tracker state.
+ * @param position Raw sample position, preferably close to the last read.
+ * @return int64_t Time in nanoseconds, 0 before the first read.
+ */
+int64_t zmpt101b_ts_time_ns(const zmpt101b_ts_t *ts, int64_t position);
+
+/**
+ * @brief Tells whether timestamps are accurate: the period is measured and an epoch bounds the offset.
+ *
+ * @param ts Tracker state.
+ * @return true If locked.
+ */
+bool zmpt101b_ts_locked(const zmpt101b_ts_t *ts);
+
+/**
+ * @brief Follows a deliberate change of the sample rate, e.g. an APLL retune.
+ *
+ * The model is re-anchored at the sample taken at time_us and continues with the period scaled
+ * by old/new, so timestamps stay continuous. The epoch bounds collected so far are carried over
+ * with their residuals, so the next fit still has them.
+ *
+ * @param ts Tracker state.
+ * @param time_us esp_timer time the new rate took effect.
+ * @param old_rate Sample rate before, any unit.
+ * @param new_rate Sample rate after, same unit.
+ */
+void zmpt101b_ts_rescale(zmpt101b_ts_t *ts, int64_t time_us, uint32_t old_rate, uint32_t new_rate);
+
+/**
+ * @brief Returns the measured raw sample period.
+ *
+ * @param ts Tracker state.
+ * @return uint32_t Period in picoseconds, the nominal one until measured.
+ */
+uint32_t zmpt101b_ts_period_ps(const zmpt101b_ts_t *ts);
+
+/**
+ * @brief Returns the tracker statistics.
+ *
+ * @param ts Tracker state.
+ * @param stats Statistics.
+ */
+void zmpt101b_ts_get_stats(const zmpt101b_ts_t *ts, zmpt101b_ts_stats_t *stats);
+
+/**
+ * @brief Records a wall-clock synchronisation, e.g. from the SNTP sync notification.
+ *
+ * @param wc Mapping state.
+ * @param mono_us esp_timer time of the sync.
+ * @param wall_us Wall-clock time at that moment, microseconds since the Unix epoch.
+ */
+void zmpt101b_wallclock_sync(zmpt101b_wallclock_t *wc, int64_t mono_us, int64_t wall_us);
+
+/**
+ * @brief Converts esp_timer time to wall-clock time, with the drift since the last sync corrected.
+ *
+ * @param wc Mapping state.
+ * @param mono_us esp_timer time.
+ * @return int64_t Microseconds since the Unix epoch, 0 before the first sync.
+ */
+int64_t zmpt101b_wallclock_to_wall(const zmpt101b_wallclock_t *wc, int64_t mono_us);
@@ -0,0 +1,148 @@
+#include <stddef.h>
+#include <string.h>
+#include "zmpt101b_warmstart.h"
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "esp_system.h"
+#include "esp_app_desc.h"
+#else
+#define RTC_NOINIT_ATTR
+#endif
+
+#define WARM_MAGIC 0x5A4D5753  // "ZMWS"
+
+// Bumped whenever warm_cache_t changes layout
+#define WARM_VERSION 1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint8_t  build[8];          // firmware that wrote the cache
+    uint32_t chars_valid;       // bit per attenuation
+    uint32_t cal_valid;         // bit per channel
+#ifdef ESP_PLATFORM
+    esp_adc_cal_characteristics_t chars[ZMPT101B_WARM_ATTEN_COUNT];
+#endif
+    zmpt101b_cal_data_t cal[ZMPT101B_CAL_CHANNELS];
+    uint32_t crc;
+} warm_cache_t;
+
+// Not initialised by the startup code, so it keeps its content across software resets
+static RTC_NOINIT_ATTR warm_cache_t cache;
+
+// Per boot, cleared by the startup code
+static bool checked = false;
+static bool warm = false;
+
+// Internal functions
+static uint32_t crc32(const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < length; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void current_build(uint8_t build[8])
+{
+#ifdef ESP_PLATFORM
+    memcpy(build, esp_app_get_description()->app_elf_sha256, 8);
+#else
+    memset(build, 0, 8);
+#endif
+}
+
+static void seal(void)
+{
+    cache.crc = crc32(&cache, offsetof(warm_cache_t, crc));
+}
+
+static void reset(void)
+{
+    memset(&cache, 0, sizeof(cache));
+    cache.magic = WARM_MAGIC;
+    cache.version = WARM_VERSION;
+    cache.size = sizeof(cache);
+    current_build(cache.build);
+    seal();
+}
+
+// Validates the cache on first use after boot and starts a new one if it didn't survive
+static void check(void)
+{
+    if (checked)
+        return;
+    checked = true;
+
+    uint8_t build[8];
+    current_build(build);
+    warm = cache.magic == WARM_MAGIC && cache.version == WARM_VERSION && cache.size == sizeof(cache) &&
+           memcmp(cache.build, build, sizeof(build)) == 0 && cache.crc == crc32(&cache, offsetof(warm_cache_t, crc));
+#ifdef ESP_PLATFORM
+    // RTC memory content after these is undefined even if it happens to check out
+    const esp_reset_reason_t reason = esp_reset_reason();
+    if (reason == ESP_RST_POWERON || reason == ESP_RST_BROWNOUT)
+        warm = false;
+#endif
+    if (!warm)
+        reset();
+}
+
+// public API implementation
+bool zmpt101b_warm_started(void)
+{
+    check();
+    return warm;
+}
+
+bool zmpt101b_warm_get_cal(uint8_t channel, zmpt101b_cal_data_t *data)
+{
+    check();
+    if (channel >= ZMPT101B_CAL_CHANNELS || !(cache.cal_valid & (1u << channel)))
+        return false;
+    *data = cache.cal[channel];
+    return true;
+}
+
+void zmpt101b_warm_put_cal(uint8_t channel, const zmpt101b_cal_data_t *data)
+{
+    check();
+    if (channel >= ZMPT101B_CAL_CHANNELS)
+        return;
+    cache.cal[channel] = *data;
+    cache.cal_valid |= 1u << channel;
+    seal();
+}
+
+#ifdef ESP_PLATFORM
+bool zmpt101b_warm_get_chars(adc_atten_t atten, esp_adc_cal_characteristics_t *chars)
+{
+    check();
+    if ((unsigned)atten >= ZMPT101B_WARM_ATTEN_COUNT || !(cache.chars_valid & (1u << atten)))
+        return false;
+    *chars = cache.chars[atten];
+    return true;
+}
+
+void zmpt101b_warm_put_chars(adc_atten_t atten, const esp_adc_cal_characteristics_t *chars)
+{
+    check();
+    if ((unsigned)atten >= ZMPT101B_WARM_ATTEN_COUNT)
+        return;
+    cache.chars[atten] = *chars;
+    cache.chars_valid |= 1u << atten;
+    seal();
+}
+#endif
+
+void zmpt101b_warm_invalidate(void)
+{
+    checked = true;
+    warm = false;
+    reset();
+}
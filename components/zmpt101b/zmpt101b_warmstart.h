@@ -0,0 +1,78 @@
+/*
+ * ZMPT101B Warm-Start Cache
+ *
+ * Keeps what zmpt101b_init() would otherwise work out again on every boot in RTC memory that
+ * survives software resets (OTA restarts, watchdog and panic resets, deep sleep):
+ * - the ADC characterisation per attenuation, so the eFuse is neither probed nor read again;
+ * - the calibration record per channel, so calibration doesn't have to be read from NVS.
+ * The cache is checked once per boot. It is discarded after a power-on or brown-out reset, when
+ * its checksum doesn't match, and when the firmware changed: the characterisation points into
+ * tables of the firmware image that wrote it.
+ * The cache mirrors NVS; erase it with zmpt101b_warm_invalidate() when NVS is erased behind
+ * the component's back.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "zmpt101b_calibration.h"
+#ifdef ESP_PLATFORM
+#include "esp_adc_cal.h"
+#endif
+
+// Attenuations with a characterisation slot (ADC_ATTEN_DB_0 .. ADC_ATTEN_DB_12)
+#define ZMPT101B_WARM_ATTEN_COUNT 4
+
+/**
+ * @brief Tells whether this boot found a valid cache.
+ *
+ * @return true Warm start: the cache survived the reset.
+ */
+bool zmpt101b_warm_started(void);
+
+/**
+ * @brief Returns the cached calibration record of a channel.
+ *
+ * @param channel ADC channel.
+ * @param data Receives the record.
+ * @return true If the channel's record is cached.
+ */
+bool zmpt101b_warm_get_cal(uint8_t channel, zmpt101b_cal_data_t *data);
+
+/**
+ * @brief Caches the calibration record of a channel, as it is stored in NVS.
+ *
+ * @param channel ADC channel.
+ * @param data Record; an empty record caches "not calibrated".
+ */
+void zmpt101b_warm_put_cal(uint8_t channel, const zmpt101b_cal_data_t *data);
+
+#ifdef ESP_PLATFORM
+/**
+ * @brief Returns the cached ADC characterisation of an attenuation.
+ *
+ * @param atten Attenuation.
+ * @param chars Receives the characterisation.
+ * @return true If the attenuation was characterised before the reset.
+ */
+bool zmpt101b_warm_get_chars(adc_atten_t atten, esp_adc_cal_characteristics_t *chars);
+
+/**
+ * @brief Caches the ADC characterisation of an attenuation.
+ *
+ * @param atten Attenuation.
+ * @param chars Characterisation from esp_adc_cal_characterize().
+ */
+void zmpt101b_warm_put_chars(adc_atten_t atten, const esp_adc_cal_characteristics_t *chars);
+#endif
+
+/**
+ * @brief Discards the cache; the next boot starts cold.
+ */
+void zmpt101b_warm_invalidate(void);
@@ -0,0 +1,85 @@
+#include <string.h>
+#include "zmpt101b_zerocross.h"
+
+// Internal functions
+// Position of the zero between the previous (index - 1) and the current sample, Q16
+static uint64_t interpolate_crossing(const zmpt101b_zc_t *zc)
+{
+    const int32_t prev = zc->prev_ac;
+    const int32_t cur = zc->ac;
+    const int32_t step = cur - prev;
+    uint32_t frac_q16 = 0;
+    if (step != 0) {
+        int64_t frac = ((int64_t)-prev << 16) / step;
+        if (frac < 0)
+            frac = 0;
+        else if (frac > 0xFFFF)
+            frac = 0xFFFF;
+        frac_q16 = (uint32_t)frac;
+    }
+    return ((zc->index - 1) << 16) + frac_q16;
+}
+
+void zmpt101b_zc_init(zmpt101b_zc_t *zc, int32_t hysteresis)
+{
+    memset(zc, 0, sizeof(*zc));
+    zc->hysteresis = hysteresis;
+}
+
+zmpt101b_zc_event_t zmpt101b_zc_update(zmpt101b_zc_t *zc, int32_t sample)
+{
+    if (!zc->primed) {
+        zc->dc_q8 = sample * 256;
+        zc->primed = true;
+    }
+    zc->dc_q8 += (sample * 256 - zc->dc_q8 + (1 << (ZMPT101B_ZC_DC_SHIFT - 1))) >> ZMPT101B_ZC_DC_SHIFT;
+
+    zc->prev_ac = zc->ac;
+    zc->ac = sample - (zc->dc_q8 >> 8);
+    zc->index++;
+
+    zmpt101b_zc_event_t event = ZMPT101B_ZC_NONE;
+    if (zc->index < 2)
+        return event;
+
+    if (!zc->positive) {
+        if (zc->prev_ac < 0 && zc->ac >= 0)
+            zc->candidate_q16 = interpolate_crossing(zc);
+        if (zc->ac > zc->hysteresis) {
+            zc->positive = true;
+            event = ZMPT101B_ZC_RISING;
+        }
+    } else {
+        if (zc->prev_ac >= 0 && zc->ac < 0)
+            zc->candidate_q16 = interpolate_crossing(zc);
+        if (zc->ac < -zc->hysteresis) {
+            zc->positive = false;
+            event = ZMPT101B_ZC_FALLING;
+        }
+    }
+
+    if (event != ZMPT101B_ZC_NONE) {
+        // Candidate is unset only when the signal jumped across the band without a sign change
+        // on consecutive samples, e.g. right after start-up
+        const uint64_t position = zc->candidate_q16 != 0 ? zc->candidate_q16 : ((zc->index - 1) << 16);
+        if (zc->crossing_q16 != 0)
+            zc->half_period_q16 = (uint32_t)(position - zc->crossing_q16);
+        zc->crossing_q16 = position;
+        zc->candidate_q16 = 0;
+
+        if (event == ZMPT101B_ZC_RISING) {
+            if (zc->rising_count > 0)
+                zc->period_q16 = (uint32_t)(position - zc->rising_q16);
+            zc->rising_q16 = position;
+            zc->rising_count++;
+        }
+    }
+    return event;
+}
+
+uint32_t zmpt101b_zc_frequency_mhz(const zmpt101b_zc_t *zc, uint32_t sample_rate)
+{
+    if (zc->period_q16 == 0)
+        return 0;
+    return (uint32_t)((((uint64_t)sample_rate * 1000) << 16) / zc->period_q16);
+}
@@ -0,0 +1,73 @@
+/*
+ * ZMPT101B Zero-Crossing Detector
+ *
+ * Streaming zero-crossing detector shared by the cycle-synchronous stages.
+ * The sensor output rides on a DC bias, which is tracked with a slow first-order filter
+ * and removed. A half-wave is confirmed only once the signal leaves the hysteresis band,
+ * so noise around zero can't produce extra crossings; the crossing itself is placed by
+ * linear interpolation between the two samples around zero, with 1/65536 sample resolution.
+ *
+ * Integer-only, no hardware dependencies.
+ *
+ * License:
+ * This component is released under the MIT License. See the LICENSE file for details.
+ *
+ * Author: Andrii Solomai
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Time constant of the DC bias tracker as a power of two, in samples (2^13 = 0.33 s at 25 kHz)
+#define ZMPT101B_ZC_DC_SHIFT 13
+
+typedef enum {
+    ZMPT101B_ZC_NONE = 0,
+    ZMPT101B_ZC_RISING,     // negative to positive half-wave
+    ZMPT101B_ZC_FALLING,    // positive to negative half-wave
+} zmpt101b_zc_event_t;
+
+typedef struct {
+    int32_t  hysteresis;        // band around zero, in sample units
+    int32_t  dc_q8;             // DC bias estimate, sample units << 8
+    int32_t  prev_ac;           // previous sample with DC removed
+    int32_t  ac;                // current sample with DC removed
+    bool     positive;          // polarity of the confirmed half-wave
+    bool     primed;            // first sample seen
+    uint64_t index;             // samples processed so far
+    uint64_t candidate_q16;     // interpolated position of the last sign change
+    uint64_t crossing_q16;      // position of the last confirmed crossing
+    uint64_t rising_q16;        // position of the last confirmed rising crossing
+    uint32_t period_q16;        // samples between the last two rising crossings, 0 until known
+    uint32_t half_period_q16;   // samples between the last two crossings, 0 until known
+    uint32_t rising_count;      // rising crossings seen
+} zmpt101b_zc_t;
+
+/**
+ * @brief Initializes a detector.
+ *
+ * @param zc Detector state.
+ * @param hysteresis Half-width of the band around zero a half-wave must leave, in sample units.
+ */
+void zmpt101b_zc_init(zmpt101b_zc_t *zc, int32_t hysteresis);
+
+/**
+ * @brief Feeds one sample.
+ *
+ * @param zc Detector state.
+ * @param sample Sample including the DC bias.
+ * @return zmpt101b_zc_event_t Crossing confirmed with this sample, if any. The crossing position
+ *         is in zc->crossing_q16 and may lie a few samples back.
+ */
+zmpt101b_zc_event_t zmpt101b_zc_update(zmpt101b_zc_t *zc, int32_t sample);
+
+/**
+ * @brief Returns the mains frequency derived from the last full period.
+ *
+ * @param zc Detector state.
+ * @param sample_rate Sample rate in Hz.
+ * @return uint32_t Frequency in millihertz, 0 until two rising crossings were seen.
+ */
+uint32_t zmpt101b_zc_frequency_mhz(const zmpt101b_zc_t *zc, uint32_t sample_rate);
@@ -13,8 +13,23 @@
 #include "freertos/task.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
+#include "nvs_flash.h"
+#include <sys/time.h>
 // include components
 #include "zmpt101b.h"
+#include "zmpt101b_log.h"
+#include "zmpt101b_telemetry.h"
+#include "zmpt101b_snapshot.h"
+#include "zmpt101b_modbus.h"
+#include "zmpt101b_metrics.h"
+#include "zmpt101b_duty.h"
+#include "zmpt101b_warmstart.h"
+#include "zmpt101b_resample.h"
+#include "zmpt101b_protection.h"
+#include "zmpt101b_spectrum.h"
+#include "esp_timer.h"
+#include "esp_cpu.h"
+#include <math.h>
 
 #define TAG "EXAMPLE_FOR_ZMPT101B_SENSOR"
 
@@ -39,9 +54,252 @@
 // Interval in milliseconds for reinitializing the sensor after a failure
 #define SENSOR_INIT_INTERVAL 10000
 
+// First retry after a failed initialization, doubled up to SENSOR_INIT_INTERVAL
+#define SENSOR_INIT_RETRY_MIN 100
+
 // Interval in milliseconds to read data from sensor
 #define SENSOR_READ_INTERVAL 5000
 
+// Uncomment to stream the readings to a collector over UDP, e.g. tools/zmpt101b_telemetry_rx.py listen.
+// The network (Wi-Fi or Ethernet) has to be brought up by the application before.
+// #define EXAMPLE_TELEMETRY_HOST "192.168.1.10"
+#define EXAMPLE_TELEMETRY_PORT 5140
+
+// Uncomment to serve the readings over Modbus TCP (see zmpt101b_modbus.h for the register map).
+// The network has to be brought up by the application before.
+// #define EXAMPLE_MODBUS_UNIT_ID 1
+
+// Uncomment to serve Prometheus metrics at http://<device>:<port>/metrics.
+// The network has to be brought up by the application before.
+// #define EXAMPLE_METRICS_PORT 9100
+
+// Uncomment to power sampling down and light-sleep between readings (see zmpt101b_duty.h).
+// The LED stays off; tasks such as the servers above only run around each reading.
+// #define EXAMPLE_LOW_POWER
+#define EXAMPLE_MAINS_FREQ 50
+
+// Uncomment to resample a second of the sample stream to this many samples per mains cycle after
+// each reading, and print the RMS over whole cycles and the resampler's CPU cycles per sample
+// (see zmpt101b_resample.h).
+// #define EXAMPLE_RESAMPLE_N 512
+#define EXAMPLE_RESAMPLE_BLOCK 256
+
+// Uncomment to run anti-islanding protection on the continuous sample stream instead of the periodic
+// readings: the GPIO goes high on a trip and stays high (see zmpt101b_protection.h). Thresholds are in
+// millivolts at the sensor, 1 mV per volt of mains with the sensor trimmed.
+// #define EXAMPLE_PROTECTION_GPIO GPIO_NUM_4
+#define EXAMPLE_PROTECTION_BLOCK 256
+#define EXAMPLE_NOMINAL_VOLTAGE 230
+
+// Uncomment to take a Welch spectrum of a second of the sample stream after each reading, and print
+// the noise floor, SNR, ENOB, the largest spur and the estimator's CPU cycles per sample (see
+// zmpt101b_spectrum.h). 1024 points hold the two mains cycles a segment needs.
+// #define EXAMPLE_SPECTRUM_N 1024
+#define EXAMPLE_SPECTRUM_AVERAGES 16
+#define EXAMPLE_SPECTRUM_BLOCK 256
+
+#if defined(EXAMPLE_MODBUS_UNIT_ID) || defined(EXAMPLE_METRICS_PORT)
+static zmpt101b_snapshot_t snapshot;
+#endif
+
+#ifdef EXAMPLE_MODBUS_UNIT_ID
+// Serves Modbus TCP from its own task, the measurement loop only publishes the snapshot
+static void modbus_task(void *arg)
+{
+    static zmpt101b_modbus_t modbus;
+    zmpt101b_modbus_init(&modbus, &snapshot, EXAMPLE_MODBUS_UNIT_ID);
+    while (zmpt101b_modbus_tcp_start(&modbus, ZMPT101B_MODBUS_PORT) != ESP_OK) {
+        ESP_LOGW(TAG, "Modbus TCP server can't listen, retrying");
+        vTaskDelay(pdMS_TO_TICKS(SENSOR_INIT_INTERVAL));
+    }
+    while (1)
+        zmpt101b_modbus_tcp_service(&modbus, 1000);
+}
+#endif
+
+#ifdef EXAMPLE_METRICS_PORT
+static zmpt101b_metrics_t metrics;
+
+// Serves the text rendered by the measurement loop
+static void metrics_task(void *arg)
+{
+    while (zmpt101b_metrics_http_start(&metrics, EXAMPLE_METRICS_PORT) != ESP_OK) {
+        ESP_LOGW(TAG, "metrics server can't listen, retrying");
+        vTaskDelay(pdMS_TO_TICKS(SENSOR_INIT_INTERVAL));
+    }
+    while (1)
+        zmpt101b_metrics_http_service(&metrics, 1000);
+}
+#endif
+
+#ifdef EXAMPLE_RESAMPLE_N
+static void resample_report(void)
+{
+    static zmpt101b_resample_t resampler;
+    static bool resampler_ready = false;
+    static int16_t in[EXAMPLE_RESAMPLE_BLOCK];
+    static int16_t out[EXAMPLE_RESAMPLE_BLOCK * 2];
+
+    // The readings in between interrupt the stream, so every report starts over
+    if (!resampler_ready) {
+        ESP_ERROR_CHECK(zmpt101b_resample_init(&resampler, EXAMPLE_RESAMPLE_N, SAMPLING_FREQ, EXAMPLE_MAINS_FREQ,
+                                               ZMPT101B_DUTY_ZC_HYSTERESIS_MV));
+        resampler_ready = true;
+    } else {
+        zmpt101b_resample_reset(&resampler);
+    }
+
+    uint32_t cpu_cycles = 0;
+    size_t consumed = 0;
+    size_t cycle_fill = 0;
+    int64_t sum = 0;
+    int64_t sum_squares = 0;
+    uint32_t cycles = 0;
+    float rms_min = INFINITY;
+    float rms_max = 0;
+    while (consumed < SAMPLING_FREQ) {
+        size_t count = 0;
+        if (zmpt101b_read_samples(ZMPT101B_SENSOR_ADC_CHANNEL, in, EXAMPLE_RESAMPLE_BLOCK, &count, NULL) != ESP_OK)
+            return;
+        const esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+        const size_t produced = zmpt101b_resample_process(&resampler, in, count, out, sizeof(out) / sizeof(out[0]));
+        cpu_cycles += esp_cpu_get_cycle_count() - start;
+        consumed += count;
+
+        // RMS of every run of N output samples, i.e. of every whole cycle, with the DC bias removed
+        for (size_t i = 0; i < produced; ++i) {
+            sum += out[i];
+            sum_squares += (int32_t)out[i] * out[i];
+            if (++cycle_fill < EXAMPLE_RESAMPLE_N)
+                continue;
+            const float mean = (float)sum / EXAMPLE_RESAMPLE_N;
+            const float rms = sqrtf((float)sum_squares / EXAMPLE_RESAMPLE_N - mean * mean);
+            rms_min = rms < rms_min ? rms : rms_min;
+            rms_max = rms > rms_max ? rms : rms_max;
+            cycles++;
+            cycle_fill = 0;
+            sum = 0;
+            sum_squares = 0;
+        }
+    }
+
+    zmpt101b_resample_stats_t stats;
+    zmpt101b_resample_get_stats(&resampler, &stats);
+    printf("resampled %u samples to %d/cycle at %lu.%03lu Hz: %lu cycles, RMS %.1f..%.1f V, %lu CPU cycles/sample\n",
+           (unsigned)consumed, EXAMPLE_RESAMPLE_N, (unsigned long)(stats.frequency_mhz / 1000),
+           (unsigned long)(stats.frequency_mhz % 1000), (unsigned long)cycles, rms_min, rms_max,
+           (unsigned long)(cpu_cycles / consumed));
+}
+#endif
+
+#ifdef EXAMPLE_SPECTRUM_N
+static void spectrum_report(void)
+{
+    static zmpt101b_spectrum_t spectrum;
+    static bool spectrum_ready = false;
+    static int16_t in[EXAMPLE_SPECTRUM_BLOCK];
+
+    // The readings in between interrupt the stream, so every report starts over
+    if (!spectrum_ready) {
+        const zmpt101b_spectrum_config_t config = {
+            .sample_rate = SAMPLING_FREQ,
+            .fft_size = EXAMPLE_SPECTRUM_N,
+            .averages = EXAMPLE_SPECTRUM_AVERAGES,
+            .nominal_freq = EXAMPLE_MAINS_FREQ,
+        };
+        ESP_ERROR_CHECK(zmpt101b_spectrum_init(&spectrum, &config));
+        spectrum_ready = true;
+    } else {
+        zmpt101b_spectrum_reset(&spectrum);
+    }
+
+    uint32_t cpu_cycles = 0;
+    size_t consumed = 0;
+    size_t published = 0;
+    while (consumed < SAMPLING_FREQ || published == 0) {
+        size_t count = 0;
+        if (zmpt101b_read_samples(ZMPT101B_SENSOR_ADC_CHANNEL, in, EXAMPLE_SPECTRUM_BLOCK, &count, NULL) != ESP_OK)
+            return;
+        const esp_cpu_cycle_count_t start = esp_cpu_get_cycle_count();
+        published += zmpt101b_spectrum_process(&spectrum, in, count);
+        cpu_cycles += esp_cpu_get_cycle_count() - start;
+        consumed += count;
+    }
+
+    zmpt101b_spectrum_result_t result;
+    if (zmpt101b_spectrum_get(&spectrum, &result) != ESP_OK)
+        return;
+    printf("spectrum of %u samples, %d points x %d: %.2f Hz %.1f mV, floor %.3g mV^2/Hz, noise %.2f mV, "
+           "SNR %.1f dB, ENOB %.2f, spur %.0f Hz %.1f dBc, %lu CPU cycles/sample\n",
+           (unsigned)consumed, EXAMPLE_SPECTRUM_N, EXAMPLE_SPECTRUM_AVERAGES, result.signal_hz, result.signal_rms_mv,
+           result.noise_density, result.noise_rms_mv, result.snr_db, result.enob, result.spur_hz, result.spur_dbc,
+           (unsigned long)(cpu_cycles / consumed));
+}
+#endif
+
+#ifdef EXAMPLE_PROTECTION_GPIO
+// Runs in the protection task right after the GPIO was driven
+static void protection_trip(const zmpt101b_protection_trip_t *trip, void *arg)
+{
+    ESP_LOGW(TAG, "protection trip: element %u on %.3f, %lld us after the sample", (unsigned)trip->element,
+             trip->value, trip->sample_time_us ? (long long)(trip->output_us - trip->sample_time_us) : -1LL);
+}
+
+// Reads the stream back to back and evaluates the protection every half cycle
+static void protection_task(void *arg)
+{
+    static zmpt101b_protection_t protection;
+    static int16_t block[EXAMPLE_PROTECTION_BLOCK];
+    const float un = EXAMPLE_NOMINAL_VOLTAGE;
+    // Settings in the style of a grid code; use what the network operator prescribes
+    const zmpt101b_protection_config_t protection_cfg = {
+        .sample_rate = SAMPLING_FREQ,
+        .nominal_freq = EXAMPLE_MAINS_FREQ,
+        .elements = {
+            { ZMPT101B_PROTECTION_UNDER_VOLTAGE, 0.85f * un, 0.02f * un, 1500 },
+            { ZMPT101B_PROTECTION_UNDER_VOLTAGE, 0.45f * un, 0.02f * un, 160 },
+            { ZMPT101B_PROTECTION_OVER_VOLTAGE, 1.10f * un, 0.02f * un, 1000 },
+            { ZMPT101B_PROTECTION_OVER_VOLTAGE, 1.20f * un, 0.02f * un, 160 },
+            { ZMPT101B_PROTECTION_UNDER_FREQUENCY, EXAMPLE_MAINS_FREQ - 2.5f, 0.05f, 100 },
+            { ZMPT101B_PROTECTION_OVER_FREQUENCY, EXAMPLE_MAINS_FREQ + 1.5f, 0.05f, 100 },
+            { ZMPT101B_PROTECTION_ROCOF, 1.0f, 0.1f, 200 },
+        },
+        .element_count = 7,
+        .block_voltage = 0.2f * un,
+        .trip_gpio = EXAMPLE_PROTECTION_GPIO,
+        .trip_level = 1,
+        .on_trip = protection_trip,
+        // A block is only seen once it is complete; allow one more half cycle on top
+        .deadline_us = (uint32_t)(EXAMPLE_PROTECTION_BLOCK * 1000000ULL / SAMPLING_FREQ) + 500000 / EXAMPLE_MAINS_FREQ,
+    };
+    ESP_ERROR_CHECK(zmpt101b_protection_init(&protection, &protection_cfg));
+
+    int64_t report_us = esp_timer_get_time();
+    while (1) {
+        size_t count = 0;
+        uint32_t quality = 0;
+        if (zmpt101b_read_samples(ZMPT101B_SENSOR_ADC_CHANNEL, block, EXAMPLE_PROTECTION_BLOCK, &count, &quality) != ESP_OK) {
+            zmpt101b_protection_reset(&protection);
+            continue;
+        }
+        if (quality & ZMPT101B_QUALITY_GAP)
+            zmpt101b_protection_reset(&protection);
+        zmpt101b_block_time_t time;
+        const bool timed = zmpt101b_get_block_time(ZMPT101B_SENSOR_ADC_CHANNEL, &time) == ESP_OK && time.locked;
+        zmpt101b_protection_process(&protection, block, count, timed ? &time : NULL);
+
+        if (esp_timer_get_time() - report_us < SENSOR_READ_INTERVAL * 1000LL)
+            continue;
+        report_us = esp_timer_get_time();
+        zmpt101b_protection_stats_t stats;
+        zmpt101b_protection_get_stats(&protection, &stats);
+        printf("protection: %lu evaluations, %lu trips, evaluation max %lu ns, decision max %lu us, %lu late\n",
+               (unsigned long)stats.evaluations, (unsigned long)stats.trips, (unsigned long)stats.eval_ns_max,
+               (unsigned long)stats.latency_us_max, (unsigned long)stats.deadline_misses);
+    }
+}
+#endif
+
 void app_main(void)
 {
     // Init blink LED
@@ -54,27 +312,184 @@ void app_main(void)
     gpio_config(&io_conf);
     gpio_set_direction(BLINK_GPIO, GPIO_MODE_OUTPUT);
 
-    // Initialize the ZMPT101B sensor.
+    // Initialize NVS, the ZMPT101B component keeps its calibration there
+    esp_err_t nvs_err = nvs_flash_init();
+    if (nvs_err == ESP_ERR_NVS_NO_FREE_PAGES || nvs_err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        // The calibration cached in RTC memory went with it
+        zmpt101b_warm_invalidate();
+        nvs_err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(nvs_err);
+
+    // Initialize the ZMPT101B sensor. Retries start quickly and back off, so a transient
+    // failure right after boot doesn't hold up the first reading for the full interval.
     esp_err_t sensor_err = ESP_ERR_NOT_FOUND;
+    uint32_t retry_ms = SENSOR_INIT_RETRY_MIN;
     do{
         sensor_err = zmpt101b_init(ZMPT101B_SENSOR_ADC_CHANNEL);
         if (sensor_err!=ESP_OK){
-            ESP_LOGW(TAG, "timeout %dmsec before retry initializatin ZMPT101B sensor", SENSOR_INIT_INTERVAL );
-            vTaskDelay(pdMS_TO_TICKS(SENSOR_INIT_INTERVAL));
+            ESP_LOGW(TAG, "timeout %ldmsec before retry initializatin ZMPT101B sensor", (long)retry_ms );
+            vTaskDelay(pdMS_TO_TICKS(retry_ms));
+            retry_ms = retry_ms * 2 > SENSOR_INIT_INTERVAL ? SENSOR_INIT_INTERVAL : retry_ms * 2;
         }
     }while(sensor_err!=ESP_OK);
 
+#ifdef EXAMPLE_PROTECTION_GPIO
+    // The protection needs every sample, so it takes the stream over from the periodic readings
+    xTaskCreate(protection_task, "protection", 4096, NULL, configMAX_PRIORITIES - 2, NULL);
+    return;
+#endif
+
+    // Open the measurement log, the example keeps running without it
+    static zmpt101b_log_t measurement_log;
+    const bool log_ready = zmpt101b_log_open(&measurement_log, ZMPT101B_LOG_PARTITION_LABEL) == ESP_OK;
+    if (!log_ready)
+        ESP_LOGW(TAG, "measurement log partition not available");
+
+#ifdef EXAMPLE_TELEMETRY_HOST
+    static zmpt101b_telemetry_t telemetry;
+    const zmpt101b_telemetry_config_t telemetry_cfg = {
+        .transport = ZMPT101B_TELEMETRY_UDP,
+        .host = EXAMPLE_TELEMETRY_HOST,
+        .port = EXAMPLE_TELEMETRY_PORT,
+        .flush_interval_us = 1000000,
+        .nominal_freq = EXAMPLE_MAINS_FREQ,
+    };
+    const bool telemetry_ready = zmpt101b_telemetry_init(&telemetry, &telemetry_cfg) == ESP_OK;
+    if (!telemetry_ready)
+        ESP_LOGW(TAG, "telemetry sink not available");
+#endif
+
+#if defined(EXAMPLE_MODBUS_UNIT_ID) || defined(EXAMPLE_METRICS_PORT)
+    zmpt101b_snapshot_init(&snapshot);
+#endif
+#ifdef EXAMPLE_MODBUS_UNIT_ID
+    xTaskCreate(modbus_task, "modbus", 4096, NULL, 5, NULL);
+#endif
+#ifdef EXAMPLE_METRICS_PORT
+    zmpt101b_metrics_init(&metrics);
+    xTaskCreate(metrics_task, "metrics", 4096, NULL, 5, NULL);
+#endif
+
+#ifdef EXAMPLE_LOW_POWER
+    static zmpt101b_duty_t duty;
+    const zmpt101b_duty_config_t duty_cfg = {
+        .interval_us = SENSOR_READ_INTERVAL * 1000,
+        .nominal_freq = EXAMPLE_MAINS_FREQ,
+        .min_sleep_us = 2000,
+    };
+    ESP_ERROR_CHECK(zmpt101b_duty_init(&duty, &duty_cfg, esp_timer_get_time()));
+#endif
+
     // Infinite loop to continuously fetch data from ZMPT101B sensor
     while (1) {
+        uint16_t voltage = 0;
+#ifdef EXAMPLE_LOW_POWER
+        // Sleeps until the next reading is due and powers sampling down again after it
+        const esp_err_t read_err = zmpt101b_duty_measure(&duty, ZMPT101B_SENSOR_ADC_CHANNEL, &voltage);
+        if (read_err != ESP_OK) {
+            // The component has already retried and recovered the acquisition; skip this reading
+            ESP_LOGW(TAG, "reading failed (%s)", esp_err_to_name(read_err));
+            continue;
+        }
+        zmpt101b_duty_stats_t duty_stats;
+        zmpt101b_duty_get_stats(&duty, &duty_stats);
+        printf("ZMPT101B return voltage = %dV (resume %u us, ~%u uJ per reading)\n", voltage,
+               (unsigned)duty_stats.resume_us, (unsigned)duty_stats.energy_avg_uj);
+#else
         gpio_set_level(BLINK_GPIO, LED_ON);
-        vTaskDelay(pdMS_TO_TICKS(LED_BLINK_DURATION));
 
-        uint16_t voltage = 0.0;
-         ESP_ERROR_CHECK(zmpt101b_read_voltage(ZMPT101B_SENSOR_ADC_CHANNEL, &voltage ));
-        printf("ZMPT101B return voltage = %dV\n", voltage);
+        zmpt101b_measurement_t measurement;
+        const esp_err_t read_err = zmpt101b_read_measurement(ZMPT101B_SENSOR_ADC_CHANNEL, &measurement);
+        if (read_err != ESP_OK) {
+            // The component has already retried and recovered the acquisition; skip this reading
+            ESP_LOGW(TAG, "reading failed (%s)", esp_err_to_name(read_err));
+            gpio_set_level(BLINK_GPIO, LED_OFF);
+            vTaskDelay(pdMS_TO_TICKS(SENSOR_READ_INTERVAL));
+            continue;
+        }
+        const int32_t rms_mv = measurement.rms_mv;
+        voltage = (uint16_t)((rms_mv + 500) / 1000);
+        printf("ZMPT101B return voltage = %ld.%02ldV, %lu.%03lu Hz, crest factor %u.%03u, DC %ld mV\n",
+               (long)((rms_mv + 5) / 1000), (long)((rms_mv + 5) / 10 % 100),
+               (unsigned long)(measurement.frequency_mhz / 1000), (unsigned long)(measurement.frequency_mhz % 1000),
+               measurement.crest_factor_milli / 1000, measurement.crest_factor_milli % 1000, (long)measurement.dc_offset_mv);
+#endif
+#ifdef EXAMPLE_RESAMPLE_N
+        resample_report();
+#endif
+#ifdef EXAMPLE_SPECTRUM_N
+        spectrum_report();
+#endif
+
+        // Boot-to-first-reading benchmark: esp_timer counts from boot
+        static bool first_reading = true;
+        if (first_reading) {
+            first_reading = false;
+            zmpt101b_stats_t boot_stats;
+            zmpt101b_get_stats(ZMPT101B_SENSOR_ADC_CHANNEL, &boot_stats);
+            ESP_LOGI(TAG, "first reading %lld us after boot (%s start, init %lu us)", (long long)esp_timer_get_time(),
+                     boot_stats.warm_start ? "warm" : "cold", (unsigned long)boot_stats.init_us);
+        }
+
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        const zmpt101b_log_record_t record = {
+            .timestamp_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec,
+            .type = ZMPT101B_LOG_VOLTAGE,
+            .values = { voltage },
+        };
+        if (log_ready && zmpt101b_log_append(&measurement_log, &record) != ESP_OK)
+            ESP_LOGW(TAG, "failed to append to the measurement log");
 
+#if defined(EXAMPLE_MODBUS_UNIT_ID) || defined(EXAMPLE_METRICS_PORT)
+        zmpt101b_stats_t stats;
+        zmpt101b_get_stats(ZMPT101B_SENSOR_ADC_CHANNEL, &stats);
+        const zmpt101b_snapshot_data_t data = {
+            .timestamp_us = record.timestamp_us,
+#ifdef EXAMPLE_LOW_POWER
+            .rms_mv = (uint32_t)voltage * 1000,
+#else
+            .rms_mv = (uint32_t)measurement.rms_mv,
+            .frequency_mhz = measurement.frequency_mhz,
+#endif
+            .thd_centi_pct = ZMPT101B_SNAPSHOT_THD_UNKNOWN,
+            // Events need every cycle of the stream (zmpt101b_aggregation.h); the periodic windows
+            // here miss what happens between them, so the counters are reported unknown
+            .dips = ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN,
+            .swells = ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN,
+            .interruptions = ZMPT101B_SNAPSHOT_EVENTS_UNKNOWN,
+            .attenuation = stats.attenuation,
+            .quality = stats.quality,
+            .clipped = stats.clipped_low + stats.clipped_high,
+            .gaps = stats.gaps,
+            .duplicates = stats.duplicates,
+            .range_switches = stats.range_switches,
+            .window_us = stats.window_us,
+        };
+        zmpt101b_snapshot_publish(&snapshot, &data);
+#endif
+#ifdef EXAMPLE_METRICS_PORT
+        // The published copy carries the min/max and update count kept by the snapshot
+        zmpt101b_snapshot_data_t published;
+        zmpt101b_snapshot_read(&snapshot, &published);
+        zmpt101b_metrics_update(&metrics, &published);
+#endif
+
+#ifdef EXAMPLE_TELEMETRY_HOST
+        if (telemetry_ready) {
+            zmpt101b_telemetry_add_record(&telemetry, &record, record.timestamp_us);
+            zmpt101b_telemetry_service(&telemetry, record.timestamp_us);
+        }
+#endif
+
+#ifndef EXAMPLE_LOW_POWER
+        // The LED lit up with the reading, so the first one isn't held back by the blink
+        vTaskDelay(pdMS_TO_TICKS(LED_BLINK_DURATION));
         gpio_set_level(BLINK_GPIO, LED_OFF);
         // Wait for the next iteration
         vTaskDelay(pdMS_TO_TICKS(SENSOR_READ_INTERVAL));
+#endif
     }
 }
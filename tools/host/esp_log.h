@@ -0,0 +1,15 @@
+/*
+ * Minimal esp_log.h for building the platform independent ZMPT101B modules on a host
+ * (used by the tools/ scripts). Errors and warnings go to stderr, the other levels are
+ * compiled out as with CONFIG_LOG_DEFAULT_LEVEL_WARN.
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ((void)(tag))
+#define ESP_LOGD(tag, format, ...) ((void)(tag))
+#define ESP_LOGV(tag, format, ...) ((void)(tag))
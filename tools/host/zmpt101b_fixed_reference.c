@@ -0,0 +1,116 @@
+// Host-only loops for tools/zmpt101b_fixed_bench.py: the fixed-point functions of zmpt101b_fixed.h
+// and the float and double code they replace, each over an array and returning the time taken in
+// nanoseconds, so the call overhead of ctypes doesn't count.
+
+#include <math.h>
+#include <stddef.h>
+#include <time.h>
+#include "zmpt101b_fixed.h"
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t ref_q15_mul(const int16_t *a, const int16_t *b, int16_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        out[i] = zmpt101b_q15_mul(a[i], b[i]);
+    return now_ns() - start;
+}
+
+uint64_t ref_q15_mul_float(const int16_t *a, const int16_t *b, int16_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        const float y = lrintf((a[i] / 32768.0f) * (b[i] / 32768.0f) * 32768.0f);
+        out[i] = y > 32767.0f ? 32767 : (int16_t)y;
+    }
+    return now_ns() - start;
+}
+
+uint64_t ref_q31_mul(const int32_t *a, const int32_t *b, int32_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        out[i] = zmpt101b_q31_mul(a[i], b[i]);
+    return now_ns() - start;
+}
+
+uint64_t ref_q31_mul_float(const int32_t *a, const int32_t *b, int32_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++) {
+        const double y = rint((a[i] / 2147483648.0) * (b[i] / 2147483648.0) * 2147483648.0);
+        out[i] = y > 2147483647.0 ? INT32_MAX : (int32_t)y;
+    }
+    return now_ns() - start;
+}
+
+uint64_t ref_isqrt32(const uint32_t *in, uint32_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        out[i] = zmpt101b_isqrt32(in[i]);
+    return now_ns() - start;
+}
+
+uint64_t ref_sqrtf(const uint32_t *in, uint32_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint32_t)sqrtf((float)in[i]);
+    return now_ns() - start;
+}
+
+uint64_t ref_p2p_to_rms_fixed(const int32_t *in, int32_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        out[i] = zmpt101b_fx_p2p_to_rms_mv(in[i]);
+    return now_ns() - start;
+}
+
+// The expression zmpt101b_read_voltage() used before
+uint64_t ref_p2p_to_rms_double(const int32_t *in, int32_t *out, size_t n)
+{
+    const uint64_t start = now_ns();
+    for (size_t i = 0; i < n; i++)
+        out[i] = round((in[i] / 2.0) / 1.4142135 * 1000.0);
+    return now_ns() - start;
+}
+
+// RMS of consecutive blocks of `block` samples, as zmpt101b_threephase.c takes them
+uint64_t ref_block_rms_fixed(const int16_t *in, size_t n, size_t block, float *out)
+{
+    const uint64_t start = now_ns();
+    for (size_t b = 0; b + block <= n; b += block) {
+        int64_t sum = 0;
+        uint64_t sum_squares = 0;
+        for (size_t i = b; i < b + block; i++) {
+            sum += in[i];
+            sum_squares += (uint64_t)((int32_t)in[i] * in[i]);
+        }
+        out[b / block] = (float)zmpt101b_fx_ac_rms_q8(sum, sum_squares, (uint32_t)block) / (1 << ZMPT101B_FX_RMS_FRAC_BITS);
+    }
+    return now_ns() - start;
+}
+
+uint64_t ref_block_rms_float(const int16_t *in, size_t n, size_t block, float *out)
+{
+    const uint64_t start = now_ns();
+    for (size_t b = 0; b + block <= n; b += block) {
+        float sum = 0, sum_squares = 0;
+        for (size_t i = b; i < b + block; i++) {
+            sum += in[i];
+            sum_squares += (float)in[i] * in[i];
+        }
+        const float mean = sum / block;
+        const float variance = sum_squares / block - mean * mean;
+        out[b / block] = variance > 0 ? sqrtf(variance) : 0;
+    }
+    return now_ns() - start;
+}
@@ -0,0 +1,239 @@
+# Host test of the ZMPT101B measurement aggregation (components/zmpt101b/zmpt101b_aggregation.h).
+#
+# Usage:
+#   python zmpt101b_aggregation_sim.py [--seed 1] [--freq 50|60]
+#       build the aggregation engine for the host and feed it timestamped mains samples from
+#       25 minutes before a 2-hour clock tick to past the next one, with a dip and a swell inside
+#       two of the 10-minute intervals; rebuilds every 150/180-cycle, 10-minute and 2-hour value
+#       from the values below it and checks the clock alignment, the root-sum-square RMS, the
+#       counts and that exactly the intervals containing an event are flagged
+
+import argparse
+import ctypes
+import math
+import random
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h and zmpt101b_aggregation.h
+SAMPLING_FREQ = 25000
+AGG_SHORT_WINDOWS = 15
+AGG_10_MIN_US = 600 * 1000000
+AGG_2_HOUR_US = 7200 * 1000000
+
+AGG_CYCLES, AGG_150_CYCLES, AGG_10_MIN, AGG_2_HOUR = range(4)
+INTERVAL_NAMES = ['10/12-cycle', '150/180-cycle', '10-minute', '2-hour']
+
+BIAS_MV = 1650
+PEAK_MV = 325               # 230 V mains with the sensor trimmed to 1 mV per V
+NOISE_MV = 0.5
+DECLARED_MV = 230000
+
+# 2026-01-01 00:00 UTC, a 2-hour tick; the stream starts 25 minutes before it
+TICK_2_HOUR_S = 1767225600
+START_S = TICK_2_HOUR_S - 25 * 60
+DURATION_S = 25 * 60 + 7200 + 5 * 60
+
+# Events as (name, start in seconds after START_S, first cycle within that second, cycles, gain)
+EVENTS = [('dip', 12 * 60 + 7, 13, 5, 0.6), ('swell', 22 * 60 + 41, 4, 3, 1.2)]
+
+# Unflagged values must match the RMS of the undisturbed mains this closely
+RMS_TOLERANCE = 0.002
+
+
+class ZeroCross(ctypes.Structure):
+    _fields_ = [('hysteresis', ctypes.c_int32), ('dc_q8', ctypes.c_int32), ('prev_ac', ctypes.c_int32),
+                ('ac', ctypes.c_int32), ('positive', ctypes.c_bool), ('primed', ctypes.c_bool),
+                ('index', ctypes.c_uint64), ('candidate_q16', ctypes.c_uint64), ('crossing_q16', ctypes.c_uint64),
+                ('rising_q16', ctypes.c_uint64), ('period_q16', ctypes.c_uint32),
+                ('half_period_q16', ctypes.c_uint32), ('rising_count', ctypes.c_uint32)]
+
+
+class AggValue(ctypes.Structure):
+    _fields_ = [('interval', ctypes.c_int), ('rms_mv', ctypes.c_uint32), ('timestamp_us', ctypes.c_int64),
+                ('count', ctypes.c_uint32), ('flagged', ctypes.c_bool)]
+
+
+AggCallback = ctypes.CFUNCTYPE(None, ctypes.POINTER(AggValue), ctypes.c_void_p)
+
+
+class AggConfig(ctypes.Structure):
+    _fields_ = [('sample_rate', ctypes.c_uint32), ('nominal_freq', ctypes.c_uint16),
+                ('declared_mv', ctypes.c_uint32), ('callback', AggCallback), ('ctx', ctypes.c_void_p)]
+
+
+class AggLevel(ctypes.Structure):
+    _fields_ = [('sum_sq', ctypes.c_uint64), ('count', ctypes.c_uint32), ('flagged', ctypes.c_bool)]
+
+
+class Agg(ctypes.Structure):
+    _fields_ = [('cfg', AggConfig), ('zc', ZeroCross), ('window_cycles', ctypes.c_uint8),
+                ('max_cycle_samples', ctypes.c_uint32), ('dip_mv', ctypes.c_uint32), ('swell_mv', ctypes.c_uint32),
+                ('interruption_mv', ctypes.c_uint32), ('cycle_sum_sq', ctypes.c_uint64),
+                ('cycle_samples', ctypes.c_uint32), ('window_sum_sq', ctypes.c_uint64),
+                ('window_samples', ctypes.c_uint32), ('window_cycle_count', ctypes.c_uint8),
+                ('window_flagged', ctypes.c_bool), ('synced', ctypes.c_bool),
+                ('short_level', AggLevel), ('min10_level', AggLevel), ('hour2_level', AggLevel),
+                ('next_10min_us', ctypes.c_int64), ('next_2hour_us', ctypes.c_int64),
+                ('event_state', ctypes.c_uint8), ('dips', ctypes.c_uint32), ('swells', ctypes.c_uint32),
+                ('interruptions', ctypes.c_uint32)]
+
+
+def load_aggregation_library():
+    """
+    Builds the aggregation engine and the zero-crossing detector it runs on for the host.
+    """
+    lib = build_library('zmpt101b_aggregation',
+                        ['zmpt101b_aggregation.c', 'zmpt101b_zerocross.c', 'zmpt101b_fixed.c'],
+                        ['zmpt101b_aggregation.h', 'zmpt101b_zerocross.h', 'zmpt101b_fixed.h'])
+    lib.zmpt101b_agg_init.argtypes = [ctypes.POINTER(Agg), ctypes.POINTER(AggConfig)]
+    lib.zmpt101b_agg_init.restype = ctypes.c_int
+    lib.zmpt101b_agg_process.argtypes = [ctypes.POINTER(Agg), ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t,
+                                         ctypes.c_int64]
+    lib.zmpt101b_agg_process.restype = None
+    return lib
+
+
+def rss(values):
+    """
+    What the engine reports for a set of values: the root of their mean square, rounded down.
+    """
+    return math.isqrt(sum(v * v for v in values) // len(values))
+
+
+def second_block(nominal_freq, noise, event=None):
+    """
+    One second of samples starting on a rising zero crossing. `event` scales whole cycles.
+    """
+    samples = []
+    for n in range(SAMPLING_FREQ):
+        gain = 1.0
+        if event is not None:
+            _, _, first, cycles, event_gain = event
+            if first <= n * nominal_freq // SAMPLING_FREQ < first + cycles:
+                gain = event_gain
+        samples.append(int(round(BIAS_MV + PEAK_MV * gain * math.sin(2 * math.pi * nominal_freq * n / SAMPLING_FREQ)
+                                 + noise[n])))
+    return (ctypes.c_int16 * SAMPLING_FREQ)(*samples)
+
+
+def event_span_us(event, nominal_freq):
+    _, second, first, cycles, _ = event
+    start = (START_S + second) * 1000000 + first * 1000000 / nominal_freq
+    return start, start + cycles * 1000000 / nominal_freq
+
+
+def run(lib, nominal_freq, rng):
+    """
+    Feeds the stream at one mains frequency and checks every aggregate. Returns True when they all pass.
+    """
+    values = [[] for _ in INTERVAL_NAMES]
+    callback = AggCallback(lambda value, ctx: values[value.contents.interval].append(
+        (value.contents.timestamp_us, value.contents.rms_mv, value.contents.count, value.contents.flagged)))
+    config = AggConfig(SAMPLING_FREQ, nominal_freq, DECLARED_MV, callback, None)
+    agg = Agg()
+    if lib.zmpt101b_agg_init(ctypes.byref(agg), ctypes.byref(config)) != 0:
+        raise RuntimeError('zmpt101b_agg_init failed')
+
+    noise = [rng.gauss(0, NOISE_MV) for _ in range(SAMPLING_FREQ)]
+    steady = second_block(nominal_freq, noise)
+    event_blocks = {event[1]: second_block(nominal_freq, noise, event) for event in EVENTS}
+    for second in range(DURATION_S):
+        lib.zmpt101b_agg_process(ctypes.byref(agg), event_blocks.get(second, steady), SAMPLING_FREQ,
+                                 (START_S + second) * 1000000)
+
+    failures = []
+    windows, shorts, min10s, hour2s = values
+    window_cycles = 10 if nominal_freq == 50 else 12
+    window_samples = SAMPLING_FREQ * window_cycles // nominal_freq
+    nominal_rms = PEAK_MV / math.sqrt(2) * 1000
+    half_cycle_us = 500000 / nominal_freq
+    spans = [event_span_us(event, nominal_freq) for event in EVENTS]
+
+    # 10/12-cycle values: whole cycles, flagged when they hold more than half a cycle of an event
+    for (prev_ts, _, _, _), (ts, rms_mv, count, flagged) in zip(windows, windows[1:]):
+        if abs(count - window_samples) > 2:
+            failures.append(f'10/12-cycle value at {ts}: {count} samples, expected {window_samples}')
+        expected = any(min(ts, end) - max(prev_ts, start) > half_cycle_us for start, end in spans)
+        if flagged != expected:
+            failures.append(f'10/12-cycle value at {ts}: flagged {flagged}, expected {expected}')
+        if not flagged and abs(rms_mv - nominal_rms) > nominal_rms * RMS_TOLERANCE:
+            failures.append(f'10/12-cycle value at {ts}: {rms_mv} mV, expected {nominal_rms:.0f} mV')
+
+    # 150/180-cycle values: the 15 values before them, never across a 10-minute tick
+    index = {ts: n for n, (ts, _, _, _) in enumerate(windows)}
+    for ts, rms_mv, count, flagged in shorts:
+        parts = windows[index[ts] - AGG_SHORT_WINDOWS + 1:index[ts] + 1]
+        if count != AGG_SHORT_WINDOWS or len(parts) != AGG_SHORT_WINDOWS:
+            failures.append(f'150/180-cycle value at {ts}: count {count}')
+            continue
+        if parts[0][0] // AGG_10_MIN_US != ts // AGG_10_MIN_US:
+            failures.append(f'150/180-cycle value at {ts}: spans the 10-minute tick after {parts[0][0]}')
+        if rms_mv != rss([p[1] for p in parts]) or flagged != any(p[3] for p in parts):
+            failures.append(f'150/180-cycle value at {ts}: {rms_mv} mV flagged {flagged}, expected '
+                            f'{rss([p[1] for p in parts])} mV flagged {any(p[3] for p in parts)}')
+
+    # 10-minute values: every tick from the first one after the start, over the values ending in it
+    first_tick = (START_S * 1000000 // AGG_10_MIN_US + 1) * AGG_10_MIN_US
+    expected_ticks = list(range(first_tick, (START_S + DURATION_S) * 1000000, AGG_10_MIN_US))
+    # The interval still open at the end of the stream isn't reported yet
+    if [v[0] for v in min10s] != expected_ticks[:len(min10s)] or len(min10s) < len(expected_ticks) - 1:
+        failures.append(f'10-minute values at {[v[0] for v in min10s]}, expected the ticks {expected_ticks}')
+    for ts, rms_mv, count, flagged in min10s:
+        parts = [w for w in windows if ts - AGG_10_MIN_US <= w[0] < ts]
+        full = ts - AGG_10_MIN_US > START_S * 1000000
+        if count != len(parts) or (full and abs(count - AGG_10_MIN_US // (window_samples * 1000000 // SAMPLING_FREQ)) > 1):
+            failures.append(f'10-minute value at {ts}: count {count}, {len(parts)} values in the interval')
+        elif rms_mv != rss([p[1] for p in parts]) or flagged != any(p[3] for p in parts):
+            failures.append(f'10-minute value at {ts}: {rms_mv} mV flagged {flagged}, expected '
+                            f'{rss([p[1] for p in parts])} mV flagged {any(p[3] for p in parts)}')
+        if not flagged and abs(rms_mv - nominal_rms) > nominal_rms * RMS_TOLERANCE:
+            failures.append(f'10-minute value at {ts}: {rms_mv} mV, expected {nominal_rms:.0f} mV')
+
+    # 2-hour values: on the 2-hour ticks, over the 10-minute values ending in the interval
+    if [v[0] for v in hour2s] != [TICK_2_HOUR_S * 1000000, TICK_2_HOUR_S * 1000000 + AGG_2_HOUR_US]:
+        failures.append(f'2-hour values at {[v[0] for v in hour2s]}')
+    for ts, rms_mv, count, flagged in hour2s:
+        parts = [v for v in min10s if ts - AGG_2_HOUR_US < v[0] <= ts]
+        full = ts - AGG_2_HOUR_US > START_S * 1000000
+        if count != len(parts) or (full and count != AGG_2_HOUR_US // AGG_10_MIN_US):
+            failures.append(f'2-hour value at {ts}: count {count}, {len(parts)} values in the interval')
+        elif rms_mv != rss([p[1] for p in parts]) or flagged != any(p[3] for p in parts):
+            failures.append(f'2-hour value at {ts}: {rms_mv} mV flagged {flagged}, expected '
+                            f'{rss([p[1] for p in parts])} mV flagged {any(p[3] for p in parts)}')
+
+    # Both events fall in the first 2-hour interval, in two different 10-minute intervals
+    flagged_counts = [sum(v[3] for v in level) for level in values]
+    if flagged_counts[AGG_10_MIN] != len(EVENTS) or [v[3] for v in hour2s] != [True, False]:
+        failures.append(f'flagged values per interval {flagged_counts}')
+    if (agg.dips, agg.swells, agg.interruptions) != (1, 1, 0):
+        failures.append(f'{agg.dips} dips, {agg.swells} swells, {agg.interruptions} interruptions counted')
+
+    print(f'{nominal_freq} Hz mains: ' + ', '.join(f'{len(level)} {name} values ({flags} flagged)' for name, level, flags
+                                               in zip(INTERVAL_NAMES, values, flagged_counts)))
+    unflagged = [v[1] for v in min10s if not v[3]]
+    if unflagged:
+        print(f'  unflagged 10-minute RMS {min(unflagged)}..{max(unflagged)} mV, mains {nominal_rms:.0f} mV')
+    for failure in failures[:5]:
+        print(f'  {failure}')
+    return not failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B aggregation test')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--freq', type=int, choices=(50, 60), help='run one mains frequency only')
+    args = parser.parse_args()
+    lib = load_aggregation_library()
+    rng = random.Random(args.seed)
+
+    ok = True
+    for nominal_freq in (50, 60):
+        if args.freq in (None, nominal_freq):
+            ok &= run(lib, nominal_freq, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
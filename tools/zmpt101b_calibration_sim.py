@@ -0,0 +1,234 @@
+# Host test of the ZMPT101B calibration records (components/zmpt101b/zmpt101b_calibration.h).
+#
+# Usage:
+#   python zmpt101b_calibration_sim.py [--seed 1]
+#       build the calibration with the file-backed store of zmpt101b_storage.h for the host and
+#       calibrate a simulated sensor with a gain, offset and curvature error at up to four
+#       reference voltages, then power-cycle: every boot loads a fresh copy of the library, so
+#       the RTC cache is gone and the records come from the store. Checks that the corrections
+#       after the reload match the ones before it and the points they were built from, that a
+#       re-run point replaces the old one, that a cleared channel and incompatible or truncated
+#       records read as uncalibrated, and that channels don't share records
+
+import argparse
+import ctypes
+import os
+import random
+import shutil
+import struct
+import tempfile
+
+from zmpt101b_host import SCRIPT_DIR, build_library
+
+# Must match zmpt101b_calibration.h, zmpt101b_storage.h and zmpt101b_calibration.c
+CAL_MAX_POINTS = 4
+CAL_CHANNELS = 8
+CAL_SAME_POINT_PCT = 5
+CAL_DATA_VERSION = 1
+NVS_NAMESPACE = 'zmpt101b'
+
+ESP_OK = 0
+ESP_ERR_INVALID_ARG = 0x102
+
+REFERENCES_MV = [110000, 180000, 230000, 260000]
+# Corrections may be off the straight segments by the rounding of the Q16 gains and of the result
+GAIN_FRAC_BITS = 16
+
+
+def tolerance_mv(measured_mv):
+    return measured_mv / (1 << (GAIN_FRAC_BITS + 1)) + 1
+
+
+class CalPoint(ctypes.Structure):
+    _fields_ = [('measured_mv', ctypes.c_int32), ('reference_mv', ctypes.c_int32)]
+
+
+class CalData(ctypes.Structure):
+    _fields_ = [('version', ctypes.c_uint16), ('point_count', ctypes.c_uint8), ('reserved', ctypes.c_uint8),
+                ('phase_mdeg', ctypes.c_int32), ('points', CalPoint * CAL_MAX_POINTS)]
+
+
+def load_calibration_library(path):
+    """
+    Loads one copy of the calibration library. Each copy has its own static state, like a cold boot.
+    """
+    lib = ctypes.CDLL(path)
+    for name in ('zmpt101b_calibration_load', 'zmpt101b_calibration_clear'):
+        getattr(lib, name).argtypes = [ctypes.c_uint8]
+        getattr(lib, name).restype = ctypes.c_int
+    lib.zmpt101b_calibration_add_point.argtypes = [ctypes.c_uint8, ctypes.c_int32, ctypes.c_int32]
+    lib.zmpt101b_calibration_add_point.restype = ctypes.c_int
+    lib.zmpt101b_calibration_set_phase.argtypes = [ctypes.c_uint8, ctypes.c_int32]
+    lib.zmpt101b_calibration_set_phase.restype = ctypes.c_int
+    lib.zmpt101b_calibration_get.argtypes = [ctypes.c_uint8, ctypes.POINTER(CalData)]
+    lib.zmpt101b_calibration_get.restype = ctypes.c_int
+    lib.zmpt101b_calibration_apply.argtypes = [ctypes.c_uint8, ctypes.c_int32]
+    lib.zmpt101b_calibration_apply.restype = ctypes.c_int32
+    lib.zmpt101b_calibration_phase.argtypes = [ctypes.c_uint8]
+    lib.zmpt101b_calibration_phase.restype = ctypes.c_int32
+    lib.zmpt101b_storage_set_dir.argtypes = [ctypes.c_char_p]
+    lib.zmpt101b_storage_set_dir.restype = None
+    return lib
+
+
+class Device:
+    """
+    Boots of a device whose store is a directory: every boot() is a cold start with a new copy
+    of the library.
+    """
+    def __init__(self, store_dir):
+        build_library('zmpt101b_calibration',
+                      ['zmpt101b_calibration.c', 'zmpt101b_storage.c', 'zmpt101b_warmstart.c'],
+                      ['zmpt101b_calibration.h', 'zmpt101b_storage.h', 'zmpt101b_warmstart.h'])
+        self.store_dir = store_dir
+        self.dir = ctypes.c_char_p(store_dir.encode())
+        self.boots = 0
+
+    def boot(self):
+        self.boots += 1
+        path = os.path.join(self.store_dir, f'boot{self.boots}.so')
+        shutil.copy(os.path.join(SCRIPT_DIR, 'libzmpt101b_calibration.so'), path)
+        lib = load_calibration_library(path)
+        lib.zmpt101b_storage_set_dir(self.dir)
+        return lib
+
+    def record_path(self, channel):
+        return os.path.join(self.store_dir, f'{NVS_NAMESPACE}.cal_ch{channel}.bin')
+
+
+class Sensor:
+    """
+    Uncalibrated readings of a channel: gain and offset error and a little curvature.
+    """
+    def __init__(self, rng):
+        self.gain = rng.uniform(0.9, 1.1)
+        self.offset = rng.uniform(-3000, 3000)
+        self.curvature = rng.uniform(-2e-7, 2e-7)
+
+    def measured(self, true_mv):
+        return int(round(true_mv * self.gain + self.offset + self.curvature * (true_mv - 200000) ** 2))
+
+
+def interpolate(points, measured_mv):
+    """
+    The correction the points define: straight segments through them, extended past the ends.
+    """
+    if len(points) == 1:
+        return measured_mv * points[0][1] / points[0][0]
+    for i in range(len(points) - 1):
+        (m0, r0), (m1, r1) = points[i], points[i + 1]
+        if measured_mv < m1 or i == len(points) - 2:
+            return r0 + (measured_mv - m0) * (r1 - r0) / (m1 - m0)
+
+
+def sweep(lib, channel, readings):
+    return [lib.zmpt101b_calibration_apply(channel, m) for m in readings]
+
+
+def record(lib, channel):
+    data = CalData()
+    assert lib.zmpt101b_calibration_get(channel, ctypes.byref(data)) == ESP_OK
+    return bytes(data)
+
+
+def check(failures, condition, message):
+    if not condition:
+        failures.append(message)
+
+
+def run(store_dir, rng):
+    failures = []
+    device = Device(store_dir)
+    readings = [rng.randint(50000, 300000) for _ in range(200)]
+
+    # Boot 1: nothing stored yet, calibrate channel 0 at four points and channel 3 at one
+    lib = device.boot()
+    for channel in range(CAL_CHANNELS):
+        check(failures, lib.zmpt101b_calibration_load(channel) == ESP_OK, f'boot 1: channel {channel} failed to load')
+    check(failures, sweep(lib, 0, readings) == readings, 'boot 1: uncalibrated channel corrects its readings')
+    sensors = {0: Sensor(rng), 3: Sensor(rng)}
+    points = {0: [], 3: []}
+    for reference in REFERENCES_MV:
+        measured = sensors[0].measured(reference)
+        check(failures, lib.zmpt101b_calibration_add_point(0, measured, reference) == ESP_OK,
+              f'boot 1: point {reference} mV not stored')
+        points[0].append((measured, reference))
+    measured = sensors[3].measured(230000)
+    lib.zmpt101b_calibration_add_point(3, measured, 230000)
+    points[3].append((measured, 230000))
+    phase = rng.randint(-5000, 5000)
+    lib.zmpt101b_calibration_set_phase(0, phase)
+    check(failures, lib.zmpt101b_calibration_add_point(CAL_CHANNELS, 1000, 1000) == ESP_ERR_INVALID_ARG,
+          'boot 1: channel out of range accepted')
+
+    for channel in (0, 3):
+        pts = sorted(points[channel])
+        for m, r in pts:
+            check(failures, abs(lib.zmpt101b_calibration_apply(channel, m) - r) <= tolerance_mv(m),
+                  f'boot 1: channel {channel} corrects its point {m} mV to '
+                  f'{lib.zmpt101b_calibration_apply(channel, m)} mV, not {r} mV')
+        worst = max(abs(c - interpolate(pts, m)) / tolerance_mv(m) for m, c in zip(readings, sweep(lib, channel, readings)))
+        check(failures, worst <= 1, f'boot 1: channel {channel} off its calibration points by up to '
+                                    f'{worst:.2f}x the gain resolution')
+    check(failures, os.path.getsize(device.record_path(0)) == ctypes.sizeof(CalData),
+          'boot 1: channel 0 record has the wrong size in the store')
+    check(failures, not os.path.exists(device.record_path(1)), 'boot 1: uncalibrated channel 1 was stored')
+    before = {channel: (record(lib, channel), sweep(lib, channel, readings)) for channel in range(CAL_CHANNELS)}
+    print(f'boot 1: calibrated channel 0 at {len(points[0])} points and channel 3 at 1, corrections on the '
+          f'segments through the points within the Q{GAIN_FRAC_BITS} gain resolution')
+
+    # Boot 2: a cold start, everything comes back from the store
+    lib = device.boot()
+    check(failures, lib.zmpt101b_calibration_apply(0, 230000) == 230000, 'boot 2: correction before the load')
+    for channel in range(CAL_CHANNELS):
+        check(failures, lib.zmpt101b_calibration_load(channel) == ESP_OK, f'boot 2: channel {channel} failed to load')
+        check(failures, (record(lib, channel), sweep(lib, channel, readings)) == before[channel],
+              f'boot 2: channel {channel} corrects differently after the reload')
+    check(failures, lib.zmpt101b_calibration_phase(0) == phase, 'boot 2: phase correction lost')
+    print(f'boot 2: reloaded {CAL_CHANNELS} channels from the store, {len(readings)} readings each corrected as before')
+
+    # Re-running a point within 5 % replaces it instead of taking a slot
+    reference = REFERENCES_MV[2] * (100 + CAL_SAME_POINT_PCT - 1) // 100
+    measured = sensors[0].measured(reference)
+    lib.zmpt101b_calibration_add_point(0, measured, reference)
+    points[0] = sorted([p for p in points[0] if p[1] != REFERENCES_MV[2]] + [(measured, reference)])
+    lib = device.boot()
+    lib.zmpt101b_calibration_load(0)
+    data = CalData.from_buffer_copy(record(lib, 0))
+    stored = [(data.points[i].measured_mv, data.points[i].reference_mv) for i in range(data.point_count)]
+    check(failures, stored == points[0], f'boot 3: points {stored} after replacing one, expected {points[0]}')
+    print(f'boot 3: re-run point at {reference} mV replaced the one at {REFERENCES_MV[2]} mV')
+
+    # Clearing removes the record; incompatible and truncated records read as uncalibrated
+    lib.zmpt101b_calibration_clear(0)
+    good = open(device.record_path(3), 'rb').read()
+    with open(device.record_path(3), 'wb') as f:
+        f.write(struct.pack('<H', CAL_DATA_VERSION + 1) + good[2:])
+    with open(device.record_path(5), 'wb') as f:
+        f.write(good[:-4])
+    lib = device.boot()
+    for channel, what in ((0, 'cleared'), (3, 'incompatible'), (5, 'truncated')):
+        check(failures, lib.zmpt101b_calibration_load(channel) == ESP_OK, f'boot 4: {what} channel failed to load')
+        check(failures, sweep(lib, channel, readings) == readings, f'boot 4: {what} record still corrects readings')
+    check(failures, not os.path.exists(device.record_path(0)), 'boot 4: cleared record still in the store')
+    print('boot 4: cleared, incompatible and truncated records read as uncalibrated')
+
+    for failure in failures[:10]:
+        print(f'  {failure}')
+    return not failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B calibration persistence test')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    rng = random.Random(args.seed)
+
+    with tempfile.TemporaryDirectory() as store_dir:
+        ok = run(store_dir, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,199 @@
+# Python bindings for the ZMPT101B waveform codec (components/zmpt101b/zmpt101b_codec.c).
+# The C source is compiled into a shared library next to this script on first use
+# (a C compiler must be on the PATH), so the host uses exactly the code running on the device.
+#
+# Usage:
+#   python zmpt101b_codec.py decode capture.bin [output.txt]   decode a stream of coded blocks
+#   python zmpt101b_codec.py bench [sampled_voltage.txt]        compare with the DEBUG_EXTRA_INFO text dump
+
+import ctypes
+import os
+import sys
+import time
+
+from zmpt101b_host import SCRIPT_DIR, build_library
+
+# Must match zmpt101b_codec.h
+CODEC_HISTORY = 1024
+CODEC_HEADER_SIZE = 6
+
+
+class CodecState(ctypes.Structure):
+    _fields_ = [
+        ('history', ctypes.c_int16 * CODEC_HISTORY),
+        ('position', ctypes.c_uint32),
+        ('rice_acc', ctypes.c_uint32),
+        ('period', ctypes.c_uint16),
+        ('sync_pending', ctypes.c_bool),
+        ('synced', ctypes.c_bool),
+    ]
+
+
+def codec_bound(samples):
+    """
+    Worst-case size of a coded block, ZMPT101B_CODEC_BOUND().
+    """
+    return CODEC_HEADER_SIZE + 5 * samples
+
+
+def load_library():
+    """
+    Loads the codec library, building it from the component source when it's missing or outdated.
+
+    :return: ctypes library handle.
+    """
+    lib = build_library('zmpt101b_codec', ['zmpt101b_codec.c'], ['zmpt101b_codec.h'])
+    lib.zmpt101b_codec_init.argtypes = [ctypes.POINTER(CodecState), ctypes.c_uint16]
+    lib.zmpt101b_codec_init.restype = None
+    lib.zmpt101b_codec_set_period.argtypes = [ctypes.POINTER(CodecState), ctypes.c_uint16]
+    lib.zmpt101b_codec_set_period.restype = ctypes.c_bool
+    lib.zmpt101b_codec_sync.argtypes = [ctypes.POINTER(CodecState)]
+    lib.zmpt101b_codec_sync.restype = None
+    lib.zmpt101b_codec_encode.argtypes = [ctypes.POINTER(CodecState), ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t,
+                                          ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t]
+    lib.zmpt101b_codec_encode.restype = ctypes.c_size_t
+    lib.zmpt101b_codec_decode.argtypes = [ctypes.POINTER(CodecState), ctypes.POINTER(ctypes.c_uint8), ctypes.c_size_t,
+                                          ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+    lib.zmpt101b_codec_decode.restype = ctypes.c_size_t
+    return lib
+
+
+class Encoder:
+    """
+    Streaming encoder, one call per block as on the device.
+    """
+
+    def __init__(self, period, lib=None):
+        self.lib = lib or load_library()
+        self.state = CodecState()
+        self.lib.zmpt101b_codec_init(ctypes.byref(self.state), period)
+
+    def set_period(self, period):
+        return self.lib.zmpt101b_codec_set_period(ctypes.byref(self.state), period)
+
+    def sync(self):
+        self.lib.zmpt101b_codec_sync(ctypes.byref(self.state))
+
+    def encode(self, samples):
+        """
+        Encodes one block of samples (up to 65535).
+
+        :param samples: Sequence of int16 samples.
+        :return: Coded block as bytes.
+        """
+        data = (ctypes.c_int16 * len(samples))(*samples)
+        out = (ctypes.c_uint8 * codec_bound(len(samples)))()
+        size = self.lib.zmpt101b_codec_encode(ctypes.byref(self.state), data, len(samples), out, len(out))
+        if size == 0:
+            raise ValueError('block could not be encoded')
+        return bytes(out[:size])
+
+
+class Decoder:
+    """
+    Streaming decoder for a sequence of coded blocks.
+    """
+
+    def __init__(self, lib=None):
+        self.lib = lib or load_library()
+        self.state = CodecState()
+        self.lib.zmpt101b_codec_init(ctypes.byref(self.state), 0)
+
+    def decode(self, data):
+        """
+        Decodes all complete blocks in data; blocks ahead of the first sync block are skipped.
+
+        :param data: Coded bytes starting at a block header.
+        :return: List of decoded samples.
+        """
+        buffer = (ctypes.c_uint8 * len(data)).from_buffer_copy(data)
+        samples = []
+        pos = 0
+        while pos < len(data):
+            count = data[pos] | (data[pos + 1] << 8) if pos + 1 < len(data) else 0
+            out = (ctypes.c_int16 * max(count, 1))()
+            consumed = ctypes.c_size_t(0)
+            decoded = self.lib.zmpt101b_codec_decode(ctypes.byref(self.state),
+                                                     ctypes.cast(ctypes.byref(buffer, pos), ctypes.POINTER(ctypes.c_uint8)),
+                                                     len(data) - pos, out, len(out), ctypes.byref(consumed))
+            if consumed.value == 0:
+                raise ValueError(f'malformed block at offset {pos}')
+            samples.extend(out[:decoded])
+            pos += consumed.value
+        return samples
+
+
+def parse_dump(file_path):
+    """
+    Parses a DEBUG_EXTRA_INFO text dump (see plot_voltage.py).
+
+    :param file_path: Path to the dump.
+    :return: Tuple of sampling frequency, samples in millivolts and the size of the text in bytes.
+    """
+    with open(file_path, 'r') as file:
+        text = file.read()
+    lines = text.splitlines()
+    sampling_freq = int(lines[0].split(': ')[1])
+    values = [round(float(value) * 1000) for line in lines[2:] if line.strip() for value in line.split()]
+    return sampling_freq, values, len(text.encode())
+
+
+def encode_blocks(encoder, samples, block_size):
+    return b''.join(encoder.encode(samples[i:i + block_size]) for i in range(0, len(samples), block_size))
+
+
+def bench(file_path, block_size=512, nominal_freq=50, repeat=20):
+    """
+    Compares the codec with the text dump: size and host throughput.
+    Throughput is given in MB/s of raw 16-bit samples and includes the ctypes call overhead.
+    """
+    lib = load_library()
+    sampling_freq, samples, text_size = parse_dump(file_path)
+    period = min(sampling_freq // nominal_freq, CODEC_HISTORY - 2)
+
+    start = time.perf_counter()
+    for _ in range(repeat):
+        coded = encode_blocks(Encoder(period, lib), samples, block_size)
+    encode_s = (time.perf_counter() - start) / repeat
+
+    start = time.perf_counter()
+    for _ in range(repeat):
+        decoded = Decoder(lib).decode(coded)
+    decode_s = (time.perf_counter() - start) / repeat
+
+    start = time.perf_counter()
+    for _ in range(repeat):
+        text = ' '.join(f'{value / 1000:.2f}' for value in samples)
+    text_s = (time.perf_counter() - start) / repeat
+
+    raw_size = 2 * len(samples)
+    print(f'Samples:      {len(samples)} at {sampling_freq} Hz, block {block_size}, period {period}')
+    print(f'Text dump:    {text_size} bytes ({text_size / len(samples):.2f} bytes/sample), '
+          f'formatting {raw_size / text_s / 1e6:.2f} MB/s')
+    print(f'Raw 16-bit:   {raw_size} bytes')
+    print(f'Compressed:   {len(coded)} bytes ({8 * len(coded) / len(samples):.2f} bits/sample), '
+          f'{text_size / len(coded):.1f}x smaller than text, {raw_size / len(coded):.1f}x smaller than raw')
+    print(f'Encode:       {raw_size / encode_s / 1e6:.2f} MB/s')
+    print(f'Decode:       {raw_size / decode_s / 1e6:.2f} MB/s')
+    print(f'Lossless:     {"yes" if decoded == samples else "NO"}')
+
+
+def main():
+    """
+    Entry point, see the usage at the top of the file.
+    """
+    command = sys.argv[1] if len(sys.argv) > 1 else 'bench'
+    if command == 'decode' and len(sys.argv) > 2:
+        with open(sys.argv[2], 'rb') as file:
+            samples = Decoder().decode(file.read())
+        output = open(sys.argv[3], 'w') if len(sys.argv) > 3 else sys.stdout
+        output.write('\n'.join(str(value) for value in samples) + '\n')
+    elif command == 'bench':
+        bench(sys.argv[2] if len(sys.argv) > 2 else os.path.join(SCRIPT_DIR, 'sampled_voltage.txt'))
+    else:
+        print('usage: zmpt101b_codec.py decode <file> [output] | bench [dump]')
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,195 @@
+# Host test and benchmark of the ZMPT101B oversampling decimator (components/zmpt101b/zmpt101b_decimator.h).
+#
+# Usage:
+#   python zmpt101b_decimator_bench.py [--seed 1] [--order 3 --ratio 4]
+#       build the CIC + compensation FIR decimator for the host and run it for every order and
+#       ratio zmpt101b_decimator_init() accepts, or the one given: checks that a constant input
+#       comes out exactly scaled to 16 bits, that the gain at 50 Hz to 5 kHz matches the analytic
+#       CIC and compensator response, and that white ADC noise drops by about the square root of
+#       the ratio; then measures the cost of zmpt101b_decimator_process() per raw input sample and
+#       per output sample, which the target reports as cycles per sample with ZMPT101B_OVERSAMPLING
+
+import argparse
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h and zmpt101b_decimator.h
+SAMPLING_FREQ = 25000
+DMA_BUFFER_LEN = 1024
+CIC_MAX_ORDER = 5
+DECIM_OUTPUT_BITS = 16
+RAW_SAMPLE_BITS = 12
+DECIM_ORDER = 3
+DECIM_RATIO = 4
+
+OUTPUT_SCALE = 1 << (DECIM_OUTPUT_BITS - RAW_SAMPLE_BITS)
+BIAS = 2048                 # ADC codes
+AMPLITUDE = 1500
+NOISE_CODES = 4.0           # white ADC noise, roughly 9-10 ENOB
+FIT_OUTPUTS = 5000          # 0.2 s of output, whole cycles of every test tone
+
+GAIN_FREQS = [50, 1000, 2500, 5000]
+GAIN_TOLERANCE_DB = 0.02
+
+
+class Decimator(ctypes.Structure):
+    _fields_ = [('order', ctypes.c_uint8), ('ratio_log2', ctypes.c_uint8), ('out_shift', ctypes.c_uint8),
+                ('phase', ctypes.c_uint16), ('comp_coeff', ctypes.c_int32),
+                ('integrator', ctypes.c_uint32 * CIC_MAX_ORDER), ('comb', ctypes.c_uint32 * CIC_MAX_ORDER),
+                ('fir_hist', ctypes.c_int32 * 2), ('primed', ctypes.c_uint8)]
+
+
+def load_decimator_library():
+    """
+    Builds the decimator for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_decimator', ['zmpt101b_decimator.c', 'zmpt101b_fixed.c'],
+                        ['zmpt101b_decimator.h', 'zmpt101b_fixed.h'])
+    lib.zmpt101b_decimator_init.argtypes = [ctypes.POINTER(Decimator), ctypes.c_uint8, ctypes.c_uint16]
+    lib.zmpt101b_decimator_init.restype = ctypes.c_int
+    lib.zmpt101b_decimator_process.argtypes = [ctypes.POINTER(Decimator), ctypes.POINTER(ctypes.c_uint16),
+                                               ctypes.c_size_t, ctypes.POINTER(ctypes.c_uint16), ctypes.c_size_t]
+    lib.zmpt101b_decimator_process.restype = ctypes.c_size_t
+    return lib
+
+
+def configurations():
+    """
+    Every order and power-of-two ratio whose bit growth fits the 32-bit registers and reaches 16 bits.
+    """
+    for order in range(1, CIC_MAX_ORDER + 1):
+        for ratio_log2 in range(1, 16):
+            if DECIM_OUTPUT_BITS <= RAW_SAMPLE_BITS + order * ratio_log2 <= 32:
+                yield order, 1 << ratio_log2
+
+
+def decimate(lib, order, ratio, codes):
+    dec = Decimator()
+    if lib.zmpt101b_decimator_init(ctypes.byref(dec), order, ratio) != 0:
+        raise RuntimeError(f'zmpt101b_decimator_init({order}, {ratio}) failed')
+    data = (ctypes.c_uint16 * len(codes))(*codes)
+    out = (ctypes.c_uint16 * (len(codes) // ratio))()
+    produced = lib.zmpt101b_decimator_process(ctypes.byref(dec), data, len(codes), out, len(out))
+    return list(out[:produced])
+
+
+def tone_codes(freq, ratio, count, rng, noise=0.0):
+    rate = SAMPLING_FREQ * ratio
+    phase = rng.uniform(0, 2 * math.pi)
+    return [max(0, min(4095, int(round(BIAS + AMPLITUDE * math.sin(2 * math.pi * freq * n / rate + phase)
+                                       + rng.gauss(0, noise)))))
+            for n in range(count)]
+
+
+def fit_tone(samples, freq):
+    """
+    Amplitude of the tone at `freq` in the output and the RMS of what is left, by least squares
+    over whole cycles.
+    """
+    n = len(samples)
+    mean = sum(samples) / n
+    s = sum((x - mean) * math.sin(2 * math.pi * freq * k / SAMPLING_FREQ) for k, x in enumerate(samples)) * 2 / n
+    c = sum((x - mean) * math.cos(2 * math.pi * freq * k / SAMPLING_FREQ) for k, x in enumerate(samples)) * 2 / n
+    residual = [x - mean - s * math.sin(2 * math.pi * freq * k / SAMPLING_FREQ)
+                - c * math.cos(2 * math.pi * freq * k / SAMPLING_FREQ) for k, x in enumerate(samples)]
+    return math.hypot(s, c), math.sqrt(sum(r * r for r in residual) / n)
+
+
+def expected_gain(order, ratio, freq):
+    """
+    Analytic response of the CIC at the input rate and the [-a, 1+2a, -a] compensator at the output rate.
+    """
+    x = math.pi * freq / (SAMPLING_FREQ * ratio)
+    cic = abs(math.sin(ratio * x) / (ratio * math.sin(x))) ** order
+    a = ((order * 32768 + 12) // 24) / 32768
+    return cic * abs(1 + 2 * a - 2 * a * math.cos(2 * math.pi * freq / SAMPLING_FREQ))
+
+
+def check(lib, order, ratio, rng):
+    """
+    Runs the accuracy checks for one configuration. Returns the failures.
+    """
+    failures = []
+    settle = order + 4
+    count = (FIT_OUTPUTS + settle + order + 2) * ratio
+
+    # A constant input is scaled exactly, the CIC gain and the compensator taps sum to one
+    code = rng.randint(1, 4094)
+    out = decimate(lib, order, ratio, [code] * count)
+    if any(y != code * OUTPUT_SCALE for y in out):
+        failures.append(f'constant {code}: output {sorted(set(out))[:4]}, expected {code * OUTPUT_SCALE}')
+
+    gains = []
+    for freq in GAIN_FREQS:
+        out = decimate(lib, order, ratio, tone_codes(freq, ratio, count, rng))[-FIT_OUTPUTS:]
+        amplitude, _ = fit_tone(out, freq)
+        error_db = 20 * math.log10(amplitude / (AMPLITUDE * OUTPUT_SCALE * expected_gain(order, ratio, freq)))
+        gains.append(20 * math.log10(amplitude / (AMPLITUDE * OUTPUT_SCALE)))
+        if abs(error_db) > GAIN_TOLERANCE_DB:
+            failures.append(f'{freq} Hz: gain {gains[-1]:+.3f} dB, {error_db:+.3f} dB off the analytic response')
+
+    # White noise at the input rate keeps 1/ratio of its power in the output band, less the CIC roll-off
+    out = decimate(lib, order, ratio, tone_codes(50, ratio, count, rng, NOISE_CODES))[-FIT_OUTPUTS:]
+    _, noise = fit_tone(out, 50)
+    reduction = NOISE_CODES * OUTPUT_SCALE / noise
+    if reduction < 0.8 * math.sqrt(ratio):
+        failures.append(f'noise reduced {reduction:.2f}x, expected about {math.sqrt(ratio):.2f}x')
+
+    print(f'order {order}, ratio {ratio:3}: gain ' + ', '.join(f'{g:+.3f} dB at {f} Hz' for f, g in zip(GAIN_FREQS, gains))
+          + f', noise {NOISE_CODES:.1f} -> {noise / OUTPUT_SCALE:.2f} codes')
+    for failure in failures:
+        print(f'  {failure}')
+    return failures
+
+
+def benchmark(lib, order, ratio, rng):
+    """
+    Host cost of zmpt101b_decimator_process() on DMA blocks of raw samples.
+    """
+    codes = tone_codes(50, ratio, DMA_BUFFER_LEN, rng, NOISE_CODES)
+    block = (ctypes.c_uint16 * DMA_BUFFER_LEN)(*[(3 << 12) | c for c in codes])
+    out = (ctypes.c_uint16 * DMA_BUFFER_LEN)()
+    dec = Decimator()
+    lib.zmpt101b_decimator_init(ctypes.byref(dec), order, ratio)
+    repeat = 2000
+    best = float('inf')
+    for _ in range(5):
+        start = time.perf_counter()
+        for _ in range(repeat):
+            lib.zmpt101b_decimator_process(ctypes.byref(dec), block, DMA_BUFFER_LEN, out, DMA_BUFFER_LEN)
+        best = min(best, time.perf_counter() - start)
+    per_sample = best / repeat / DMA_BUFFER_LEN * 1e9
+    print(f'order {order}, ratio {ratio:3}: {per_sample:.2f} ns per raw sample, {per_sample * ratio:.2f} ns per '
+          f'output sample, {per_sample * ratio * SAMPLING_FREQ / 1e6:.3f} ms per second of output, ctypes call included')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B decimator test and benchmark')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--order', type=int, help='test one configuration, with --ratio')
+    parser.add_argument('--ratio', type=int)
+    args = parser.parse_args()
+    lib = load_decimator_library()
+    rng = random.Random(args.seed)
+
+    configs = list(configurations())
+    if args.order is not None or args.ratio is not None:
+        configs = [(args.order or DECIM_ORDER, args.ratio or DECIM_RATIO)]
+    # The larger ratios take long to simulate and run at input rates the I2S ADC can't reach
+    configs = [(order, ratio) for order, ratio in configs if ratio <= 16]
+
+    failures = []
+    for order, ratio in configs:
+        failures += check(lib, order, ratio, rng)
+    for order, ratio in configs:
+        benchmark(lib, order, ratio, rng)
+    print('all checks passed' if not failures else 'CHECKS FAILED')
+    raise SystemExit(0 if not failures else 1)
+
+
+if __name__ == '__main__':
+    main()
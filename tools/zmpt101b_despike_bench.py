@@ -0,0 +1,244 @@
+# Host test and benchmark of the ZMPT101B spike rejection (components/zmpt101b/zmpt101b_despike.h).
+#
+# Usage:
+#   python zmpt101b_despike_bench.py [--windows 200] [--seed 1] [--recording sampled_voltage.txt]
+#       build the spike rejection for the host and run the median, the median of three and the
+#       slew-rate test on windows of synthetic mains waveforms with ADC noise and injected single
+#       spikes and bursts, and on a window recorded with DEBUG_EXTRA_INFO with spikes added;
+#       compares the spikes left, the extremes, the RMS and the spikes reported against the clean
+#       signal, checks that noise alone and a real step aren't rejected, and measures the cost per
+#       sample of each method
+
+import argparse
+import ctypes
+import math
+import os
+import random
+import time
+
+from zmpt101b_host import SCRIPT_DIR, build_library
+
+# Must match zmpt101b.h and zmpt101b_despike.h
+SAMPLING_FREQ = 25000
+WINDOW = 1024
+MEDIAN_WINDOW = 11
+THRESHOLD = 40
+SLEW_MAX_RUN = 3
+LOG = 4
+MEDIAN, MEDIAN3, SLEW = 0, 1, 2
+METHODS = [('median', MEDIAN), ('median of three', MEDIAN3), ('slew-rate test', SLEW)]
+
+BIAS = 2048                                          # ADC codes
+HARMONICS = [(1, 1.0, 0.0), (3, 0.05, 0.7), (5, 0.03, -1.9)]   # order, relative amplitude, phase
+
+
+class Config(ctypes.Structure):
+    _fields_ = [('mode', ctypes.c_int), ('median_window', ctypes.c_uint8), ('threshold', ctypes.c_uint16)]
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [('rejected', ctypes.c_uint32), ('largest', ctypes.c_uint16), ('logged', ctypes.c_uint8),
+                ('index', ctypes.c_uint16 * LOG)]
+
+
+def load_despike_library():
+    """
+    Builds the spike rejection for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_despike', ['zmpt101b_despike.c'], ['zmpt101b_despike.h'])
+    lib.zmpt101b_despike.argtypes = [ctypes.POINTER(Config), ctypes.POINTER(ctypes.c_uint16), ctypes.c_size_t,
+                                     ctypes.POINTER(ctypes.c_uint16), ctypes.POINTER(ctypes.c_uint16), ctypes.POINTER(Stats)]
+    lib.zmpt101b_despike.restype = ctypes.c_int
+    return lib
+
+
+def despike(lib, mode, samples):
+    data = (ctypes.c_uint16 * len(samples))(*samples)
+    low, high, stats = ctypes.c_uint16(), ctypes.c_uint16(), Stats()
+    err = lib.zmpt101b_despike(ctypes.byref(Config(mode, MEDIAN_WINDOW, THRESHOLD)), data, len(samples),
+                               ctypes.byref(low), ctypes.byref(high), ctypes.byref(stats))
+    assert err == 0
+    return list(data), low.value, high.value, stats
+
+
+def clean_window(rng, frequency=50.0, peak=1200.0):
+    phase = rng.uniform(0, 2 * math.pi)
+    return [BIAS + sum(peak * r * math.sin(h * (2 * math.pi * frequency * n / SAMPLING_FREQ + phase) + p)
+                       for h, r, p in HARMONICS) for n in range(WINDOW)]
+
+
+def digitize(values, rng, noise):
+    return [min(4095, max(0, int(round(v + rng.gauss(0, noise))))) for v in values]
+
+
+def inject(samples, rng, count, longest):
+    """
+    Adds `count` spikes of 1 to `longest` samples, 150 to 1500 codes either way, away from the
+    window edges and a median window apart, so each is a burst of its own length; returns the
+    spiked samples and the spiked positions.
+    """
+    spiked = list(samples)
+    positions = set()
+    starts = []
+    while len(starts) < count:
+        start = rng.randrange(8, len(samples) - 8 - longest)
+        if all(abs(start - other) > MEDIAN_WINDOW + longest for other in starts):
+            starts.append(start)
+    for start in starts:
+        length = rng.randint(1, longest)
+        height = rng.choice((-1, 1)) * rng.uniform(150, 1500)
+        for n in range(start, start + length):
+            spiked[n] = min(4095, max(0, int(round(spiked[n] + height))))
+            positions.add(n)
+    return spiked, positions
+
+
+def ac_rms(samples):
+    mean = sum(samples) / len(samples)
+    return math.sqrt(sum((s - mean) ** 2 for s in samples) / len(samples))
+
+
+def score(clean, filtered, low, high):
+    """
+    Largest deviation from the clean signal away from the edges, error of the extremes and of
+    the RMS in percent.
+    """
+    inner = range(8, WINDOW - 8)
+    worst = max(abs(filtered[n] - clean[n]) for n in inner)
+    extremes = max(abs(low - min(clean)), abs(high - max(clean)))
+    rms = abs(ac_rms(filtered) - ac_rms(clean)) / ac_rms(clean) * 100
+    return worst, extremes, rms
+
+
+def run(lib, name, windows, rng, spikes, longest, noise, limits):
+    """
+    limits per method: largest deviation, extremes error in codes, RMS error in % and whether
+    only spiked samples may be reported, or None where the method isn't expected to cope.
+    """
+    print(f'{name}: {windows} windows, {spikes} spikes of up to {longest} samples, noise {noise} codes')
+    results = {mode: [0, 0, 0.0, 0, 0] for _, mode in METHODS}
+    injected = 0
+    for _ in range(windows):
+        values = clean_window(rng)
+        clean = [int(round(v)) for v in values]
+        noisy = digitize(values, rng, noise)
+        spiked, positions = inject(noisy, rng, spikes, longest)
+        injected += len(positions)
+        for _, mode in METHODS:
+            filtered, low, high, stats = despike(lib, mode, spiked)
+            worst, extremes, rms = score(clean, filtered, low, high)
+            r = results[mode]
+            r[0], r[1], r[2] = max(r[0], worst), max(r[1], extremes), max(r[2], rms)
+            r[3] += stats.rejected
+            # Reported positions must be spiked samples
+            r[4] += sum(stats.index[i] not in positions for i in range(stats.logged))
+    ok = True
+    for label, mode in METHODS:
+        worst, extremes, rms, rejected, misplaced = results[mode]
+        limit = limits[mode]
+        verdict = ''
+        if limit is not None and (worst > limit[0] or extremes > limit[1] or rms > limit[2] or (limit[3] and misplaced)):
+            verdict = '  FAILED'
+            ok = False
+        print(f'  {label}: worst deviation {worst} codes, extremes {extremes} codes, RMS {rms:.3f} %, '
+              f'{rejected} of {injected} spiked samples reported, {misplaced} misplaced{verdict}'
+              + ('' if limit is not None else ' (not expected to cope)'))
+    return ok
+
+
+def check_quiet(lib, windows, rng, noise):
+    """
+    Noise alone must not be reported.
+    """
+    ok = True
+    for label, mode in METHODS:
+        rejected = sum(despike(lib, mode, digitize(clean_window(rng), rng, noise))[3].rejected for _ in range(windows))
+        if rejected:
+            ok = False
+        print(f'noise only, {label}: {rejected} samples reported in {windows} windows{"" if not rejected else "  FAILED"}')
+    return ok
+
+
+def check_step(lib):
+    """
+    A real step longer than a burst, e.g. after a range switch, must come through the slew-rate test.
+    """
+    samples = [BIAS] * 300 + [BIAS + 600] * (WINDOW - 300)
+    filtered = despike(lib, SLEW, samples)[0]
+    settled = all(filtered[n] == samples[n] for n in range(300 + SLEW_MAX_RUN + 1, WINDOW))
+    print(f'step of 600 codes, slew-rate test: {"follows" if settled else "FAILED to follow"} after {SLEW_MAX_RUN} samples')
+    return settled
+
+
+def load_recording(path):
+    """
+    Window printed by DEBUG_EXTRA_INFO, in volts at the sensor, as millivolts.
+    """
+    with open(path) as f:
+        lines = f.readlines()
+    return [int(round(float(v) * 1000)) for line in lines[2:] for v in line.split()]
+
+
+def run_recording(lib, path, rng):
+    samples = load_recording(path)
+    print(f'recording {os.path.basename(path)}: {len(samples)} samples, {min(samples)}..{max(samples)} mV')
+    spiked, positions = inject(samples[:WINDOW], rng, 6, 2)
+    for label, mode in METHODS:
+        _, low, high, stats = despike(lib, mode, samples)
+        _, spiked_low, spiked_high, spiked_stats = despike(lib, mode, spiked)
+        print(f'  {label}: {low}..{high} mV with {stats.rejected} rejected, {spiked_low}..{spiked_high} mV and '
+              f'{spiked_stats.rejected} of {len(positions)} rejected with spikes added')
+
+
+def benchmark(lib, rng):
+    """
+    Cost per sample of each method on the host, the copy of the window included.
+    """
+    samples = inject(digitize(clean_window(rng), rng, 3), rng, 8, 3)[0]
+    source = (ctypes.c_uint16 * WINDOW)(*samples)
+    data = (ctypes.c_uint16 * WINDOW)()
+    low, high, stats = ctypes.c_uint16(), ctypes.c_uint16(), Stats()
+    costs = {}
+    for label, mode in METHODS:
+        config = Config(mode, MEDIAN_WINDOW, THRESHOLD)
+        repeat = 200 if mode == MEDIAN else 2000
+        best = float('inf')
+        for _ in range(5):
+            start = time.perf_counter()
+            for _ in range(repeat):
+                ctypes.memmove(data, source, ctypes.sizeof(source))
+                lib.zmpt101b_despike(ctypes.byref(config), data, WINDOW, ctypes.byref(low), ctypes.byref(high),
+                                     ctypes.byref(stats))
+            best = min(best, time.perf_counter() - start)
+        costs[mode] = best / repeat / WINDOW * 1e9
+    print('host cost: ' + ', '.join(f'{label} {costs[mode]:.2f} ns per sample' for label, mode in METHODS)
+          + f' ({costs[MEDIAN] / costs[SLEW]:.0f}x for the slew-rate test)')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B spike rejection test and benchmark')
+    parser.add_argument('--windows', type=int, default=200)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--recording', default=os.path.join(SCRIPT_DIR, 'sampled_voltage.txt'))
+    args = parser.parse_args()
+    lib = load_despike_library()
+    rng = random.Random(args.seed)
+
+    # Deviations left are the noise, which the filters smooth to about its own size; the median
+    # drags the samples before a spike on a steep slope along, by several slopes of about 15 codes
+    # per sample, and reports them too; the median of three lets bursts of two or more through
+    ok = run(lib, 'single spikes', args.windows, rng, 8, 1, 3.0,
+             {MEDIAN: (200, 15, 0.3, False), MEDIAN3: (30, 15, 0.1, True), SLEW: (30, 15, 0.1, True)})
+    ok &= run(lib, 'bursts', args.windows, rng, 8, 3, 3.0,
+              {MEDIAN: (200, 15, 0.3, False), MEDIAN3: None, SLEW: (30, 15, 0.1, True)})
+    ok &= check_quiet(lib, args.windows, rng, 3.0)
+    ok &= check_step(lib)
+    if os.path.exists(args.recording):
+        run_recording(lib, args.recording, rng)
+    benchmark(lib, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
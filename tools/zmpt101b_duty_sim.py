@@ -0,0 +1,208 @@
+# Host simulation of the ZMPT101B duty-cycle scheduler (components/zmpt101b/zmpt101b_duty.h).
+#
+# Usage:
+#   python zmpt101b_duty_sim.py [--windows 2000] [--seed 1]
+#       build the scheduler for the host and run it against simulated mains with a wandering
+#       frequency, jittery wake-ups and resume times; checks that every window starts on the
+#       first rising crossing after its slot, that no slot is missed, and reports the alignment
+#       wait against waking naively at the slot and the estimated energy per measurement
+
+import argparse
+import ctypes
+import random
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b_duty.h
+FREQ_TOLERANCE_PPM = 1000
+GUARD_US = 500
+
+# Must match zmpt101b.h
+DMA_BUFFER_LEN = 1024       # samples per DMA buffer
+
+SAMPLE_US = 40              # 25 kHz
+DMA_BLOCK_US = DMA_BUFFER_LEN * SAMPLE_US
+WINDOW_US = 40000           # zmpt101b_read_voltage() after the crossing
+
+
+class Config(ctypes.Structure):
+    _fields_ = [('interval_us', ctypes.c_uint32), ('nominal_freq', ctypes.c_uint16), ('min_sleep_us', ctypes.c_uint32),
+                ('active_uw', ctypes.c_uint32), ('sleep_uw', ctypes.c_uint32)]
+
+
+class Plan(ctypes.Structure):
+    _fields_ = [('wake_us', ctypes.c_int64), ('target_us', ctypes.c_int64), ('earliest_us', ctypes.c_int64),
+                ('sleep_us', ctypes.c_uint32), ('predicted', ctypes.c_bool), ('measure_period', ctypes.c_bool)]
+
+
+class Result(ctypes.Structure):
+    _fields_ = [('sleep_us', ctypes.c_uint32), ('wake_us', ctypes.c_int64), ('ready_us', ctypes.c_int64),
+                ('start_us', ctypes.c_int64), ('end_us', ctypes.c_int64), ('period_ns', ctypes.c_uint32)]
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [('windows', ctypes.c_uint32), ('missed_slots', ctypes.c_uint32), ('unaligned', ctypes.c_uint32),
+                ('late_resumes', ctypes.c_uint32),                 ('resume_us', ctypes.c_uint32), ('resume_max_us', ctypes.c_uint32), ('align_wait_us', ctypes.c_uint32),
+                ('align_wait_max_us', ctypes.c_uint32), ('prediction_error_us', ctypes.c_int32),
+                ('energy_uj', ctypes.c_uint32), ('energy_avg_uj', ctypes.c_uint32), ('active_us', ctypes.c_uint64),
+                ('sleep_us', ctypes.c_uint64)]
+
+
+def load_duty_library():
+    """
+    Builds the scheduler for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_duty', ['zmpt101b_duty.c'], ['zmpt101b_duty.h'])
+    lib.zmpt101b_duty_init.argtypes = [ctypes.c_void_p, ctypes.POINTER(Config), ctypes.c_int64]
+    lib.zmpt101b_duty_plan.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.POINTER(Plan)]
+    lib.zmpt101b_duty_window_done.argtypes = [ctypes.c_void_p, ctypes.POINTER(Result)]
+    lib.zmpt101b_duty_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(Stats)]
+    return lib
+
+
+class Mains:
+    """
+    Rising zero crossings of a mains whose frequency wanders like a real grid: a random walk
+    in 0.002 Hz steps per second, held within +-0.2 Hz of nominal, with optional outages.
+    Queries may go back at most a few cycles.
+    """
+
+    def __init__(self, nominal, rng, outages):
+        self.nominal = nominal
+        self.rng = rng
+        self.freq = nominal + rng.uniform(-0.08, 0.08)
+        self.next_step = 1e6
+        self.crossings = [1e6 + rng.uniform(0, 1e6 / nominal)]
+        self.outages = outages      # (from_us, to_us) without mains
+
+    def _advance(self):
+        last = self.crossings[-1]
+        if last >= self.next_step:
+            self.freq += self.rng.gauss(0, 0.002)
+            self.freq = min(max(self.freq, self.nominal - 0.2), self.nominal + 0.2)
+            self.next_step += 1e6
+        self.crossings.append(last + 1e6 / self.freq)
+        del self.crossings[:-8]
+
+    def first_after(self, t_us):
+        while self.crossings[-1] < t_us:
+            self._advance()
+        return next(c for c in self.crossings if c >= t_us)
+
+    def live(self, t_us):
+        return not any(start <= t_us < end for start, end in self.outages)
+
+
+def simulate(lib, nominal, interval_s, windows, rng, outages=()):
+    """
+    Runs the scheduler the way zmpt101b_duty_measure() does; returns the statistics and the
+    timing violations found.
+    """
+    config = Config(interval_us=int(interval_s * 1e6), nominal_freq=nominal, min_sleep_us=2000)
+    duty = ctypes.create_string_buffer(512)
+    start_us = 1000000
+    if lib.zmpt101b_duty_init(duty, ctypes.byref(config), start_us) != 0:
+        raise RuntimeError('zmpt101b_duty_init failed')
+    period_us = 1e6 / nominal
+    mains = Mains(nominal, rng, [(start_us + a * 1e6, start_us + b * 1e6) for a, b in outages])
+    slot = start_us
+    now = start_us
+    last_crossing = start_us
+    report = {'failures': [], 'waits': [], 'naive_waits': [], 'predicted': 0, 'errors': [], 'late_misses': 0}
+
+    for n in range(windows):
+        plan = Plan()
+        lib.zmpt101b_duty_plan(duty, int(now), ctypes.byref(plan))
+        result = Result(sleep_us=plan.sleep_us)
+        # Timer wake-ups come up to 0.2 ms late, resumes take 0.3-0.8 ms and now and then 3 ms
+        wake = max(now, plan.wake_us) + rng.uniform(0, 200)
+        ready = wake + (3000 if rng.random() < 0.01 else rng.uniform(300, 800))
+        result.wake_us, result.ready_us = int(wake), int(ready)
+        report['predicted'] += plan.predicted
+
+        # Waking at the slot without a prediction waits for whatever crossing comes next
+        naive = mains.first_after(slot) - slot
+        intended = mains.first_after(plan.earliest_us)
+        crossing = mains.first_after(max(ready, plan.earliest_us))
+        if mains.live(crossing):
+            report['naive_waits'].append(naive)
+            # A resume slower than the scheduler allowed for may miss the intended crossing
+            missed = crossing != intended
+            report['late_misses'] += missed
+            first = crossing
+            if plan.measure_period:
+                crossing = mains.first_after(first + 1)
+                result.period_ns = int((crossing - first) * 1000 + rng.gauss(0, 1000))
+            result.start_us = int(crossing + rng.gauss(0, 2))
+            report['waits'].append(crossing - ready)
+
+            # The window starts on the first crossing after its slot, one cycle later when it measures
+            # the period. A predicted crossing may have drifted to just before the slot, but no further
+            # than the margin the scheduler allowed for.
+            margin = GUARD_US + (slot - last_crossing) * FREQ_TOLERANCE_PPM / 1e6 if plan.predicted else 0
+            late = crossing - slot
+            cycles = 2 if plan.measure_period else 1
+            if not missed and (late < -margin or late > cycles * period_us * 1.01 + margin):
+                report['failures'].append(f'window {n}: started {late / 1000:.2f} ms after its slot')
+            if plan.predicted and not missed:
+                error = first - plan.target_us
+                report['errors'].append(error)
+                if abs(error) > margin:
+                    report['failures'].append(f'window {n}: crossing {error:.0f} us off the prediction')
+            last_crossing = crossing
+            end = crossing + DMA_BLOCK_US + WINDOW_US
+        else:
+            # No crossing within three cycles
+            end = ready + 3 * period_us + DMA_BLOCK_US + WINDOW_US
+        result.end_us = int(end)
+        lib.zmpt101b_duty_window_done(duty, ctypes.byref(result))
+        now = end + rng.uniform(0, 500)
+        slot += interval_s * 1e6
+
+    stats = Stats()
+    lib.zmpt101b_duty_get_stats(duty, ctypes.byref(stats))
+    return stats, report
+
+
+def mean(values):
+    return sum(values) / len(values) if values else 0.0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B duty-cycle scheduler simulation')
+    parser.add_argument('--windows', type=int, default=2000)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_duty_library()
+    rng = random.Random(args.seed)
+
+    scenarios = [  # name, nominal Hz, interval s, outages (s from start), expect predictions
+        ('50 Hz every 5 s', 50, 5.0, (), True),
+        ('60 Hz every 2 s', 60, 2.0, (), True),
+        ('50 Hz every 1 s, outage', 50, 1.0, ((300.2, 310.7),), True),
+        ('50 Hz every 20 s', 50, 20.0, (), False),
+    ]
+    ok = True
+    for name, nominal, interval, outages, expect_predictions in scenarios:
+        stats, report = simulate(lib, nominal, interval, args.windows, rng, outages)
+        errors = [abs(e) for e in report['errors']]
+        print(f'{name}: {stats.windows} windows, {report["predicted"]} predicted, missed slots {stats.missed_slots}, '
+              f'unaligned {stats.unaligned}')
+        print(f'  alignment wait ms: mean {mean(report["waits"]) / 1000:.2f}, max {stats.align_wait_max_us / 1000:.2f} '
+              f'(waking at the slot: mean {mean(report["naive_waits"]) / 1000:.2f})')
+        if errors:
+            print(f'  prediction error us: mean {mean(errors):.0f}, max {max(errors):.0f}')
+        print(f'  resume us: max {stats.resume_max_us}, late {stats.late_resumes} '
+              f'({report["late_misses"]} missed their crossing); awake {stats.active_us / 1e6:.1f} s, '
+              f'asleep {stats.sleep_us / 1e6:.1f} s; energy per measurement {stats.energy_avg_uj / 1000:.2f} mJ '
+              f'(estimate)')
+        for failure in report['failures'][:5]:
+            print(f'  FAILED: {failure}')
+        if report['failures'] or stats.missed_slots or (report['predicted'] > 0) != expect_predictions:
+            ok = False
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
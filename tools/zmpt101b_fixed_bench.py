@@ -0,0 +1,196 @@
+# Host test and benchmark of the ZMPT101B fixed-point layer (components/zmpt101b/zmpt101b_fixed.h).
+#
+# Usage:
+#   python zmpt101b_fixed_bench.py [--count 200000] [--seed 1]
+#       build the fixed-point functions for the host together with the float and double code they
+#       replace; checks the integer square roots exactly, the Q15 and Q31 multiplies to half an
+#       LSB with saturation, the block RMS against the exact value and the peak-to-peak conversion
+#       of zmpt101b_read_voltage() over its whole input range, and measures the cost per call of
+#       both versions
+
+import argparse
+import ctypes
+import math
+import os
+import random
+
+from zmpt101b_host import HOST_DIR, build_library
+
+REFERENCE_PATH = os.path.join(HOST_DIR, 'zmpt101b_fixed_reference.c')
+
+# Must match zmpt101b_fixed.h
+RMS_FRAC_BITS = 8
+# Range of peak-to-peak sensor millivolts zmpt101b_read_voltage() converts
+P2P_MAX_MV = 3300
+
+
+def load_fixed_library():
+    """
+    Builds the fixed-point layer and the reference loops of tools/host for the host.
+    """
+    lib = build_library('zmpt101b_fixed', ['zmpt101b_fixed.c', REFERENCE_PATH], ['zmpt101b_fixed.h'], ['-lm'])
+    lib.zmpt101b_isqrt64.argtypes = [ctypes.c_uint64]
+    lib.zmpt101b_isqrt64.restype = ctypes.c_uint32
+    lib.zmpt101b_isqrt32.argtypes = [ctypes.c_uint32]
+    lib.zmpt101b_isqrt32.restype = ctypes.c_uint16
+    lib.zmpt101b_fx_ac_rms_q8.argtypes = [ctypes.c_int64, ctypes.c_uint64, ctypes.c_uint32]
+    lib.zmpt101b_fx_ac_rms_q8.restype = ctypes.c_uint32
+    i16p, i32p, u32p = ctypes.POINTER(ctypes.c_int16), ctypes.POINTER(ctypes.c_int32), ctypes.POINTER(ctypes.c_uint32)
+    for name in ('ref_q15_mul', 'ref_q15_mul_float'):
+        getattr(lib, name).argtypes = [i16p, i16p, i16p, ctypes.c_size_t]
+    for name in ('ref_q31_mul', 'ref_q31_mul_float'):
+        getattr(lib, name).argtypes = [i32p, i32p, i32p, ctypes.c_size_t]
+    for name in ('ref_p2p_to_rms_fixed', 'ref_p2p_to_rms_double'):
+        getattr(lib, name).argtypes = [i32p, i32p, ctypes.c_size_t]
+    for name in ('ref_block_rms_fixed', 'ref_block_rms_float'):
+        getattr(lib, name).argtypes = [i16p, ctypes.c_size_t, ctypes.c_size_t, ctypes.POINTER(ctypes.c_float)]
+    for name in ('ref_isqrt32', 'ref_sqrtf'):
+        getattr(lib, name).argtypes = [u32p, u32p, ctypes.c_size_t]
+    for name in ('ref_q15_mul', 'ref_q15_mul_float', 'ref_q31_mul', 'ref_q31_mul_float', 'ref_p2p_to_rms_fixed',
+                 'ref_p2p_to_rms_double', 'ref_block_rms_fixed', 'ref_block_rms_float', 'ref_isqrt32', 'ref_sqrtf'):
+        getattr(lib, name).restype = ctypes.c_uint64
+    return lib
+
+
+def report(name, worst, limit, unit):
+    ok = worst <= limit
+    print(f'{name}: worst error {worst:.4g} {unit} (limit {limit:g}){"" if ok else "  FAILED"}')
+    return ok
+
+
+def check_isqrt(lib, rng, count):
+    edges = [0, 1, 2, 3, 4, 2**31, 2**32 - 1, 2**62, 2**63 - 1, 2**64 - 1]
+    edges += [k * k + d for k in (1, 65535, 65536, 2**32 - 1) for d in (-1, 0, 1) if 0 <= k * k + d < 2**64]
+    values = edges + [rng.getrandbits(rng.randint(1, 64)) for _ in range(count)]
+    wrong64 = sum(lib.zmpt101b_isqrt64(v) != math.isqrt(v) for v in values)
+    wrong32 = sum(lib.zmpt101b_isqrt32(v) != math.isqrt(v) for v in values if v < 2**32)
+    ok = wrong64 == 0 and wrong32 == 0
+    print(f'isqrt64, isqrt32: {wrong64} and {wrong32} of {len(values)} roots wrong{"" if ok else "  FAILED"}')
+    return ok
+
+
+def check_q15(lib, rng, count):
+    a = [-32768, -32768, 32767, -32768, 0] + [rng.randint(-32768, 32767) for _ in range(count)]
+    b = [-32768, 32767, 32767, 1, 0] + [rng.randint(-32768, 32767) for _ in range(count)]
+    n = len(a)
+    out = (ctypes.c_int16 * n)()
+    lib.ref_q15_mul((ctypes.c_int16 * n)(*a), (ctypes.c_int16 * n)(*b), out, n)
+    ok = out[0] == 32767
+    worst = max(abs(out[i] - min(a[i] * b[i] / 32768, 32767)) for i in range(n))
+    print(f'q15_mul: -1 * -1 = {out[0]} (saturates to 32767){"" if ok else "  FAILED"}')
+    return report('q15_mul', worst, 0.5, 'LSB') and ok
+
+
+def check_q31(lib, rng, count):
+    a = [-2**31, -2**31, 2**31 - 1, -2**31, 0] + [rng.randint(-2**31, 2**31 - 1) for _ in range(count)]
+    b = [-2**31, 2**31 - 1, 2**31 - 1, 1, 0] + [rng.randint(-2**31, 2**31 - 1) for _ in range(count)]
+    n = len(a)
+    out = (ctypes.c_int32 * n)()
+    lib.ref_q31_mul((ctypes.c_int32 * n)(*a), (ctypes.c_int32 * n)(*b), out, n)
+    ok = out[0] == 2**31 - 1
+    worst = max(abs(out[i] - min(a[i] * b[i] / 2**31, 2**31 - 1)) for i in range(n))
+    print(f'q31_mul: -1 * -1 = {out[0]} (saturates to {2**31 - 1}){"" if ok else "  FAILED"}')
+    return report('q31_mul', worst, 0.5, 'LSB') and ok
+
+
+def check_ac_rms(lib, rng, count):
+    """
+    RMS without the mean of random blocks: sine plus DC bias and noise as the ADC delivers it,
+    full-scale extremes and blocks with huge sums where the adaptive shift gives up precision.
+    """
+    worst = 0.0
+    worst_float = 0.0
+    blocks = []
+    for _ in range(max(count // 1000, 50)):
+        length = rng.randint(1, 2048)
+        bias, amplitude = rng.randint(0, 3300), rng.uniform(0, 1650)
+        phase = rng.uniform(0, 2 * math.pi)
+        blocks.append([max(-32768, min(32767, int(round(bias + amplitude * math.sin(phase + 2 * math.pi * i / 500)
+                                                        + rng.gauss(0, 3))))) for i in range(length)])
+    blocks.append([32767, -32768] * 1024)
+    blocks.append([-32768] * 4096)
+    blocks.append([1000])
+    for block in blocks:
+        total, squares, n = sum(block), sum(x * x for x in block), len(block)
+        exact = math.sqrt(n * squares - total * total) / n
+        fixed = lib.zmpt101b_fx_ac_rms_q8(total, squares, n) / (1 << RMS_FRAC_BITS)
+        # The float path it replaces in zmpt101b_threephase.c
+        as_float = ctypes.c_float(math.sqrt(ctypes.c_float(n * squares - total * total).value)).value / n
+        worst = max(worst, abs(fixed - exact))
+        worst_float = max(worst_float, abs(as_float - exact))
+    # Truncated root and rounded division: under one LSB of the result
+    ok = report('fx_ac_rms_q8', worst, 1 / (1 << RMS_FRAC_BITS), 'sample units')
+    print(f'  (the float version it replaces: {worst_float:.4g})')
+
+    # Sums too large for the full scaling still stay within one millionth
+    n, peak = 65536, 32767
+    total, squares = 0, n * peak * peak
+    exact = math.sqrt(n * squares - total * total) / n
+    fixed = lib.zmpt101b_fx_ac_rms_q8(total, squares, n) / (1 << RMS_FRAC_BITS)
+    return report('fx_ac_rms_q8 at 2^16 full-scale samples', abs(fixed - exact) / exact, 1e-6, 'relative') and ok
+
+
+def check_p2p(lib):
+    n = P2P_MAX_MV + 1
+    values = (ctypes.c_int32 * n)(*range(n))
+    fixed, double = (ctypes.c_int32 * n)(), (ctypes.c_int32 * n)()
+    lib.ref_p2p_to_rms_fixed(values, fixed, n)
+    lib.ref_p2p_to_rms_double(values, double, n)
+    worst_exact = max(abs(fixed[d] - d * 1000 / (2 * math.sqrt(2))) for d in range(n))
+    worst_double = max(abs(fixed[d] - double[d]) for d in range(n))
+    differ = sum(fixed[d] != double[d] for d in range(n))
+    ok = report('fx_p2p_to_rms_mv against exact', worst_exact, 0.5, 'mV')
+    ok &= report('fx_p2p_to_rms_mv against the double expression it replaces', worst_double, 1, 'mV')
+    print(f'  {differ} of {n} inputs differ from the double expression (its 1.4142135 is short of sqrt(2))')
+    return ok
+
+
+def benchmark(lib, rng, count):
+    """
+    Cost per call of the fixed-point and the float or double version, each in a C loop so the
+    ctypes overhead stays out.
+    """
+    n = count
+    i16 = lambda: (ctypes.c_int16 * n)(*[rng.randint(-32768, 32767) for _ in range(n)])
+    i32 = lambda: (ctypes.c_int32 * n)(*[rng.randint(-2**31, 2**31 - 1) for _ in range(n)])
+    a16, b16, o16 = i16(), i16(), (ctypes.c_int16 * n)()
+    a32, b32, o32 = i32(), i32(), (ctypes.c_int32 * n)()
+    p2p = (ctypes.c_int32 * n)(*[rng.randint(0, P2P_MAX_MV) for _ in range(n)])
+    u32 = (ctypes.c_uint32 * n)(*[rng.getrandbits(32) for _ in range(n)])
+    ou32 = (ctypes.c_uint32 * n)()
+    block = (ctypes.c_int16 * n)(*[int(1650 + 1000 * math.sin(i / 80)) for i in range(n)])
+    rms = (ctypes.c_float * (n // 500 + 1))()
+    cases = [
+        ('q15 multiply', lambda f: f(a16, b16, o16, n), lib.ref_q15_mul, lib.ref_q15_mul_float, n),
+        ('q31 multiply', lambda f: f(a32, b32, o32, n), lib.ref_q31_mul, lib.ref_q31_mul_float, n),
+        ('square root of 32 bits', lambda f: f(u32, ou32, n), lib.ref_isqrt32, lib.ref_sqrtf, n),
+        ('peak-to-peak to RMS', lambda f: f(p2p, o32, n), lib.ref_p2p_to_rms_fixed, lib.ref_p2p_to_rms_double, n),
+        ('RMS of a 500-sample block', lambda f: f(block, n, 500, rms), lib.ref_block_rms_fixed, lib.ref_block_rms_float,
+         n // 500),
+    ]
+    print('host cost per call, fixed against float (the host has a hardware FPU, the ESP32 runs double in software):')
+    for name, call, fixed, floating, calls in cases:
+        best = [min(call(f) for _ in range(5)) / calls for f in (fixed, floating)]
+        print(f'  {name}: {best[0]:.2f} ns against {best[1]:.2f} ns')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B fixed-point layer test and benchmark')
+    parser.add_argument('--count', type=int, default=200000)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_fixed_library()
+    rng = random.Random(args.seed)
+
+    ok = check_isqrt(lib, rng, args.count)
+    ok &= check_q15(lib, rng, args.count)
+    ok &= check_q31(lib, rng, args.count)
+    ok &= check_ac_rms(lib, rng, args.count)
+    ok &= check_p2p(lib)
+    benchmark(lib, rng, args.count)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
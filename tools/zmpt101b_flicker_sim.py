@@ -0,0 +1,265 @@
+# Host test of the ZMPT101B flickermeter (components/zmpt101b/zmpt101b_flicker.h).
+#
+# Usage:
+#   python zmpt101b_flicker_sim.py [--seed 1] [--lamp 50|60]
+#       build the flicker chain for the host and run the IEC 61000-4-15 response tests on the
+#       sample stream: sinusoidal modulation from 0.5 to 25.5 Hz at the amplitudes of the
+#       standard's table for Pinst = 1 (tolerance 8 %), and rectangular modulation from 1 to
+#       1620 changes per minute at the amplitudes of the classifier table for Pst = 1 over a
+#       clock-aligned 10-minute interval (tolerance 5 %), for the 230 V / 50 Hz and the
+#       120 V / 60 Hz lamp; then checks that steady mains read no flicker at any sensor level
+
+import argparse
+import ctypes
+import math
+import random
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h and zmpt101b_flicker.h
+SAMPLING_FREQ = 25000
+FLICKER_SETTLE_S = 20
+FLICKER_10_MIN_US = 600 * 1000000
+
+# The smallest modulations of the tables are a fraction of a millivolt at the sensor level of
+# 230 V mains, below the resolution of the stream, so the tables run near the top of the ADC range
+BIAS_MV = 1650
+PEAK_MV = 1000
+NOISE_MV = 0.5              # dithers the integer millivolts
+
+# Sensor levels steady mains are checked at, and the highest Pinst they may read
+FLOOR_LEVELS_MV = [250, 325, 500, 1000, 1400]
+PINST_FLOOR_MAX = 0.05
+
+PINST_TOLERANCE = 0.08
+PST_TOLERANCE = 0.05
+
+# IEC 61000-4-15 sinusoidal modulation for Pinst = 1: modulation frequency in Hz, peak-to-peak
+# dV/V in % for the 230 V / 50 Hz and the 120 V / 60 Hz lamp
+SINE_TABLE = [
+    (0.5, 2.325, 2.453), (1.0, 1.397, 1.465), (1.5, 1.067, 1.126), (2.0, 0.879, 0.942),
+    (2.5, 0.747, 0.815), (3.0, 0.645, 0.717), (3.5, 0.564, 0.637), (4.0, 0.497, 0.570),
+    (4.5, 0.442, 0.514), (5.0, 0.396, 0.466), (5.5, 0.357, 0.426), (6.0, 0.325, 0.393),
+    (6.5, 0.300, 0.366), (7.0, 0.280, 0.346), (7.5, 0.265, 0.332), (8.0, 0.256, 0.323),
+    (8.8, 0.250, 0.321), (9.5, 0.254, 0.329), (10.0, 0.261, 0.341), (10.5, 0.271, 0.355),
+    (11.0, 0.283, 0.373), (11.5, 0.298, 0.394), (12.0, 0.314, 0.417), (13.0, 0.351, 0.469),
+    (14.0, 0.393, 0.528), (15.0, 0.438, 0.592), (16.0, 0.486, 0.660), (17.0, 0.537, 0.734),
+    (18.0, 0.590, 0.811), (19.0, 0.646, 0.892), (20.0, 0.704, 0.977), (21.0, 0.764, 1.067),
+    (22.0, 0.828, 1.160), (23.0, 0.894, 1.257), (24.0, 0.964, 1.359), (25.0, 1.037, 1.464),
+    (25.5, 1.075, 1.518),
+]
+
+# IEC 61000-4-15 rectangular modulation for Pst = 1: changes per minute, dV/V in % for the
+# 230 V / 50 Hz and the 120 V / 60 Hz lamp
+RECT_TABLE = [
+    (1, 2.724, 3.181), (2, 2.211, 2.564), (7, 1.459, 1.694), (39, 0.906, 1.040),
+    (110, 0.725, 0.844), (1620, 0.402, 0.548),
+]
+
+
+class FlickerValue(ctypes.Structure):
+    _fields_ = [('pst', ctypes.c_float), ('plt', ctypes.c_float), ('plt_valid', ctypes.c_bool),
+                ('partial', ctypes.c_bool), ('plt_partial', ctypes.c_bool), ('timestamp_us', ctypes.c_int64)]
+
+
+FlickerCallback = ctypes.CFUNCTYPE(None, ctypes.POINTER(FlickerValue), ctypes.c_void_p)
+
+
+class FlickerConfig(ctypes.Structure):
+    _fields_ = [('sample_rate', ctypes.c_uint32), ('nominal_freq', ctypes.c_uint16),
+                ('callback', FlickerCallback), ('ctx', ctypes.c_void_p)]
+
+
+def load_flicker_library():
+    """
+    Builds the flickermeter for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_flicker', ['zmpt101b_flicker.c'], ['zmpt101b_flicker.h'], ['-lm'])
+    lib.zmpt101b_flicker_init.argtypes = [ctypes.c_void_p, ctypes.POINTER(FlickerConfig)]
+    lib.zmpt101b_flicker_init.restype = ctypes.c_int
+    lib.zmpt101b_flicker_process.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t,
+                                             ctypes.c_int64]
+    lib.zmpt101b_flicker_process.restype = None
+    lib.zmpt101b_flicker_pinst.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_flicker_pinst.restype = ctypes.c_float
+    return lib
+
+
+class Meter:
+    """
+    A flickermeter fed from a stream of mains samples: one second of carrier and of noise is
+    generated once and repeated, which keeps the long runs fast.
+    """
+    def __init__(self, lib, nominal_freq, rng, peak_mv=PEAK_MV):
+        self.lib = lib
+        self.peak_mv = peak_mv
+        self.values = []
+        self.callback = FlickerCallback(lambda value, ctx: self.values.append(
+            (value.contents.pst, value.contents.partial, value.contents.timestamp_us)))
+        self.config = FlickerConfig(SAMPLING_FREQ, nominal_freq, self.callback, None)
+        # zmpt101b_flicker_t is about 2.5 KB
+        self.state = ctypes.create_string_buffer(4096)
+        if lib.zmpt101b_flicker_init(self.state, ctypes.byref(self.config)) != 0:
+            raise RuntimeError('zmpt101b_flicker_init failed')
+        phase = rng.uniform(0, 2 * math.pi)
+        self.carrier = [math.sin(2 * math.pi * nominal_freq * n / SAMPLING_FREQ + phase) for n in range(SAMPLING_FREQ)]
+        self.noise = [rng.gauss(0, NOISE_MV) for _ in range(SAMPLING_FREQ)]
+        self.position = 0
+        self.start_us = 0
+        self.levels = {}
+
+    def time_us(self):
+        return self.start_us + self.position * 1000000 // SAMPLING_FREQ
+
+    def level(self, gain):
+        """
+        One second of samples at a constant amplitude, reused for every step at that amplitude.
+        """
+        if gain not in self.levels:
+            samples = [int(round(BIAS_MV + self.peak_mv * gain * c + e)) for c, e in zip(self.carrier, self.noise)]
+            self.levels[gain] = (ctypes.c_int16 * SAMPLING_FREQ)(*samples)
+        return self.levels[gain]
+
+    def feed_level(self, gain, count):
+        """
+        Feeds `count` samples at a constant amplitude.
+        """
+        block = self.level(gain)
+        while count > 0:
+            offset = self.position % SAMPLING_FREQ
+            length = min(count, SAMPLING_FREQ - offset)
+            pointer = ctypes.cast(ctypes.byref(block, offset * 2), ctypes.POINTER(ctypes.c_int16))
+            self.lib.zmpt101b_flicker_process(self.state, pointer, length, self.time_us())
+            self.position += length
+            count -= length
+
+    def feed_modulated(self, gain, count):
+        """
+        Feeds `count` samples with the amplitude from gain(n), n being the stream position.
+        """
+        first = self.position
+        samples = [int(round(BIAS_MV + self.peak_mv * gain(n) * self.carrier[n % SAMPLING_FREQ]
+                             + self.noise[n % SAMPLING_FREQ]))
+                   for n in range(first, first + count)]
+        block = (ctypes.c_int16 * count)(*samples)
+        self.lib.zmpt101b_flicker_process(self.state, block, count, self.time_us())
+        self.position += count
+
+    def pinst(self):
+        return self.lib.zmpt101b_flicker_pinst(self.state)
+
+
+def run_sine(lib, nominal_freq, column, rng):
+    """
+    Sinusoidal modulation: the highest Pinst in steady state must be 1 within the tolerance.
+    """
+    failures = []
+    errors = []
+    for row in SINE_TABLE:
+        freq, dv = row[0], row[column] / 100
+        meter = Meter(lib, nominal_freq, rng)
+        # The normaliser and the filters settle on the unmodulated mains first, then the
+        # 0.05 Hz high-pass and the smoothing get a few seconds of the modulation
+        meter.feed_level(1.0, FLICKER_SETTLE_S * SAMPLING_FREQ)
+        phase = rng.uniform(0, 2 * math.pi)
+
+        def gain(n):
+            return 1.0 + dv / 2 * math.sin(2 * math.pi * freq * n / SAMPLING_FREQ + phase)
+        meter.feed_modulated(gain, int(max(5.0, 3 / freq) * SAMPLING_FREQ))
+        # Pinst every millisecond over at least two modulation periods
+        step = SAMPLING_FREQ // 1000
+        peak = 0.0
+        for _ in range(int(max(1.0, 2 / freq) * 1000)):
+            meter.feed_modulated(gain, step)
+            peak = max(peak, meter.pinst())
+        errors.append(peak - 1.0)
+        if abs(peak - 1.0) > PINST_TOLERANCE:
+            failures.append(f'{freq} Hz, dV/V {row[column]} %: Pinst {peak:.3f}')
+    worst = max(errors, key=abs)
+    print(f'{nominal_freq} Hz lamp, sinusoidal modulation: {len(SINE_TABLE)} points, Pinst error '
+          f'worst {worst * 100:+.1f} %, mean {sum(errors) / len(errors) * 100:+.1f} %')
+    return failures
+
+
+def run_rect(lib, nominal_freq, column, rng):
+    """
+    Rectangular modulation: the Pst of the first complete 10-minute interval must be 1 within
+    the tolerance.
+    """
+    failures = []
+    errors = []
+    for row in RECT_TABLE:
+        changes, dv = row[0], row[column] / 100
+        meter = Meter(lib, nominal_freq, rng)
+        # Start so that the filters have settled when the next 10-minute interval begins
+        meter.start_us = 1700000400 * 1000000 - (FLICKER_SETTLE_S + 10) * 1000000 - rng.randrange(1000000)
+        interval_end = (meter.time_us() // FLICKER_10_MIN_US + 2) * FLICKER_10_MIN_US
+        step = SAMPLING_FREQ * 60 / changes
+        high = rng.random() < 0.5
+        next_change = rng.uniform(0, step)
+        while meter.time_us() <= interval_end:
+            count = max(1, int(round(next_change)) - meter.position)
+            meter.feed_level(1.0 + dv / 2 if high else 1.0 - dv / 2, count)
+            if meter.position >= next_change:
+                high = not high
+                next_change += step
+        complete = [pst for pst, partial, end in meter.values if not partial and end == interval_end]
+        if not complete:
+            failures.append(f'{changes} changes/min: no complete interval ending at {interval_end} us')
+            continue
+        errors.append(complete[0] - 1.0)
+        if abs(complete[0] - 1.0) > PST_TOLERANCE:
+            failures.append(f'{changes} changes/min, dV/V {row[column]} %: Pst {complete[0]:.3f}')
+    worst = max(errors, key=abs) if errors else 0.0
+    print(f'{nominal_freq} Hz lamp, rectangular modulation: {len(RECT_TABLE)} points, Pst error '
+          f'worst {worst * 100:+.1f} %')
+    return failures
+
+
+def run_floor(lib, nominal_freq, rng):
+    """
+    Steady mains: Pinst must stay at the floor the noise leaves, whatever the sensor level. A DC
+    bias estimate that is off by a few millivolts leaks the mains frequency into the chain and
+    shows up here, increasingly so at low levels.
+    """
+    failures = []
+    floors = []
+    for peak_mv in FLOOR_LEVELS_MV:
+        meter = Meter(lib, nominal_freq, rng, peak_mv)
+        meter.feed_level(1.0, FLICKER_SETTLE_S * SAMPLING_FREQ)
+        step = SAMPLING_FREQ // 1000
+        floor = 0.0
+        for _ in range(5000):
+            meter.feed_level(1.0, step)
+            floor = max(floor, meter.pinst())
+        floors.append(f'{peak_mv} mV {floor:.4f}')
+        if floor > PINST_FLOOR_MAX:
+            failures.append(f'steady mains at {peak_mv} mV: Pinst {floor:.4f}')
+    print(f'{nominal_freq} Hz lamp, steady mains: Pinst {", ".join(floors)}')
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B flickermeter test')
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--lamp', type=int, choices=[50, 60], help='test one lamp only')
+    args = parser.parse_args()
+    lib = load_flicker_library()
+    rng = random.Random(args.seed)
+
+    failures = []
+    for nominal_freq, column in ((50, 1), (60, 2)):
+        if args.lamp is not None and args.lamp != nominal_freq:
+            continue
+        failures += run_sine(lib, nominal_freq, column, rng)
+        failures += run_rect(lib, nominal_freq, column, rng)
+        failures += run_floor(lib, nominal_freq, rng)
+    for failure in failures:
+        print(f'  {failure}')
+    ok = not failures
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,169 @@
+# Host simulation of the ZMPT101B grid-locked sample clock (components/zmpt101b/zmpt101b_gridlock.h).
+#
+# Usage:
+#   python zmpt101b_gridlock_sim.py [--seconds 600] [--seed 1]
+#       build the software PLL for the host and run it against simulated mains with frequency
+#       ramps, steps and a random walk, sampled by an APLL with finite resolution; checks pull-in
+#       time, tracking error while locked and that the rate never leaves the capture range
+
+import argparse
+import ctypes
+import math
+import random
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b_gridlock.h
+LOCK_PPM = 100
+RANGE_PPM = 100000
+
+APLL_RESOLUTION_PPM = 1.5   # ESP32 APLL step around 5.7 MHz
+CROSSING_JITTER = 0.1      # zero-crossing position noise, samples
+
+
+class Status(ctypes.Structure):
+    _fields_ = [('locked', ctypes.c_bool), ('error_ppb', ctypes.c_int32), ('phase_msamples', ctypes.c_int32),
+                ('frequency_mhz', ctypes.c_uint32), ('rate_mhz', ctypes.c_uint32), ('updates', ctypes.c_uint32),
+                ('retunes', ctypes.c_uint32), ('unlocks', ctypes.c_uint32), ('rejected', ctypes.c_uint32)]
+
+
+def load_gridlock_library():
+    """
+    Builds the loop for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_gridlock', ['zmpt101b_gridlock.c'], ['zmpt101b_gridlock.h'])
+    lib.zmpt101b_gridlock_init.argtypes = [ctypes.c_void_p, ctypes.c_uint16, ctypes.c_uint16]
+    lib.zmpt101b_gridlock_cycle.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.zmpt101b_gridlock_cycle.restype = ctypes.c_bool
+    lib.zmpt101b_gridlock_target_mhz.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_gridlock_target_mhz.restype = ctypes.c_uint32
+    lib.zmpt101b_gridlock_applied.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.zmpt101b_gridlock_get_status.argtypes = [ctypes.c_void_p, ctypes.POINTER(Status)]
+    return lib
+
+
+def apll_round(rate_hz):
+    """
+    Rate the APLL actually produces for a requested one.
+    """
+    step = APLL_RESOLUTION_PPM * 1e-6
+    return math.exp(round(math.log(rate_hz) / step) * step)
+
+
+def simulate(lib, name, samples_per_cycle, nominal, profile, steady, seconds, rng):
+    """
+    Runs the loop cycle by cycle: each rising crossing is placed where the mains puts it in the
+    sample stream, with jitter, and the cycle length in samples is fed to the loop. Returns the
+    pull-in time, the worst cycle-length error while locked and the worst one while the mains
+    frequency is steady (steady(t) is true).
+    """
+    gl = ctypes.create_string_buffer(128)
+    if lib.zmpt101b_gridlock_init(gl, samples_per_cycle, nominal) != 0:
+        raise RuntimeError('zmpt101b_gridlock_init failed')
+    rate = apll_round(samples_per_cycle * nominal)
+    lib.zmpt101b_gridlock_applied(gl, int(rate * 1000))
+    low = samples_per_cycle * nominal * (1 - RANGE_PPM * 1e-6)
+    high = samples_per_cycle * nominal * (1 + RANGE_PPM * 1e-6)
+
+    t = 0.0
+    position = 0.0                  # sample position of the last rising crossing
+    last_measured = position + rng.gauss(0, CROSSING_JITTER)
+    status = Status()
+    lock_time = None
+    locked_errors = []
+    steady_errors = []
+    out_of_range = False
+    while t < seconds:
+        freq = profile(t)
+        period_s = 1 / freq
+        position += period_s * rate
+        t += period_s
+        measured = position + rng.gauss(0, CROSSING_JITTER)
+        cycle = measured - last_measured
+        last_measured = measured
+
+        exact = rate / freq         # true cycle length at the rate in effect
+        if lib.zmpt101b_gridlock_cycle(gl, int(round(cycle * 65536))):
+            rate = apll_round(lib.zmpt101b_gridlock_target_mhz(gl) / 1000)
+            lib.zmpt101b_gridlock_applied(gl, int(round(rate * 1000)))
+            out_of_range |= not (low * 0.999999 <= rate <= high * 1.000001)
+        lib.zmpt101b_gridlock_get_status(gl, ctypes.byref(status))
+        if status.locked:
+            if lock_time is None:
+                lock_time = t
+            error_ppm = (exact - samples_per_cycle) / samples_per_cycle * 1e6
+            locked_errors.append(error_ppm)
+            if steady(t):
+                steady_errors.append(error_ppm)
+
+    worst = max((abs(e) for e in locked_errors), default=float('inf'))
+    worst_steady = max((abs(e) for e in steady_errors), default=float('inf'))
+    rms = math.sqrt(sum(e * e for e in steady_errors) / len(steady_errors)) if steady_errors else float('inf')
+    print(f'{name}: locked after {lock_time if lock_time is not None else float("nan"):.1f} s, '
+          f'{status.updates} updates, {status.retunes} retunes, {status.unlocks} unlocks, {status.rejected} rejected')
+    # A window of k cycles is off whole cycles by k times the relative error: leakage into the bins
+    print(f'  cycle length error ppm: steady rms {rms:.1f}, steady max {worst_steady:.1f}, max while locked {worst:.1f} '
+          f'(a 10-cycle window is off by {worst_steady * 10 * 512e-6:.3f} samples at 512/cycle)')
+    return lock_time, worst, worst_steady, rms, out_of_range
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B grid-locked sample clock simulation')
+    parser.add_argument('--seconds', type=float, default=600)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_gridlock_library()
+    rng = random.Random(args.seed)
+
+    walk = {'t': 0.0, 'f': 50.0, 'next': 50.0}
+
+    def random_walk(t):
+        # Grid frequency wandering a few mHz per second, kept within ±0.2 Hz; interpolated, since
+        # the frequency of a large grid moves smoothly
+        while walk['t'] + 1.0 < t:
+            walk['t'] += 1.0
+            walk['f'] = walk['next']
+            walk['next'] = min(max(walk['f'] + rng.gauss(0, 0.002), 49.8), 50.2)
+        return walk['f'] + (walk['next'] - walk['f']) * (t - walk['t'])
+
+    def ramp(t):
+        # Off-nominal start, then a 0.05 Hz/s ramp down and back up, as after losing a large generator
+        if t < 100:
+            return 49.93
+        if t < 110:
+            return 49.93 - 0.05 * (t - 100)
+        if t < 200:
+            return 49.43
+        if t < 220:
+            return 49.43 + 0.05 * (t - 200)
+        return 50.43
+
+    always = lambda t: t > 10    # noqa: E731
+    scenarios = [  # name, samples per cycle, nominal Hz, profile, steady periods, pull-in limit s, limit while locked ppm
+        ('512/cycle, 50 Hz random walk', 512, 50, random_walk, always, 5, 1.5 * LOCK_PPM),
+        # 0.05 Hz/s is 1000 ppm/s: one update behind is 500 ppm, at most a step more while the lock detector catches up
+        ('1024/cycle, 50 Hz ramps', 1024, 50, ramp, lambda t: 10 < t < 100 or 130 < t < 200 or t > 250, 5, 1500),
+        ('512/cycle, 60 Hz, 59.4 Hz island', 512, 60, lambda t: 59.4 + 0.3 * math.sin(t / 40), always, 5, 1.5 * LOCK_PPM),
+    ]
+    ok = True
+    for name, spc, nominal, profile, steady, pull_in, limit in scenarios:
+        lock_time, worst, worst_steady, rms, out_of_range = simulate(lib, name, spc, nominal, profile, steady, args.seconds, rng)
+        if lock_time is None or lock_time > pull_in:
+            print(f'  FAILED: no lock within {pull_in} s')
+            ok = False
+        # The rate holds for a whole update while the mains drifts on, which alone costs tens of ppm
+        if worst_steady > 1.5 * LOCK_PPM or rms > LOCK_PPM / 4:
+            print(f'  FAILED: steady tracking error {worst_steady:.1f} ppm, rms {rms:.1f} ppm')
+            ok = False
+        if worst > limit:
+            print(f'  FAILED: tracking error {worst:.1f} ppm while locked')
+            ok = False
+        if out_of_range:
+            print('  FAILED: rate left the capture range')
+            ok = False
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
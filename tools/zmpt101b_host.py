@@ -0,0 +1,36 @@
+# Host build of the ZMPT101B component modules for the tools/ scripts.
+#
+# The platform independent modules of components/zmpt101b are compiled into a shared library
+# with the esp_err.h and esp_log.h shims from tools/host and loaded with ctypes. The compiler
+# ($CC, cc by default) and the flags are set here for every script.
+
+import ctypes
+import os
+import subprocess
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+COMPONENT_DIR = os.path.join(SCRIPT_DIR, '..', 'components', 'zmpt101b')
+HOST_DIR = os.path.join(SCRIPT_DIR, 'host')
+
+CFLAGS = ['-O2', '-Wall', '-Wextra', '-shared', '-fPIC']
+
+
+def build_library(name, sources, headers=(), libs=()):
+    """
+    Builds tools/lib<name>.so when it's missing or older than its sources, their headers or this
+    file, and loads it.
+
+    :param name: Library name, e.g. 'zmpt101b_phasor'.
+    :param sources: C files, by name in components/zmpt101b or by path.
+    :param headers: Headers the sources depend on, the same way.
+    :param libs: Linker flags, e.g. '-lm'.
+    :return: ctypes library handle.
+    """
+    path = os.path.join(SCRIPT_DIR, f'lib{name}.so')
+    sources = [os.path.join(COMPONENT_DIR, s) for s in sources]
+    inputs = sources + [os.path.join(COMPONENT_DIR, h) for h in headers] + [os.path.abspath(__file__)]
+    if not os.path.exists(path) or any(os.path.getmtime(path) < os.path.getmtime(s) for s in inputs):
+        compiler = os.environ.get('CC', 'cc')
+        subprocess.check_call([compiler] + CFLAGS + ['-I', HOST_DIR, '-I', COMPONENT_DIR, '-o', path]
+                              + sources + list(libs))
+    return ctypes.CDLL(path)
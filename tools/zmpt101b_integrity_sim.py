@@ -0,0 +1,250 @@
+# Host test of the ZMPT101B sample integrity checks (components/zmpt101b/zmpt101b_integrity.h).
+#
+# Usage:
+#   python zmpt101b_integrity_sim.py [--windows 200] [--seed 1]
+#       build the checker for the host and feed it windows of tagged I2S words cut into DMA
+#       blocks, clean and with one injected fault each: words tagged with another channel, data
+#       bits stuck at 0 or 1, a flat stream, a block dropped by the ring, a block delivered twice
+#       and clipping; checks that the block and window quality bits and counters report exactly
+#       the injected fault, that the tags are stripped, and measures the cost per sample
+
+import argparse
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h and zmpt101b_integrity.h
+SAMPLING_FREQ = 25000
+DMA_BUFFER_LEN = 1024
+DMA_BUFFER_COUNT = 8
+DMA_RING_TIME_US = DMA_BUFFER_COUNT * DMA_BUFFER_LEN * 1000000 // SAMPLING_FREQ
+BLOCK_US = DMA_BUFFER_LEN * 1e6 / SAMPLING_FREQ
+CODE_MAX = 0x0FFF
+
+QUALITY_TAG_MISMATCH = 1 << 0
+QUALITY_STUCK_BITS = 1 << 1
+QUALITY_CONSTANT = 1 << 2
+QUALITY_GAP = 1 << 3
+QUALITY_DUPLICATE = 1 << 4
+QUALITY_CLIPPED = 1 << 5
+
+QUALITY_NAMES = [(QUALITY_TAG_MISMATCH, 'tag'), (QUALITY_STUCK_BITS, 'stuck'), (QUALITY_CONSTANT, 'constant'),
+                 (QUALITY_GAP, 'gap'), (QUALITY_DUPLICATE, 'duplicate'), (QUALITY_CLIPPED, 'clipped')]
+
+
+class Integrity(ctypes.Structure):
+    _fields_ = [('expected_tag', ctypes.c_uint8), ('max_interval_us', ctypes.c_uint32),
+                ('quality', ctypes.c_uint32), ('samples', ctypes.c_uint32), ('tag_mismatches', ctypes.c_uint32),
+                ('clipped_low', ctypes.c_uint32), ('clipped_high', ctypes.c_uint32), ('gaps', ctypes.c_uint32),
+                ('duplicates', ctypes.c_uint32), ('stuck_mask', ctypes.c_uint16), ('min_code', ctypes.c_uint16),
+                ('max_code', ctypes.c_uint16),
+                ('or_bits', ctypes.c_uint32), ('and_bits', ctypes.c_uint32), ('prev_checksum', ctypes.c_uint32),
+                ('prev_arrival_us', ctypes.c_int64), ('has_prev', ctypes.c_bool)]
+
+
+def load_integrity_library():
+    """
+    Builds the integrity checker for the host.
+    """
+    lib = build_library('zmpt101b_integrity', ['zmpt101b_integrity.c'], ['zmpt101b_integrity.h'])
+    lib.zmpt101b_integrity_begin.argtypes = [ctypes.POINTER(Integrity), ctypes.c_uint8, ctypes.c_uint32]
+    lib.zmpt101b_integrity_begin.restype = None
+    lib.zmpt101b_integrity_check_block.argtypes = [ctypes.POINTER(Integrity), ctypes.POINTER(ctypes.c_uint16),
+                                                   ctypes.c_size_t, ctypes.c_int64]
+    lib.zmpt101b_integrity_check_block.restype = ctypes.c_uint32
+    lib.zmpt101b_integrity_end.argtypes = [ctypes.POINTER(Integrity)]
+    lib.zmpt101b_integrity_end.restype = ctypes.c_uint32
+    return lib
+
+
+def describe(quality):
+    return '|'.join(name for bit, name in QUALITY_NAMES if quality & bit) or 'clean'
+
+
+def mains_codes(count, rng, amplitude=1400, bias=2048, noise=3.0):
+    """
+    ADC codes of a 50 Hz sine with noise and a random phase, limited to the 12-bit range.
+    """
+    phase = rng.uniform(0, 2 * math.pi)
+    return [max(0, min(CODE_MAX, int(round(bias + amplitude * math.sin(2 * math.pi * 50 * n / SAMPLING_FREQ + phase)
+                                               + rng.gauss(0, noise)))))
+            for n in range(count)]
+
+
+class Window:
+    """
+    One measurement window as the driver hands it over: DMA blocks of tagged words with their
+    arrival times. The faults below edit it before it's fed to the checker.
+    """
+    def __init__(self, codes, channel, rng, block_len=DMA_BUFFER_LEN):
+        self.channel = channel
+        self.codes = [codes[i:i + block_len] for i in range(0, len(codes), block_len)]
+        self.tags = [[channel] * len(block) for block in self.codes]
+        # The reader lags the DMA by up to half a block; arrivals never drift by more than the ring holds
+        self.arrivals = [1000000 + (k + 1) * BLOCK_US + rng.uniform(0, BLOCK_US / 2) for k in range(len(self.codes))]
+
+    def words(self, k):
+        return [(tag << 12) | code for tag, code in zip(self.tags[k], self.codes[k])]
+
+    def pick_block(self, rng, min_length):
+        return rng.choice([k for k, block in enumerate(self.codes) if len(block) >= min_length])
+
+
+def feed(lib, window):
+    """
+    Runs the checker over the window. Returns the per-block flags, the window quality, the state
+    and whether every block came back with the tags stripped.
+    """
+    st = Integrity()
+    lib.zmpt101b_integrity_begin(ctypes.byref(st), window.channel, DMA_RING_TIME_US)
+    block_flags = []
+    stripped = True
+    for k in range(len(window.codes)):
+        words = window.words(k)
+        block = (ctypes.c_uint16 * len(words))(*words)
+        block_flags.append(lib.zmpt101b_integrity_check_block(ctypes.byref(st), block, len(words),
+                                                              int(window.arrivals[k])))
+        stripped &= list(block) == window.codes[k]
+    return block_flags, lib.zmpt101b_integrity_end(ctypes.byref(st)), st, stripped
+
+
+def inject_tags(window, rng):
+    # Any block, the single word a short read leaves at the end of the window too
+    k = rng.randrange(len(window.codes))
+    count = rng.randint(1, min(8, len(window.codes[k])))
+    for i in rng.sample(range(len(window.codes[k])), count):
+        window.tags[k][i] = (window.channel + rng.randint(1, 15)) & 0x0F
+    return QUALITY_TAG_MISMATCH, {k: QUALITY_TAG_MISMATCH}, {'tag_mismatches': count}
+
+
+def inject_stuck(window, rng):
+    # One of the bits a 2800-code swing toggles, stuck high or low in every word
+    bit = 1 << rng.randint(0, 9)
+    high = rng.random() < 0.5
+    for block in window.codes:
+        for i, code in enumerate(block):
+            block[i] = code | bit if high else code & ~bit
+    return QUALITY_STUCK_BITS, {}, {'stuck_mask': bit}
+
+
+def inject_flat(window, rng):
+    # A disconnected sensor: the bias with a code or two of noise, blocks may repeat exactly
+    level = rng.randint(200, 3800)
+    for block in window.codes:
+        for i in range(len(block)):
+            block[i] = level + rng.choice((0, 0, 0, 1, -1))
+    return QUALITY_CONSTANT, {}, {}
+
+
+def inject_drop(window, rng):
+    # The reader stalled until the ring overflowed: every later block arrives a ring's worth late
+    k = rng.randrange(1, len(window.codes))
+    for j in range(k, len(window.codes)):
+        window.arrivals[j] += DMA_RING_TIME_US + BLOCK_US
+    return QUALITY_GAP, {k: QUALITY_GAP}, {'gaps': 1}
+
+
+def inject_duplicate(window, rng):
+    # The driver hands the same buffer over twice, so the copy is a whole DMA block
+    k = rng.choice([k for k in range(1, len(window.codes)) if len(window.codes[k]) == DMA_BUFFER_LEN])
+    window.codes[k] = list(window.codes[k - 1])
+    return QUALITY_DUPLICATE, {k: QUALITY_DUPLICATE}, {'duplicates': 1}
+
+
+def inject_clipping(window, rng):
+    low = rng.randint(1, 20)
+    high = rng.randint(1, 20)
+    k = window.pick_block(rng, 40)
+    indexes = rng.sample(range(len(window.codes[k])), low + high)
+    for i in indexes[:low]:
+        window.codes[k][i] = 0
+    for i in indexes[low:]:
+        window.codes[k][i] = CODE_MAX
+    return QUALITY_CLIPPED, {}, {'clipped_low': low, 'clipped_high': high}
+
+
+def inject_late(window, rng):
+    # The reader was preempted for most of the ring, then caught up: late, but nothing was lost
+    k = rng.randrange(1, len(window.codes))
+    delay = rng.uniform(0.5, 0.9) * (DMA_RING_TIME_US - BLOCK_US)
+    for j in range(k, len(window.codes)):
+        window.arrivals[j] = max(window.arrivals[j], window.arrivals[k - 1] + delay + (j - k) * 5)
+    return 0, {}, {}
+
+
+FAULTS = [('clean', lambda window, rng: (0, {}, {})), ('wrong channel tags', inject_tags),
+          ('stuck bit', inject_stuck), ('flat stream', inject_flat), ('dropped block', inject_drop),
+          ('duplicated block', inject_duplicate), ('clipping', inject_clipping), ('late reader', inject_late)]
+
+
+def run(lib, name, inject, windows, rng):
+    """
+    Feeds `windows` windows with the fault injected and checks the quality bits and counters.
+    """
+    failures = []
+    for n in range(windows):
+        channel = rng.randrange(8)
+        # Whole DMA blocks, and now and then a short read that ends on an odd word
+        length = rng.choice((4 * DMA_BUFFER_LEN, 4 * DMA_BUFFER_LEN + 1, 3 * DMA_BUFFER_LEN + 333))
+        window = Window(mains_codes(length, rng), channel, rng)
+        expected, expected_blocks, expected_counts = inject(window, rng)
+        block_flags, quality, st, stripped = feed(lib, window)
+        if quality != expected:
+            failures.append(f'window {n}: quality {describe(quality)}, expected {describe(expected)}')
+        for k, flags in enumerate(block_flags):
+            # Stuck bits, flat streams and clipping are window-level results, the rest come per block
+            flags &= QUALITY_TAG_MISMATCH | QUALITY_GAP | QUALITY_DUPLICATE
+            if flags != expected_blocks.get(k, 0):
+                failures.append(f'window {n}, block {k}: flags {describe(flags)}, '
+                                f'expected {describe(expected_blocks.get(k, 0))}')
+        for field, value in expected_counts.items():
+            if getattr(st, field) != value:
+                failures.append(f'window {n}: {field} {getattr(st, field)}, expected {value}')
+        if st.samples != length:
+            failures.append(f'window {n}: {st.samples} samples counted, {length} fed')
+        if not stripped:
+            failures.append(f'window {n}: tags left in the codes')
+    print(f'{name}: {windows} windows, {len(failures)} failures')
+    for failure in failures[:5]:
+        print(f'  {failure}')
+    return not failures
+
+
+def benchmark(lib, rng):
+    codes = mains_codes(DMA_BUFFER_LEN, rng)
+    words = [(3 << 12) | code for code in codes]
+    block = (ctypes.c_uint16 * DMA_BUFFER_LEN)()
+    st = Integrity()
+    repeat = 2000
+    best = float('inf')
+    for _ in range(5):
+        lib.zmpt101b_integrity_begin(ctypes.byref(st), 3, 0)
+        start = time.perf_counter()
+        for n in range(repeat):
+            block[:] = words
+            lib.zmpt101b_integrity_check_block(ctypes.byref(st), block, DMA_BUFFER_LEN, n)
+        best = min(best, time.perf_counter() - start)
+    print(f'host cost: {best / repeat / DMA_BUFFER_LEN * 1e9:.2f} ns per sample, block copy and ctypes call included')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B sample integrity test')
+    parser.add_argument('--windows', type=int, default=200)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_integrity_library()
+    rng = random.Random(args.seed)
+
+    ok = True
+    for name, inject in FAULTS:
+        ok &= run(lib, name, inject, args.windows, rng)
+    benchmark(lib, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,317 @@
+# Host test of the ZMPT101B measurement log (components/zmpt101b/zmpt101b_log.h).
+#
+# Usage:
+#   python zmpt101b_log_sim.py [--seed 1]
+#       build the log with the file-backed partition stand-in of zmpt101b_storage.h for the host
+#       (a NOR flash image: erased to 0xFF, writes only clear bits) and append records until the
+#       ring has wrapped more than once. Checks that the records read back in order with their
+#       sequence numbers, that the oldest sector is the one reused, that a reopen recovers the
+#       head, the generation and the next sequence number, that a record torn by a power loss
+#       (written only in part, or with flipped bits) fails its CRC on the reopen, is skipped and
+#       counted and appending goes on behind it, and that time-range queries return exactly the
+#       records in [from, to)
+
+import argparse
+import ctypes
+import os
+import random
+import tempfile
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b_log.h and zmpt101b_log.c
+LOG_PARTITION_LABEL = 'zmpt_log'
+LOG_SECTOR_SIZE = 4096
+LOG_RECORD_SIZE = 32
+LOG_MAX_SECTORS = 64
+LOG_FILE_SIZE = 16 * LOG_SECTOR_SIZE
+RECORDS_PER_SECTOR = LOG_SECTOR_SIZE // LOG_RECORD_SIZE - 1
+
+LOG_VOLTAGE = 1
+LOG_EVENT = 3
+
+ESP_OK = 0
+ESP_ERR_INVALID_STATE = 0x103
+
+SECTORS = LOG_FILE_SIZE // LOG_SECTOR_SIZE
+START_US = 1_700_000_000_000_000
+
+
+class LogRecord(ctypes.Structure):
+    _fields_ = [('timestamp_us', ctypes.c_int64), ('type', ctypes.c_uint16), ('flags', ctypes.c_uint16),
+                ('values', ctypes.c_int32 * 3)]
+
+
+class LogSector(ctypes.Structure):
+    _fields_ = [('min_us', ctypes.c_int64), ('max_us', ctypes.c_int64), ('generation', ctypes.c_uint32),
+                ('records', ctypes.c_uint16)]
+
+
+class Log(ctypes.Structure):
+    _fields_ = [('partition', ctypes.c_void_p), ('sector_count', ctypes.c_uint32), ('head', ctypes.c_uint32),
+                ('generation', ctypes.c_uint32), ('sequence', ctypes.c_uint32), ('corrupt', ctypes.c_uint32),
+                ('sectors', LogSector * LOG_MAX_SECTORS)]
+
+
+LogCallback = ctypes.CFUNCTYPE(ctypes.c_bool, ctypes.POINTER(LogRecord), ctypes.c_uint32, ctypes.c_void_p)
+
+
+def load_log_library():
+    """
+    Builds the log for the host, with the partition stand-in in the storage directory.
+    """
+    lib = build_library('zmpt101b_log', ['zmpt101b_log.c', 'zmpt101b_storage.c'],
+                        ['zmpt101b_log.h', 'zmpt101b_storage.h'])
+    lib.zmpt101b_log_open.argtypes = [ctypes.POINTER(Log), ctypes.c_char_p]
+    lib.zmpt101b_log_open.restype = ctypes.c_int
+    lib.zmpt101b_log_close.argtypes = [ctypes.POINTER(Log)]
+    lib.zmpt101b_log_close.restype = None
+    lib.zmpt101b_log_append.argtypes = [ctypes.POINTER(Log), ctypes.POINTER(LogRecord)]
+    lib.zmpt101b_log_append.restype = ctypes.c_int
+    lib.zmpt101b_log_query.argtypes = [ctypes.POINTER(Log), ctypes.c_int64, ctypes.c_int64, LogCallback,
+                                       ctypes.c_void_p]
+    lib.zmpt101b_log_query.restype = ctypes.c_int
+    lib.zmpt101b_log_clear.argtypes = [ctypes.POINTER(Log)]
+    lib.zmpt101b_log_clear.restype = ctypes.c_int
+    lib.zmpt101b_storage_set_dir.argtypes = [ctypes.c_char_p]
+    lib.zmpt101b_storage_set_dir.restype = None
+    return lib
+
+
+class Writer:
+    """
+    Appends records to an open log and keeps what was written, as (sequence, timestamp, type, flags, values),
+    with the number of the slot each one went to since the log was new.
+    """
+    def __init__(self, lib, log, rng):
+        self.lib = lib
+        self.log = log
+        self.rng = rng
+        self.timestamp_us = START_US
+        self.written = []
+        self.slots = []
+        self.used = 0
+
+    def expected(self):
+        """
+        The records still in the ring: the ones in the head sector and the full sectors before it.
+        """
+        return [w for w, s in zip(self.written, self.slots) if s >= self.used - retained(self.used)]
+
+    def tear(self):
+        """
+        Forgets the last record, its slot stays used.
+        """
+        self.slots.pop()
+        return self.written.pop()
+
+    def append(self, count):
+        for _ in range(count):
+            # Now and then several records share a timestamp, like an event and the reading it came with
+            self.timestamp_us += self.rng.choice((0, 1_000_000, 1_000_000, 1_000_000 + self.rng.randint(-5000, 5000)))
+            kind = self.rng.choice((LOG_VOLTAGE, LOG_EVENT))
+            values = (self.rng.randint(-2**31, 2**31 - 1), self.rng.randint(0, 300000), self.rng.randint(-1, 60000))
+            flags = self.rng.randint(0, 0xFFFF)
+            record = LogRecord(self.timestamp_us, kind, flags, (ctypes.c_int32 * 3)(*values))
+            sequence = self.log.sequence
+            err = self.lib.zmpt101b_log_append(ctypes.byref(self.log), ctypes.byref(record))
+            if err != ESP_OK:
+                raise RuntimeError(f'zmpt101b_log_append() failed: 0x{err:x}')
+            self.written.append((sequence, self.timestamp_us, kind, flags, values))
+            self.slots.append(self.used)
+            self.used += 1
+
+
+def query(lib, log, from_us, to_us, limit=None):
+    """
+    Records the log returns for [from_us, to_us), in the order it returns them.
+    """
+    found = []
+
+    def collect(record, sequence, _ctx):
+        r = record.contents
+        found.append((sequence, r.timestamp_us, r.type, r.flags, tuple(r.values)))
+        return limit is None or len(found) < limit
+
+    callback = LogCallback(collect)
+    err = lib.zmpt101b_log_query(ctypes.byref(log), from_us, to_us, callback, None)
+    if err != ESP_OK:
+        raise RuntimeError(f'zmpt101b_log_query() failed: 0x{err:x}')
+    return found
+
+
+def query_all(lib, log):
+    return query(lib, log, -2**63, 2**63 - 1)
+
+
+def reopen(lib, log):
+    lib.zmpt101b_log_close(ctypes.byref(log))
+    log = Log()
+    err = lib.zmpt101b_log_open(ctypes.byref(log), LOG_PARTITION_LABEL.encode())
+    if err != ESP_OK:
+        raise RuntimeError(f'zmpt101b_log_open() failed: 0x{err:x}')
+    return log
+
+
+def retained(total):
+    """
+    Records the ring keeps after `total` appends: the head sector and the full sectors before it.
+    """
+    if total <= SECTORS * RECORDS_PER_SECTOR:
+        return total
+    return (SECTORS - 1) * RECORDS_PER_SECTOR + (total - 1) % RECORDS_PER_SECTOR + 1
+
+
+def slot_offset(sector, slot):
+    return sector * LOG_SECTOR_SIZE + slot * LOG_RECORD_SIZE
+
+
+def check(failures, condition, message):
+    if not condition:
+        failures.append(message)
+
+
+def run(store_dir, rng):
+    failures = []
+    lib = load_log_library()
+    # The store keeps the pointer, the buffer has to outlive the library calls
+    store = ctypes.c_char_p(store_dir.encode())
+    lib.zmpt101b_storage_set_dir(store)
+    image = os.path.join(store_dir, f'{LOG_PARTITION_LABEL}.part')
+
+    # A new partition starts erased with one sector
+    log = Log()
+    check(failures, lib.zmpt101b_log_append(ctypes.byref(log), ctypes.byref(LogRecord())) == ESP_ERR_INVALID_STATE,
+          'append to a log that isn\'t open accepted')
+    check(failures, lib.zmpt101b_log_open(ctypes.byref(log), LOG_PARTITION_LABEL.encode()) == ESP_OK,
+          'open of a new partition failed')
+    check(failures, os.path.getsize(image) == LOG_FILE_SIZE, 'partition stand-in has the wrong size')
+    check(failures, (log.sector_count, log.head, log.generation, log.sequence, log.corrupt) == (SECTORS, 0, 1, 0, 0),
+          f'new log: {log.sector_count} sectors, head {log.head}, generation {log.generation}, '
+          f'sequence {log.sequence}, {log.corrupt} corrupt')
+    check(failures, query_all(lib, log) == [], 'new log returns records')
+
+    # Append within the first sectors
+    writer = Writer(lib, log, rng)
+    writer.append(RECORDS_PER_SECTOR * 3 + 17)
+    check(failures, query_all(lib, log) == writer.written, 'records before the wrap read back differently')
+    check(failures, (log.head, log.generation) == (3, 4), f'head {log.head}, generation {log.generation} '
+                                                           f'after 3 full sectors, expected 3 and 4')
+    print(f'append: {len(writer.written)} records read back in order with sequence 0 to {len(writer.written) - 1}')
+
+    # Rotation past the end of the ring, twice: the oldest sector is erased and reused
+    heads = []
+    total = (SECTORS * 2 + rng.randint(1, SECTORS - 2)) * RECORDS_PER_SECTOR + rng.randint(1, RECORDS_PER_SECTOR - 1)
+    while len(writer.written) + RECORDS_PER_SECTOR <= total:
+        writer.append(RECORDS_PER_SECTOR)
+        heads.append(log.head)
+    writer.append(total - len(writer.written))
+    kept = retained(len(writer.written))
+    found = query_all(lib, log)
+    check(failures, found == writer.expected() == writer.written[-kept:],
+          f'after the wrap: {len(found)} records read back, expected the last {kept} in order')
+    check(failures, sorted(set(heads)) == list(range(SECTORS)), 'ring rotation skipped sectors')
+    check(failures, all(b == (a + 1) % SECTORS for a, b in zip(heads, heads[1:])), 'ring rotation out of order')
+    generations = sorted(log.sectors[s].generation for s in range(SECTORS))
+    expected_head_generation = (len(writer.written) - 1) // RECORDS_PER_SECTOR + 1
+    check(failures, generations == list(range(expected_head_generation - SECTORS + 1, expected_head_generation + 1)),
+          f'sector generations {generations} after the wrap')
+    print(f'rotation: {len(writer.written)} records over {SECTORS} sectors, the last {kept} kept, generation '
+          f'{log.generation}, head sector {log.head}')
+
+    # Reopen: head, generation and next sequence number come back from the flash
+    state = (log.head, log.generation, log.sequence)
+    log = reopen(lib, log)
+    writer.log = log
+    check(failures, (log.head, log.generation, log.sequence) == state,
+          f'reopen: head, generation, sequence {(log.head, log.generation, log.sequence)}, expected {state}')
+    check(failures, log.corrupt == 0, f'reopen: {log.corrupt} corrupt records in an intact log')
+    check(failures, query_all(lib, log) == writer.expected(), 'reopen: records read back differently')
+    writer.append(5)
+    check(failures, [w[0] for w in writer.written[-6:]] == list(range(state[2] - 1, state[2] + 5)),
+          'reopen: sequence numbers don\'t continue')
+    print(f'reopen: head sector {log.head}, generation {log.generation}, appending goes on at sequence {state[2]}')
+
+    # Power loss during a write: the last record is written only in part or has flipped bits
+    for torn_count, damage in enumerate(('truncated', 'corrupted'), 1):
+        head, slot = log.head, log.sectors[log.head].records
+        with open(image, 'r+b') as f:
+            f.seek(slot_offset(head, slot))
+            data = bytearray(f.read(LOG_RECORD_SIZE))
+            if damage == 'truncated':
+                cut = rng.randint(4, LOG_RECORD_SIZE - 1)
+                data[cut:] = b'\xff' * (LOG_RECORD_SIZE - cut)
+            else:
+                bit = rng.randrange(8, (LOG_RECORD_SIZE - 4) * 8)
+                data[bit // 8] ^= 1 << (bit % 8)
+            f.seek(slot_offset(head, slot))
+            f.write(bytes(data))
+        torn = writer.tear()
+
+        log = reopen(lib, log)
+        writer.log = log
+        check(failures, log.corrupt == torn_count,
+              f'{damage} record: {log.corrupt} corrupt records counted, expected {torn_count}')
+        check(failures, log.sequence == torn[0], f'{damage} record: next sequence {log.sequence}, expected {torn[0]}')
+        check(failures, (log.head, log.sectors[head].records) == (head, slot),
+              f'{damage} record: head sector {log.head} with {log.sectors[log.head].records} slots used, '
+              f'expected {head} with {slot}')
+        check(failures, query_all(lib, log) == writer.expected(), f'{damage} record: returned or others lost')
+        writer.append(3)
+        check(failures, query_all(lib, log) == writer.expected(),
+              f'{damage} record: records appended behind it read back differently')
+        log = reopen(lib, log)
+        writer.log = log
+        check(failures, log.corrupt == torn_count,
+              f'{damage} record: {log.corrupt} corrupt records counted on the next reopen, expected {torn_count}')
+        print(f'{damage} record in sector {head} slot {slot}: skipped and counted on reopen, sequence {torn[0]} '
+              f'reused by the next append')
+
+    # Time ranges: every record with from <= timestamp < to, oldest first; the callback can stop the query
+    records = query_all(lib, log)
+    first, last = min(r[1] for r in records), max(r[1] for r in records)
+    ranges = [(first - 10, first), (last + 1, last + 10), (first, last + 1), (last, last + 1)]
+    for _ in range(200):
+        a, b = sorted(rng.randint(first - 2_000_000, last + 2_000_000) for _ in range(2))
+        ranges.append((a, b))
+    for _ in range(50):
+        t = rng.choice(records)[1]
+        ranges.append((t, t + rng.choice((1, 1_000_000, 1_000_001))))
+    for from_us, to_us in ranges:
+        expected = [r for r in records if from_us <= r[1] < to_us]
+        found = query(lib, log, from_us, to_us)
+        if found != expected:
+            failures.append(f'query [{from_us - START_US}, {to_us - START_US}) us: {len(found)} records, '
+                            f'expected {len(expected)}')
+            break
+    limit = rng.randint(1, 50)
+    check(failures, query(lib, log, first, last + 1, limit) == records[:limit], 'query didn\'t stop at the callback')
+    print(f'time ranges: {len(ranges)} queries over {len(records)} records returned exactly the ones in range')
+
+    # Clearing erases everything and starts over
+    check(failures, lib.zmpt101b_log_clear(ctypes.byref(log)) == ESP_OK, 'clear failed')
+    log = reopen(lib, log)
+    check(failures, (log.head, log.generation, log.sequence, log.corrupt) == (0, 1, 0, 0) and query_all(lib, log) == [],
+          'cleared log reopens with records or state')
+    lib.zmpt101b_log_close(ctypes.byref(log))
+    print('clear: the log reopens empty')
+
+    for failure in failures[:10]:
+        print(f'  {failure}')
+    return not failures
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B measurement log test')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    rng = random.Random(args.seed)
+
+    with tempfile.TemporaryDirectory() as store_dir:
+        ok = run(store_dir, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,166 @@
+# Host test of the ZMPT101B measurement of a window (components/zmpt101b/zmpt101b_measurement.h).
+#
+# Usage:
+#   python zmpt101b_measurement_sim.py [--windows 200] [--seed 1]
+#       build the block analysis for the host and feed it windows of analytic mains waveforms with
+#       harmonics, DC bias, ADC noise and random phase, at and off nominal frequency, short
+#       windows and windows without signal; checks RMS, frequency, DC offset, extremes, peak and
+#       crest factor of every window against the analytic values, and measures the cost per sample
+
+import argparse
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h and zmpt101b_measurement.h
+SAMPLING_FREQ = 25000
+WINDOW = 1024
+MAINS_PER_SENSOR = 1000
+
+HARMONICS = [(1, 1.0, 0.0), (3, 0.05, 0.7), (5, 0.03, -1.9), (7, 0.01, 2.4)]   # order, relative amplitude, phase
+
+
+class Measurement(ctypes.Structure):
+    _fields_ = [('rms_mv', ctypes.c_int32), ('frequency_mhz', ctypes.c_uint32), ('min_mv', ctypes.c_int32),
+                ('max_mv', ctypes.c_int32), ('peak_mv', ctypes.c_int32), ('dc_offset_mv', ctypes.c_int32), ('crest_factor_milli', ctypes.c_uint16),
+                ('half_cycles', ctypes.c_uint16), ('sample_count', ctypes.c_uint32), ('timestamp_us', ctypes.c_int64),
+                ('quality', ctypes.c_uint32)]
+
+
+def load_measurement_library():
+    """
+    Builds the block analysis for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_measurement', ['zmpt101b_measurement.c', 'zmpt101b_fixed.c'],
+                        ['zmpt101b_measurement.h', 'zmpt101b_fixed.h'])
+    lib.zmpt101b_measurement_compute.argtypes = [ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t, ctypes.c_uint32,
+                                                 ctypes.c_int32]
+    lib.zmpt101b_measurement_compute.restype = Measurement
+    return lib
+
+
+class Signal:
+    """
+    Sensor output: a fundamental of `peak` mV with the relative harmonics on a DC bias.
+    """
+    def __init__(self, frequency, peak, bias, noise_mv):
+        self.frequency = frequency
+        self.peak = peak
+        self.bias = bias
+        self.noise_mv = noise_mv
+
+    def value(self, t, phase):
+        return self.bias + sum(self.peak * r * math.sin(h * (2 * math.pi * self.frequency * t + phase) + p)
+                               for h, r, p in HARMONICS)
+
+    def window(self, length, rng):
+        phase = rng.uniform(0, 2 * math.pi)
+        samples = [self.value(n / SAMPLING_FREQ, phase) + (rng.gauss(0, self.noise_mv) if self.noise_mv else 0)
+                   for n in range(length)]
+        return [int(round(s)) for s in samples]
+
+    def truth(self):
+        """
+        RMS, extremes against the bias over a dense cycle, in mains mV, and the crest factor.
+        """
+        rms = self.peak * math.sqrt(sum(r * r for _, r, _ in HARMONICS) / 2) * MAINS_PER_SENSOR
+        if self.frequency == 0:
+            return rms, 0, 0, 0
+        cycle = [self.value(k / (4096 * self.frequency), 0) - self.bias for k in range(4096)]
+        low, high = min(cycle) * MAINS_PER_SENSOR, max(cycle) * MAINS_PER_SENSOR
+        return rms, low, high, max(high, -low) / rms if rms else 0
+
+
+def measure(lib, samples):
+    block = (ctypes.c_int16 * len(samples))(*samples)
+    # The level zmpt101b.c uses: mean of the window
+    return lib.zmpt101b_measurement_compute(block, len(samples), SAMPLING_FREQ, int(sum(samples) / len(samples)))
+
+
+def run(lib, name, signal, length, windows, rng, limits):
+    """
+    Measures windows of one signal; limits are RMS %, frequency mHz, DC mV and extremes and peak mains mV.
+    """
+    rms_limit, frequency_limit, dc_limit, extreme_limit = limits
+    rms, low, high, crest = signal.truth()
+    expected_half_cycles = int(2 * length * signal.frequency / SAMPLING_FREQ)
+    worst = [0.0, 0.0, 0.0, 0.0, 0.0]
+    wrong_cycles = 0
+    for _ in range(windows):
+        m = measure(lib, signal.window(length, rng))
+        # The first crossing may fall after the start of the window's first half cycle, and an odd
+        # count of more than one is cut to whole cycles
+        if not max(expected_half_cycles - 2, 0) <= m.half_cycles <= expected_half_cycles or m.sample_count != length:
+            wrong_cycles += 1
+        worst[0] = max(worst[0], abs(m.rms_mv - rms) / rms * 100 if rms else abs(m.rms_mv) / MAINS_PER_SENSOR)
+        frequency = signal.frequency * 1000 if m.half_cycles else 0
+        worst[1] = max(worst[1], abs(m.frequency_mhz - frequency))
+        worst[2] = max(worst[2], abs(m.dc_offset_mv - signal.bias))
+        if expected_half_cycles >= 4:
+            worst[3] = max(worst[3], abs(m.min_mv - low), abs(m.max_mv - high), abs(m.peak_mv - max(high, -low)))
+            worst[4] = max(worst[4], abs(m.crest_factor_milli / 1000 - crest))
+
+    unit = '%' if rms else 'mV without signal'
+    print(f'{name}: {windows} windows of {length} samples, errors max: RMS {worst[0]:.4f} {unit}, '
+          f'frequency {worst[1]:.0f} mHz, DC {worst[2]:.0f} mV'
+          + (f', extremes and peak {worst[3]:.0f} mains mV, crest factor {worst[4]:.4f}' if expected_half_cycles >= 4 else ''))
+    ok = True
+    if wrong_cycles:
+        print(f'  FAILED: {wrong_cycles} windows spanned the wrong number of half cycles')
+        ok = False
+    if worst[0] > rms_limit or worst[1] > frequency_limit or worst[2] > dc_limit or worst[3] > extreme_limit:
+        print(f'  FAILED: limits RMS {rms_limit}, frequency {frequency_limit} mHz, DC {dc_limit} mV, '
+              f'extremes and peak {extreme_limit} mains mV')
+        ok = False
+    return ok
+
+
+def benchmark(lib):
+    """
+    Cost per sample on the host.
+    """
+    samples = Signal(50.0, 325, 1650, 2.0).window(WINDOW, random.Random(0))
+    block = (ctypes.c_int16 * WINDOW)(*samples)
+    level = int(sum(samples) / len(samples))
+    repeat = 2000
+    best = float('inf')
+    for _ in range(5):
+        start = time.perf_counter()
+        for _ in range(repeat):
+            lib.zmpt101b_measurement_compute(block, WINDOW, SAMPLING_FREQ, level)
+        best = min(best, time.perf_counter() - start)
+    print(f'host cost: {best / repeat / WINDOW * 1e9:.2f} ns per sample, ctypes call included')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B window measurement test')
+    parser.add_argument('--windows', type=int, default=200)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_measurement_library()
+    rng = random.Random(args.seed)
+
+    # With one cycle per window the frequency and the RMS are only as good as two crossings: 2 mV
+    # of noise on a slope of 4 mV per sample moves each by up to about a sample, 0.2 % of 500
+    scenarios = [  # name, signal, window, limits: RMS %, frequency mHz, DC mV, extremes and peak mains mV
+        ('230 V, 50 Hz, clean', Signal(50.0, 325, 1650, 0.0), WINDOW, (0.02, 5, 1, 1000)),
+        ('230 V, 50 Hz, noisy', Signal(50.0, 325, 1650, 2.0), WINDOW, (0.3, 250, 1, 14000)),
+        ('120 V, 60 Hz, noisy', Signal(60.0, 170, 1610, 2.0), WINDOW, (0.5, 500, 1, 14000)),
+        ('230 V, 47.5 Hz, noisy', Signal(47.5, 325, 1702, 2.0), WINDOW, (0.3, 250, 1, 14000)),
+        ('230 V, 52 Hz, 10 cycles', Signal(52.0, 325, 1650, 2.0), 5000, (0.08, 30, 1, 14000)),
+        ('230 V, 50 Hz, 1.5 cycles', Signal(50.0, 325, 1650, 0.0), 750, (0.02, 5, 1, 0)),
+        ('no signal', Signal(0.0, 0, 1650, 2.0), WINDOW, (8, 0, 1, 0)),
+    ]
+    ok = True
+    for name, signal, length, limits in scenarios:
+        ok &= run(lib, name, signal, length, args.windows, rng, limits)
+    benchmark(lib)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,207 @@
+# Scraper for the ZMPT101B /metrics endpoint (components/zmpt101b/zmpt101b_metrics.h).
+#
+# Usage:
+#   python zmpt101b_metrics_scrape.py scrape --url http://192.168.1.20:9100/metrics
+#       fetch the exposition text once, validate it and print the samples
+#   python zmpt101b_metrics_scrape.py loopback [--seconds 5] [--rate 100] [--window 0.2]
+#       build the endpoint for the host, serve it from a thread while another thread renders a new
+#       text every measurement window, scrape it over localhost at --rate requests per second and
+#       then as fast as possible: reports latency, throughput and render cost, validates every text
+
+import argparse
+import ctypes
+import http.client
+import math
+import re
+import socket
+import threading
+import time
+import urllib.request
+
+from zmpt101b_host import build_library
+
+SAMPLE = re.compile(r'^([a-zA-Z_:][a-zA-Z0-9_:]*) (\S+)$')
+COMMENT = re.compile(r'^# (HELP|TYPE) ([a-zA-Z_:][a-zA-Z0-9_:]*) (.*)$')
+
+
+def parse(text):
+    """
+    Parses the exposition text; raises ValueError on anything a Prometheus server would reject.
+    """
+    if text and not text.endswith('\n'):
+        raise ValueError('text does not end with a newline')
+    samples = {}
+    types = {}
+    for line in text.splitlines():
+        comment = COMMENT.match(line)
+        if comment:
+            if comment.group(1) == 'TYPE':
+                if comment.group(3) not in ('gauge', 'counter'):
+                    raise ValueError(f'bad type: {line}')
+                types[comment.group(2)] = comment.group(3)
+            continue
+        sample = SAMPLE.match(line)
+        if not sample:
+            raise ValueError(f'bad line: {line!r}')
+        name, value = sample.group(1), float(sample.group(2))
+        if name not in types:
+            raise ValueError(f'sample without TYPE: {name}')
+        if types[name] == 'counter' and not value >= 0:
+            raise ValueError(f'bad counter value: {line}')
+        samples[name] = value
+    return samples
+
+
+def scrape(args):
+    with urllib.request.urlopen(args.url, timeout=5) as response:
+        samples = parse(response.read().decode())
+    for name, value in samples.items():
+        print(f'{name} {value}')
+
+
+class SnapshotData(ctypes.Structure):
+    _fields_ = [('timestamp_us', ctypes.c_int64), ('rms_mv', ctypes.c_uint32), ('rms_min_mv', ctypes.c_uint32),
+                ('rms_max_mv', ctypes.c_uint32), ('frequency_mhz', ctypes.c_uint32),
+                ('thd_centi_pct', ctypes.c_uint16), ('attenuation', ctypes.c_uint16), ('dips', ctypes.c_uint32),
+                ('swells', ctypes.c_uint32), ('interruptions', ctypes.c_uint32), ('quality', ctypes.c_uint32),
+                ('clipped', ctypes.c_uint32), ('gaps', ctypes.c_uint32), ('duplicates', ctypes.c_uint32),
+                ('range_switches', ctypes.c_uint32), ('updates', ctypes.c_uint32), ('window_us', ctypes.c_uint32)]
+
+
+class MetricsStats(ctypes.Structure):
+    _fields_ = [('renders', ctypes.c_uint32), ('renders_skipped', ctypes.c_uint32), ('render_us', ctypes.c_uint32),
+                ('overflows', ctypes.c_uint32), ('scrapes', ctypes.c_uint32)]
+
+
+def load_metrics_library():
+    """
+    Builds the metrics endpoint for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_metrics', ['zmpt101b_metrics.c'], ['zmpt101b_metrics.h', 'zmpt101b_snapshot.h'])
+    lib.zmpt101b_metrics_init.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_metrics_update.argtypes = [ctypes.c_void_p, ctypes.POINTER(SnapshotData)]
+    lib.zmpt101b_metrics_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(MetricsStats)]
+    lib.zmpt101b_metrics_http_start.argtypes = [ctypes.c_void_p, ctypes.c_uint16]
+    lib.zmpt101b_metrics_http_service.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.zmpt101b_metrics_http_stop.argtypes = [ctypes.c_void_p]
+    return lib
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(int(len(ordered) * fraction), len(ordered) - 1)]
+
+
+def run_scrapes(port, seconds, rate, failures):
+    """
+    Scrapes over one keep-alive connection, paced at rate per second (0: back to back).
+    """
+    connection = http.client.HTTPConnection('127.0.0.1', port, timeout=5)
+    latencies = []
+    start = time.perf_counter()
+    while time.perf_counter() - start < seconds:
+        if rate > 0:
+            due = start + len(latencies) / rate
+            delay = due - time.perf_counter()
+            if delay > 0:
+                time.sleep(delay)
+        t0 = time.perf_counter_ns()
+        connection.request('GET', '/metrics')
+        response = connection.getresponse()
+        body = response.read()
+        latencies.append(time.perf_counter_ns() - t0)
+        try:
+            if response.status != 200:
+                raise ValueError(f'status {response.status}')
+            samples = parse(body.decode())
+            if samples['zmpt101b_voltage_rms_volts'] * 1000 != round(samples['zmpt101b_voltage_rms_volts'] * 1000):
+                raise ValueError('voltage not in millivolts')
+        except (ValueError, KeyError) as e:
+            failures.append(str(e))
+    connection.close()
+    return latencies
+
+
+def loopback(args):
+    lib = load_metrics_library()
+    metrics = ctypes.create_string_buffer(16 * 1024)
+    lib.zmpt101b_metrics_init(metrics)
+
+    probe = socket.socket()
+    probe.bind(('127.0.0.1', 0))
+    port = probe.getsockname()[1]
+    probe.close()
+    if lib.zmpt101b_metrics_http_start(metrics, port) != 0:
+        raise RuntimeError('zmpt101b_metrics_http_start failed')
+
+    stop = threading.Event()
+
+    def serve():
+        while not stop.is_set():
+            lib.zmpt101b_metrics_http_service(metrics, 10)
+
+    def update():
+        n = 0
+        while not stop.is_set():
+            n += 1
+            rms = 230000 + int(2000 * math.sin(n / 10))
+            data = SnapshotData(timestamp_us=1700000000000000 + n * int(args.window * 1e6), rms_mv=rms,
+                                rms_min_mv=228000, rms_max_mv=232000, frequency_mhz=50000 + n % 20,
+                                thd_centi_pct=0xFFFF if n % 2 else 312, dips=0xFFFFFFFF if n % 3 else n // 50,
+                                swells=0xFFFFFFFF, interruptions=0xFFFFFFFF, updates=n, window_us=40000)
+            lib.zmpt101b_metrics_update(metrics, ctypes.byref(data))
+            time.sleep(args.window)
+
+    threads = [threading.Thread(target=serve, daemon=True), threading.Thread(target=update, daemon=True)]
+    for thread in threads:
+        thread.start()
+    time.sleep(0.1)
+
+    # 404 for other paths, the connection stays usable
+    failures = []
+    connection = http.client.HTTPConnection('127.0.0.1', port, timeout=5)
+    connection.request('GET', '/')
+    response = connection.getresponse()
+    response.read()
+    if response.status != 404:
+        failures.append(f'GET / returned {response.status}')
+    connection.close()
+
+    paced = run_scrapes(port, args.seconds, args.rate, failures)
+    burst = run_scrapes(port, 1.0, 0, failures)
+    stop.set()
+    for thread in threads:
+        thread.join()
+    stats = MetricsStats()
+    lib.zmpt101b_metrics_get_stats(metrics, ctypes.byref(stats))
+    lib.zmpt101b_metrics_http_stop(metrics)
+
+    us = [v / 1000 for v in paced]
+    print(f'paced: {len(us)} scrapes in {args.seconds:.1f} s ({len(us) / args.seconds:.0f}/s), latency us: '
+          f'median {percentile(us, 0.5):.0f}, p99 {percentile(us, 0.99):.0f}, max {max(us):.0f}')
+    print(f'back to back: {len(burst)} scrapes/s')
+    print(f'renders {stats.renders}, skipped {stats.renders_skipped}, last render {stats.render_us} us, '
+          f'overflows {stats.overflows}, scrapes served {stats.scrapes}')
+    for failure in sorted(set(failures)):
+        print(f'FAILED: {failure}')
+    ok = not failures and stats.overflows == 0 and len(us) >= 0.95 * args.rate * args.seconds
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    return 0 if ok else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B metrics scraper')
+    parser.add_argument('mode', choices=['scrape', 'loopback'])
+    parser.add_argument('--url', default='http://127.0.0.1:9100/metrics')
+    parser.add_argument('--seconds', type=float, default=5.0, help='loopback duration of the paced scrapes')
+    parser.add_argument('--rate', type=float, default=100.0, help='paced scrapes per second')
+    parser.add_argument('--window', type=float, default=0.2, help='seconds between renders in loopback mode')
+    args = parser.parse_args()
+    if args.mode == 'scrape':
+        scrape(args)
+    else:
+        raise SystemExit(loopback(args))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,289 @@
+# Minimal Modbus TCP client for the ZMPT101B Modbus server (components/zmpt101b/zmpt101b_modbus.h).
+#
+# Usage:
+#   python zmpt101b_modbus_client.py poll --host 192.168.1.20 [--port 502] [--unit 1] [--interval 1.0]
+#       read the register map of a device and print it
+#   python zmpt101b_modbus_client.py loopback [--seconds 3] [--port 0]
+#       build the server for the host, serve it from a thread while another thread publishes
+#       snapshots as fast as it can, and poll it over localhost: reports request latency and
+#       publish times, checks every read for torn snapshots and checks the RTU framing
+
+import argparse
+import ctypes
+import socket
+import struct
+import threading
+import time
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b_modbus.h
+REGISTER_COUNT = 32
+REG_CONTROL = 256
+CONTROL_RESET_MINMAX = 1
+FIELDS = [  # name, register, registers
+    ('rms_mv', 0, 2), ('rms_min_mv', 2, 2), ('rms_max_mv', 4, 2), ('frequency_mhz', 6, 2),
+    ('thd_centi_pct', 8, 1), ('attenuation', 9, 1), ('dips', 10, 2), ('swells', 12, 2),
+    ('interruptions', 14, 2), ('quality', 16, 2), ('clipped', 18, 2), ('gaps', 20, 2),
+    ('duplicates', 22, 2), ('range_switches', 24, 2), ('updates', 26, 2), ('timestamp_us', 28, 4),
+]
+
+
+class ModbusError(Exception):
+    pass
+
+
+class Client:
+    """
+    Blocking Modbus TCP client, one request at a time.
+    """
+
+    def __init__(self, host, port, unit=1, timeout=2.0):
+        self.sock = socket.create_connection((host, port), timeout=timeout)
+        self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        self.unit = unit
+        self.transaction = 0
+
+    def close(self):
+        self.sock.close()
+
+    def request(self, pdu):
+        self.transaction = (self.transaction + 1) & 0xFFFF
+        self.sock.sendall(struct.pack('>HHHB', self.transaction, 0, len(pdu) + 1, self.unit) + pdu)
+        header = self._receive(7)
+        transaction, protocol, length, _ = struct.unpack('>HHHB', header)
+        response = self._receive(length - 1)
+        if transaction != self.transaction or protocol != 0:
+            raise ModbusError('response does not match the request')
+        if response[0] & 0x80:
+            raise ModbusError(f'exception {response[1]:#04x} for function {pdu[0]:#04x}')
+        return response
+
+    def _receive(self, size):
+        data = b''
+        while len(data) < size:
+            chunk = self.sock.recv(size - len(data))
+            if not chunk:
+                raise ModbusError('connection closed')
+            data += chunk
+        return data
+
+    def read_input_registers(self, start, count):
+        response = self.request(struct.pack('>BHH', 0x04, start, count))
+        return list(struct.unpack(f'>{count}H', response[2:2 + 2 * count]))
+
+    def write_register(self, address, value):
+        self.request(struct.pack('>BHH', 0x06, address, value))
+
+
+def decode_map(registers):
+    values = {}
+    for name, start, count in FIELDS:
+        value = 0
+        for register in registers[start:start + count]:
+            value = (value << 16) | register
+        values[name] = value
+    return values
+
+
+def poll(args):
+    client = Client(args.host, args.port, args.unit)
+    try:
+        while True:
+            values = decode_map(client.read_input_registers(0, REGISTER_COUNT))
+            print(', '.join(f'{name} {value}' for name, value in values.items()))
+            time.sleep(args.interval)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        client.close()
+
+
+class SnapshotData(ctypes.Structure):
+    _fields_ = [('timestamp_us', ctypes.c_int64), ('rms_mv', ctypes.c_uint32), ('rms_min_mv', ctypes.c_uint32),
+                ('rms_max_mv', ctypes.c_uint32), ('frequency_mhz', ctypes.c_uint32),
+                ('thd_centi_pct', ctypes.c_uint16), ('attenuation', ctypes.c_uint16), ('dips', ctypes.c_uint32),
+                ('swells', ctypes.c_uint32), ('interruptions', ctypes.c_uint32), ('quality', ctypes.c_uint32),
+                ('clipped', ctypes.c_uint32), ('gaps', ctypes.c_uint32), ('duplicates', ctypes.c_uint32),
+                ('range_switches', ctypes.c_uint32), ('updates', ctypes.c_uint32), ('window_us', ctypes.c_uint32)]
+
+
+class ServerStats(ctypes.Structure):
+    _fields_ = [('requests', ctypes.c_uint32), ('exceptions', ctypes.c_uint32), ('ignored', ctypes.c_uint32),
+                ('connections', ctypes.c_uint32), ('snapshot_retries', ctypes.c_uint32)]
+
+
+def load_server_library():
+    """
+    Builds the Modbus server and snapshot for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_modbus', ['zmpt101b_modbus.c', 'zmpt101b_snapshot.c'],
+                        ['zmpt101b_modbus.h', 'zmpt101b_snapshot.h'])
+    lib.zmpt101b_snapshot_init.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_snapshot_publish.argtypes = [ctypes.c_void_p, ctypes.POINTER(SnapshotData)]
+    lib.zmpt101b_modbus_init.argtypes = [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_uint8]
+    lib.zmpt101b_modbus_rtu_process.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t, ctypes.c_char_p]
+    lib.zmpt101b_modbus_rtu_process.restype = ctypes.c_size_t
+    lib.zmpt101b_modbus_tcp_start.argtypes = [ctypes.c_void_p, ctypes.c_uint16]
+    lib.zmpt101b_modbus_tcp_service.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    lib.zmpt101b_modbus_tcp_stop.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_modbus_crc16.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+    lib.zmpt101b_modbus_crc16.restype = ctypes.c_uint16
+    return lib
+
+
+def publisher(lib, snapshot, stop, durations):
+    """
+    Publishes snapshots back to back; every counter carries the same number so a torn read shows.
+    """
+    n = 0
+    while not stop.is_set():
+        n += 1
+        data = SnapshotData(timestamp_us=n, rms_mv=230000 + n % 1000, frequency_mhz=50000, thd_centi_pct=n & 0xFFFF,
+                            dips=n, swells=n, interruptions=n, quality=n, clipped=n, gaps=n, duplicates=n,
+                            range_switches=n)
+        start = time.perf_counter_ns()
+        lib.zmpt101b_snapshot_publish(snapshot, ctypes.byref(data))
+        durations.append(time.perf_counter_ns() - start)
+        if n % 64 == 0:
+            time.sleep(0)
+
+
+def check_rtu(lib, server):
+    """
+    Sends RTU frames through zmpt101b_modbus_rtu_process(); returns a list of failures.
+    """
+    failures = []
+    response = ctypes.create_string_buffer(260)
+
+    def frame(unit, pdu):
+        body = bytes([unit]) + pdu
+        crc = lib.zmpt101b_modbus_crc16(body, len(body))
+        return body + struct.pack('<H', crc)
+
+    # Reference CRC from the Modbus specification examples
+    if lib.zmpt101b_modbus_crc16(bytes.fromhex('0103006b0003'), 6) != 0x1774:
+        failures.append('crc16 reference')
+    length = lib.zmpt101b_modbus_rtu_process(server, frame(1, struct.pack('>BHH', 0x04, 0, 4)), 8, response)
+    reply = response.raw[:length]
+    if length != 13 or reply[:3] != b'\x01\x04\x08' or lib.zmpt101b_modbus_crc16(reply, length) != 0:
+        failures.append('rtu read')
+    bad = bytearray(frame(1, struct.pack('>BHH', 0x04, 0, 4)))
+    bad[-1] ^= 0xFF
+    if lib.zmpt101b_modbus_rtu_process(server, bytes(bad), 8, response) != 0:
+        failures.append('rtu bad crc answered')
+    if lib.zmpt101b_modbus_rtu_process(server, frame(2, struct.pack('>BHH', 0x04, 0, 4)), 8, response) != 0:
+        failures.append('rtu other unit answered')
+    length = lib.zmpt101b_modbus_rtu_process(server, frame(1, struct.pack('>BHH', 0x04, 30, 4)), 8, response)
+    if response.raw[1:3] != b'\x84\x02':
+        failures.append('rtu illegal address')
+    length = lib.zmpt101b_modbus_rtu_process(server, frame(1, b'\x2b'), 4, response)
+    if response.raw[1:3] != b'\xab\x01':
+        failures.append('rtu illegal function')
+    return failures
+
+
+def percentile(values, fraction):
+    ordered = sorted(values)
+    return ordered[min(int(len(ordered) * fraction), len(ordered) - 1)]
+
+
+def loopback(args):
+    lib = load_server_library()
+    snapshot = ctypes.create_string_buffer(1024)
+    server = ctypes.create_string_buffer(4096)
+    lib.zmpt101b_snapshot_init(snapshot)
+    if lib.zmpt101b_modbus_init(server, snapshot, 1) != 0:
+        raise RuntimeError('zmpt101b_modbus_init failed')
+
+    # Pick a free port when none is given
+    port = args.port
+    if port == 0:
+        probe = socket.socket()
+        probe.bind(('127.0.0.1', 0))
+        port = probe.getsockname()[1]
+        probe.close()
+    if lib.zmpt101b_modbus_tcp_start(server, port) != 0:
+        raise RuntimeError('zmpt101b_modbus_tcp_start failed')
+
+    stop = threading.Event()
+    durations = []
+    writer = threading.Thread(target=publisher, args=(lib, snapshot, stop, durations), daemon=True)
+    writer.start()
+
+    def serve():
+        while not stop.is_set():
+            lib.zmpt101b_modbus_tcp_service(server, 10)
+
+    serving = threading.Thread(target=serve, daemon=True)
+    serving.start()
+
+    client = Client('127.0.0.1', port)
+    latencies = []
+    torn = 0
+    failures = []
+    start = time.perf_counter()
+    while time.perf_counter() - start < args.seconds:
+        t0 = time.perf_counter_ns()
+        values = decode_map(client.read_input_registers(0, REGISTER_COUNT))
+        latencies.append(time.perf_counter_ns() - t0)
+        counters = {values[name] for name in ('dips', 'swells', 'interruptions', 'quality', 'clipped', 'gaps',
+                                               'duplicates', 'range_switches', 'timestamp_us')}
+        if len(counters) != 1 or values['thd_centi_pct'] != values['dips'] & 0xFFFF:
+            torn += 1
+
+    # Control register and exceptions
+    client.write_register(REG_CONTROL, CONTROL_RESET_MINMAX)
+    time.sleep(0.05)
+    values = decode_map(client.read_input_registers(0, REGISTER_COUNT))
+    if values['rms_max_mv'] - values['rms_min_mv'] > 999:
+        failures.append('min/max reset')
+    for pdu, code in ((struct.pack('>BHH', 0x04, 31, 2), 0x02), (struct.pack('>BHH', 0x03, 0, 126), 0x03),
+                      (struct.pack('>BHH', 0x06, 0, 1), 0x02), (b'\x01\x00\x00\x00\x01', 0x01)):
+        try:
+            client.request(pdu)
+            failures.append(f'no exception for function {pdu[0]:#04x}')
+        except ModbusError as e:
+            if f'exception {code:#04x}' not in str(e):
+                failures.append(str(e))
+    client.close()
+
+    stop.set()
+    serving.join()
+    writer.join()
+    failures += check_rtu(lib, server)
+    lib.zmpt101b_modbus_tcp_stop(server)
+
+    us = [v / 1000 for v in latencies]
+    publish = [v / 1000 for v in durations]
+    print(f'requests {len(us)} in {args.seconds:.1f} s ({len(us) / args.seconds:.0f}/s), latency us: '
+          f'median {percentile(us, 0.5):.1f}, p99 {percentile(us, 0.99):.1f}, max {max(us):.1f}')
+    print(f'publications {len(publish)}, publish call us: median {percentile(publish, 0.5):.2f}, '
+          f'p99 {percentile(publish, 0.99):.2f}, max {max(publish):.1f}')
+    print(f'torn reads {torn}')
+    for failure in failures:
+        print(f'FAILED: {failure}')
+    ok = torn == 0 and not failures
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    return 0 if ok else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B Modbus TCP client')
+    parser.add_argument('mode', choices=['poll', 'loopback'])
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=None)
+    parser.add_argument('--unit', type=int, default=1)
+    parser.add_argument('--interval', type=float, default=1.0, help='seconds between polls')
+    parser.add_argument('--seconds', type=float, default=3.0, help='loopback duration')
+    args = parser.parse_args()
+    if args.mode == 'poll':
+        args.port = args.port or 502
+        poll(args)
+    else:
+        args.port = args.port or 0
+        raise SystemExit(loopback(args))
+
+
+if __name__ == '__main__':
+    main()
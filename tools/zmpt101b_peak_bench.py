@@ -0,0 +1,196 @@
+# Host comparison of the ZMPT101B peak estimators (components/zmpt101b/zmpt101b_measurement.h).
+#
+# Usage:
+#   python zmpt101b_peak_bench.py [--windows 300] [--seed 1]
+#       build the spike rejection and the block analysis for the host and estimate the peak of
+#       noisy synthetic mains windows, clean and with spikes left in them, four ways: the larger
+#       of the window's extremes after the median filter, the way the component used to, the same
+#       extremes unfiltered, and the trimmed mean of the half cycle peaks unfiltered and after the
+#       slew-rate test; reports bias, standard deviation and worst error of each against the true
+#       peak, checks the half cycle peaks hold up where the extremes don't, and measures the cost
+#       per sample of each path
+
+import argparse
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h, zmpt101b_despike.h and zmpt101b_measurement.h
+SAMPLING_FREQ = 25000
+WINDOW = 1024
+MAINS_PER_SENSOR = 1000
+MEDIAN_WINDOW = 11
+THRESHOLD = 40
+LOG = 4
+NONE, MEDIAN, SLEW = -1, 0, 2
+
+HARMONICS = [(1, 1.0, 0.0), (3, 0.05, 0.7), (5, 0.03, -1.9)]   # order, relative amplitude, phase
+BIAS = 1650                                                     # mV at the sensor output
+PEAK = 325                                                      # mV of the fundamental, 230 V mains
+
+# label, filter, whether the estimate is the half cycle peak
+ESTIMATORS = [
+    ('extremes after the median', MEDIAN, False),
+    ('extremes unfiltered', NONE, False),
+    ('half cycle peaks unfiltered', NONE, True),
+    ('half cycle peaks after the slew-rate test', SLEW, True),
+]
+
+
+class Config(ctypes.Structure):
+    _fields_ = [('mode', ctypes.c_int), ('median_window', ctypes.c_uint8), ('threshold', ctypes.c_uint16)]
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [('rejected', ctypes.c_uint32), ('largest', ctypes.c_uint16), ('logged', ctypes.c_uint8),
+                ('index', ctypes.c_uint16 * LOG)]
+
+
+class Measurement(ctypes.Structure):
+    _fields_ = [('rms_mv', ctypes.c_int32), ('frequency_mhz', ctypes.c_uint32), ('min_mv', ctypes.c_int32),
+                ('max_mv', ctypes.c_int32), ('peak_mv', ctypes.c_int32), ('dc_offset_mv', ctypes.c_int32),
+                ('crest_factor_milli', ctypes.c_uint16), ('half_cycles', ctypes.c_uint16),
+                ('sample_count', ctypes.c_uint32), ('timestamp_us', ctypes.c_int64), ('quality', ctypes.c_uint32)]
+
+
+def load_peak_library():
+    """
+    Builds the spike rejection and the block analysis for the host, with the esp_err.h shim from tools/host.
+    """
+    names = ('zmpt101b_despike', 'zmpt101b_measurement', 'zmpt101b_fixed')
+    lib = build_library('zmpt101b_peak', [name + '.c' for name in names], [name + '.h' for name in names])
+    lib.zmpt101b_despike.argtypes = [ctypes.POINTER(Config), ctypes.POINTER(ctypes.c_uint16), ctypes.c_size_t,
+                                     ctypes.POINTER(ctypes.c_uint16), ctypes.POINTER(ctypes.c_uint16), ctypes.POINTER(Stats)]
+    lib.zmpt101b_despike.restype = ctypes.c_int
+    lib.zmpt101b_measurement_compute.argtypes = [ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t, ctypes.c_uint32,
+                                                 ctypes.c_int32]
+    lib.zmpt101b_measurement_compute.restype = Measurement
+    return lib
+
+
+class Path:
+    """
+    Filter and measurement of one window, the way measure_window() in zmpt101b.c runs them,
+    on buffers allocated once.
+    """
+    def __init__(self, lib, mode, length):
+        self.lib = lib
+        self.mode = mode
+        self.length = length
+        self.config = Config(max(mode, 0), MEDIAN_WINDOW, THRESHOLD)
+        self.data = (ctypes.c_uint16 * length)()
+        self.low, self.high, self.stats = ctypes.c_uint16(), ctypes.c_uint16(), Stats()
+
+    def run(self, source, level):
+        ctypes.memmove(self.data, source, ctypes.sizeof(self.data))
+        if self.mode != NONE:
+            self.lib.zmpt101b_despike(ctypes.byref(self.config), self.data, self.length, ctypes.byref(self.low),
+                                      ctypes.byref(self.high), ctypes.byref(self.stats))
+        window = ctypes.cast(self.data, ctypes.POINTER(ctypes.c_int16))
+        return self.lib.zmpt101b_measurement_compute(window, self.length, SAMPLING_FREQ, level)
+
+
+def true_peak():
+    cycle = [sum(PEAK * r * math.sin(h * 2 * math.pi * k / 4096 + p) for h, r, p in HARMONICS) for k in range(4096)]
+    return max(max(cycle), -min(cycle)) * MAINS_PER_SENSOR
+
+
+def window(rng, length, noise, spikes):
+    """
+    Sensor output in mV with ADC noise and `spikes` impulses of 1 or 2 samples, 50 to 600 mV
+    either way, and its mean, the crossing level zmpt101b.c uses.
+    """
+    phase = rng.uniform(0, 2 * math.pi)
+    frequency = rng.uniform(49.5, 50.5)
+    samples = [BIAS + sum(PEAK * r * math.sin(h * (2 * math.pi * frequency * n / SAMPLING_FREQ + phase) + p)
+                          for h, r, p in HARMONICS) + rng.gauss(0, noise) for n in range(length)]
+    for _ in range(spikes):
+        start = rng.randrange(length - 2)
+        height = rng.choice((-1, 1)) * rng.uniform(50, 600)
+        for n in range(start, start + rng.randint(1, 2)):
+            samples[n] += height
+    samples = [max(0, int(round(s))) for s in samples]
+    return (ctypes.c_uint16 * length)(*samples), sum(samples) // length
+
+
+def run(lib, name, length, windows, rng, noise, spikes):
+    """
+    Returns the standard deviation of the error of each estimator in mains mV.
+    """
+    truth = true_peak()
+    paths = [Path(lib, mode, length) for _, mode, _ in ESTIMATORS]
+    errors = [[] for _ in ESTIMATORS]
+    for _ in range(windows):
+        source, level = window(rng, length, noise, spikes)
+        for (_, _, robust), path, e in zip(ESTIMATORS, paths, errors):
+            m = path.run(source, level)
+            e.append((m.peak_mv if robust else max(m.max_mv, -m.min_mv)) - truth)
+    print(f'{name}: {windows} windows of {length} samples, noise {noise} mV, {spikes} spikes per window')
+    deviations = []
+    for (label, _, _), e in zip(ESTIMATORS, errors):
+        mean = sum(e) / len(e)
+        deviation = math.sqrt(sum((x - mean) ** 2 for x in e) / len(e))
+        deviations.append(deviation)
+        print(f'  {label}: bias {mean / 1000:+.2f} V, standard deviation {deviation / 1000:.2f} V, '
+              f'worst {max(abs(x) for x in e) / 1000:.2f} V')
+    return deviations
+
+
+def benchmark(lib, rng):
+    """
+    Cost per sample of each path on the host, the copy of the window included. The block
+    analysis gathers the extremes and the half cycle peaks in the same pass, so the paths differ
+    by their filter only.
+    """
+    source, level = window(rng, WINDOW, 2.0, 2)
+    costs = []
+    paths = [('median and block analysis', MEDIAN), ('block analysis alone', NONE),
+             ('slew-rate test and block analysis', SLEW)]
+    for label, mode in paths:
+        path = Path(lib, mode, WINDOW)
+        repeat = 200 if mode == MEDIAN else 2000
+        best = float('inf')
+        for _ in range(5):
+            start = time.perf_counter()
+            for _ in range(repeat):
+                path.run(source, level)
+            best = min(best, time.perf_counter() - start)
+        costs.append(best / repeat / WINDOW * 1e9)
+    print('host cost: ' + ', '.join(f'{label} {cost:.1f} ns' for (label, _), cost in zip(paths, costs))
+          + ' per sample, ctypes calls included')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B peak estimator comparison')
+    parser.add_argument('--windows', type=int, default=300)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_peak_library()
+    rng = random.Random(args.seed)
+
+    ok = True
+    for length in (WINDOW, 5000):
+        # Without spikes the half cycle peaks average the noise down where the extremes take its maximum
+        clean = run(lib, 'noise only', length, args.windows, rng, 2.0, 0)
+        if clean[2] > clean[1]:
+            print('  FAILED: the half cycle peaks vary more than the extremes')
+            ok = False
+        # With a spike left in the window the unfiltered extremes follow it, the half cycle peaks
+        # need one in most half cycles to move. A spike can also add or hide a crossing, though,
+        # and splits a half cycle of a two-cycle window badly enough that the slew-rate test is
+        # still needed there; from ten cycles on the half cycle peaks hold up on their own
+        spiked = run(lib, 'residual spikes', length, args.windows, rng, 2.0, 1)
+        if spiked[2] * 4 > spiked[1] or spiked[3] > 2 * clean[3] + 1000 or \
+                (length > WINDOW and spiked[2] > 2 * clean[2] + 1000):
+            print('  FAILED: the half cycle peaks follow the spikes')
+            ok = False
+    benchmark(lib, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,330 @@
+# Host test of the ZMPT101B protection stage (components/zmpt101b/zmpt101b_protection.h).
+#
+# Usage:
+#   python zmpt101b_protection_sim.py [--seed 1]
+#       build the stage for the host and run scripted frequency and voltage excursions through it
+#       in DMA-sized blocks: sags, swells, frequency steps and ramps, an islanding ROCOF, loss of
+#       mains, and disturbances it must ride through (short dips, a phase jump, gaps in the
+#       stream followed by a reset). Checks which element trips, that it trips no earlier than
+#       its delay and no later than the delay plus the detection bound, that the callback fires
+#       once, and the latency and evaluation time the stage measures itself
+
+import argparse
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+from zmpt101b_phasor_sim import Phasor, Estimator
+
+# Must match zmpt101b.h, zmpt101b_phasor.h and zmpt101b_protection.h
+SAMPLING_FREQ = 25000
+MAX_ELEMENTS = 8
+ROCOF_CYCLES = 5
+VOLTAGE_HALF_CYCLES = 3
+FREQUENCY_HALF_CYCLES = 4
+ROCOF_HALF_CYCLES = 2 * ROCOF_CYCLES + 4
+UNDER_FREQUENCY, OVER_FREQUENCY, ROCOF, UNDER_VOLTAGE, OVER_VOLTAGE = range(5)
+QUANTITY_NAMES = ['f<', 'f>', 'ROCOF', 'U<', 'U>']
+
+NOMINAL = 50
+BIAS_MV = 1650
+UN = 230.0      # nominal RMS in input units, mV at the sensor
+HARMONICS = [(3, 0.04, 0.7), (5, 0.03, -1.9), (7, 0.01, 2.4)]     # order, fraction of the fundamental, phase
+NOISE_MV = 2.0
+BLOCK_MAX = 512
+
+# Interface protection settings in the style of a grid code; use what the network operator prescribes
+ELEMENTS = [  # quantity, threshold, hysteresis, delay ms
+    (UNDER_VOLTAGE, 0.85 * UN, 0.02 * UN, 1500),
+    (UNDER_VOLTAGE, 0.45 * UN, 0.02 * UN, 160),
+    (OVER_VOLTAGE, 1.10 * UN, 0.02 * UN, 1000),
+    (OVER_VOLTAGE, 1.20 * UN, 0.02 * UN, 160),
+    (UNDER_FREQUENCY, 47.5, 0.05, 100),
+    (OVER_FREQUENCY, 51.5, 0.05, 100),
+    (ROCOF, 1.0, 0.1, 200),
+]
+
+
+class Element(ctypes.Structure):
+    _fields_ = [('quantity', ctypes.c_int), ('threshold', ctypes.c_float), ('hysteresis', ctypes.c_float),
+                ('delay_ms', ctypes.c_uint32)]
+
+
+class Trip(ctypes.Structure):
+    _fields_ = [('sample', ctypes.c_uint64), ('pickup_sample', ctypes.c_uint64), ('element', ctypes.c_uint8),
+                ('quantity', ctypes.c_int), ('value', ctypes.c_float), ('phasor', Phasor),
+                ('sample_time_us', ctypes.c_int64), ('output_us', ctypes.c_int64)]
+
+
+TRIP_CALLBACK = ctypes.CFUNCTYPE(None, ctypes.POINTER(Trip), ctypes.c_void_p)
+
+
+class Config(ctypes.Structure):
+    _fields_ = [('sample_rate', ctypes.c_uint32), ('nominal_freq', ctypes.c_uint16),
+                ('elements', Element * MAX_ELEMENTS), ('element_count', ctypes.c_uint8),
+                ('block_voltage', ctypes.c_float), ('trip_gpio', ctypes.c_int32), ('trip_level', ctypes.c_uint8),
+                ('on_trip', TRIP_CALLBACK), ('arg', ctypes.c_void_p), ('deadline_us', ctypes.c_uint32)]
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [('evaluations', ctypes.c_uint32), ('blocked', ctypes.c_uint32), ('eval_ns_last', ctypes.c_uint32),
+                ('eval_ns_max', ctypes.c_uint32), ('latency_us_last', ctypes.c_uint32), ('latency_us_max', ctypes.c_uint32),
+                ('deadline_misses', ctypes.c_uint32), ('trips', ctypes.c_uint32)]
+
+
+class Protection(ctypes.Structure):
+    _fields_ = [('config', Config), ('phasor', Estimator), ('delay_samples', ctypes.c_uint32 * MAX_ELEMENTS),
+                ('pickup_sample', ctypes.c_uint64 * MAX_ELEMENTS), ('picked', ctypes.c_uint8), ('tripped', ctypes.c_bool),
+                ('trip', Trip), ('stats', Stats)]
+
+
+class BlockTime(ctypes.Structure):
+    _fields_ = [('first_sample', ctypes.c_uint64), ('count', ctypes.c_uint32), ('stream', ctypes.c_uint32),
+                ('time_us', ctypes.c_int64), ('wall_us', ctypes.c_int64), ('period_ps', ctypes.c_uint32),
+                ('locked', ctypes.c_bool)]
+
+
+def load_protection_library():
+    """
+    Builds the stage and the phasor estimator for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_protection', ['zmpt101b_protection.c', 'zmpt101b_phasor.c'],
+                        ['zmpt101b_protection.h', 'zmpt101b_phasor.h'], ['-lm'])
+    lib.zmpt101b_protection_init.argtypes = [ctypes.POINTER(Protection), ctypes.POINTER(Config)]
+    lib.zmpt101b_protection_reset.argtypes = [ctypes.POINTER(Protection)]
+    lib.zmpt101b_protection_process.argtypes = [ctypes.POINTER(Protection), ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t,
+                                                ctypes.POINTER(BlockTime)]
+    lib.zmpt101b_protection_process.restype = ctypes.c_size_t
+    lib.zmpt101b_protection_get_trip.argtypes = [ctypes.POINTER(Protection), ctypes.POINTER(Trip)]
+    lib.zmpt101b_protection_rearm.argtypes = [ctypes.POINTER(Protection)]
+    lib.zmpt101b_protection_get_stats.argtypes = [ctypes.POINTER(Protection), ctypes.POINTER(Stats)]
+    return lib
+
+
+def synthesize(script, seconds, rng):
+    """
+    Samples of a mains waveform following script(t) -> (frequency Hz, RMS of the fundamental,
+    phase offset radians), with harmonics and ADC noise, rounded to whole millivolts.
+    """
+    samples = []
+    phase = 0.0
+    for n in range(int(seconds * SAMPLING_FREQ)):
+        frequency, rms, offset = script(n / SAMPLING_FREQ)
+        peak = rms * math.sqrt(2)
+        at = 2 * math.pi * phase + offset
+        value = BIAS_MV + peak * (math.sin(at) + sum(a * math.sin(h * at + p) for h, a, p in HARMONICS))
+        value += rng.gauss(0, NOISE_MV)
+        samples.append(int(round(value)))
+        phase += frequency / SAMPLING_FREQ
+    return samples
+
+
+def make_config(callback, deadline_us=0, elements=ELEMENTS):
+    config = Config()
+    config.sample_rate = SAMPLING_FREQ
+    config.nominal_freq = NOMINAL
+    for e, (quantity, threshold, hysteresis, delay_ms) in enumerate(elements):
+        config.elements[e] = Element(quantity, threshold, hysteresis, delay_ms)
+    config.element_count = len(elements)
+    config.block_voltage = 0.2 * UN
+    config.trip_gpio = -1
+    config.trip_level = 1
+    config.on_trip = callback
+    config.deadline_us = deadline_us
+    return config
+
+
+def feed(lib, pr, samples, rng, timed=False):
+    """
+    Feeds the samples in blocks of random length. With `timed`, every block carries a block time
+    as if it had just been read: its last sample was taken a sample period ago.
+    """
+    i = 0
+    while i < len(samples):
+        n = min(len(samples) - i, rng.randint(1, BLOCK_MAX))
+        block = (ctypes.c_int16 * n)(*samples[i:i + n])
+        block_time = None
+        if timed:
+            now_us = time.monotonic_ns() // 1000
+            block_time = ctypes.byref(BlockTime(i, n, 0, now_us - n * 1000000 // SAMPLING_FREQ, 0,
+                                                1000000000000 // SAMPLING_FREQ, True))
+        lib.zmpt101b_protection_process(ctypes.byref(pr), block, n, block_time)
+        i += n
+
+
+def run(lib, rng, name, script, seconds, expected=None, onset_s=0.0, early_ms=0):
+    """
+    Runs one excursion. `expected` is the index of the element that must trip first, timed from
+    `onset_s`, when the true quantity crosses its threshold; None if nothing may trip. On a slow
+    ramp the noise of the measurement makes the crossing uncertain by `early_ms`.
+    """
+    calls = []
+
+    def on_trip(trip, arg):
+        calls.append(Trip.from_buffer_copy(trip.contents))
+    callback = TRIP_CALLBACK(on_trip)
+
+    pr = Protection()
+    config = make_config(callback)
+    if lib.zmpt101b_protection_init(ctypes.byref(pr), ctypes.byref(config)) != 0:
+        raise RuntimeError('zmpt101b_protection_init failed')
+    feed(lib, pr, synthesize(script, seconds, rng), rng)
+
+    trip = Trip()
+    tripped = lib.zmpt101b_protection_get_trip(ctypes.byref(pr), ctypes.byref(trip)) == 0
+    stats = Stats()
+    lib.zmpt101b_protection_get_stats(ctypes.byref(pr), ctypes.byref(stats))
+    if len(calls) != (1 if tripped else 0) or (tripped and calls[0].sample != trip.sample):
+        print(f'{name}: FAILED: {len(calls)} callbacks for {"a" if tripped else "no"} trip')
+        return False
+
+    if expected is None:
+        if tripped:
+            print(f'{name}: FAILED: {QUANTITY_NAMES[trip.quantity]} (element {trip.element}) tripped at '
+                  f'{trip.sample / SAMPLING_FREQ:.3f} s on {trip.value:.3f}')
+            return False
+        print(f'{name}: no trip over {stats.evaluations} evaluations, {stats.blocked} with f and ROCOF blocked')
+        return True
+
+    quantity, _, _, delay_ms = ELEMENTS[expected]
+    if not tripped:
+        print(f'{name}: FAILED: no trip, expected {QUANTITY_NAMES[quantity]} (element {expected})')
+        return False
+    bound = {UNDER_VOLTAGE: VOLTAGE_HALF_CYCLES, OVER_VOLTAGE: VOLTAGE_HALF_CYCLES, UNDER_FREQUENCY: FREQUENCY_HALF_CYCLES,
+             OVER_FREQUENCY: FREQUENCY_HALF_CYCLES, ROCOF: ROCOF_HALF_CYCLES}[quantity]
+    latency_ms = (trip.sample - round(onset_s * SAMPLING_FREQ)) * 1000 / SAMPLING_FREQ
+    detection_ms = latency_ms - delay_ms
+    limit_ms = bound * 500 / NOMINAL
+    print(f'{name}: {QUANTITY_NAMES[trip.quantity]} (element {trip.element}) tripped on {trip.value:.3f} '
+          f'{latency_ms:.1f} ms after the onset, {detection_ms:.1f} ms beyond the {delay_ms} ms delay '
+          f'(bound {limit_ms:.0f} ms)')
+    if trip.element != expected:
+        print(f'  FAILED: expected element {expected}')
+        return False
+    if detection_ms < -early_ms or detection_ms > limit_ms:
+        print(f'  FAILED: trip outside delay .. delay + {limit_ms:.0f} ms')
+        return False
+    return True
+
+
+def run_rearm(lib, rng):
+    """
+    Trip on a sag, rearm once the voltage is back, and nothing may trip again.
+    """
+    pr = Protection()
+    config = make_config(TRIP_CALLBACK(lambda trip, arg: None))
+    lib.zmpt101b_protection_init(ctypes.byref(pr), ctypes.byref(config))
+    feed(lib, pr, synthesize(lambda t: (50.0, 0.3 * UN if 0.5 <= t < 1.0 else UN, 0.0), 1.5, rng), rng)
+    first = Trip()
+    if lib.zmpt101b_protection_get_trip(ctypes.byref(pr), ctypes.byref(first)) != 0:
+        print('rearm: FAILED: no trip on the sag')
+        return False
+    lib.zmpt101b_protection_rearm(ctypes.byref(pr))
+    feed(lib, pr, synthesize(lambda t: (50.0, UN, 0.0), 3.0, rng), rng)
+    stats = Stats()
+    lib.zmpt101b_protection_get_stats(ctypes.byref(pr), ctypes.byref(stats))
+    if lib.zmpt101b_protection_get_trip(ctypes.byref(pr), ctypes.byref(Trip())) == 0 or stats.trips != 1:
+        print(f'rearm: FAILED: {stats.trips} trips, tripped again after rearming')
+        return False
+    print(f'rearm: tripped once on the sag at {first.sample / SAMPLING_FREQ:.3f} s, quiet for 3 s after rearming')
+    return True
+
+
+def run_gaps(lib, rng, seconds):
+    """
+    Healthy mains with gaps in the stream, each followed by a reset as the example does on
+    ZMPT101B_QUALITY_GAP and read errors. With an instantaneous over-voltage element added, a
+    phasor taken over a window not yet refilled would trip it.
+    """
+    calls = []
+    callback = TRIP_CALLBACK(lambda trip, arg: calls.append(trip.contents.element))
+    pr = Protection()
+    config = make_config(callback, elements=ELEMENTS + [(OVER_VOLTAGE, 1.15 * UN, 0.02 * UN, 0)])
+    lib.zmpt101b_protection_init(ctypes.byref(pr), ctypes.byref(config))
+    samples = synthesize(lambda t: (50.0, UN, 0.0), seconds, rng)
+    gaps = 0
+    i = 0
+    while i < len(samples):
+        n = min(len(samples) - i, rng.randint(BLOCK_MAX // 2, BLOCK_MAX))
+        block = (ctypes.c_int16 * n)(*samples[i:i + n])
+        lib.zmpt101b_protection_process(ctypes.byref(pr), block, n, None)
+        i += n
+        if rng.random() < 0.2:
+            # Blocks lost at some point of the cycle
+            i += rng.randint(1, 4 * BLOCK_MAX)
+            lib.zmpt101b_protection_reset(ctypes.byref(pr))
+            gaps += 1
+    stats = Stats()
+    lib.zmpt101b_protection_get_stats(ctypes.byref(pr), ctypes.byref(stats))
+    if calls or lib.zmpt101b_protection_get_trip(ctypes.byref(pr), ctypes.byref(Trip())) == 0:
+        print(f'gaps: FAILED: element {calls[0] if calls else "?"} tripped on healthy mains after {gaps} gaps')
+        return False
+    print(f'gaps: {gaps} gaps and resets in {seconds} s of healthy mains, no trip over {stats.evaluations} evaluations')
+    return True
+
+
+def run_latency(lib, rng, seconds):
+    """
+    Feeds blocks with their block time, as on the device, and checks the latency the stage
+    measures: at most the block length plus scheduling slack, since every decision comes out
+    while its block is processed.
+    """
+    block_us = BLOCK_MAX * 1000000 // SAMPLING_FREQ
+    slack_us = 5000
+    pr = Protection()
+    config = make_config(TRIP_CALLBACK(lambda trip, arg: None), deadline_us=block_us + slack_us)
+    lib.zmpt101b_protection_init(ctypes.byref(pr), ctypes.byref(config))
+    feed(lib, pr, synthesize(lambda t: (50.0 + 0.5 * math.sin(t), UN, 0.0), seconds, rng), rng, timed=True)
+    stats = Stats()
+    lib.zmpt101b_protection_get_stats(ctypes.byref(pr), ctypes.byref(stats))
+    print(f'latency: {stats.evaluations} evaluations, decision up to {stats.latency_us_max} us after the last sample '
+          f'(blocks up to {block_us} us), {stats.deadline_misses} over {config.deadline_us} us; '
+          f'evaluation up to {stats.eval_ns_max} ns')
+    if stats.evaluations == 0 or stats.deadline_misses:
+        print('  FAILED: decisions past the deadline')
+        return False
+    return True
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B protection stage test')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_protection_library()
+    rng = random.Random(args.seed)
+
+    def step(at, before, after):
+        return lambda t: after if t >= at else before
+
+    scenarios = [  # name, script(t) -> (Hz, RMS, phase offset), seconds, element expected to trip, onset s[, early ms]
+        ('steady 50 Hz', lambda t: (50.0, UN, 0.0), 10, None, 0),
+        ('49.9 Hz, 10 degree phase jump', lambda t: (49.9, UN, math.radians(10) if t >= 1.0 else 0.0), 3, None, 0),
+        ('dip to 30 % for 100 ms', lambda t: (50.0, 0.3 * UN if 1.0 <= t < 1.1 else UN, 0.0), 3, None, 0),
+        ('sag to 80 % for 1 s', lambda t: (50.0, 0.8 * UN if 1.0 <= t < 2.0 else UN, 0.0), 4, None, 0),
+        ('frequency 51.6 Hz for 60 ms', lambda t: (51.6 if 1.0 <= t < 1.06 else 50.0, UN, 0.0), 3, None, 0),
+        ('sag to 40 %', lambda t: (50.0, step(1.0, UN, 0.4 * UN)(t), 0.0), 2, 1, 1.0),
+        ('sag to 80 % for 1 s, again from 3 s', lambda t: (50.0, 0.8 * UN if 1.0 <= t < 2.0 or t >= 3.0 else UN, 0.0),
+         5.5, 0, 3.0),
+        ('swell to 112 %', lambda t: (50.0, step(1.0, UN, 1.12 * UN)(t), 0.0), 3, 2, 1.0),
+        ('swell to 125 %', lambda t: (50.0, step(1.0, UN, 1.25 * UN)(t), 0.0), 2, 3, 1.0),
+        ('frequency step to 52 Hz', lambda t: (step(1.0, 50.0, 52.0)(t), UN, 0.0), 2, 5, 1.0),
+        ('frequency step to 47 Hz', lambda t: (step(1.0, 50.0, 47.0)(t), UN, 0.0), 2, 4, 1.0),
+        # About 10 mHz rms of frequency noise is 20 ms of the ramp
+        ('ramp down at 0.5 Hz/s', lambda t: (50.0 - 0.5 * max(t - 1.0, 0), UN, 0.0), 7, 4, 6.0, 20),
+        ('islanding, ramp up at 2 Hz/s', lambda t: (50.0 + 2.0 * max(t - 1.0, 0), UN, 0.0), 2, 6, 1.0),
+        ('loss of mains', lambda t: (50.0, step(1.0, UN, 0.0)(t), 0.0), 2, 1, 1.0),
+    ]
+    ok = True
+    for name, script, seconds, expected, onset, *early in scenarios:
+        ok &= run(lib, rng, name, script, seconds, expected, onset, *early)
+    ok &= run_rearm(lib, rng)
+    ok &= run_gaps(lib, rng, 10)
+    ok &= run_latency(lib, rng, 5)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,223 @@
+# Host test of the ZMPT101B cycle-synchronous resampler (components/zmpt101b/zmpt101b_resample.h).
+#
+# Usage:
+#   python zmpt101b_resample_sim.py [--seconds 10] [--seed 1]
+#       build the resampler for the host and feed it analytic mains waveforms with harmonics, off
+#       nominal, ramping and stepping in frequency, in blocks of random length; checks that every
+#       run of N output samples is one cycle by comparing the output with the analytic waveform,
+#       that block boundaries don't change the output, and measures the cost per sample
+
+import argparse
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h and zmpt101b_duty.h
+SAMPLING_FREQ = 25000
+ZC_HYSTERESIS_MV = 20
+
+BIAS_MV = 1650
+HARMONICS = [(1, 325.0, 0.0), (3, 16.0, 0.7), (5, 9.0, -1.9), (7, 3.0, 2.4), (11, 1.5, 0.3)]   # order, peak mV, phase
+CYCLES_PER_CHECK = 10
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [('inputs', ctypes.c_uint64), ('outputs', ctypes.c_uint64), ('cycles', ctypes.c_uint32),
+                ('rejected', ctypes.c_uint32), ('dropped', ctypes.c_uint32), ('frequency_mhz', ctypes.c_uint32)]
+
+
+def load_resample_library():
+    """
+    Builds the resampler for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_resample', ['zmpt101b_resample.c', 'zmpt101b_zerocross.c'],
+                        ['zmpt101b_resample.h', 'zmpt101b_zerocross.h'])
+    lib.zmpt101b_resample_init.argtypes = [ctypes.c_void_p, ctypes.c_uint16, ctypes.c_uint32, ctypes.c_uint16, ctypes.c_int32]
+    lib.zmpt101b_resample_reset.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_resample_process.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t,
+                                              ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t]
+    lib.zmpt101b_resample_process.restype = ctypes.c_size_t
+    lib.zmpt101b_resample_max_output.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+    lib.zmpt101b_resample_max_output.restype = ctypes.c_size_t
+    lib.zmpt101b_resample_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(Stats)]
+    return lib
+
+
+def waveform(phase):
+    """
+    Sensor output in mV at a fundamental phase in cycles.
+    """
+    return BIAS_MV + sum(a * math.sin(2 * math.pi * h * phase + p) for h, a, p in HARMONICS)
+
+
+def synthesize(profile, seconds, rng, noise_mv):
+    """
+    Samples the waveform at SAMPLING_FREQ with the fundamental frequency following profile(t),
+    rounded to whole millivolts as zmpt101b_read_samples() delivers them.
+    """
+    samples = []
+    phase = 0.0
+    for n in range(int(seconds * SAMPLING_FREQ)):
+        samples.append(int(round(waveform(phase) + (rng.gauss(0, noise_mv) if noise_mv else 0))))
+        phase += profile(n / SAMPLING_FREQ) / SAMPLING_FREQ
+    return samples
+
+
+def resample(lib, samples, samples_per_cycle, nominal, rng, block_max):
+    rs = ctypes.create_string_buffer(512)
+    if lib.zmpt101b_resample_init(rs, samples_per_cycle, SAMPLING_FREQ, nominal, ZC_HYSTERESIS_MV) != 0:
+        raise RuntimeError('zmpt101b_resample_init failed')
+    out = []
+    i = 0
+    while i < len(samples):
+        n = min(len(samples) - i, rng.randint(1, block_max))
+        block = (ctypes.c_int16 * n)(*samples[i:i + n])
+        capacity = lib.zmpt101b_resample_max_output(rs, n)
+        buffer = (ctypes.c_int16 * capacity)()
+        count = lib.zmpt101b_resample_process(rs, block, n, buffer, capacity)
+        out.extend(buffer[:count])
+        i += n
+    stats = Stats()
+    lib.zmpt101b_resample_get_stats(rs, ctypes.byref(stats))
+    return out, stats
+
+
+def harmonic_fit(block, cycles):
+    """
+    DC and harmonic phasors of a block assumed to hold a whole number of cycles, and the worst and
+    the RMS deviation of the block from the waveform they describe.
+    """
+    n = len(block)
+    dc = sum(block) / n
+    phasors = {}
+    for h, _, _ in HARMONICS:
+        k = h * cycles
+        re = sum(v * math.cos(2 * math.pi * k * i / n) for i, v in enumerate(block)) * 2 / n
+        im = sum(v * math.sin(2 * math.pi * k * i / n) for i, v in enumerate(block)) * 2 / n
+        phasors[h] = (re, im)
+    worst = 0.0
+    square = 0.0
+    for i, v in enumerate(block):
+        model = dc + sum(re * math.cos(2 * math.pi * h * cycles * i / n) + im * math.sin(2 * math.pi * h * cycles * i / n)
+                         for h, (re, im) in phasors.items())
+        worst = max(worst, abs(v - model))
+        square += (v - model) ** 2
+    return phasors, worst, math.sqrt(square / n)
+
+
+def check_blocks(samples, block_len, cycles, skip_blocks):
+    """
+    Fits consecutive blocks and compares each with the analytic waveform: the harmonic amplitudes
+    and their phases relative to the fundamental must match, and nothing else may be left.
+    """
+    worst_residual = 0.0
+    worst_rms = 0.0
+    worst_amplitude = 0.0
+    worst_phase = 0.0
+    blocks = 0
+    for start in range(skip_blocks * block_len, len(samples) - block_len + 1, block_len):
+        phasors, residual, rms = harmonic_fit(samples[start:start + block_len], cycles)
+        fundamental = math.atan2(phasors[1][0], phasors[1][1])
+        for h, amplitude, phase in HARMONICS:
+            re, im = phasors[h]
+            worst_amplitude = max(worst_amplitude, abs(math.hypot(re, im) - amplitude))
+            relative = math.atan2(re, im) - h * fundamental
+            error = (relative - phase + math.pi) % (2 * math.pi) - math.pi
+            worst_phase = max(worst_phase, abs(error) * amplitude / HARMONICS[0][1])
+        worst_residual = max(worst_residual, residual)
+        worst_rms = max(worst_rms, rms)
+        blocks += 1
+    return worst_residual, worst_rms, worst_amplitude, worst_phase, blocks
+
+
+def run(lib, name, samples_per_cycle, nominal, profile, seconds, rng, noise_mv, limit_mv):
+    samples = synthesize(profile, seconds, rng, noise_mv)
+    out, stats = resample(lib, samples, samples_per_cycle, nominal, rng, 1024)
+    # Same input in one block per call of 1..7 samples: block boundaries must not matter
+    out_small, _ = resample(lib, samples[:SAMPLING_FREQ], samples_per_cycle, nominal, rng, 7)
+    block_invariant = out_small == out[:len(out_small)]
+
+    # Blocks of CYCLES_PER_CHECK cycles skipped while the crossing detector's DC estimate settles
+    settle = 5
+    residual, rms, amplitude, phase, blocks = check_blocks(out, samples_per_cycle * CYCLES_PER_CHECK, CYCLES_PER_CHECK, settle)
+    # The same analysis on the raw stream, assuming the nominal frequency
+    raw_block = SAMPLING_FREQ * CYCLES_PER_CHECK // nominal
+    raw_residual, _, raw_amplitude, _, _ = check_blocks(samples, raw_block, CYCLES_PER_CHECK, settle)
+
+    print(f'{name}: {stats.inputs} in, {stats.outputs} out, {stats.cycles} cycles, {stats.rejected} rejected, '
+          f'{stats.dropped} dropped, last frequency {stats.frequency_mhz / 1000:.3f} Hz')
+    print(f'  {blocks} blocks of {CYCLES_PER_CHECK} cycles: deviation from the analytic waveform max {residual:.2f} mV, '
+          f'rms {rms:.2f} mV; harmonic amplitude error max {amplitude:.2f} mV, phase error max {phase:.2f} mV '
+          f'(raw stream at nominal: deviation {raw_residual:.1f} mV, amplitude error {raw_amplitude:.1f} mV)')
+    ok = True
+    # With ADC noise only the RMS deviation says something: the noise itself has large peaks
+    deviation = rms if noise_mv else residual
+    if deviation > limit_mv or amplitude > limit_mv or phase > limit_mv:
+        print(f'  FAILED: error above {limit_mv} mV')
+        ok = False
+    if not block_invariant:
+        print('  FAILED: output depends on the block boundaries')
+        ok = False
+    if stats.dropped:
+        print('  FAILED: zmpt101b_resample_max_output() was too small')
+        ok = False
+    return ok
+
+
+def benchmark(lib, samples_per_cycle):
+    """
+    Cost per input sample on the host, in ns and in cycles of the nominal clock.
+    """
+    rs = ctypes.create_string_buffer(512)
+    lib.zmpt101b_resample_init(rs, samples_per_cycle, SAMPLING_FREQ, 50, ZC_HYSTERESIS_MV)
+    n = SAMPLING_FREQ * 40
+    block = (ctypes.c_int16 * n)(*[int(waveform(i * 50.2 / SAMPLING_FREQ)) for i in range(n)])
+    capacity = lib.zmpt101b_resample_max_output(rs, n)
+    buffer = (ctypes.c_int16 * capacity)()
+    best = float('inf')
+    for _ in range(5):
+        start = time.perf_counter()
+        lib.zmpt101b_resample_process(rs, block, n, buffer, capacity)
+        best = min(best, time.perf_counter() - start)
+    ns = best / n * 1e9
+    mhz = None
+    try:
+        with open('/proc/cpuinfo') as cpuinfo:
+            mhz = next(float(line.split(':')[1]) for line in cpuinfo if line.startswith('cpu MHz'))
+    except (OSError, StopIteration, ValueError):
+        pass
+    cycles = f', ~{ns * mhz / 1000:.0f} cycles at {mhz:.0f} MHz' if mhz else ''
+    print(f'host cost, {samples_per_cycle}/cycle: {ns:.1f} ns per input sample{cycles}')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B cycle-synchronous resampler test')
+    parser.add_argument('--seconds', type=float, default=10)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_resample_library()
+    rng = random.Random(args.seed)
+
+    # Input and output are whole millivolts, which alone allows up to ~1.6 mV of deviation (the
+    # cubic weighs four rounded inputs); the rest is interpolation and the cycle length lagging a ramp
+    scenarios = [  # name, N, nominal Hz, frequency profile, ADC noise mV, limit mV
+        ('512/cycle, 50.000 Hz', 512, 50, lambda t: 50.0, 0, 2.5),
+        ('512/cycle, 49.37 Hz', 512, 50, lambda t: 49.37, 0, 2.5),
+        ('256/cycle, 61.2 Hz on 60 Hz', 256, 60, lambda t: 61.2, 0, 2.5),
+        ('1024/cycle, 50.4 Hz', 1024, 50, lambda t: 50.4, 0, 2.5),
+        ('512/cycle, ramp 0.1 Hz/s', 512, 50, lambda t: 49.5 + 0.1 * t, 0, 4.0),
+        ('512/cycle, 49.8 Hz, 3 mV rms ADC noise', 512, 50, lambda t: 49.8, 3, 3.0),
+    ]
+    ok = True
+    for name, spc, nominal, profile, noise, limit in scenarios:
+        ok &= run(lib, name, spc, nominal, profile, args.seconds, rng, noise, limit)
+    benchmark(lib, 512)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
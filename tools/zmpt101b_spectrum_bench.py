@@ -0,0 +1,229 @@
+# Host test and benchmark of the ZMPT101B Welch spectrum (components/zmpt101b/zmpt101b_spectrum.h).
+#
+# Usage:
+#   python zmpt101b_spectrum_bench.py [--seed 1]
+#       build the spectrum estimator for the host; compare the fixed-point spectrum of single
+#       segments with a direct DFT in double precision, then stream synthetic mains signals with
+#       harmonics, white noise of known density, the quantization of integer millivolts alone and
+#       an interfering tone through it, and check the noise floor, SNR, ENOB and the spur found
+#       against the analytic values; measures the cost per sample for several FFT sizes
+
+import argparse
+import cmath
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h and zmpt101b_spectrum.h
+SAMPLING_FREQ = 25000
+MAX_N = 1024
+
+HARMONICS = [(1, 1.0, 0.0), (3, 0.05, 0.7), (5, 0.03, -1.9), (7, 0.01, 2.4)]   # order, relative amplitude, phase
+PURE = [(1, 1.0, 0.0)]
+BIAS = 1650                                                                     # mV at the sensor output
+
+
+class Config(ctypes.Structure):
+    _fields_ = [('sample_rate', ctypes.c_uint32), ('fft_size', ctypes.c_uint16), ('averages', ctypes.c_uint16),
+                ('nominal_freq', ctypes.c_uint16)]
+
+
+class Result(ctypes.Structure):
+    _fields_ = [('sample', ctypes.c_uint64), ('spectra', ctypes.c_uint32), ('bin_hz', ctypes.c_float),
+                ('signal_hz', ctypes.c_float), ('signal_rms_mv', ctypes.c_float), ('noise_density', ctypes.c_float),
+                ('noise_rms_mv', ctypes.c_float), ('snr_db', ctypes.c_float), ('enob', ctypes.c_float),
+                ('spur_hz', ctypes.c_float), ('spur_dbc', ctypes.c_float)]
+
+
+class Spectrum(ctypes.Structure):
+    _fields_ = [('config', Config), ('log2_size', ctypes.c_uint16), ('index', ctypes.c_uint16),
+                ('due', ctypes.c_uint16), ('segments', ctypes.c_uint16), ('history', ctypes.c_int16 * MAX_N),
+                ('work', ctypes.c_int32 * MAX_N), ('twiddle', ctypes.c_int16 * MAX_N),
+                ('window', ctypes.c_int16 * (MAX_N // 2 + 1)), ('power', ctypes.c_uint64 * (MAX_N // 2 + 1)),
+                ('psd', ctypes.c_float * (MAX_N // 2 + 1)), ('scale', ctypes.c_float), ('samples', ctypes.c_uint64),
+                ('result', Result)]
+
+
+def load_spectrum_library():
+    """
+    Builds the spectrum estimator for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_spectrum', ['zmpt101b_spectrum.c', 'zmpt101b_fixed.c'],
+                        ['zmpt101b_spectrum.h', 'zmpt101b_fixed.h'], ['-lm'])
+    lib.zmpt101b_spectrum_init.argtypes = [ctypes.POINTER(Spectrum), ctypes.POINTER(Config)]
+    lib.zmpt101b_spectrum_init.restype = ctypes.c_int
+    lib.zmpt101b_spectrum_process.argtypes = [ctypes.POINTER(Spectrum), ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t]
+    lib.zmpt101b_spectrum_process.restype = ctypes.c_size_t
+    lib.zmpt101b_spectrum_get.argtypes = [ctypes.POINTER(Spectrum), ctypes.POINTER(Result)]
+    lib.zmpt101b_spectrum_get.restype = ctypes.c_int
+    lib.zmpt101b_spectrum_get_psd.argtypes = [ctypes.POINTER(Spectrum), ctypes.POINTER(ctypes.c_float), ctypes.c_size_t]
+    lib.zmpt101b_spectrum_get_psd.restype = ctypes.c_size_t
+    return lib
+
+
+def estimator(lib, fft_size, averages, nominal=50):
+    sp = Spectrum()
+    err = lib.zmpt101b_spectrum_init(ctypes.byref(sp), ctypes.byref(Config(SAMPLING_FREQ, fft_size, averages, nominal)))
+    assert err == 0
+    return sp
+
+
+def signal(rng, length, frequency, peak, noise, tone=None, harmonics=HARMONICS):
+    """
+    Sensor output in integer mV: mains with harmonics, Gaussian noise of `noise` mV RMS and an
+    optional interfering tone (frequency, amplitude).
+    """
+    phase = rng.uniform(0, 2 * math.pi)
+    samples = []
+    for n in range(length):
+        t = n / SAMPLING_FREQ
+        v = BIAS + sum(peak * r * math.sin(h * (2 * math.pi * frequency * t + phase) + p) for h, r, p in harmonics)
+        if tone:
+            v += tone[1] * math.sin(2 * math.pi * tone[0] * t)
+        if noise:
+            v += rng.gauss(0, noise)
+        samples.append(int(round(v)))
+    return samples
+
+
+def feed(lib, sp, samples):
+    block = (ctypes.c_int16 * len(samples))(*samples)
+    return lib.zmpt101b_spectrum_process(ctypes.byref(sp), block, len(samples))
+
+
+def psd_of(lib, sp, fft_size):
+    psd = (ctypes.c_float * (fft_size // 2 + 1))()
+    count = lib.zmpt101b_spectrum_get_psd(ctypes.byref(sp), psd, len(psd))
+    return list(psd)[:count]
+
+
+def reference_psd(segment, bins):
+    """
+    One-sided PSD of a segment by a direct DFT in double precision, the way the estimator
+    takes it: mean rounded to whole mV removed, periodic Hann window.
+    """
+    n = len(segment)
+    mean = (sum(segment) + n // 2) >> (n.bit_length() - 1)
+    window = [0.5 - 0.5 * math.cos(2 * math.pi * i / n) for i in range(n)]
+    x = [(s - mean) * w for s, w in zip(segment, window)]
+    s2 = sum(w * w for w in window)
+    result = {}
+    for k in bins:
+        X = sum(v * cmath.exp(-2j * math.pi * k * i / n) for i, v in enumerate(x))
+        result[k] = abs(X) ** 2 / (SAMPLING_FREQ * s2) * (1 if k in (0, n // 2) else 2)
+    return result
+
+
+def check_dft(lib, rng, fft_size):
+    """
+    Fixed-point spectrum of one segment against the direct DFT. The error, taken on the magnitudes
+    and averaged over the bins, must stay 15 dB under the floor that the quantization to whole mV
+    puts under any spectrum: the rounding inside the transform is small against what the ADC adds.
+    The strongest bin must be within 1 %.
+    """
+    sp = estimator(lib, fft_size, 1, 0)
+    samples = signal(rng, fft_size, 50.3 * 1024 / fft_size, 325, 2.0, (6100.0, 20))
+    feed(lib, sp, samples)
+    psd = psd_of(lib, sp, fft_size)
+    bins = range(fft_size // 2 + 1)
+    reference = reference_psd(samples, bins)
+    floor = 1 / 12 / (SAMPLING_FREQ / 2)
+    error = sum((math.sqrt(psd[k]) - math.sqrt(reference[k])) ** 2 for k in bins) / len(bins)
+    strongest = max(bins, key=lambda k: reference[k])
+    deviation = abs(psd[strongest] / reference[strongest] - 1)
+    ok = error < floor * 10 ** -1.5 and deviation < 0.01
+    print(f'direct DFT, {fft_size} points: {len(bins)} bins, error {10 * math.log10(error / floor):.1f} dB of the '
+          f'quantization floor, strongest bin {deviation * 100:.3f} % off{"" if ok else "  FAILED"}')
+    return ok
+
+
+def run(lib, name, rng, fft_size, averages, nominal, frequency, peak, noise, tone=None, harmonics=HARMONICS):
+    """
+    Streams a signal until two spectra are out and checks the estimates of the second against the
+    analytic values: the floor is `noise` mV RMS of white noise plus the quantization to whole mV,
+    and the noise is the floor and the interfering tone.
+    """
+    sp = estimator(lib, fft_size, averages, nominal)
+    per_spectrum = fft_size + (averages - 1) * fft_size // 2
+    length = per_spectrum + averages * fft_size // 2
+    published = feed(lib, sp, signal(rng, length, frequency, peak, noise, tone, harmonics))
+    result = Result()
+    lib.zmpt101b_spectrum_get(ctypes.byref(sp), ctypes.byref(result))
+
+    floor_power = noise ** 2 + 1 / 12
+    density = floor_power / (SAMPLING_FREQ / 2)
+    noise_power = floor_power + (tone[1] ** 2 / 2 if tone else 0)
+    signal_rms = peak / math.sqrt(2)
+    snr = 10 * math.log10(signal_rms ** 2 / noise_power)
+    errors = {
+        'spectra': published == 2 and result.sample == length - 1,
+        'signal': abs(result.signal_rms_mv - signal_rms) / signal_rms < 0.01 and abs(result.signal_hz - frequency) < result.bin_hz / 4,
+        'noise floor': abs(result.noise_density - density) / density < 0.15,
+        'SNR': abs(result.snr_db - snr) < 0.6,
+    }
+    line = (f'{name}, {fft_size} points, {averages} averages: fundamental {result.signal_hz:.2f} Hz '
+            f'{result.signal_rms_mv:.2f} mV, noise floor {result.noise_density * 1e6:.2f} (expected {density * 1e6:.2f}) '
+            f'mV^2/MHz, noise {result.noise_rms_mv:.3f} mV, SNR {result.snr_db:.2f} (expected {snr:.2f}) dB, '
+            f'ENOB {result.enob:.2f}, spur {result.spur_hz:.0f} Hz {result.spur_dbc:.1f} dBc')
+    if tone:
+        expected = 20 * math.log10(tone[1] / peak)
+        errors['spur'] = abs(result.spur_hz - tone[0]) < result.bin_hz and abs(result.spur_dbc - expected) < 1.0
+        line += f' (expected {tone[0]:.0f} Hz {expected:.1f} dBc)'
+    failed = [key for key, good in errors.items() if not good]
+    print(line + (f'  FAILED: {", ".join(failed)}' if failed else ''))
+    return not failed
+
+
+def benchmark(lib, rng):
+    """
+    Cost per sample on the host for several FFT sizes, with 16 averages.
+    """
+    samples = signal(rng, 8192, 50.0, 325, 2.0)
+    block = (ctypes.c_int16 * len(samples))(*samples)
+    costs = []
+    for fft_size in (256, 512, 1024):
+        sp = estimator(lib, fft_size, 16, 0)
+        repeat = 20
+        best = float('inf')
+        for _ in range(5):
+            start = time.perf_counter()
+            for _ in range(repeat):
+                lib.zmpt101b_spectrum_process(ctypes.byref(sp), block, len(samples))
+            best = min(best, time.perf_counter() - start)
+        costs.append((fft_size, best / repeat / len(samples) * 1e9))
+    print('host cost: ' + ', '.join(f'{n} points {cost:.1f} ns' for n, cost in costs) + ' per sample')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B Welch spectrum test and benchmark')
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_spectrum_library()
+    rng = random.Random(args.seed)
+
+    ok = True
+    for fft_size in (16, 256, 1024):
+        ok &= check_dft(lib, rng, fft_size)
+    # A segment of 1024 samples is the shortest that holds two cycles of 50 or 60 Hz at 25 kHz;
+    # without a nominal frequency the strongest tone is the signal, here a test tone with no mains
+    scenarios = [  # name, FFT size, averages, nominal Hz, frequency, peak mV, noise mV RMS, interfering tone, harmonics
+        ('230 V, 2 mV noise', 1024, 32, 50, 50.0, 325, 2.0, None, HARMONICS),
+        ('230 V, 49.7 Hz, 2 mV noise', 1024, 64, 50, 49.7, 325, 2.0, None, HARMONICS),
+        ('120 V, 60 Hz, 1 mV noise', 1024, 32, 60, 60.0, 170, 1.0, None, HARMONICS),
+        ('230 V, quantization only', 1024, 32, 50, 50.2, 325, 0.0, None, HARMONICS),
+        ('230 V, 7.3 kHz interference', 1024, 32, 50, 50.0, 325, 1.0, (7300.0, 3.0), HARMONICS),
+        ('230 V, 11 kHz interference', 1024, 32, 50, 50.0, 325, 1.0, (11000.0, 10.0), HARMONICS),
+        ('3.1 kHz test tone, no mains', 256, 64, 0, 3100.0, 20, 1.0, None, PURE),
+    ]
+    for name, fft_size, averages, nominal, frequency, peak, noise, tone, harmonics in scenarios:
+        ok &= run(lib, name, rng, fft_size, averages, nominal, frequency, peak, noise, tone, harmonics)
+    benchmark(lib, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
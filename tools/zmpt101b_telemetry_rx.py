@@ -0,0 +1,282 @@
+# Receiver for the ZMPT101B telemetry frames (components/zmpt101b/zmpt101b_telemetry.h).
+# It decodes frames from UDP or TCP and accounts for throughput and lost data: gaps in the frame
+# sequence numbers are frames lost in transit, the dropped-frames counter in the header tells how
+# many frames the sender itself dropped under congestion.
+#
+# Usage:
+#   python zmpt101b_telemetry_rx.py listen [--tcp] [--port 5140]
+#       receive from a device and print statistics every second
+#   python zmpt101b_telemetry_rx.py loopback [--tcp] [--seconds 5] [--rate 200000] [--stall 2.0]
+#       build the sink for the host, drive it over localhost and check the drop accounting;
+#       --stall pauses the receiver to force congestion, the sender has to drop frames then
+#       (--stall 0 skips that check)
+
+import argparse
+import ctypes
+import math
+import socket
+import struct
+import threading
+import time
+
+from zmpt101b_codec import Decoder, load_library as load_codec_library
+from zmpt101b_host import build_library
+
+# Must match zmpt101b_telemetry.h
+MAGIC = 0x5A54
+HEADER = struct.Struct('<HBBIIHH')
+ITEM_HEADER = struct.Struct('<BBH')
+RECORD = struct.Struct('<qHH3i')
+WAVEFORM = struct.Struct('<qII')
+ITEM_RECORD = 1
+ITEM_WAVEFORM = 2
+
+
+class Statistics:
+    """
+    Accounting of the received frames.
+    """
+
+    def __init__(self):
+        self.frames = 0
+        self.bytes = 0
+        self.records = 0
+        self.waveform_samples = 0
+        self.lost_in_transit = 0
+        self.sender_dropped = 0
+        self.malformed = 0
+        self.next_sequence = None
+        self.started = time.perf_counter()
+
+    def summary(self):
+        elapsed = max(time.perf_counter() - self.started, 1e-9)
+        return (f'frames {self.frames}, records {self.records}, waveform samples {self.waveform_samples}, '
+                f'{self.bytes / elapsed / 1e6:.3f} MB/s, sender dropped {self.sender_dropped}, '
+                f'lost in transit {self.lost_in_transit}, malformed {self.malformed}')
+
+
+class FrameParser:
+    """
+    Parses frames and updates the statistics. TCP data is fed as a byte stream.
+    """
+
+    def __init__(self, stats, codec_lib=None):
+        self.stats = stats
+        self.codec_lib = codec_lib
+        self.buffer = b''
+
+    def feed_stream(self, data):
+        self.buffer += data
+        while len(self.buffer) >= HEADER.size:
+            payload = HEADER.unpack_from(self.buffer)[6]
+            if len(self.buffer) < HEADER.size + payload:
+                break
+            self.frame(self.buffer[:HEADER.size + payload])
+            self.buffer = self.buffer[HEADER.size + payload:]
+
+    def frame(self, data):
+        magic, version, _, sequence, dropped, items, payload = HEADER.unpack_from(data)
+        if magic != MAGIC or len(data) != HEADER.size + payload:
+            self.stats.malformed += 1
+            return
+        stats = self.stats
+        if stats.next_sequence is not None and sequence > stats.next_sequence:
+            # The header counts the frames dropped by the sender up to this one, the rest of a gap was lost in transit
+            gap = sequence - stats.next_sequence
+            stats.lost_in_transit += max(gap - (dropped - stats.sender_dropped), 0)
+        stats.next_sequence = sequence + 1
+        stats.sender_dropped = dropped
+        stats.frames += 1
+        stats.bytes += len(data)
+
+        pos = HEADER.size
+        for _ in range(items):
+            item_type, _, size = ITEM_HEADER.unpack_from(data, pos)
+            body = data[pos + ITEM_HEADER.size:pos + ITEM_HEADER.size + size]
+            pos += ITEM_HEADER.size + size
+            if item_type == ITEM_RECORD:
+                stats.records += 1
+            elif item_type == ITEM_WAVEFORM:
+                if self.codec_lib is not None:
+                    stats.waveform_samples += len(Decoder(self.codec_lib).decode(body[WAVEFORM.size:]))
+                else:
+                    stats.waveform_samples += body[WAVEFORM.size] | (body[WAVEFORM.size + 1] << 8)
+
+
+def receive(sock, tcp, parser, stop, stall_until=None):
+    """
+    Receives until stop is set; with stall_until the socket isn't read before that time.
+    """
+    sock.settimeout(0.1)
+    while not stop.is_set():
+        if stall_until is not None and time.perf_counter() < stall_until[0]:
+            time.sleep(0.01)
+            continue
+        try:
+            data = sock.recv(65536)
+        except socket.timeout:
+            continue
+        if not data:
+            break
+        if tcp:
+            parser.feed_stream(data)
+        else:
+            parser.frame(data)
+
+
+def listen(args):
+    stats = Statistics()
+    parser = FrameParser(stats, load_codec_library())
+    if args.tcp:
+        server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        server.bind(('0.0.0.0', args.port))
+        server.listen(1)
+        sock, peer = server.accept()
+        print(f'connection from {peer[0]}')
+    else:
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.bind(('0.0.0.0', args.port))
+    stop = threading.Event()
+    thread = threading.Thread(target=receive, args=(sock, args.tcp, parser, stop), daemon=True)
+    thread.start()
+    try:
+        while thread.is_alive():
+            time.sleep(1)
+            print(stats.summary())
+    except KeyboardInterrupt:
+        stop.set()
+
+
+class Config(ctypes.Structure):
+    _fields_ = [('transport', ctypes.c_int), ('host', ctypes.c_char_p), ('port', ctypes.c_uint16),
+                ('flush_interval_us', ctypes.c_uint32), ('nominal_freq', ctypes.c_uint16)]
+
+
+class Record(ctypes.Structure):
+    _fields_ = [('timestamp_us', ctypes.c_int64), ('type', ctypes.c_uint16), ('flags', ctypes.c_uint16),
+                ('values', ctypes.c_int32 * 3)]
+
+
+class SinkStats(ctypes.Structure):
+    _fields_ = [('frames_sent', ctypes.c_uint32), ('frames_dropped', ctypes.c_uint32),
+                ('items_dropped', ctypes.c_uint32), ('items_rejected', ctypes.c_uint32),
+                ('bytes_sent', ctypes.c_uint64), ('send_errors', ctypes.c_uint32), ('connects', ctypes.c_uint32)]
+
+
+def load_sink_library():
+    """
+    Builds the telemetry sink and codec for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_telemetry', ['zmpt101b_telemetry.c', 'zmpt101b_codec.c'],
+                        ['zmpt101b_telemetry.h', 'zmpt101b_codec.h'], ['-lpthread'])
+    lib.zmpt101b_telemetry_init.argtypes = [ctypes.c_void_p, ctypes.POINTER(Config)]
+    lib.zmpt101b_telemetry_deinit.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_telemetry_add_record.argtypes = [ctypes.c_void_p, ctypes.POINTER(Record), ctypes.c_int64]
+    lib.zmpt101b_telemetry_add_waveform.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int16), ctypes.c_size_t,
+                                                    ctypes.c_uint32, ctypes.c_int64, ctypes.c_int64]
+    lib.zmpt101b_telemetry_service.argtypes = [ctypes.c_void_p, ctypes.c_int64]
+    lib.zmpt101b_telemetry_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(SinkStats)]
+    return lib
+
+
+def loopback(args):
+    """
+    Drives the sink against a localhost receiver and checks that every frame is accounted for.
+    """
+    lib = load_sink_library()
+    stats = Statistics()
+    parser = FrameParser(stats, load_codec_library())
+
+    if args.tcp:
+        server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        # A small receive buffer makes the stall congest the sender quickly
+        server.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+        server.bind(('127.0.0.1', 0))
+        server.listen(1)
+    else:
+        server = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        server.bind(('127.0.0.1', 0))
+    port = server.getsockname()[1]
+
+    sink = ctypes.create_string_buffer(64 * 1024)
+    config = Config(1 if args.tcp else 0, b'127.0.0.1', port, 10000, 50)
+    err = lib.zmpt101b_telemetry_init(sink, ctypes.byref(config))
+    if err != 0:
+        raise RuntimeError(f'zmpt101b_telemetry_init failed: {err}')
+
+    stop = threading.Event()
+    stall_until = [time.perf_counter() + 0.5 + args.stall] if args.stall > 0 else None
+    if args.tcp:
+        lib.zmpt101b_telemetry_service(sink, ctypes.c_int64(0))
+        sock, _ = server.accept()
+    else:
+        sock = server
+    thread = threading.Thread(target=receive, args=(sock, args.tcp, parser, stop, stall_until), daemon=True)
+    thread.start()
+
+    wave = (ctypes.c_int16 * 500)(*[int(1650 + 320 * math.sin(2 * math.pi * i / 500)) for i in range(500)])
+    start = time.perf_counter()
+    produced = 0
+    while time.perf_counter() - start < args.seconds:
+        now_us = int((time.perf_counter() - start) * 1e6)
+        due = int(args.rate * (time.perf_counter() - start))
+        while produced < due:
+            record = Record(now_us, 1, 0, (ctypes.c_int32 * 3)(produced, 0, 0))
+            lib.zmpt101b_telemetry_add_record(sink, ctypes.byref(record), ctypes.c_int64(now_us))
+            produced += 1
+            if produced % 100 == 0:
+                lib.zmpt101b_telemetry_add_waveform(sink, wave, 500, 25000, ctypes.c_int64(now_us),
+                                                    ctypes.c_int64(now_us))
+        lib.zmpt101b_telemetry_service(sink, ctypes.c_int64(now_us))
+        time.sleep(0.001)
+
+    # Drain what is still queued
+    end_us = int((time.perf_counter() - start) * 1e6) + 1000000
+    for _ in range(200):
+        lib.zmpt101b_telemetry_service(sink, ctypes.c_int64(end_us))
+        time.sleep(0.005)
+    time.sleep(0.3)
+    stop.set()
+    thread.join()
+
+    sink_stats = SinkStats()
+    lib.zmpt101b_telemetry_get_stats(sink, ctypes.byref(sink_stats))
+    lib.zmpt101b_telemetry_deinit(sink)
+
+    sequences = sink_stats.frames_sent + sink_stats.frames_dropped
+    print(f'sender:   produced {produced} records, frames sent {sink_stats.frames_sent}, '
+          f'dropped {sink_stats.frames_dropped} ({sink_stats.items_dropped} items), '
+          f'bytes {sink_stats.bytes_sent}, send errors {sink_stats.send_errors}')
+    print(f'receiver: {stats.summary()}')
+    # Every frame got a sequence number once completed; it was either sent, dropped or lost in transit
+    accounted = stats.frames + stats.lost_in_transit
+    ok = stats.malformed == 0 and stats.sender_dropped <= sink_stats.frames_dropped and accounted <= sequences
+    if args.tcp:
+        ok = ok and stats.lost_in_transit == 0 and stats.frames == sink_stats.frames_sent
+    # A stall has to congest the sender, or the drop accounting wasn't exercised
+    if args.stall > 0 and (sink_stats.frames_dropped == 0 or stats.sender_dropped == 0):
+        print('stall did not congest the sender, no frames dropped')
+        ok = False
+    print('accounting consistent' if ok else 'ACCOUNTING MISMATCH')
+    return 0 if ok else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B telemetry receiver')
+    parser.add_argument('mode', choices=['listen', 'loopback'])
+    parser.add_argument('--tcp', action='store_true', help='use TCP instead of UDP')
+    parser.add_argument('--port', type=int, default=5140)
+    parser.add_argument('--seconds', type=float, default=5.0)
+    parser.add_argument('--rate', type=float, default=200000.0, help='records per second in loopback mode')
+    parser.add_argument('--stall', type=float, default=2.0, help='seconds the loopback receiver pauses')
+    args = parser.parse_args()
+    if args.mode == 'listen':
+        listen(args)
+    else:
+        raise SystemExit(loopback(args))
+
+
+if __name__ == '__main__':
+    main()
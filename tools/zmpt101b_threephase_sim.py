@@ -0,0 +1,220 @@
+# Host test of the ZMPT101B three-phase analytics (components/zmpt101b/zmpt101b_threephase.h).
+#
+# Usage:
+#   python zmpt101b_threephase_sim.py [--seconds 5] [--seed 1]
+#       build the three-phase stage for the host and feed it synthetic three-phase signals with
+#       unbalanced magnitudes and angles, zero sequence, swapped and missing phases, harmonics and
+#       ADC noise, in blocks of random length; checks unbalance, line-to-line and line-to-neutral
+#       RMS and the phase rotation of every window against the analytic values, and measures the
+#       cost per frame
+
+import argparse
+import cmath
+import ctypes
+import math
+import random
+import time
+
+from zmpt101b_host import build_library
+from zmpt101b_phasor_sim import Phasor, Estimator
+
+# Must match zmpt101b.h and zmpt101b_threephase.h
+SAMPLING_FREQ = 25000
+PRESENT_MV = 20
+
+ROTATION_UNKNOWN, ROTATION_L1_L2_L3, ROTATION_L1_L3_L2 = 0, 1, 2
+BIAS_MV = [1650, 1610, 1702]                        # the sensors' offsets differ
+HARMONICS = [(1, 1.0, 0.0), (3, 0.04, 0.7), (5, 0.03, -1.9), (7, 0.01, 2.4)]   # order, relative amplitude, phase
+
+
+class Value(ctypes.Structure):
+    _fields_ = [('sample', ctypes.c_uint64), ('phasor', Phasor * 3), ('line_to_neutral_rms', ctypes.c_float * 3),
+                ('line_to_line_rms', ctypes.c_float * 3), ('line_to_line_fundamental', ctypes.c_float * 3),
+                ('positive', ctypes.c_float), ('negative', ctypes.c_float), ('zero', ctypes.c_float),
+                ('negative_unbalance_pct', ctypes.c_float), ('zero_unbalance_pct', ctypes.c_float),
+                ('missing', ctypes.c_uint8), ('rotation', ctypes.c_int)]
+
+
+class Config(ctypes.Structure):
+    _fields_ = [('sample_rate', ctypes.c_uint32), ('nominal_freq', ctypes.c_uint16), ('skew_ns', ctypes.c_uint32 * 3)]
+
+
+class ThreePhase(ctypes.Structure):
+    _fields_ = [('phasor', Estimator * 3), ('count', ctypes.c_uint32), ('sum', ctypes.c_int64 * 6),
+                ('sum_squares', ctypes.c_int64 * 6), ('last', Value)]
+
+
+def load_threephase_library():
+    """
+    Builds the stage and the phasor estimator for the host, with the esp_err.h shim from tools/host.
+    """
+    lib = build_library('zmpt101b_threephase', ['zmpt101b_threephase.c', 'zmpt101b_phasor.c', 'zmpt101b_fixed.c'],
+                        ['zmpt101b_threephase.h', 'zmpt101b_phasor.h', 'zmpt101b_fixed.h'], ['-lm'])
+    lib.zmpt101b_threephase_init.argtypes = [ctypes.POINTER(ThreePhase), ctypes.POINTER(Config)]
+    lib.zmpt101b_threephase_process.argtypes = [ctypes.POINTER(ThreePhase), ctypes.POINTER(ctypes.POINTER(ctypes.c_int16)),
+                                                ctypes.c_size_t, ctypes.POINTER(Value), ctypes.c_size_t]
+    lib.zmpt101b_threephase_process.restype = ctypes.c_size_t
+    return lib
+
+
+class System:
+    """
+    Three line-to-neutral voltages: peak mV and angle in degrees of each fundamental, the same
+    relative harmonics on each phase (so the triplen ones are zero sequence), the sensors' DC bias
+    and ADC noise, sampled simultaneously.
+    """
+    def __init__(self, frequency, peaks, angles, noise_mv=0.0):
+        self.frequency = frequency
+        self.peaks = peaks
+        self.angles = [math.radians(a) for a in angles]
+        self.noise_mv = noise_mv
+
+    def synthesize(self, seconds, rng):
+        channels = [[], [], []]
+        for n in range(int(seconds * SAMPLING_FREQ)):
+            phase = 2 * math.pi * self.frequency * n / SAMPLING_FREQ
+            for c in range(3):
+                value = BIAS_MV[c] + sum(self.peaks[c] * r * math.sin(h * (phase + self.angles[c]) + p) for h, r, p in HARMONICS)
+                if self.noise_mv:
+                    value += rng.gauss(0, self.noise_mv)
+                channels[c].append(int(round(value)))
+        return channels
+
+    def harmonic_phasor(self, c, h, r, p):
+        return self.peaks[c] * r * cmath.exp(1j * (h * self.angles[c] + p)) / math.sqrt(2)
+
+    def truth(self):
+        """
+        Analytic values: RMS of the sequence components, RMS of each phase and line-to-line pair, the
+        fundamental line-to-line RMS and the rotation.
+        """
+        v = [self.harmonic_phasor(c, 1, 1.0, 0.0) for c in range(3)]
+        a = cmath.exp(2j * math.pi / 3)
+        zero = abs(v[0] + v[1] + v[2]) / 3
+        positive = abs(v[0] + a * v[1] + a * a * v[2]) / 3
+        negative = abs(v[0] + a * a * v[1] + a * v[2]) / 3
+        line_to_neutral = [math.sqrt(sum(abs(self.harmonic_phasor(c, h, r, p)) ** 2 for h, r, p in HARMONICS)) for c in range(3)]
+        line_to_line = [math.sqrt(sum(abs(self.harmonic_phasor(c, h, r, p) - self.harmonic_phasor((c + 1) % 3, h, r, p)) ** 2
+                                      for h, r, p in HARMONICS)) for c in range(3)]
+        fundamental = [abs(v[c] - v[(c + 1) % 3]) for c in range(3)]
+        missing = sum(1 << c for c in range(3) if self.peaks[c] / math.sqrt(2) < PRESENT_MV)
+        if missing:
+            rotation = ROTATION_UNKNOWN
+        elif positive > negative:
+            rotation = ROTATION_L1_L2_L3
+        else:
+            rotation = ROTATION_L1_L3_L2
+        return (positive, negative, zero), line_to_neutral, line_to_line, fundamental, missing, rotation
+
+
+def analyse(lib, channels, nominal, rng, block_max):
+    tp = ThreePhase()
+    config = Config(SAMPLING_FREQ, nominal, (ctypes.c_uint32 * 3)(0, 0, 0))
+    if lib.zmpt101b_threephase_init(ctypes.byref(tp), ctypes.byref(config)) != 0:
+        raise RuntimeError('zmpt101b_threephase_init failed')
+    values = []
+    i = 0
+    total = len(channels[0])
+    while i < total:
+        n = min(total - i, rng.randint(1, block_max))
+        blocks = [(ctypes.c_int16 * n)(*channels[c][i:i + n]) for c in range(3)]
+        pointers = (ctypes.POINTER(ctypes.c_int16) * 3)(*[ctypes.cast(b, ctypes.POINTER(ctypes.c_int16)) for b in blocks])
+        out = (Value * (n // tp.phasor[0].window + 2))()
+        count = lib.zmpt101b_threephase_process(ctypes.byref(tp), pointers, n, out, len(out))
+        values.extend(Value.from_buffer_copy(out[k]) for k in range(count))
+        i += n
+    return values
+
+
+def run(lib, name, nominal, system, seconds, rng, rms_limit_pct):
+    channels = system.synthesize(seconds, rng)
+    values = analyse(lib, channels, nominal, rng, 1024)
+    sequences, line_to_neutral, line_to_line, fundamental, missing, rotation = system.truth()
+    # Errors of the sequence components in percent of the dominant one, which is u2 and u0 in
+    # positive sequence and still means something with two phases swapped
+    dominant = max(sequences[0], sequences[1])
+
+    worst_sequence = worst_ln = worst_ll = worst_fundamental = 0.0
+    wrong = 0
+    for v in values[2:]:
+        for measured, expected in zip((v.positive, v.negative, v.zero), sequences):
+            worst_sequence = max(worst_sequence, abs(measured - expected) / dominant * 100)
+        for c in range(3):
+            if line_to_neutral[c] > PRESENT_MV:
+                worst_ln = max(worst_ln, abs(v.line_to_neutral_rms[c] / line_to_neutral[c] - 1) * 100)
+            worst_ll = max(worst_ll, abs(v.line_to_line_rms[c] / line_to_line[c] - 1) * 100)
+            worst_fundamental = max(worst_fundamental, abs(v.line_to_line_fundamental[c] / fundamental[c] - 1) * 100)
+        wrong += v.rotation != rotation or v.missing != missing
+    last = values[-1]
+    print(f'{name}: {len(values)} windows, u2 {last.negative_unbalance_pct:.3f} % '
+          f'(expected {sequences[1] / sequences[0] * 100:.3f} %), u0 {last.zero_unbalance_pct:.3f} % '
+          f'(expected {sequences[2] / sequences[0] * 100:.3f} %), L1-L2 {last.line_to_line_rms[0]:.1f} mV '
+          f'(expected {line_to_line[0]:.1f} mV), rotation {last.rotation} (expected {rotation})')
+    print(f'  errors max: sequence components {worst_sequence:.3f} % points, line-to-neutral RMS {worst_ln:.3f} %, '
+          f'line-to-line RMS {worst_ll:.3f} %, line-to-line fundamental {worst_fundamental:.3f} %; '
+          f'{wrong} windows with wrong rotation or missing phases')
+    ok = True
+    # IEC 61000-4-30 class A: unbalance within 0.15 % points
+    if worst_sequence > 0.15:
+        print('  FAILED: unbalance error above 0.15 % points')
+        ok = False
+    if worst_ln > rms_limit_pct or worst_ll > rms_limit_pct:
+        print(f'  FAILED: RMS error above {rms_limit_pct} %')
+        ok = False
+    if worst_fundamental > 0.2:
+        print('  FAILED: fundamental line-to-line error above 0.2 %')
+        ok = False
+    if wrong:
+        print('  FAILED: wrong rotation or missing phases')
+        ok = False
+    return ok
+
+
+def benchmark(lib):
+    """
+    Cost per frame of three samples on the host.
+    """
+    system = System(50.1, [325, 320, 330], [0, -120, 120])
+    channels = system.synthesize(4, random.Random(0))
+    n = len(channels[0])
+    tp = ThreePhase()
+    config = Config(SAMPLING_FREQ, 50, (ctypes.c_uint32 * 3)(0, 0, 0))
+    lib.zmpt101b_threephase_init(ctypes.byref(tp), ctypes.byref(config))
+    blocks = [(ctypes.c_int16 * n)(*channels[c]) for c in range(3)]
+    pointers = (ctypes.POINTER(ctypes.c_int16) * 3)(*[ctypes.cast(b, ctypes.POINTER(ctypes.c_int16)) for b in blocks])
+    best = float('inf')
+    for _ in range(5):
+        start = time.perf_counter()
+        lib.zmpt101b_threephase_process(ctypes.byref(tp), pointers, n, None, 0)
+        best = min(best, time.perf_counter() - start)
+    print(f'host cost: {best / n * 1e9:.1f} ns per frame of three samples')
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B three-phase analytics test')
+    parser.add_argument('--seconds', type=float, default=5)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_threephase_library()
+    rng = random.Random(args.seed)
+
+    # The sample-based RMS are taken over one nominal cycle, so off nominal they ripple by up to
+    # about 2/3 of the relative frequency offset; at 60 Hz the 417-sample window is 0.08 % long
+    scenarios = [  # name, nominal Hz, system, RMS limit %
+        ('balanced, 50 Hz', 50, System(50.0, [325, 325, 325], [0, -120, 120], 1.0), 0.2),
+        ('unbalanced magnitudes and angles, 49.8 Hz', 50,
+         System(49.8, [325, 304, 339], [0, -122, 117], 1.0), 0.3),
+        ('zero sequence, 60 Hz', 60, System(60.0, [170, 150, 170], [0, -110, 110], 1.0), 0.3),
+        ('L2 and L3 swapped, 50.2 Hz', 50, System(50.2, [325, 318, 330], [0, 120, -120], 1.0), 0.3),
+        ('L3 missing, 50 Hz', 50, System(50.0, [325, 325, 0], [0, -120, 120], 1.0), 0.2),
+    ]
+    ok = True
+    for name, nominal, system, limit in scenarios:
+        ok &= run(lib, name, nominal, system, args.seconds, rng, limit)
+    benchmark(lib)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
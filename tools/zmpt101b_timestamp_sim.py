@@ -0,0 +1,284 @@
+# Host simulation of the ZMPT101B sample timestamping (components/zmpt101b/zmpt101b_timestamp.h).
+#
+# Usage:
+#   python zmpt101b_timestamp_sim.py [--seconds 120] [--seed 1]
+#       build the tracker for the host and run it against a simulated I2S DMA ring whose sample
+#       clock is skewed against esp_timer, with interrupt and wake-up latency, preemption and
+#       reader stalls that overflow the ring, and the sample rate retuned on the fly as the
+#       grid-locked clock does; checks that every locked timestamp is within one sample period,
+#       then checks the SNTP wall-clock mapping with a drifting esp_timer
+
+import argparse
+import collections
+import ctypes
+import random
+
+from zmpt101b_host import build_library
+
+# Must match zmpt101b.h
+DMA_BUFFER_LEN = 1024
+DMA_BUFFER_COUNT = 8
+SAMPLING_FREQ = 25000
+
+
+class Stats(ctypes.Structure):
+    _fields_ = [('observations', ctypes.c_uint32), ('epochs', ctypes.c_uint32), ('restarts', ctypes.c_uint32),
+                ('pulls', ctypes.c_uint32), ('rejected_fits', ctypes.c_uint32), ('fit_spread_ns', ctypes.c_uint32)]
+
+
+def load_timestamp_library():
+    """
+    Builds the tracker for the host.
+    """
+    lib = build_library('zmpt101b_timestamp', ['zmpt101b_timestamp.c'], ['zmpt101b_timestamp.h'])
+    lib.zmpt101b_ts_init.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32]
+    lib.zmpt101b_ts_restart.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_ts_rescale.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_uint32, ctypes.c_uint32]
+    lib.zmpt101b_ts_observe.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_int64]
+    lib.zmpt101b_ts_time_ns.argtypes = [ctypes.c_void_p, ctypes.c_int64]
+    lib.zmpt101b_ts_time_ns.restype = ctypes.c_int64
+    lib.zmpt101b_ts_locked.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_ts_locked.restype = ctypes.c_bool
+    lib.zmpt101b_ts_period_ps.argtypes = [ctypes.c_void_p]
+    lib.zmpt101b_ts_period_ps.restype = ctypes.c_uint32
+    lib.zmpt101b_ts_get_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(Stats)]
+    lib.zmpt101b_wallclock_sync.argtypes = [ctypes.c_void_p, ctypes.c_int64, ctypes.c_int64]
+    lib.zmpt101b_wallclock_to_wall.argtypes = [ctypes.c_void_p, ctypes.c_int64]
+    lib.zmpt101b_wallclock_to_wall.restype = ctypes.c_int64
+    return lib
+
+
+class DmaRing:
+    """
+    I2S DMA ring in true time (microseconds). Buffer i holds raw samples i*B .. i*B+B-1 and is
+    complete when its last sample is; the sample rate follows skew_ppm(t). A full ring drops its
+    oldest buffer, as the legacy driver does.
+    """
+
+    def __init__(self, rate, skew_ppm, start_us):
+        self.rate = rate
+        self.skew_ppm = skew_ppm
+        self.ends = [start_us]          # ends[i + 1]: true time buffer i completed
+        self.queue = collections.deque()
+        self.next_buffer = 0
+        self.overflowed = False
+
+    def buffer_end(self, index):
+        while len(self.ends) <= index + 1:
+            t = self.ends[-1]
+            self.ends.append(t + DMA_BUFFER_LEN * 1e6 / (self.rate * (1 + self.skew_ppm(t) * 1e-6)))
+        return self.ends[index + 1]
+
+    def completion(self, position):
+        """
+        True time the raw samples before `position` were complete.
+        """
+        index, offset = divmod(position, DMA_BUFFER_LEN)
+        if offset == 0:
+            return self.buffer_end(index - 1) if index > 0 else self.ends[0]
+        start = self.buffer_end(index - 1) if index > 0 else self.ends[0]
+        return start + (self.buffer_end(index) - start) * offset / DMA_BUFFER_LEN
+
+    def advance(self, t):
+        while self.buffer_end(self.next_buffer) <= t:
+            if len(self.queue) == DMA_BUFFER_COUNT:
+                self.queue.popleft()
+                self.overflowed = True
+            self.queue.append(self.next_buffer)
+            self.next_buffer += 1
+
+
+class Reader:
+    """
+    zmpt101b_read_samples() on top of i2s_read(): serves the rest of the current buffer, then
+    takes buffers from the queue, waiting for the next one to complete if it is empty.
+    """
+
+    def __init__(self, dma, rng):
+        self.dma = dma
+        self.rng = rng
+        self.buffer = None
+        self.offset = DMA_BUFFER_LEN
+
+    def wake_latency(self):
+        # Interrupt and task switch, now and then a higher-priority task runs first
+        latency = 12 + self.rng.expovariate(1 / 4)
+        if self.rng.random() < 0.01:
+            latency += self.rng.uniform(500, 3000)
+        return latency
+
+    def read(self, now, size):
+        """
+        Returns when the read returned and the true position of its first sample.
+        """
+        first = None
+        taken = 0
+        t = now
+        while taken < size:
+            if self.offset == DMA_BUFFER_LEN:
+                self.dma.advance(t)
+                if not self.dma.queue:
+                    t = self.dma.buffer_end(self.dma.next_buffer) + self.wake_latency()
+                    self.dma.advance(t)
+                self.buffer = self.dma.queue.popleft()
+                self.offset = 0
+            if first is None:
+                first = self.buffer * DMA_BUFFER_LEN + self.offset
+            step = min(size - taken, DMA_BUFFER_LEN - self.offset)
+            self.offset += step
+            taken += step
+        return t + 2 + size * 0.01, first
+
+
+class Retuner:
+    """
+    Steps the sample rate now and then by up to max_ppm, as the grid-locked clock's APLL retunes
+    do, and tells the tracker. Used as the ring's skew function.
+    """
+
+    def __init__(self, rng, max_ppm, interval_s):
+        self.rng = rng
+        self.max_ppm = max_ppm
+        self.interval_us = interval_s * 1e6
+        self.changes = [(0.0, 0.0)]     # (true time, skew ppm from then on)
+        self.next_us = None
+
+    def __call__(self, t):
+        for start, ppm in reversed(self.changes):
+            if t >= start:
+                return ppm
+        return 0.0
+
+    def maybe_retune(self, lib, ts, rate, now, esp_timer):
+        if self.next_us is None:
+            self.next_us = now + self.interval_us
+        if now < self.next_us:
+            return
+        old = self.changes[-1][1]
+        new = old + self.rng.uniform(-self.max_ppm, self.max_ppm)
+        self.changes.append((now, new))
+        lib.zmpt101b_ts_rescale(ts, int(esp_timer(now)), int(rate * 1000 * (1 + old * 1e-6)), int(rate * 1000 * (1 + new * 1e-6)))
+        self.next_us = now + self.interval_us
+
+
+def simulate(lib, name, rate, skew_ppm, timer_ppm, read_size, seconds, rng, stalls=False):
+    """
+    Runs the tracker the way zmpt101b_read_samples() does and compares every block timestamp
+    with the true esp_timer time of its first sample.
+    """
+    ts = ctypes.create_string_buffer(1024)
+    lib.zmpt101b_ts_init(ts, rate, DMA_BUFFER_LEN)
+    start = 1e6
+    dma = DmaRing(rate, skew_ppm, start)
+    reader = Reader(dma, rng)
+    esp_timer = lambda t: t * (1 + timer_ppm * 1e-6)    # noqa: E731
+    # The stream's samples are ADC_SAMPLE_RATE / SAMPLING_FREQ raw samples each; timestamps must
+    # be good to one of them
+    limit_us = 1e6 / SAMPLING_FREQ
+
+    position = 0
+    now = start
+    next_stall = start + rng.uniform(5e6, 15e6)
+    errors = []
+    unlocked = 0
+    while now < start + seconds * 1e6:
+        returned, first = reader.read(now, read_size)
+        before = position
+        position += read_size
+        if dma.overflowed:
+            dma.overflowed = False
+            lib.zmpt101b_ts_restart(ts)
+        lib.zmpt101b_ts_observe(ts, position, int(esp_timer(returned)))
+
+        if lib.zmpt101b_ts_locked(ts):
+            predicted_us = lib.zmpt101b_ts_time_ns(ts, before + 1) / 1000
+            errors.append(predicted_us - esp_timer(dma.completion(first + 1)))
+        else:
+            unlocked += 1
+
+        # Processing the block, now and then a stall long enough to overflow the ring
+        now = returned + rng.uniform(0, 0.3 * read_size * 1e6 / rate)
+        if isinstance(skew_ppm, Retuner):
+            skew_ppm.maybe_retune(lib, ts, rate, now, esp_timer)
+        if stalls and now > next_stall:
+            now += rng.uniform(400e3, 800e3)
+            next_stall = now + rng.uniform(5e6, 15e6)
+
+    stats = Stats()
+    lib.zmpt101b_ts_get_stats(ts, ctypes.byref(stats))
+    period_ps = lib.zmpt101b_ts_period_ps(ts)
+    true_period_ps = 1e12 / (rate * (1 + skew_ppm(now) * 1e-6)) * (1 + timer_ppm * 1e-6)
+    worst = max(abs(e) for e in errors) if errors else float('inf')
+    mean = sum(errors) / len(errors) if errors else 0.0
+    print(f'{name}: {stats.observations} reads, {len(errors)} locked, {unlocked} unlocked, {stats.restarts} restarts, '
+          f'{stats.pulls} pulls, {stats.rejected_fits} rejected fits')
+    print(f'  timestamp error us: mean {mean:+.1f}, max {worst:.1f} (limit {limit_us:.0f}); '
+          f'period error {(period_ps - true_period_ps) / true_period_ps * 1e6:+.2f} ppm; '
+          f'fit spread {stats.fit_spread_ns / 1000:.1f} us')
+    ok = worst < limit_us and len(errors) > 0
+    if not ok:
+        print(f'  FAILED: timestamp error {worst:.1f} us')
+    return ok
+
+
+def simulate_wall_clock(lib, rng, hours=48, interval_s=3600, timer_ppm=35.0, jitter_ms=2.0):
+    """
+    SNTP syncs against an esp_timer running timer_ppm fast; one sync in the middle comes from a
+    server 5 s off and is corrected by the next one. Checks the mapping halfway between syncs.
+    """
+    wc = ctypes.create_string_buffer(128)
+    naive = ctypes.create_string_buffer(128)
+    epoch_us = 1_760_000_000 * 10**6
+    esp_timer = lambda t: int(t * (1 + timer_ppm * 1e-6))    # noqa: E731
+    bad_sync = hours // 2
+    errors = []
+    naive_errors = []
+    for n in range(hours * 3600 // interval_s):
+        t = 10e6 + n * interval_s * 1e6
+        wall = epoch_us + int(t + rng.gauss(0, jitter_ms * 1000)) + (5 * 10**6 if n == bad_sync else 0)
+        lib.zmpt101b_wallclock_sync(wc, esp_timer(t), wall)
+        # The same mapping without drift correction: a fresh instance per sync
+        naive.raw = bytes(len(naive.raw))
+        lib.zmpt101b_wallclock_sync(naive, esp_timer(t), wall)
+        if n >= 2 and n not in (bad_sync, bad_sync + 1):
+            middle = t + interval_s * 0.5e6
+            errors.append(abs(lib.zmpt101b_wallclock_to_wall(wc, esp_timer(middle)) - (epoch_us + middle)))
+            naive_errors.append(abs(lib.zmpt101b_wallclock_to_wall(naive, esp_timer(middle)) - (epoch_us + middle)))
+    worst = max(errors) / 1000
+    print(f'wall clock, esp_timer {timer_ppm:+.0f} ppm, syncs every {interval_s} s: error halfway between syncs max '
+          f'{worst:.1f} ms (without drift correction {max(naive_errors) / 1000:.1f} ms)')
+    ok = worst < 5 * jitter_ms
+    if not ok:
+        print(f'  FAILED: wall-clock error {worst:.1f} ms')
+    return ok
+
+
+def main():
+    parser = argparse.ArgumentParser(description='ZMPT101B sample timestamping simulation')
+    parser.add_argument('--seconds', type=float, default=120)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    lib = load_timestamp_library()
+    rng = random.Random(args.seed)
+
+    constant = lambda ppm: (lambda t: ppm)    # noqa: E731
+    scenarios = [  # name, raw rate, I2S skew, esp_timer skew, samples per read, stalls
+        ('25 kHz, I2S +150 ppm, 512-sample reads', 25000, constant(150), 20, 512, False),
+        ('25 kHz, I2S -2.7 % (divider), 1000-sample reads', 25000, constant(-27000), -15, 1000, False),
+        ('100 kHz oversampled, I2S drifting +40..-40 ppm, 1024-sample reads', 100000,
+         lambda t: 40 - 80 * t / (args.seconds * 1e6), 0, 1024, False),
+        ('25 kHz, 8-sample reads', 25000, constant(-60), 10, 8, False),
+        ('25 kHz, reader stalls overflowing the ring', 25000, constant(80), 0, 256, True),
+        ('25.6 kHz grid-locked, retuned by up to 100 ppm every 0.5 s', 25600, Retuner(rng, 100, 0.5), 25, 512, False),
+    ]
+    ok = True
+    for name, rate, skew, timer_ppm, read_size, stalls in scenarios:
+        seconds = args.seconds / 4 if read_size < 64 else args.seconds
+        ok &= simulate(lib, name, rate, skew, timer_ppm, read_size, seconds, rng, stalls)
+    ok &= simulate_wall_clock(lib, rng)
+    print('all checks passed' if ok else 'CHECKS FAILED')
+    raise SystemExit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()